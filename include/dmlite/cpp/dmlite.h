@@ -191,6 +191,12 @@ namespace dmlite {
     /// Get the plugin manager.
     PluginManager* getPluginManager() throw (DmException);
 
+    /// Forget the state of the last user: go back to the default security
+    /// context, working directory and umask, and erase the key-value pairs.
+    /// The instances are kept, so this is much cheaper than a new StackInstance.
+    /// @note The interfaces got before reset must not be used by the next user.
+    void reset() throw (DmException);
+
     /// Set the security credentials.
     void setSecurityCredentials(const SecurityCredentials& cred) throw (DmException);
 
@@ -232,6 +238,9 @@ namespace dmlite {
 
     SecurityContext* secCtx_;
 
+    /// The umask the catalog had when built
+    mode_t umask_;
+
     std::map<std::string, PoolDriver*> poolDrivers_;
 
     std::map<std::string, boost::any> stackMsg_;
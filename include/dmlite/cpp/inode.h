@@ -212,6 +212,13 @@ namespace dmlite {
     virtual void utime(ino_t inode,
                        const struct utimbuf* buf) throw (DmException);
 
+    /// Change only the access time. Backends may defer the update and
+    /// coalesce it with others, the default calls utime right away.
+    /// @param meta  The entry, as known by the caller.
+    /// @param atime The new access time.
+    virtual void updateAccessTime(const ExtendedStat& meta,
+                                  time_t atime) throw (DmException);
+
     /// Set the mode of a file.
     /// @param inode The inode of the file.
     /// @param uid   The owner. If -1, not changed.
@@ -22,6 +22,14 @@ namespace dmlite {
   class PluginManager;
   class StackInstance;
 
+  /// One of the reads of IOHandler::preadv
+  struct IOSegment {
+    void*  buffer; ///< Where to put the data
+    size_t count;  ///< Number of bytes to read
+    off_t  offset; ///< Where to read from
+    size_t nbytes; ///< Set to the number of bytes actually read
+  };
+
   /// IO interface
   class IOHandler {
    public:
@@ -105,6 +113,59 @@ namespace dmlite {
 
     /// Return true if end of file.
     virtual bool eof(void) throw (DmException);
+
+    /// Send data from the file to a descriptor (i.e. a socket) without
+    /// changing the file offset.
+    /// @param outfd  Where to send the data.
+    /// @param offset The offset of the file where to start.
+    /// @param count  Number of bytes to send.
+    /// @return       Number of bytes sent. Less than count only at the end of the file.
+    /// @note         A default implementation using pread is provided. Implementations
+    ///               with a local file avoid copying the data into user space.
+    virtual size_t transferTo(int outfd, off_t offset, size_t count) throw (DmException);
+
+    /// Write into the file data received from a descriptor (i.e. a socket)
+    /// without changing the file offset.
+    /// @param infd   Where to get the data from.
+    /// @param offset The offset of the file where to start.
+    /// @param count  Number of bytes to receive.
+    /// @return       Number of bytes written. Less than count only if infd ended.
+    /// @note         A default implementation using pwrite is provided.
+    virtual size_t transferFrom(int infd, off_t offset, size_t count) throw (DmException);
+
+    /// Read many segments, each from its own offset, without changing the file offset.
+    /// @param segments An array with 'count' segments. Their nbytes is set.
+    /// @param count    Number of segments.
+    /// @return         The total size read. A segment gets less than asked only at the end of the file.
+    /// @note           A default implementation using pread is provided.
+    virtual size_t preadv(IOSegment* segments, size_t count) throw (DmException);
+
+    /// Start a preadv in the background.
+    /// @param segments As for preadv. They must stay valid until waitAsync returns.
+    /// @param count    Number of segments.
+    /// @return         An identifier to pass to waitAsync.
+    /// @note           The default implementation runs preadv in a thread pool shared
+    ///                 by all the handlers, so preadv must be safe to call concurrently.
+    ///                 Every submitted read must be waited for before the handler is destroyed.
+    virtual int submitAsync(IOSegment* segments, size_t count) throw (DmException);
+
+    /// Wait for a read started with submitAsync.
+    /// @param id The value returned by submitAsync.
+    /// @return   As preadv. If the read failed, its exception is thrown here.
+    virtual size_t waitAsync(int id) throw (DmException);
+
+   protected:
+    /// preadv for implementations with a local file descriptor. Hints the kernel about
+    /// all the segments first, so that it reads them in parallel, and merges the adjacent ones.
+    static size_t preadvFd(int fd, IOSegment* segments, size_t count) throw (DmException);
+
+    /// transferTo for implementations with a local file descriptor.
+    /// Uses sendfile, or pread if the descriptors do not allow it.
+    static size_t sendFile(int fd, off_t offset, int outfd, size_t count) throw (DmException);
+
+    /// transferFrom for implementations with a local file descriptor.
+    /// Uses splice, or pwrite if the descriptors do not allow it.
+    static size_t receiveFile(int infd, int fd, off_t offset, size_t count) throw (DmException);
   };
 
   /// IO Driver
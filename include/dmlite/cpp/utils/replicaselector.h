@@ -0,0 +1,72 @@
+/// @file   include/dmlite/cpp/utils/replicaselector.h
+/// @brief  Policy to choose the replica a client reads from.
+/// @details This is not a plugin!
+#ifndef DMLITE_CPP_UTILS_REPLICASELECTOR_H
+#define DMLITE_CPP_UTILS_REPLICASELECTOR_H
+
+#include <string>
+#include <vector>
+#include "../authn.h"
+#include "../exceptions.h"
+#include "../inode.h"
+
+namespace dmlite {
+
+  class StackInstance;
+
+  /// Chooses the replica a client should read from.
+  /// The criteria are applied in the configured order: the first one that
+  /// tells two replicas apart decides. Replicas still tied are chosen at random,
+  /// so without criteria this is a plain random choice.
+  /// Redirections are counted per server, for the whole process, and decay
+  /// with time, so the load criterion spreads the reads of hot files.
+  class ReplicaSelector {
+   public:
+    enum Criterion {
+      kLocal,       ///< Replicas on the client's subnet first.
+      kPermanent,   ///< Non volatile replicas first.
+      kLeastLoaded  ///< Replicas on servers with fewer recent redirections first.
+    };
+
+    ReplicaSelector();
+    virtual ~ReplicaSelector();
+
+    /// Set the criteria from a comma separated list of local, permanent and load.
+    /// An empty string, or "random", means no criteria.
+    void setCriteria(const std::string& criteria) throw (DmException);
+
+    /// Set the prefix lengths that define the subnet of the client.
+    /// @param spec As "ipv4/ipv6", i.e. "24/64".
+    void setSubnetPrefixes(const std::string& spec) throw (DmException);
+
+    /// Choose one of the replicas for the client, and count it as a redirection.
+    /// @param ctx      The security context of the client. May be NULL.
+    /// @param replicas The candidates. Must not be empty.
+    /// @return         The index of the chosen replica.
+    unsigned select(const SecurityContext* ctx, const std::vector<Replica>& replicas);
+
+    /// Remove from the list the replicas that the "ExcludeReplicas" key
+    /// of the stack asks to exclude (an array of replica ids).
+    static void removeExcluded(StackInstance* si, std::vector<Replica>& replicas) throw (DmException);
+
+    /// Recent redirections to the given server.
+    static unsigned long recentRedirections(const std::string& server);
+
+   protected:
+    /// The value of a replica for the given criterion. Lower is better.
+    /// Override to add or change criteria.
+    virtual unsigned long score(Criterion criterion, const std::string& clientAddress,
+                                const Replica& replica);
+
+    /// True if the server is in the same subnet as the client.
+    bool isLocal(const std::string& clientAddress, const std::string& server);
+
+   private:
+    std::vector<Criterion> criteria_;
+    unsigned ipv4Prefix_;
+    unsigned ipv6Prefix_;
+  };
+
+};
+
+#endif // DMLITE_CPP_UTILS_REPLICASELECTOR_H
@@ -15,6 +15,9 @@
 namespace dmlite {
   /// Generic username for a name-independent token
   static const std::string kGenericUser = "nouser";
+
+  /// Digest used by default to sign tokens
+  static const std::string kDefaultTokenDigest = "sha1";
   
   /// Possible outputs for validateToken
   enum TokenResult {
@@ -70,7 +73,59 @@ namespace dmlite {
      std::string serialize(void) const throw ();
      void        validate (void) const throw (DmException);
   };
-  
+
+  /// Precompiled form of an Acl, intended for repeated permission checks.
+  /// Only the entries relevant for access checks are kept (mask, group obj,
+  /// users and groups), sorted, in a fixed inline array. ACLs bigger
+  /// than kInlineEntries spill to the heap.
+  struct CompiledAcl {
+    static const unsigned kInlineEntries = 12;
+
+    CompiledAcl() throw ();
+    explicit CompiledAcl(const Acl& acl) throw ();
+    CompiledAcl(const CompiledAcl& c) throw ();
+    CompiledAcl& operator = (const CompiledAcl& c) throw ();
+
+    /// Recompile from the given Acl.
+    void compile(const Acl& acl) throw ();
+
+    /// Pointer to the kUser entries, followed by the kGroup entries.
+    const AclEntry* entries(void) const throw ()
+    {
+      return spill_.empty() ? inline_ : &spill_[0];
+    }
+
+    bool     empty;        ///< True if there was no ACL at all.
+    uint8_t  mask;         ///< ACL_MASK permissions, 0x7F if no mask.
+    uint8_t  groupObjPerm; ///< ACL_GROUP_OBJ permissions.
+    uint16_t nUsers;       ///< Number of kUser entries, sorted by id.
+    uint16_t nGroups;      ///< Number of kGroup entries, sorted by id.
+
+   private:
+    AclEntry              inline_[kInlineEntries];
+    std::vector<AclEntry> spill_;
+  };
+
+  /// Precompiled form of a SecurityContext. Extracts once the uid, the
+  /// banned status and a sorted set of the (not banned) gids, so checks do not
+  /// need to go through the Extensible lookups.
+  /// A default constructed context is denied everything.
+  struct CompiledSecurityContext {
+    CompiledSecurityContext() throw ();
+    explicit CompiledSecurityContext(const SecurityContext& ctx);
+
+    /// Recompile from the given context.
+    void compile(const SecurityContext& ctx);
+
+    /// Check if the context contains the given gid (binary search).
+    bool hasGroup(gid_t gid) const throw ();
+
+    uid_t              uid;
+    bool               banned;
+    std::vector<gid_t> gids;
+    std::string        userName;
+  };
+
   /// Check if the group vector contains the given gid.
   /// @param groups The GroupInfo vector.
   /// @param gid    The gid to look for.
@@ -89,12 +144,29 @@ namespace dmlite {
                        const Acl& acl, const struct ::stat& stat,
                        mode_t mode);
 
+  /// Same as above, but using precompiled forms of the context and the ACL.
+  /// Does not do any allocation or Extensible lookups.
+  /// @return        0 if the mode is allowed, 1 if not.
+  int checkPermissions(const CompiledSecurityContext& context,
+                       const CompiledAcl& acl, const struct ::stat& stat,
+                       mode_t mode);
+
+  /// Default seconds between checks for changes in a mapfile.
+  static const time_t kDefaultMapFileCheckInterval = 10;
+
   /// Get the VO from a full DN.
+  /// The mapfile is loaded the first time, and then checked for changes
+  /// at most once per check interval. Changes are loaded in the background,
+  /// and lookups use the previous version meanwhile.
   /// @param mapfile The file that contains the user => group mapping.
   /// @param dn      The DN to parse.
   /// @return        The mapped VO.
   std::string voFromDn(const std::string& mapfile, const std::string& dn);
 
+  /// Set how often voFromDn checks if the mapfiles changed.
+  /// @param seconds The new interval. 0 checks on every call.
+  void setMapFileCheckInterval(time_t seconds);
+
   /// Get the VO from a role.
   /// @param role The role.
   /// @return     The VO.
@@ -103,6 +175,36 @@ namespace dmlite {
   /// Get the subject from the certificate.
   std::string getCertificateSubject(const std::string& path);
 
+  /// Generates and validates tokens signed with one secret.
+  /// The HMAC key state is precomputed once, and copied into each thread
+  /// that uses it. Tokens that validated are remembered until they expire,
+  /// so a client reusing the same token does not pay the HMAC again.
+  /// Engines are shared and never released, get them with TokenEngine::get.
+  class TokenEngine {
+   public:
+    /// Get the engine for the given secret and digest.
+    /// @param passwd The password used to sign the tokens.
+    /// @param digest The OpenSSL name of the digest (i.e. sha1, sha256).
+    ///               Both ends must use the same.
+    static TokenEngine* get(const std::string& passwd,
+                            const std::string& digest = kDefaultTokenDigest) throw (DmException);
+
+    /// See dmlite::generateToken
+    std::string generate(const std::string& id, const std::string& pfn,
+                         time_t lifetime, bool write = false);
+
+    /// See dmlite::validateToken
+    TokenResult validate(const std::string& token, const std::string& id,
+                         const std::string& pfn, bool write = false);
+
+   private:
+    TokenEngine(const std::string& passwd, const std::string& digest) throw (DmException);
+    ~TokenEngine();
+
+    struct Internal;
+    Internal* d_;
+  };
+
   /// Generate a token.
   /// @param id       A unique ID of the user. May be the DN, the IP...
   /// @param pfn      The PFN we want a token for.
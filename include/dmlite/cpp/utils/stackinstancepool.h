@@ -0,0 +1,82 @@
+/// @file    include/dmlite/cpp/utils/stackinstancepool.h
+/// @brief   Pool of ready to use stack instances
+#ifndef DMLITE_CPP_UTILS_STACKINSTANCEPOOL_H
+#define DMLITE_CPP_UTILS_STACKINSTANCEPOOL_H
+
+#include <set>
+#include "../dmlite.h"
+#include "poolcontainer.h"
+
+namespace dmlite {
+
+  /// Keeps built StackInstances, so frontends that need one per request
+  /// do not pay for instantiating every plugin each time.
+  /// Released stacks are reset (see StackInstance::reset) before being
+  /// handed out again. Stacks that can not be reset are destroyed.
+  class StackInstancePool {
+   public:
+    /// Constructor
+    /// @param pm   The plugin manager the stacks are built from.
+    /// @param size How many stacks to keep. As with PoolContainer, up to 2*size
+    ///             can be in use before acquire blocks.
+    StackInstancePool(PluginManager* pm, int size);
+
+    /// Destructor. Stacks still in use are not freed.
+    ~StackInstancePool();
+
+    /// Get a stack, with the default security context.
+    StackInstance* acquire(bool block = true) throw (DmException);
+
+    /// Give back a stack got with acquire.
+    void release(StackInstance* si) throw ();
+
+    /// Change how many stacks are kept.
+    void resize(int size);
+
+   private:
+    class Factory: public PoolElementFactory<StackInstance*> {
+     public:
+      Factory(PluginManager* pm);
+
+      StackInstance* create();
+      void destroy(StackInstance* si);
+      bool isValid(StackInstance* si);
+
+      /// Do not give this one out again
+      void discard(StackInstance* si);
+
+     private:
+      PluginManager* pm_;
+
+      boost::mutex                mutex_;
+      std::set<StackInstance*>    discarded_;
+    };
+
+    Factory                       factory_;
+    PoolContainer<StackInstance*> pool_;
+  };
+
+  /// Takes a stack from a pool, and gives it back when going out of scope
+  class StackInstanceGrabber {
+   public:
+    StackInstanceGrabber(StackInstancePool& pool, bool block = true): pool_(pool)
+    {
+      si_ = pool_.acquire(block);
+    }
+
+    ~StackInstanceGrabber()
+    {
+      pool_.release(si_);
+    }
+
+    StackInstance* operator -> () { return si_; }
+    operator StackInstance* ()    { return si_; }
+
+   private:
+    StackInstancePool& pool_;
+    StackInstance*     si_;
+  };
+
+};
+
+#endif // DMLITE_CPP_UTILS_STACKINSTANCEPOOL_H
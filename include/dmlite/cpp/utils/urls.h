@@ -9,6 +9,44 @@
 #include "extensible.h"
 
 namespace dmlite {
+
+  /// Iterates over the components of a path without copying them.
+  /// Follows the same rules as Url::splitPath: if the path is absolute,
+  /// the first component is "/", and multiple slashes are skipped.
+  /// Components point into the original buffer, which must outlive the iterator.
+  class PathIterator {
+   public:
+    explicit PathIterator(const std::string& path) throw ();
+    PathIterator(const char* path, size_t length) throw ();
+
+    /// Move to the next component.
+    /// @return false if there are no more components.
+    bool next(void) throw ();
+
+    /// The current component. It is NOT null terminated.
+    const char* data(void) const throw () { return cur_; }
+    size_t      size(void) const throw () { return len_; }
+
+    /// Copy the current component into str, reusing its storage.
+    void assignTo(std::string& str) const { str.assign(cur_, len_); }
+
+    /// Compare the current component with a null terminated string.
+    bool equals(const char* str) const throw ();
+
+    /// Offset of the current component within the original buffer.
+    size_t offset(void) const throw () { return cur_ - begin_; }
+
+    /// What remains of the path after the current component, unparsed.
+    const char* rest(void) const throw () { return cur_ + len_; }
+    size_t      restSize(void) const throw () { return end_ - (cur_ + len_); }
+
+   private:
+    const char* begin_;
+    const char* end_;
+    const char* pos_;
+    const char* cur_;
+    size_t      len_;
+  };
   
   struct Url {
     std::string scheme;
@@ -45,6 +83,10 @@ namespace dmlite {
     
     /// Remove multiple slashes.
     static std::string normalizePath(const std::string& path, const bool add_trailing_slash = true) throw ();
+
+    /// Same as normalizePath, but modifies the given string.
+    /// It never grows, so it does not allocate.
+    static void normalizePathInPlace(std::string& path, const bool add_trailing_slash = true) throw ();
      
   };
 };
@@ -78,6 +78,13 @@ StackInstance::StackInstance(PluginManager* pm) throw (DmException):
 
   // Set the context, if was created
   if (this->secCtx_) setSecurityContextImpl_();
+
+  // Remember the initial umask, for reset
+  this->umask_ = 022;
+  if (this->catalog_) {
+    this->umask_ = this->catalog_->umask(022);
+    this->catalog_->umask(this->umask_);
+  }
   
   Log(Logger::Lvl4, stackinstancelogmask, stackinstancelogname, "");
 }
@@ -156,6 +163,48 @@ PluginManager* StackInstance::getPluginManager() throw (DmException)
 
 
 
+void StackInstance::reset() throw (DmException)
+{
+  Log(Logger::Lvl4, stackinstancelogmask, stackinstancelogname, "");
+
+  this->stackMsg_.clear();
+
+  if (this->catalog_) {
+    // Not all the catalogs keep a working dir
+    std::string cwd;
+    try {
+      cwd = this->catalog_->getWorkingDir();
+    }
+    catch (DmException& e) {
+      // Nothing to reset
+    }
+    // Back to the root. An empty path would be understood only by some of them
+    if (!cwd.empty() && cwd != "/")
+      this->catalog_->changeDir("/");
+
+    this->catalog_->umask(this->umask_);
+  }
+
+  // Back to the default security context. If there is none, the next
+  // user must set one before getting to the instances
+  SecurityContext* ctx = 0x00;
+  if (this->authn_) {
+    try {
+      ctx = this->authn_->createSecurityContext();
+    }
+    catch (DmException& e) {
+      ctx = 0x00;
+    }
+  }
+  delete this->secCtx_;
+  this->secCtx_ = ctx;
+  if (this->secCtx_) setSecurityContextImpl_();
+
+  Log(Logger::Lvl3, stackinstancelogmask, stackinstancelogname, "");
+}
+
+
+
 Authn* StackInstance::getAuthn() throw (DmException)
 {
   if (this->authn_ == 0)
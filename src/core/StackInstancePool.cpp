@@ -0,0 +1,90 @@
+/// @file   core/StackInstancePool.cpp
+/// @brief  Implementation of dm::StackInstancePool
+#include <dmlite/cpp/utils/stackinstancepool.h>
+
+#include "utils/logger.h"
+
+using namespace dmlite;
+
+
+
+StackInstancePool::Factory::Factory(PluginManager* pm): pm_(pm)
+{
+}
+
+
+
+StackInstance* StackInstancePool::Factory::create()
+{
+  return new StackInstance(this->pm_);
+}
+
+
+
+void StackInstancePool::Factory::destroy(StackInstance* si)
+{
+  {
+    boost::mutex::scoped_lock lock(this->mutex_);
+    this->discarded_.erase(si);
+  }
+  delete si;
+}
+
+
+
+bool StackInstancePool::Factory::isValid(StackInstance* si)
+{
+  boost::mutex::scoped_lock lock(this->mutex_);
+  return this->discarded_.find(si) == this->discarded_.end();
+}
+
+
+
+void StackInstancePool::Factory::discard(StackInstance* si)
+{
+  boost::mutex::scoped_lock lock(this->mutex_);
+  this->discarded_.insert(si);
+}
+
+
+
+StackInstancePool::StackInstancePool(PluginManager* pm, int size):
+    factory_(pm), pool_(&factory_, size)
+{
+}
+
+
+
+StackInstancePool::~StackInstancePool()
+{
+}
+
+
+
+StackInstance* StackInstancePool::acquire(bool block) throw (DmException)
+{
+  return this->pool_.acquire(block);
+}
+
+
+
+void StackInstancePool::release(StackInstance* si) throw ()
+{
+  // Reset out of the pool lock, it can call into the plugins
+  try {
+    si->reset();
+  }
+  catch (DmException& e) {
+    Log(Logger::Lvl1, stackinstancelogmask, stackinstancelogname,
+        "Could not reset a stack, it will not be reused: " << e.what());
+    this->factory_.discard(si);
+  }
+  this->pool_.release(si);
+}
+
+
+
+void StackInstancePool::resize(int size)
+{
+  this->pool_.resize(size);
+}
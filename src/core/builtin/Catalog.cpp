@@ -34,7 +34,7 @@ inline gid_t getGid(const SecurityContext* ctx, unsigned index)
 
 
 BuiltInCatalogFactory::BuiltInCatalogFactory():
-  updateATime_(true), symLinkLimit_(3)
+  updateATime_(true), aTimeInterval_(86400), symLinkLimit_(3)
 {
   // Nothing
 }
@@ -60,6 +60,8 @@ void BuiltInCatalogFactory::configure(const std::string& key, const std::string&
     std::transform(value.begin(), value.end(), lower.begin(), tolower);
     this->updateATime_ = (value == "yes");
   }
+  else if (key == "AccessTimeInterval")
+    this->aTimeInterval_ = atol(value.c_str());
   else gotit = false;
 
   if (gotit)
@@ -71,14 +73,14 @@ void BuiltInCatalogFactory::configure(const std::string& key, const std::string&
 
 Catalog* BuiltInCatalogFactory::createCatalog(PluginManager*) throw (DmException)
 {
-  return new BuiltInCatalog(this->updateATime_, this->symLinkLimit_);
+  return new BuiltInCatalog(this->updateATime_, this->aTimeInterval_, this->symLinkLimit_);
 }
 
 
 
-BuiltInCatalog::BuiltInCatalog(bool updateATime, unsigned symLinkLimit) throw (DmException):
+BuiltInCatalog::BuiltInCatalog(bool updateATime, time_t aTimeInterval, unsigned symLinkLimit) throw (DmException):
     si_(NULL), secCtx_(), cwd_(0), umask_(022),
-    updateATime_(updateATime), symLinkLimit_(symLinkLimit)
+    updateATime_(updateATime), aTimeInterval_(aTimeInterval), symLinkLimit_(symLinkLimit)
 {
   // Nothing
 }
@@ -109,6 +111,8 @@ void BuiltInCatalog::setStackInstance(StackInstance* si) throw (DmException)
 void BuiltInCatalog::setSecurityContext(const SecurityContext* ctx) throw (DmException)
 {
   this->secCtx_ = ctx;
+  if (ctx)
+    this->compiledSecCtx_.compile(*ctx);
 }
 
 
@@ -138,8 +142,11 @@ std::string BuiltInCatalog::getWorkingDir (void) throw (DmException)
 
 DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& path, bool followSym) throw (DmException)
 {
- // Split the path always assuming absolute
-  std::vector<std::string> components = Url::splitPath(path);
+  // Walk the components over the path itself. Only following a symlink
+  // needs a new buffer, with the link and whatever was left of the path.
+  const std::string* current = &path;
+  std::string        buffer;
+  PathIterator       component(path);
 
   // Iterate starting from absolute root (parent of /) (0)
   uint64_t     parent       = 0;
@@ -148,6 +155,10 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
 
   meta = ExtendedStat(); // ensure it's clean
 
+  if (this->secCtx_ == 0)
+    throw DmException(DMLITE_SYSERR(EINVAL),
+                      "Security context not initialized!!");
+
   // If path is absolute OR cwd is empty, start in root
   if (path[0] == '/' || this->cwdPath_.empty()) {
     // Stat '/', and, if it does not exist, create it
@@ -172,7 +183,7 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
     //updating parent
     parent = meta.stat.st_ino;
     if (path[0] == '/') {
-	    components.erase(components.begin());
+      component.next(); // Skip the root, we are already there
     }
   }
   // Relative, and cwd set, so start there
@@ -183,16 +194,17 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
   }
 
 
-  for (unsigned i = 0; i < components.size(); ) {
+  while (component.next()) {
     // Check that the parent is a directory first
     if (!S_ISDIR(meta.stat.st_mode) && !S_ISLNK(meta.stat.st_mode))
       return DmStatus(ENOTDIR, meta.name + " is not a directory");
     // New element traversed! Need to check if it is possible to keep going.
-    if (checkPermissions(this->secCtx_, meta.acl, meta.stat, S_IEXEC) != 0)
+    if (checkPermissions(this->compiledSecCtx_, CompiledAcl(meta.acl),
+                         meta.stat, S_IEXEC) != 0)
       return DmStatus(EACCES, "Not enough permissions to list " + meta.name);
 
     // Pop next component
-    c = components[i];
+    component.assignTo(c);
 
     // Stay here
     if (c == ".") {
@@ -217,14 +229,10 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
           return st;
         }
 
-        while (i < components.size()) {
-          components.pop_back();
-        }
-
-	      //re-add / at the beginning
-	      components.insert( components.begin(),std::string(1,'/'));
+        std::string under(*current, 0, component.offset());
+        Url::normalizePathInPlace(under, false);
         return DmStatus(ENOENT, "Entry '%s' not found under '%s'",
-                        c.c_str(), Url::joinPath(components).c_str());
+                        c.c_str(), under.c_str());
       }
 
       // Symbolic link!, follow that instead
@@ -238,15 +246,13 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
                            this->symLinkLimit_, path.c_str());
         }
 
-        // We have the symbolic link now. Split it and push
-        // into the component
-        std::vector<std::string> symPath = Url::splitPath(link.link);
-
-        for (unsigned j = i + 1; j < components.size(); ++j)
-          symPath.push_back(components[j]);
-
-        components.swap(symPath);
-        i = 0;
+        // We have the symbolic link now. Continue with it,
+        // followed by what was left of the path
+        std::string target(link.link);
+        target.append(component.rest(), component.restSize());
+        buffer.swap(target);
+        current   = &buffer;
+        component = PathIterator(buffer);
 
         // If absolute, need to reset parent
         if (link.link[0] == '/') {
@@ -270,7 +276,6 @@ DmStatus BuiltInCatalog::extendedStat(ExtendedStat &meta, const std::string& pat
         parent = meta.stat.st_ino;
       }
     }
-    ++i; // Next in array
   }
 
   checksums::fillChecksumInXattr(meta);
@@ -1117,6 +1122,7 @@ Directory* BuiltInCatalog::openDir(const std::string& path) throw (DmException)
   BuiltInDir* dirp;
 
   dirp = new BuiltInDir;
+  dirp->accessed = false;
 
   try {
     dirp->dir = this->extendedStat(path,true);
@@ -1150,7 +1156,10 @@ struct dirent* BuiltInCatalog::readDir(Directory* dir) throw (DmException)
 {
   BuiltInDir* dirp = (BuiltInDir*)dir;
   struct dirent* d = this->si_->getINode()->readDir(dirp->idir);
-  this->updateAccessTime(dirp->dir);
+  if (!dirp->accessed) {
+    this->updateAccessTime(dirp->dir);
+    dirp->accessed = true;
+  }
   return d;
 }
 
@@ -1162,7 +1171,10 @@ ExtendedStat* BuiltInCatalog::readDirx(Directory* dir) throw (DmException)
   ExtendedStat* s = this->si_->getINode()->readDirx(dirp->idir);
   if (s)
     checksums::fillChecksumInXattr(*s);
-  this->updateAccessTime(dirp->dir);
+  if (!dirp->accessed) {
+    this->updateAccessTime(dirp->dir);
+    dirp->accessed = true;
+  }
   return s;
 }
 
@@ -1199,12 +1211,15 @@ void BuiltInCatalog::updateReplica(const Replica& replica) throw (DmException)
 
 void BuiltInCatalog::updateAccessTime(const ExtendedStat& meta) throw (DmException)
 {
-  if (this->updateATime_) {
-    struct utimbuf tim;
-    tim.actime  = time(NULL);
-    tim.modtime = meta.stat.st_mtime;
-    this->si_->getINode()->utime(meta.stat.st_ino, &tim);
-  }
+  if (!this->updateATime_)
+    return;
+
+  time_t now = time(NULL);
+  if ((meta.stat.st_atime > meta.stat.st_mtime) && (meta.stat.st_atime > meta.stat.st_ctime) &&
+      (now - meta.stat.st_atime < this->aTimeInterval_))
+    return;
+
+  this->si_->getINode()->updateAccessTime(meta, now);
 }
 
 
@@ -1244,10 +1259,15 @@ void BuiltInCatalog::traverseBackwards(const ExtendedStat& meta) throw (DmExcept
 {
   ExtendedStat current = meta;
 
+  if (this->secCtx_ == 0)
+    throw DmException(DMLITE_SYSERR(EINVAL),
+                      "Security context not initialized!!");
+
   // We want to check if we can arrive here...
   while (current.parent != 0) {
     current = this->si_->getINode()->extendedStat(current.parent);
-    if (checkPermissions(this->secCtx_, current.acl, current.stat, S_IEXEC))
+    if (checkPermissions(this->compiledSecCtx_, CompiledAcl(current.acl),
+                         current.stat, S_IEXEC))
       throw DmException(EACCES,
                         "Can not access #%ld", current.stat.st_ino);
   }
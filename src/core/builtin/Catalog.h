@@ -9,6 +9,7 @@
 #include <dmlite/cpp/inode.h>
 #include <dmlite/cpp/poolmanager.h>
 #include <dmlite/cpp/pooldriver.h>
+#include <dmlite/cpp/utils/security.h>
 
 namespace dmlite {
 
@@ -16,11 +17,13 @@ namespace dmlite {
     virtual ~BuiltInDir() {};
     IDirectory*  idir;
     ExtendedStat dir;
+    /// The access time of dir is updated once per listing
+    bool         accessed;
   };
 
   class BuiltInCatalog: public Catalog {
    public:
-    BuiltInCatalog(bool updateATime, unsigned symLinkLimit) throw (DmException);
+    BuiltInCatalog(bool updateATime, time_t aTimeInterval, unsigned symLinkLimit) throw (DmException);
     ~BuiltInCatalog();
 
     std::string getImplId(void) const throw();
@@ -108,7 +111,8 @@ namespace dmlite {
     ExtendedStat getParent(const std::string& path, std::string* parentPath,
                           std::string* name) throw (DmException);
 
-    /// Update access time (if updateATime is true)
+    /// Update access time (if updateATime is true), as relatime does:
+    /// only if it is older than the last change, or than aTimeInterval
     void updateAccessTime(const ExtendedStat& meta) throw (DmException);
 
     /// Traverse backwards to check permissions.
@@ -134,12 +138,15 @@ namespace dmlite {
     StackInstance*   si_;
 
     const SecurityContext* secCtx_;
+    /// Precompiled secCtx_, for the checks done while walking paths
+    CompiledSecurityContext compiledSecCtx_;
 
     std::string cwdPath_;
     ino_t       cwd_;
 
     mode_t   umask_;
     bool     updateATime_;
+    time_t   aTimeInterval_;
     unsigned symLinkLimit_;
   };
 
@@ -155,6 +162,7 @@ namespace dmlite {
 
    private:
     bool     updateATime_;
+    time_t   aTimeInterval_;
     unsigned symLinkLimit_;
   };
 
@@ -106,6 +106,17 @@ NOT_IMPLEMENTED(Replica INode::getReplica(const std::string&) throw (DmException
 NOT_IMPLEMENTED(void INode::updateReplica(const Replica&) throw (DmException));
 NOT_IMPLEMENTED(std::vector<Replica> INode::getReplicas(ino_t) throw (DmException));
 NOT_IMPLEMENTED(void INode::utime(ino_t, const struct utimbuf*) throw (DmException));
+
+
+void INode::updateAccessTime(const ExtendedStat& meta, time_t atime) throw (DmException)
+{
+  struct utimbuf tim;
+  tim.actime  = atime;
+  tim.modtime = meta.stat.st_mtime;
+  this->utime(meta.stat.st_ino, &tim);
+}
+
+
 NOT_IMPLEMENTED(void INode::setMode(ino_t, uid_t, gid_t, mode_t, const Acl&) throw (DmException));
 NOT_IMPLEMENTED(void INode::setSize(ino_t, size_t) throw (DmException));
 NOT_IMPLEMENTED(void INode::setChecksum(ino_t, const std::string&, const std::string&) throw (DmException));
@@ -2,9 +2,210 @@
 #include "NotImplemented.h"
 #include "utils/logger.h"
 
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <deque>
+#include <errno.h>
+#include <limits.h>
+#include <map>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 using namespace dmlite;
 
 
+/// Size of the chunks when the data has to go through user space
+static const size_t kTransferChunk = 1024 * 1024;
+
+
+
+namespace {
+
+  /// A read started with submitAsync
+  struct AsyncRead {
+    IOHandler*  handler;
+    IOSegment*  segments;
+    size_t      count;
+    bool        done;
+    bool        failed;
+    size_t      result;
+    DmException error;
+  };
+
+  /// Threads shared by all the handlers that run their asynchronous
+  /// reads with the default implementation
+  class AsyncReadPool {
+   public:
+    static AsyncReadPool* instance()
+    {
+      boost::call_once(&AsyncReadPool::create, once_);
+      return instance_;
+    }
+
+    int submit(IOHandler* handler, IOSegment* segments, size_t count)
+    {
+      AsyncRead* r = new AsyncRead();
+      r->handler  = handler;
+      r->segments = segments;
+      r->count    = count;
+      r->done     = false;
+      r->failed   = false;
+      r->result   = 0;
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (nthreads_ == 0) {
+        nthreads_ = std::max(4u, boost::thread::hardware_concurrency());
+        for (unsigned i = 0; i < nthreads_; ++i) {
+          boost::thread t(&AsyncReadPool::work, this);
+          t.detach();
+        }
+      }
+
+      int id = ++lastId_;
+      reads_[id] = r;
+      queue_.push_back(r);
+      queued_.notify_one();
+      return id;
+    }
+
+    size_t wait(int id)
+    {
+      AsyncRead* r;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        std::map<int, AsyncRead*>::iterator i = reads_.find(id);
+        if (i == reads_.end())
+          throw DmException(DMLITE_SYSERR(EINVAL), "Unknown asynchronous read %d", id);
+        r = i->second;
+        while (!r->done)
+          finished_.wait(lock);
+        reads_.erase(i);
+      }
+
+      size_t result = r->result;
+      bool failed = r->failed;
+      DmException error = r->error;
+      delete r;
+
+      if (failed)
+        throw error;
+      return result;
+    }
+
+   private:
+    AsyncReadPool(): lastId_(0), nthreads_(0) {}
+
+    static void create()
+    {
+      // Never deleted, the detached threads may outlive the static destructors
+      instance_ = new AsyncReadPool();
+    }
+
+    void work()
+    {
+      while (true) {
+        AsyncRead* r;
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          while (queue_.empty())
+            queued_.wait(lock);
+          r = queue_.front();
+          queue_.pop_front();
+        }
+
+        try {
+          r->result = r->handler->preadv(r->segments, r->count);
+        }
+        catch (DmException& e) {
+          r->failed = true;
+          r->error  = e;
+        }
+        catch (std::exception& e) {
+          r->failed = true;
+          r->error  = DmException(DMLITE_SYSERR(DMLITE_UNEXPECTED_EXCEPTION),
+                                  "Unexpected exception in an asynchronous read: %s", e.what());
+        }
+        catch (...) {
+          // Whatever it was, the waiter must be told
+          r->failed = true;
+          r->error  = DmException(DMLITE_SYSERR(DMLITE_UNEXPECTED_EXCEPTION),
+                                  "Unexpected exception in an asynchronous read");
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+        r->done = true;
+        finished_.notify_all();
+      }
+    }
+
+    static AsyncReadPool*  instance_;
+    static boost::once_flag once_;
+
+    boost::mutex              mutex_;
+    boost::condition_variable queued_;
+    boost::condition_variable finished_;
+    std::deque<AsyncRead*>    queue_;
+    std::map<int, AsyncRead*> reads_;
+    int                       lastId_;
+    unsigned                  nthreads_;
+  };
+
+  AsyncReadPool*   AsyncReadPool::instance_ = NULL;
+  boost::once_flag AsyncReadPool::once_     = BOOST_ONCE_INIT;
+
+}
+
+
+
+/// Block until fd is ready, for nonblocking descriptors
+static void waitFd(int fd, short events)
+{
+  struct pollfd p;
+  p.fd      = fd;
+  p.events  = events;
+  p.revents = 0;
+  while (::poll(&p, 1, -1) < 0 && errno == EINTR);
+}
+
+
+
+/// Read what is available, up to count. Returns 0 only at the end.
+static size_t readSome(int fd, char* buffer, size_t count) throw (DmException)
+{
+  while (true) {
+    ssize_t n = ::read(fd, buffer, count);
+    if (n >= 0)
+      return static_cast<size_t>(n);
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      waitFd(fd, POLLIN);
+    else if (errno != EINTR)
+      throw DmException(DMLITE_SYSERR(errno), "Could not read from fd %d", fd);
+  }
+}
+
+
+
+/// Write all of the buffer
+static void writeAll(int fd, const char* buffer, size_t count) throw (DmException)
+{
+  while (count > 0) {
+    ssize_t n = ::write(fd, buffer, count);
+    if (n >= 0) {
+      buffer += n;
+      count  -= n;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      waitFd(fd, POLLOUT);
+    else if (errno != EINTR)
+      throw DmException(DMLITE_SYSERR(errno), "Could not write to fd %d", fd);
+  }
+}
+
+
 
 IODriverFactory::~IODriverFactory()
 {
@@ -131,3 +332,259 @@ NOT_IMPLEMENTED_WITHOUT_ID(void IOHandler::seek(off_t, Whence) throw (DmExceptio
 NOT_IMPLEMENTED_WITHOUT_ID(off_t IOHandler::tell(void) throw (DmException));
 NOT_IMPLEMENTED_WITHOUT_ID(void IOHandler::flush(void) throw (DmException));
 NOT_IMPLEMENTED_WITHOUT_ID(bool IOHandler::eof(void) throw (DmException));
+
+
+
+size_t IOHandler::preadv(IOSegment* segments, size_t count) throw (DmException)
+{
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    IOSegment& seg = segments[i];
+    seg.nbytes = 0;
+    while (seg.nbytes < seg.count) {
+      size_t n = this->pread(static_cast<char*>(seg.buffer) + seg.nbytes,
+                             seg.count - seg.nbytes, seg.offset + seg.nbytes);
+      if (n == 0)
+        break;
+      seg.nbytes += n;
+    }
+    total += seg.nbytes;
+  }
+  return total;
+}
+
+
+
+int IOHandler::submitAsync(IOSegment* segments, size_t count) throw (DmException)
+{
+  return AsyncReadPool::instance()->submit(this, segments, count);
+}
+
+
+
+size_t IOHandler::waitAsync(int id) throw (DmException)
+{
+  return AsyncReadPool::instance()->wait(id);
+}
+
+
+
+size_t IOHandler::preadvFd(int fd, IOSegment* segments, size_t count) throw (DmException)
+{
+  // Let the kernel start reading all of them, instead of one at a time
+  for (size_t i = 0; i < count; ++i)
+    posix_fadvise(fd, segments[i].offset, segments[i].count, POSIX_FADV_WILLNEED);
+
+  size_t total = 0;
+  std::vector<struct iovec> iov;
+  for (size_t i = 0; i < count; ) {
+    // The segments that follow each other in the file go in the same call
+    off_t  end = segments[i].offset;
+    size_t j   = i;
+    iov.clear();
+    while (j < count && segments[j].offset == end && iov.size() < IOV_MAX) {
+      struct iovec v;
+      v.iov_base = segments[j].buffer;
+      v.iov_len  = segments[j].count;
+      iov.push_back(v);
+      end += segments[j].count;
+      ++j;
+    }
+
+    ssize_t n = ::preadv(fd, &iov[0], iov.size(), segments[i].offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw DmException(DMLITE_SYSERR(errno), "Could not read from fd %d", fd);
+    }
+
+    size_t left = n;
+    for (size_t k = i; k < j; ++k) {
+      IOSegment& seg = segments[k];
+      seg.nbytes = std::min(left, seg.count);
+      left -= seg.nbytes;
+
+      // Short only at the end of the file, but make sure
+      while (seg.nbytes < seg.count) {
+        ssize_t m = ::pread(fd, static_cast<char*>(seg.buffer) + seg.nbytes,
+                            seg.count - seg.nbytes, seg.offset + seg.nbytes);
+        if (m < 0 && errno == EINTR)
+          continue;
+        if (m < 0)
+          throw DmException(DMLITE_SYSERR(errno), "Could not read from fd %d", fd);
+        if (m == 0)
+          break;
+        seg.nbytes += m;
+      }
+      total += seg.nbytes;
+    }
+
+    i = j;
+  }
+  return total;
+}
+
+
+
+size_t IOHandler::transferTo(int outfd, off_t offset, size_t count) throw (DmException)
+{
+  if (count == 0)
+    return 0;
+
+  std::vector<char> buffer(std::min(count, kTransferChunk));
+  size_t total = 0;
+  while (total < count) {
+    size_t n = this->pread(&buffer[0], std::min(count - total, buffer.size()), offset + total);
+    if (n == 0)
+      break;
+    writeAll(outfd, &buffer[0], n);
+    total += n;
+  }
+  return total;
+}
+
+
+
+size_t IOHandler::transferFrom(int infd, off_t offset, size_t count) throw (DmException)
+{
+  if (count == 0)
+    return 0;
+
+  std::vector<char> buffer(std::min(count, kTransferChunk));
+  size_t total = 0;
+  while (total < count) {
+    size_t n = readSome(infd, &buffer[0], std::min(count - total, buffer.size()));
+    if (n == 0)
+      break;
+    for (size_t written = 0; written < n; ) {
+      size_t w = this->pwrite(&buffer[written], n - written, offset + total + written);
+      if (w == 0)
+        throw DmException(DMLITE_SYSERR(EIO), "Short write at offset %lld",
+                          static_cast<long long>(offset + total + written));
+      written += w;
+    }
+    total += n;
+  }
+  return total;
+}
+
+
+
+size_t IOHandler::sendFile(int fd, off_t offset, int outfd, size_t count) throw (DmException)
+{
+  size_t total = 0;
+
+#ifdef __linux__
+  while (total < count) {
+    off_t pos = offset + total;
+    ssize_t n = ::sendfile(outfd, fd, &pos, count - total);
+    if (n > 0)
+      total += n;
+    else if (n == 0)
+      return total;
+    else if (errno == EAGAIN)
+      waitFd(outfd, POLLOUT);
+    else if ((errno == EINVAL || errno == ENOSYS) && total == 0)
+      break; // Not supported by these descriptors
+    else if (errno != EINTR)
+      throw DmException(DMLITE_SYSERR(errno), "sendfile from fd %d to fd %d failed", fd, outfd);
+  }
+  if (total == count)
+    return total;
+#endif
+
+  std::vector<char> buffer(std::min(count - total, kTransferChunk));
+  while (total < count) {
+    ssize_t n = ::pread(fd, &buffer[0], std::min(count - total, buffer.size()), offset + total);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw DmException(DMLITE_SYSERR(errno), "Could not read from fd %d", fd);
+    }
+    writeAll(outfd, &buffer[0], n);
+    total += n;
+  }
+  return total;
+}
+
+
+
+size_t IOHandler::receiveFile(int infd, int fd, off_t offset, size_t count) throw (DmException)
+{
+  size_t total = 0;
+
+#ifdef __linux__
+  // splice needs a pipe in between, and can not write at an offset in append mode
+  int p[2];
+  if (count > 0 && !(::fcntl(fd, F_GETFL) & O_APPEND) && ::pipe2(p, O_CLOEXEC) == 0) {
+    bool supported = true;
+
+    while (total < count) {
+      ssize_t n = ::splice(infd, NULL, p[1], NULL, std::min(count - total, kTransferChunk),
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (n == 0)
+        break;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN) {
+          waitFd(infd, POLLIN);
+          continue;
+        }
+        int e = errno;
+        if (e == EINVAL && total == 0) {
+          supported = false;
+          break;
+        }
+        ::close(p[0]);
+        ::close(p[1]);
+        throw DmException(DMLITE_SYSERR(e), "splice from fd %d failed", infd);
+      }
+
+      // Empty the pipe into the file
+      while (n > 0) {
+        loff_t pos = offset + total;
+        ssize_t m = ::splice(p[0], NULL, fd, &pos, n, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR)
+          continue;
+        if (m <= 0) {
+          int e = (m < 0) ? errno : EIO;
+          ::close(p[0]);
+          ::close(p[1]);
+          throw DmException(DMLITE_SYSERR(e), "splice to fd %d failed", fd);
+        }
+        n     -= m;
+        total += m;
+      }
+    }
+
+    ::close(p[0]);
+    ::close(p[1]);
+    if (supported)
+      return total;
+  }
+#endif
+
+  if (count == 0)
+    return 0;
+
+  std::vector<char> buffer(std::min(count, kTransferChunk));
+  while (total < count) {
+    size_t n = readSome(infd, &buffer[0], std::min(count - total, buffer.size()));
+    if (n == 0)
+      break;
+    for (size_t written = 0; written < n; ) {
+      ssize_t w = ::pwrite(fd, &buffer[written], n - written, offset + total + written);
+      if (w < 0) {
+        if (errno == EINTR)
+          continue;
+        throw DmException(DMLITE_SYSERR(errno), "Could not write to fd %d", fd);
+      }
+      written += w;
+    }
+    total += n;
+  }
+  return total;
+}
@@ -77,6 +77,9 @@ DomeCore::~DomeCore() {
 
   }
 
+  // Keep the hottest entries of the cache for the next start
+  DOMECACHE->persist();
+
 
 }
 
@@ -140,39 +143,11 @@ void workerFunc(DomeCore *core, int myidx) {
           // Please note that authentication must be configured in the web server, not in DOME
           // -------------------------
 
-          int i = 0;
-          bool authorize = false;
-          while (true) {
-
-            char buf[1024];
-            char *dn = buf;
-            CFG->ArrayGetString("glb.auth.authorizeDN", buf, i);
-            if ( !buf[0] ) {
-              // If there ar eno directives at all then this service is closed
-              if (i == 0) authorize = false;
-              break;
-            }
-
-            if (buf[0] == '"') {
-
-              if (buf[strlen(buf)-1] != '"') {
-                Err("workerFunc", "Mismatched quotes in authorizeDN directive. Can't authorize DN " << dreq.clientdn);
-                continue;
-              }
-
-              buf[strlen(buf)-1] = '\0';
-              dn = buf+1;
-
-            }
-
-            if ( !strncmp(dn, dreq.clientdn.c_str(), sizeof(buf)) ) {
-              // Authorize if the client DN can be found in the config whitelist
-              Log(Logger::Lvl2, domelogmask, domelogname, "DN '" << dn << "' authorized by whitelist.");
-              authorize = true;
-              break;
-            }
-
-            i++;
+          // If there are no directives at all then this service is closed
+          bool authorize = CFG->GetSnapshot()->isDNAuthorized(dreq.clientdn);
+          if (authorize) {
+            // Authorize if the client DN can be found in the config whitelist
+            Log(Logger::Lvl2, domelogmask, domelogname, "DN '" << dreq.clientdn << "' authorized by whitelist.");
           }
 
           if (!authorize) {
@@ -245,6 +220,10 @@ void workerFunc(DomeCore *core, int myidx) {
                 core->dome_getreplicavec(dreq, request);
               } else if (dreq.domecmd == "dome_readlink") {
                 core->dome_readlink(dreq, request);
+              } else if (dreq.domecmd == "dome_getfsreplicas") {
+                core->dome_getfsreplicas(dreq, request);
+              } else if (dreq.domecmd == "dome_scanstatus") {
+                core->dome_scanstatus(dreq, request);
               } else {
                 DomeReq::SendSimpleResp(request, 418, SSTR("Command '" << dreq.object << "' unknown for a GET request. I like your style."));
               }
@@ -325,6 +304,9 @@ void workerFunc(DomeCore *core, int myidx) {
               else if(dreq.domecmd == "dome_makespace") {
                 core->dome_makespace(dreq, request);
               }
+              else if(dreq.domecmd == "dome_scanfs") {
+                core->dome_scanfs(dreq, request);
+              }
               else if(dreq.domecmd == "dome_modquotatoken") {
                 core->dome_modquotatoken(dreq, request);
               }
@@ -498,6 +480,9 @@ int DomeCore::init(const char *cfgfile) {
       dmc->Init();
       Log(Logger::Lvl1, domelogmask, domelogname, "Cache successfully started. maxitems: " <<
       CFG->GetLong("mdcache.maxitems", 1000000) << " itemttl:" << CFG->GetLong("mdcache.itemttl", 3600));
+
+      // Reload what was hot before the restart, while we start serving
+      dmc->startWarmup();
     }
     else
       Log(Logger::Lvl1, domelogmask, domelogname, "Could not start the DOME cache.");
@@ -534,13 +519,27 @@ int DomeCore::init(const char *cfgfile) {
     limits.push_back( CFG->GetLong("head.filepulls.maxpernode", 2) );
     status.filepullq = new GenPrioQueue(CFG->GetLong("head.filepulls.qtmout", 180), limits);
 
+    // How to place new replicas
+    DomePlacement::Policy placementpolicy;
+    std::string p = CFG->GetString("head.put.policy", (char *)"twochoices");
+    if (!DomePlacement::policyFromString(p, placementpolicy)) {
+      Err(fname, "Invalid placement policy: '" << p << "'");
+      return -1;
+    }
+    status.placement.configure(placementpolicy,
+                               CFG->GetLong("head.put.inflighttimeout", 3600),
+                               CFG->GetLong("head.put.freespacefloor_pct", 5));
+    Log(Logger::Lvl1, domelogmask, domelogname, "Placement policy: " << p);
+
     // Allocate the mysql factory and configure it
     if(status.role == status.roleHead) {
       DomeMySql::configure( CFG->GetString("head.db.host",     (char *)"localhost"),
                             CFG->GetString("head.db.user",     (char *)"guest"),
                             CFG->GetString("head.db.password", (char *)"none"),
                             CFG->GetLong  ("head.db.port",     0),
-                            CFG->GetLong  ("head.db.poolsz",   128) );
+                            CFG->GetLong  ("head.db.poolsz",   128),
+                            CFG->GetLong  ("head.db.fileidblocksize", 100),
+                            CFG->GetBool  ("head.db.atomicnlink", true) );
 
       // Try getting a db connection and use it. If it does not work
       // an exception will just kill us, which is what we want
@@ -38,6 +38,7 @@
 #include <fcgio.h>
 #include "utils/Config.hh"
 #include "DomeMysql.h"
+#include "DomeFsScan.h"
 #include <string>
 #include <vector>
 #include <map>
@@ -187,6 +188,12 @@ public:
   int dome_updatexattr(DomeReq &req, FCGX_Request &request);
   /// Make space in volatile filesystems
   int dome_makespace(DomeReq &req, FCGX_Request &request);
+  /// Head node only. The rfns of the replicas of a filesystem, sorted, a page at a time
+  int dome_getfsreplicas(DomeReq &req, FCGX_Request &request);
+  /// Disk node only. Starts comparing the filesystems of this server with the catalog
+  int dome_scanfs(DomeReq &req, FCGX_Request &request);
+  /// Disk node only. The progress and the results of the scans
+  int dome_scanstatus(DomeReq &req, FCGX_Request &request);
 
   /// Send a simple info message
   int dome_info(DomeReq &req, FCGX_Request &request, int myidx, bool authorized);
@@ -223,7 +230,10 @@ public:
   int dome_unlink(DomeReq &req, FCGX_Request &request);
   
   
-  int makespace(std::string fsplusvo, int size);
+  /// Evict the least recently used replicas under a fs+vo prefix of this disk
+  /// server, until size bytes are freed. The deletions are sent to the head node
+  /// in parallel batches. Gives back how many bytes were freed.
+  int64_t makespace(const std::string &fsplusvo, int64_t size, const dmlite::DomeCredentials &creds, std::ostream *report = NULL);
   bool addFilesizeToDirs(DomeMySql &sql, dmlite::ExtendedStat file, int64_t size);
   /// Utility: fill a dmlite security context with ALL the information we have
   /// about the client that is sending the request and the user that originated it
@@ -264,6 +274,12 @@ private:
     /// Pending disknode file pulls
   std::map<int, PendingPull> diskPendingPulls;
 
+  /// The last scan of each filesystem of this disk node, by fs
+  std::map<std::string, boost::shared_ptr<DomeFsScan> > fsscans;
+  boost::mutex fsscansmtx;
+  /// Runs the given scans one after the other
+  void runFsScans(std::vector<boost::shared_ptr<DomeFsScan> > scans, dmlite::DomeCredentials creds);
+
 protected:
 
   // given some hints, pick a list of filesystems for writing
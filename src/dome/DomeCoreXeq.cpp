@@ -26,6 +26,7 @@
 
 #include "DomeCore.h"
 #include "DomeLog.h"
+#include "DomeJson.h"
 #include "utils/DomeUtils.h"
 #include <sys/vfs.h>
 #include <unistd.h>
@@ -33,12 +34,14 @@
 #include <sys/param.h>
 #include <stdio.h>
 #include <algorithm>
+#include <set>
 #include <functional>
 #include <time.h>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/optional/optional.hpp>
+#include <boost/bind.hpp>
 
 #include "cpp/authn.h"
 #include "cpp/dmlite.h"
@@ -167,36 +170,36 @@ std::vector<DomeFsInfo> DomeCore::pickFilesystems(const std::string &pool,
                                        const std::string &fs) {
   std::vector<DomeFsInfo> selected;
 
-  boost::unique_lock<boost::recursive_mutex> l(status);
-  Log(Logger::Lvl2, domelogmask, domelogname, "Picking from a list of " << status.fslist.size() << " filesystems to write into");
+  boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
+  Log(Logger::Lvl2, domelogmask, domelogname, "Picking from a list of " << fss->fslist.size() << " filesystems to write into");
 
-  for(unsigned int i = 0; i < status.fslist.size(); i++) {
-    std::string fsname = SSTR(status.fslist[i].server << ":" << status.fslist[i].fs);
-    Log(Logger::Lvl3, domelogmask, domelogname, "Checking '" << fsname << "' of pool '" << status.fslist[i].poolname << "'");
+  for(unsigned int i = 0; i < fss->fslist.size(); i++) {
+    std::string fsname = SSTR(fss->fslist[i].server << ":" << fss->fslist[i].fs);
+    Log(Logger::Lvl3, domelogmask, domelogname, "Checking '" << fsname << "' of pool '" << fss->fslist[i].poolname << "'");
 
-    if(!status.fslist[i].isGoodForWrite()) {
+    if(!fss->fslist[i].isGoodForWrite()) {
       Log(Logger::Lvl3, domelogmask, domelogname, fsname << " ruled out - not good for write");
       continue;
     }
 
-    if(!pool.empty() && status.fslist[i].poolname != pool) {
+    if(!pool.empty() && fss->fslist[i].poolname != pool) {
       Log(Logger::Lvl3, domelogmask, domelogname, fsname << " ruled out - does not match pool hint");
       continue;
     }
 
-    if(!host.empty() && status.fslist[i].server != host) {
+    if(!host.empty() && fss->fslist[i].server != host) {
       Log(Logger::Lvl3, domelogmask, domelogname, fsname << " ruled out - does not match host hint");
       continue;
     }
 
-    if(!fs.empty() && status.fslist[i].fs != fs) {
+    if(!fs.empty() && fss->fslist[i].fs != fs) {
       Log(Logger::Lvl3, domelogmask, domelogname, fsname << " ruled out - does not match fs hint");
       continue;
     }
 
     // fslist[i], you win
     Log(Logger::Lvl3, domelogmask, domelogname, fsname << " has become a candidate for writing.");
-    selected.push_back(status.fslist[i]);
+    selected.push_back(fss->fslist[i]);
   }
   return selected;
 }
@@ -259,7 +262,7 @@ int DomeCore::dome_put(DomeReq &req, FCGX_Request &request, bool &success, struc
   }
 
   // default minfreespace is 4GB. Gets overridden by the individual pool's value
-  int64_t minfreespace_bytes = CFG->GetLong("head.put.minfreespace_mb", 1024*4) * 1024*1024;
+  int64_t minfreespace_bytes = CFG->GetSnapshot()->putminfreespace_bytes;
 
   // use quotatokens?
   // TODO: more than quotatoken may match, they all should be considered
@@ -430,22 +433,8 @@ int DomeCore::dome_put(DomeReq &req, FCGX_Request &request, bool &success, struc
   // Sort the selected filesystems by decreasing free space
   std::sort(selectedfss.begin(), selectedfss.end(), DomeFsInfo::pred_decr_freespace());
 
-  // Use the free space as weight for a random choice among the filesystems
-  // Nice algorithm taken from http://stackoverflow.com/questions/1761626/weighted-random-numbers#1761646
-  long sum_of_weight = 0;
-  int fspos = 0;
-  for (unsigned int i = 0; i < selectedfss.size(); i++) {
-    sum_of_weight += (selectedfss[i].freespace >> 20);
-  }
-  // RAND_MAX is sufficiently big for this purpose
-  int rnd = random() % sum_of_weight;
-  for(unsigned int i=0; i < selectedfss.size(); i++) {
-    if(rnd < (selectedfss[i].freespace >> 20)) {
-      fspos = i;
-      break;
-    }
-    rnd -= (selectedfss[i].freespace >> 20);
-  }
+  // Choose among them, considering the free space and the puts already in flight
+  int fspos = status.placement.pick(selectedfss);
 
   // We have the fs, build the final pfn for the file
   //  fs/group/date/basename.r_ordinal.f_ordinal
@@ -534,6 +523,9 @@ int DomeCore::dome_put(DomeReq &req, FCGX_Request &request, bool &success, struc
     return DomeReq::SendSimpleResp(request, http_status(ret), os);
   }
 
+  // From now on, this fs is receiving one more file, until the putdone
+  status.placement.putStarted(r.rfn, selectedfss[fspos], r.ptime);
+
   // Here we are assuming that some frontend will soon start to write a new replica
   //  with the name we chose here
 
@@ -969,7 +961,7 @@ int DomeCore::dome_putdone_disk(DomeReq &req, FCGX_Request &request) {
   Log(Logger::Lvl1, domelogmask, domelogname, " Forwarding to headnode. server: '" << server << "' pfn: '" << pfn << "' "
     " size: " << size << " cksumt: '" << chktype << "' cksumv: '" << chkval << "'" );
 
-  std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
+  std::string domeurl = CFG->GetSnapshot()->headnodedomeurl;
 
   DomeTalker talker(*davixPool, req.creds, domeurl,
                     "POST", "dome_putdone");
@@ -989,6 +981,9 @@ int DomeCore::dome_putdone_disk(DomeReq &req, FCGX_Request &request) {
     return DomeReq::SendSimpleResp(request, 500, talker.err());
   }
 
+  // A new file for the eviction index, if it's in a volatile filesystem
+  status.evictionindex.touch(pfn, size, time(0));
+
   return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, talker.response());
 }
 
@@ -1046,6 +1041,9 @@ int DomeCore::dome_putdone_head(DomeReq &req, FCGX_Request &request) {
   // use the rfio syntax.
   std::string rfn = server + ":" + pfn;
 
+  // Whatever happens now, the client is not writing anymore
+  status.placement.putFinished(rfn);
+
   DomeMySql sql;
   dmlite::Replica rep;
   DmStatus ret;
@@ -1196,91 +1194,108 @@ int DomeCore::dome_putdone_head(DomeReq &req, FCGX_Request &request) {
   return rc;
 };
 
-std::vector<std::string> list_folders(const std::string &folder) {
-  std::vector<std::string> ret;
+namespace {
+  /// One deletion sent to the head node by makespace
+  struct EvictionCall {
+    dmlite::DavixCtxPool *pool;
+    DomeCredentials creds;
+    std::string domeurl;
+    std::string server;
+    DomeEvictionIndex::Victim victim;
+    bool ok;
+    /// The head node does not know the replica
+    bool gone;
+    std::string err;
 
-  DIR *d;
-  struct dirent *dir;
-  d = opendir(folder.c_str());
-  if(!d) return ret;
+    void run() {
+      DomeTalker talker(*pool, creds, domeurl,
+                        "POST", "dome_delreplica");
 
-  while((dir = readdir(d)) != NULL) {
-    std::string name = dir->d_name;
-    if(name != "." && name != ".." && dir->d_name && dir->d_type == DT_DIR) {
-      ret.push_back(folder + "/" + name);
+      ok = talker.execute("pfn", victim.pfn, "server", server);
+      if (!ok) {
+        err = talker.err();
+        gone = (talker.status() == DOME_HTTP_NOT_FOUND);
+      }
     }
-  }
-
-  closedir(d);
-
-  std::sort(ret.begin(), ret.end(), std::less<std::string>());
-  return ret;
+  };
 }
 
-int DomeCore::makespace(std::string fsplusvo, int size) {
-  // retrieve the list of folders and iterate over them, starting from the oldest
-  std::vector<std::string> folders = list_folders(fsplusvo);
-  size_t folder = 0;
-  size_t evictions = 0;
-  int space_cleared = 0;
-
-  std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
-
-  while(size >= space_cleared && folder < folders.size()) {
-    DIR *d = opendir(folders[folder].c_str());
-    if(!d) break; // should not happen
+int64_t DomeCore::makespace(const std::string &fsplusvo, int64_t size, const DomeCredentials &creds, std::ostream *report) {
+  // The filesystem is what is before the vo
+  std::string prefix = fsplusvo;
+  while ((prefix.size() > 1) && (prefix[prefix.size()-1] == '/'))
+    prefix.erase(prefix.size() - 1);
+  std::string fs = prefix.substr(0, prefix.rfind('/'));
+
+  // Volatile filesystems are indexed in the background. Anything else
+  // gets indexed now, the first time it's asked to make space
+  if (status.evictionindex.addFilesystem(fs))
+    status.evictionindex.scan(fs);
+
+  std::string domeurl = CFG->GetSnapshot()->headnodedomeurl;
+  unsigned int batchsize = CFG->GetLong("disk.makespace.batchsize", 8);
+  if (batchsize < 1) batchsize = 1;
+
+  int64_t space_cleared = 0;
+  long evictions = 0;
+  // Put back in the index at the end, not to pick them again
+  std::vector<DomeEvictionIndex::Victim> failed;
+
+  // Take the least recently used files, and ask the head node to delete
+  // them, a batch at a time, in parallel
+  while (space_cleared < size) {
+    std::vector<DomeEvictionIndex::Victim> victims;
+    status.evictionindex.popOldest(prefix, size - space_cleared, batchsize, victims);
+    if (victims.empty())
+      break;
 
-    while(size >= space_cleared) {
-      struct dirent *entry = readdir(d);
-      if(!entry) {
-        break;
+    std::vector<EvictionCall> calls(victims.size());
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < victims.size(); i++) {
+      calls[i].pool = davixPool;
+      calls[i].creds = creds;
+      calls[i].domeurl = domeurl;
+      calls[i].server = status.myhostname;
+      calls[i].victim = victims[i];
+      calls[i].ok = false;
+      calls[i].gone = false;
+      threads.create_thread(boost::bind(&EvictionCall::run, &calls[i]));
+    }
+    threads.join_all();
+
+    std::set<std::string> folders;
+    for (unsigned int i = 0; i < calls.size(); i++) {
+      if (!calls[i].ok) {
+        // Dark data is left out of the index, anything else may work next time
+        Err(domelogname, "Could not evict replica '" << calls[i].victim.pfn << "': " << calls[i].err);
+        if (report)
+          *report << "Could not evict replica '" << calls[i].victim.pfn << "': " << calls[i].err << "\r\n";
+        if (!calls[i].gone)
+          failed.push_back(calls[i].victim);
+        continue;
       }
 
-      if(entry->d_type == DT_REG) {
-        std::string victim = SSTR(folder << "/" << entry->d_name);
-        struct stat tmp;
-        if(stat(victim.c_str(), &tmp) != 0) continue; // should not happen
-
-        DomeTalker talker(*davixPool, NULL, domeurl,
-                          "POST", "dome_delreplica");
+      Log(Logger::Lvl1, domelogmask, domelogname, "Evicted replica '" << calls[i].victim.pfn << "' of size " << calls[i].victim.size << " from volatile filesystem to make space");
+      if (report)
+        *report << "Evicting replica '" << calls[i].victim.pfn << "' of size '" << calls[i].victim.size << "'" << "\r\n";
 
-        if(!talker.execute("pfn", victim, "server", status.myhostname)) {
-          Err(domelogname, talker.err()); // dark data? skip file
-          continue;
-        }
-
-        Log(Logger::Lvl1, domelogmask, domelogname, "Evicting replica '" << victim << "' of size " << tmp.st_size << "from volatile filesystem to make space");
-        evictions++;
-        space_cleared += tmp.st_size;
-      }
+      space_cleared += calls[i].victim.size;
+      evictions++;
+      folders.insert(calls[i].victim.pfn.substr(0, calls[i].victim.pfn.rfind('/')));
     }
-    closedir(d);
-    folder++;
-  }
-  return space_cleared;
-}
 
-// semi-random. Depends in what order the filesystem returns the files, which
-// is implementation-defined
-std::pair<size_t, std::string> pick_a_file(const std::string &folder) {
-  DIR *d = opendir(folder.c_str());
+    // rmdir is part of POSIX and only removes a directory if empty!
+    for (std::set<std::string>::iterator f = folders.begin(); f != folders.end(); ++f)
+      rmdir(f->c_str());
+  }
 
-  while(true) {
-    struct dirent *entry = readdir(d);
-    if(!entry) {
-      closedir(d);
-      return std::make_pair(-1, "");
-    }
+  status.evictionindex.putBack(failed);
 
-    if(entry->d_type == DT_REG) {
-      std::string filename = SSTR(folder << "/" << entry->d_name);
-      struct stat tmp;
-      if(stat(filename.c_str(), &tmp) != 0) continue; // should not happen
+  Log(Logger::Lvl1, domelogmask, domelogname, "Cleared " << space_cleared << " bytes from '" << prefix << "' through the removal of " << evictions << " files");
+  if (report)
+    *report << "Cleared '" << space_cleared << "' bytes through the removal of " << evictions << " files\r\n";
 
-      closedir(d);
-      return std::make_pair(tmp.st_size, filename);
-    }
-  }
+  return space_cleared;
 }
 
 int DomeCore::dome_makespace(DomeReq &req, FCGX_Request &request) {
@@ -1291,7 +1306,7 @@ int DomeCore::dome_makespace(DomeReq &req, FCGX_Request &request) {
 
   std::string fs = req.bodyfields.get<std::string>("fs", "");
   std::string voname = req.bodyfields.get<std::string>("vo", "");
-  int size = req.bodyfields.get<size_t>("size", 0);
+  int64_t size = req.bodyfields.get<int64_t>("size", 0);
   bool ensure_space = DomeUtils::str_to_bool(req.bodyfields.get<std::string>("ensure-space", "true"));
 
   if(fs.empty()) {
@@ -1306,15 +1321,15 @@ int DomeCore::dome_makespace(DomeReq &req, FCGX_Request &request) {
 
   // verify fs exists!
   {
-  boost::unique_lock<boost::recursive_mutex> l(status);
+  boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
   bool found = false;
   size_t i, selected_fs;
-  for(i = 0; i < status.fslist.size(); i++) {
-    if(status.fslist[i].fs == fs) {
+  for(i = 0; i < fss->fslist.size(); i++) {
+    if(fss->fslist[i].fs == fs) {
       found = true;
       selected_fs = i;
       if(ensure_space) {
-        size -= status.fslist[i].freespace;
+        size -= fss->fslist[i].freespace;
       }
       break;
     }
@@ -1323,104 +1338,283 @@ int DomeCore::dome_makespace(DomeReq &req, FCGX_Request &request) {
     return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, SSTR("Could not find filesystem '" << fs << "'"));
   }
   if(size <= 0) {
-    return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, SSTR("Selected fs " << status.fslist[selected_fs].server << ":" << status.fslist[selected_fs].fs << "' has enough space. (" << status.fslist[i].freespace << ")"));
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, SSTR("Selected fs " << fss->fslist[selected_fs].server << ":" << fss->fslist[selected_fs].fs << "' has enough space. (" << fss->fslist[i].freespace << ")"));
   }
   }
 
-  // retrieve the list of folders and iterate over them, starting from the oldest
-  std::vector<std::string> folders = list_folders(fs + "/" + voname);
-  size_t folder = 0;
-  size_t evictions = 0;
-  int space_cleared = 0;
-
-  std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
   std::ostringstream response;
+  int64_t space_cleared = makespace(fs + "/" + voname, size, req.creds, &response);
 
-  while(size >= space_cleared && folder < folders.size()) {
-    std::pair<size_t, std::string> victim = pick_a_file(folders[folder]);
+  if(space_cleared < size) {
+    response << "Error: could not clear up the requested amount of space. " << size << "\r\n";
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_UNPROCESSABLE, response.str());
+  }
 
-    if(victim.second.empty()) {
-      // rmdir is part of POSIX and only removes a directory if empty!
-      // If for some crazy reason we end up here even though the directory
-      // has files, the following will not have any effects.
-      rmdir(folders[folder].c_str());
-      folder++;
-      continue;
+  return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, response.str());
+}
+
+namespace {
+  /// The replicas of a filesystem, asked to the head node a page at a time
+  class HeadReplicaSource: public DomeFsScan::ReplicaSource {
+  public:
+    HeadReplicaSource(dmlite::DavixCtxPool &p, const DomeCredentials &c, const std::string &url):
+      pool(p), creds(c), domeurl(url) {}
+
+    int getReplicas(const std::string &server, const std::string &fs, int64_t afterrowid,
+                    unsigned int limit, std::vector<std::string> &rfns, int64_t &lastrowid, std::string &err) {
+      DomeTalker talker(pool, creds, domeurl, "GET", "dome_getfsreplicas");
+
+      boost::property_tree::ptree params;
+      params.put("server", server);
+      params.put("fs", fs);
+      params.put("afterrowid", afterrowid);
+      params.put("limit", limit);
+      if (!talker.execute(params)) {
+        err = talker.err();
+        return -1;
+      }
+
+      try {
+        lastrowid = talker.jresp().get<int64_t>("lastrowid");
+        const boost::property_tree::ptree &reps = talker.jresp().get_child("replicas");
+        for (boost::property_tree::ptree::const_iterator it = reps.begin(); it != reps.end(); ++it)
+          rfns.push_back(it->second.get<std::string>("rfn"));
+      }
+      catch (boost::property_tree::ptree_error &e) {
+        err = SSTR("Received invalid json when talking to " << domeurl << ": " << e.what());
+        return -1;
+      }
+      return 0;
     }
 
-    space_cleared += victim.first;
-    evictions++;
-    Log(Logger::Lvl1, domelogmask, domelogname, "Evicting replica '" << victim.second << "' from volatile filesystem to make space");
-    response << "Evicting replica '" << victim.second << "' of size '" << victim.first << "'" << "\r\n";
+  private:
+    dmlite::DavixCtxPool &pool;
+    DomeCredentials creds;
+    std::string domeurl;
+  };
+}
 
-    DomeTalker talker(*davixPool, req.creds, domeurl,
-                      "POST", "dome_delreplica");
+void DomeCore::runFsScans(std::vector<boost::shared_ptr<DomeFsScan> > scans, DomeCredentials creds) {
+  HeadReplicaSource source(*davixPool, creds, CFG->GetSnapshot()->headnodedomeurl);
 
-    if(!talker.execute("pfn", victim.second, "server", status.myhostname)) {
-      Err(domelogname, talker.err());
-      return DomeReq::SendSimpleResp(request, 500, talker.err());
+  // One after the other, not to load the disks even more
+  for (size_t i = 0; i < scans.size(); i++)
+    scans[i]->run(source);
+}
+
+int DomeCore::dome_getfsreplicas(DomeReq &req, FCGX_Request &request) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering");
+  if (status.role != status.roleHead) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, "dome_getfsreplicas only available on head nodes.");
+  }
+
+  std::string server, fs;
+  int64_t afterrowid;
+  long limit;
+  try {
+    server = req.bodyfields.get<std::string>("server", "");
+    fs = req.bodyfields.get<std::string>("fs", "");
+    afterrowid = req.bodyfields.get<int64_t>("afterrowid", 0);
+    limit = req.bodyfields.get<long>("limit", 10000);
+  }
+  catch(boost::property_tree::ptree_error &e) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_UNPROCESSABLE, SSTR("Error while parsing json body: " << e.what()));
+  }
+
+  if (server.empty() || fs.empty()) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, "server and fs are required.");
+  }
+  if ((limit <= 0) || (limit > 100000)) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, "limit must be between 1 and 100000.");
+  }
+
+  std::vector<std::string> rfns;
+  int64_t lastrowid;
+  DomeMySql sql;
+  if (sql.getFsReplicas(server, fs, afterrowid, limit, rfns, lastrowid) < 0) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_INTERNAL_SERVER_ERROR, SSTR("Cannot read the replicas of '" << server << ":" << fs << "'"));
+  }
+
+  DomeJsonWriter json(request, DOME_HTTP_OK);
+  json.beginObject().field("lastrowid", (long long)lastrowid).beginArray("replicas");
+  for (size_t i = 0; i < rfns.size(); i++)
+    json.beginObject().field("rfn", rfns[i]).endObject();
+  json.endArray().endObject();
+
+  return json.finish();
+}
+
+int DomeCore::dome_scanfs(DomeReq &req, FCGX_Request &request) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering");
+  if (status.role == status.roleHead) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, "dome_scanfs only available on disk nodes.");
+  }
+
+  std::string fs = req.bodyfields.get<std::string>("fs", "");
+  bool cancel = DomeUtils::str_to_bool(req.bodyfields.get<std::string>("cancel", "false"));
+
+  DomeFsScan::Params params;
+  params.nthreads = CFG->GetLong("disk.scan.threads", 4);
+  params.maxrate = CFG->GetLong("disk.scan.maxrate", 10000);
+  params.ioprio = DomeTaskExec::ioprioFromString(CFG->GetString("disk.scan.ioprio", (char *)"idle"));
+  params.pagesize = CFG->GetLong("disk.scan.pagesize", 10000);
+  params.maxexamples = CFG->GetLong("disk.scan.maxexamples", 100);
+  params.grace = CFG->GetLong("disk.scan.grace", 3600);
+  std::string reportdir = CFG->GetString("disk.scan.reportdir", (char *)"");
+  if (params.ioprio < 0) params.ioprio = 0;
+
+  // The filesystems of this server, or only the one asked
+  std::vector<std::string> filesystems;
+  {
+    boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
+    for (size_t i = 0; i < fss->fslist.size(); i++) {
+      if ((fss->fslist[i].server == status.myhostname) && (fs.empty() || (fss->fslist[i].fs == fs)))
+        filesystems.push_back(fss->fslist[i].fs);
     }
   }
+  if (filesystems.empty()) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_NOT_FOUND, SSTR("Could not find filesystem '" << fs << "' on this server."));
+  }
 
-  response << "Cleared '" << space_cleared << "' bytes through the removal of " << evictions << " files\r\n";
+  std::vector<boost::shared_ptr<DomeFsScan> > scans;
+  {
+    boost::lock_guard<boost::mutex> l(fsscansmtx);
+
+    for (size_t i = 0; i < filesystems.size(); i++) {
+      std::map<std::string, boost::shared_ptr<DomeFsScan> >::iterator it = fsscans.find(filesystems[i]);
+      bool running = false;
+      if (it != fsscans.end()) {
+        DomeFsScan::Progress::State st = it->second->getProgress().state;
+        running = (st != DomeFsScan::Progress::Done) && (st != DomeFsScan::Progress::Failed);
+      }
 
-  if(space_cleared < size) {
-    response << "Error: could not clear up the requested amount of space. " << size << "\r\n";
-    return DomeReq::SendSimpleResp(request, DOME_HTTP_UNPROCESSABLE, response.str());
+      if (cancel) {
+        if (running) it->second->cancel();
+        continue;
+      }
+      if (running) {
+        return DomeReq::SendSimpleResp(request, DOME_HTTP_CONFLICT, SSTR("A scan of '" << filesystems[i] << "' is already running."));
+      }
+    }
+
+    if (cancel) {
+      return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, "Scans cancelled.");
+    }
+
+    for (size_t i = 0; i < filesystems.size(); i++) {
+      DomeFsScan::Params p = params;
+      if (!reportdir.empty()) {
+        std::string name = filesystems[i];
+        std::replace(name.begin(), name.end(), '/', '_');
+        p.reportfile = reportdir + "/dome-scan" + name + ".txt";
+      }
+
+      boost::shared_ptr<DomeFsScan> scan(new DomeFsScan(status.myhostname, filesystems[i], p));
+      fsscans[filesystems[i]] = scan;
+      scans.push_back(scan);
+    }
   }
 
-  return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, response.str());
+  boost::thread t(boost::bind(&DomeCore::runFsScans, this, scans, req.creds));
+  t.detach();
+
+  return DomeReq::SendSimpleResp(request, DOME_HTTP_OK, SSTR("Scan of " << scans.size() << " filesystems started."));
+}
+
+int DomeCore::dome_scanstatus(DomeReq &req, FCGX_Request &request) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering");
+  if (status.role == status.roleHead) {
+    return DomeReq::SendSimpleResp(request, DOME_HTTP_BAD_REQUEST, "dome_scanstatus only available on disk nodes.");
+  }
+
+  std::string fs = req.bodyfields.get<std::string>("fs", "");
+
+  std::vector<boost::shared_ptr<DomeFsScan> > scans;
+  {
+    boost::lock_guard<boost::mutex> l(fsscansmtx);
+    for (std::map<std::string, boost::shared_ptr<DomeFsScan> >::iterator it = fsscans.begin(); it != fsscans.end(); ++it)
+      if (fs.empty() || (it->first == fs)) scans.push_back(it->second);
+  }
+
+  DomeJsonWriter json(request, DOME_HTTP_OK);
+  json.beginObject().beginArray("scans");
+  for (size_t i = 0; i < scans.size(); i++) {
+    DomeFsScan::Progress p = scans[i]->getProgress();
+    json.beginObject()
+        .field("fs", scans[i]->getFs())
+        .field("state", DomeFsScan::Progress::stateName(p.state))
+        .field("starttime", (long)p.starttime)
+        .field("endtime", (long)p.endtime)
+        .field("dirs", p.dirs)
+        .field("files", p.files)
+        .field("replicas", p.replicas)
+        .field("darkdata", p.darkdata)
+        .field("lost", p.lost)
+        .field("err", p.err);
+
+    json.beginArray("darkexamples");
+    for (size_t k = 0; k < p.darkexamples.size(); k++)
+      json.beginObject().field("pfn", p.darkexamples[k]).endObject();
+    json.endArray().beginArray("lostexamples");
+    for (size_t k = 0; k < p.lostexamples.size(); k++)
+      json.beginObject().field("rfn", p.lostexamples[k]).endObject();
+    json.endArray().endObject();
+  }
+  json.endArray().endObject();
+
+  return json.finish();
 }
 
 int DomeCore::dome_getspaceinfo(DomeReq &req, FCGX_Request &request) {
   Log(Logger::Lvl4, domelogmask, domelogname, "Entering");
 
-  boost::unique_lock<boost::recursive_mutex> l(status);
+  boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
 
   boost::property_tree::ptree jresp;
-  for (unsigned int i = 0; i < status.fslist.size(); i++) {
+  for (unsigned int i = 0; i < fss->fslist.size(); i++) {
     std::string fsname, poolname;
     boost::property_tree::ptree top;
 
-    fsname = "fsinfo^" + status.fslist[i].server + "^" + status.fslist[i].fs;
+    fsname = "fsinfo^" + fss->fslist[i].server + "^" + fss->fslist[i].fs;
 
     // Add this server if not already there
 
     if (status.role == status.roleHead) { // Only headnodes report about pools
-      jresp.put(boost::property_tree::ptree::path_type(fsname+"^poolname", '^'), status.fslist[i].poolname);
-      jresp.put(boost::property_tree::ptree::path_type(fsname+"^fsstatus", '^'), status.fslist[i].status);
+      jresp.put(boost::property_tree::ptree::path_type(fsname+"^poolname", '^'), fss->fslist[i].poolname);
+      jresp.put(boost::property_tree::ptree::path_type(fsname+"^fsstatus", '^'), fss->fslist[i].status);
     }
-    jresp.put(boost::property_tree::ptree::path_type(fsname+"^freespace", '^'), status.fslist[i].freespace);
-    jresp.put(boost::property_tree::ptree::path_type(fsname+"^physicalsize", '^'), status.fslist[i].physicalsize);
-    jresp.put(boost::property_tree::ptree::path_type(fsname+"^activitystatus", '^'), status.fslist[i].activitystatus);
+    jresp.put(boost::property_tree::ptree::path_type(fsname+"^freespace", '^'), fss->fslist[i].freespace);
+    jresp.put(boost::property_tree::ptree::path_type(fsname+"^physicalsize", '^'), fss->fslist[i].physicalsize);
+    jresp.put(boost::property_tree::ptree::path_type(fsname+"^activitystatus", '^'), fss->fslist[i].activitystatus);
 
     if (status.role == status.roleHead) { //Only headnodes report about pools
-      poolname = "poolinfo^" + status.fslist[i].poolname;
+      poolname = "poolinfo^" + fss->fslist[i].poolname;
       long long tot, free;
       int pool_st;
-      status.getPoolSpaces(status.fslist[i].poolname, tot, free, pool_st);
+      status.getPoolSpaces(fss->fslist[i].poolname, tot, free, pool_st);
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^poolstatus", '^'), 0);
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), free);
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), tot);
 
-      try {
-        jresp.put(boost::property_tree::ptree::path_type(poolname+"^s_type", '^'), status.poolslist[status.fslist[i].poolname].stype);
-        jresp.put(boost::property_tree::ptree::path_type(poolname+"^defsize", '^'), status.poolslist[status.fslist[i].poolname].defsize);
-      } catch ( ... ) {};
+      std::map <std::string, DomePoolInfo>::const_iterator pi = fss->poolslist.find(fss->fslist[i].poolname);
+      if (pi != fss->poolslist.end()) {
+        jresp.put(boost::property_tree::ptree::path_type(poolname+"^s_type", '^'), pi->second.stype);
+        jresp.put(boost::property_tree::ptree::path_type(poolname+"^defsize", '^'), pi->second.defsize);
+      }
 
-      poolname = "poolinfo^" + status.fslist[i].poolname + "^fsinfo^" + status.fslist[i].server + "^" + status.fslist[i].fs;
+      poolname = "poolinfo^" + fss->fslist[i].poolname + "^fsinfo^" + fss->fslist[i].server + "^" + fss->fslist[i].fs;
 
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^fsstatus", '^'), status.fslist[i].status);
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), status.fslist[i].freespace);
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), status.fslist[i].physicalsize);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^fsstatus", '^'), fss->fslist[i].status);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), fss->fslist[i].freespace);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), fss->fslist[i].physicalsize);
 
 
     }
   }
 
   // For completeness, add also the pools that have no filesystems :-(
-  for (std::map <std::string, DomePoolInfo>::iterator it = status.poolslist.begin();
-       it != status.poolslist.end();
+  for (std::map <std::string, DomePoolInfo>::const_iterator it = fss->poolslist.begin();
+       it != fss->poolslist.end();
        it++) {
     std::string poolname = "poolinfo^" + it->second.poolname;
     jresp.put(boost::property_tree::ptree::path_type(poolname+"^s_type", '^'), it->second.stype);
@@ -1543,6 +1737,42 @@ int DomeCore::dome_info(DomeReq &req, FCGX_Request &request, int myidx, bool aut
     for (char **envp = request.envp ; *envp; ++envp) {
       response << *envp << "\r\n";
     }
+
+    if (status.role == status.roleHead) {
+      std::map<std::string, DomePlacement::FsCounters> fscounters;
+      std::map<std::string, long> serverinflight;
+      status.placement.getCounters(fscounters, serverinflight);
+
+      response << "\r\nPlacement policy: " << DomePlacement::policyToString(status.placement.getPolicy()) << "\r\n";
+      for (std::map<std::string, DomePlacement::FsCounters>::iterator it = fscounters.begin(); it != fscounters.end(); ++it) {
+        response << "fs: " << it->first << " inflight: " << it->second.inflight << " placed: " << it->second.placed <<
+          " completed: " << it->second.completed << " expired: " << it->second.expired << "\r\n";
+      }
+      for (std::map<std::string, long>::iterator it = serverinflight.begin(); it != serverinflight.end(); ++it) {
+        response << "server: " << it->first << " inflight: " << it->second << "\r\n";
+      }
+
+      std::map<std::string, DomeStatus::ReloadStats> reloadstats;
+      status.getReloadStats(reloadstats);
+
+      response << "\r\nReloads:\r\n";
+      for (std::map<std::string, DomeStatus::ReloadStats>::iterator it = reloadstats.begin(); it != reloadstats.end(); ++it) {
+        response << "table: " << it->first << " reloads: " << it->second.reloads << " full: " << it->second.fullreloads <<
+          " unchanged: " << it->second.skipped << " last_ms: " << it->second.duration << " last_read: " << it->second.read <<
+          " last_applied: " << it->second.applied << "\r\n";
+      }
+    }
+    else {
+      std::map<std::string, DomeEvictionIndex::Counters> evictioncounters;
+      status.evictionindex.getCounters(evictioncounters);
+
+      if (evictioncounters.size() > 0)
+        response << "\r\nEviction index:\r\n";
+      for (std::map<std::string, DomeEvictionIndex::Counters>::iterator it = evictioncounters.begin(); it != evictioncounters.end(); ++it) {
+        response << "prefix: " << it->first << " files: " << it->second.files << " bytes: " << it->second.bytes <<
+          " evicted: " << it->second.evicted << "\r\n";
+      }
+    }
   }
   else {
     response << "ACCESS TO DOME DENIED.\r\n"; // magic string, don't change
@@ -1787,7 +2017,8 @@ int DomeCore::dome_dochksum(DomeReq &req, FCGX_Request &request) {
     params.push_back("/usr/bin/dome-checksum");
     params.push_back(chksumtype);
     params.push_back(pfn);
-    int id = this->submitCmd(params);
+    int id = this->submitCmd(params, CFG->GetLong("disk.checksum.nice", 0),
+                             ioprioFromString(CFG->GetString("disk.checksum.ionice", (char *)"")));
 
     if(id < 0) {
       return DomeReq::SendSimpleResp(request, 500, SSTR("An error occured - unable to initiate checksum calculation"));
@@ -1867,7 +2098,7 @@ void DomeCore::sendFilepullStatus(const PendingPull &pending, const DomeTask &ta
     Log(Logger::Lvl4, domelogmask, domelogname, "File pull checksum: " << checksum);
   }
 
-  std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
+  std::string domeurl = CFG->GetSnapshot()->headnodedomeurl;
   Log(Logger::Lvl4, domelogmask, domelogname, domeurl);
 
   DomeTalker talker(*davixPool, pending.creds, domeurl,
@@ -1910,6 +2141,8 @@ void DomeCore::sendFilepullStatus(const PendingPull &pending, const DomeTask &ta
         // If stat was successful then we can get the final filesize
         Log(Logger::Lvl1, domelogmask, domelogname, "pfn: " << pending.pfn << " has size: " << st.st_size);
         jresp.put("filesize", st.st_size);
+
+        status.evictionindex.touch(pending.pfn, st.st_size, time(0));
       }
 
     }
@@ -1947,7 +2180,7 @@ void DomeCore::sendChecksumStatus(const PendingChecksum &pending, const DomeTask
     }
   }
 
-  std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
+  std::string domeurl = CFG->GetSnapshot()->headnodedomeurl;
   Log(Logger::Lvl4, domelogmask, domelogname, domeurl);
   std::string rfn = pending.server + ":" + pending.pfn;
 
@@ -2007,31 +2240,32 @@ int DomeCore::dome_statpool(DomeReq &req, FCGX_Request &request) {
   int poolst;
   status.getPoolSpaces(pn, tot, free, poolst);
 
+  boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
   boost::property_tree::ptree jresp;
-  for (unsigned int i = 0; i < status.fslist.size(); i++)
-    if (status.fslist[i].poolname == pn) {
+  for (unsigned int i = 0; i < fss->fslist.size(); i++)
+    if (fss->fslist[i].poolname == pn) {
       std::string fsname, poolname;
       boost::property_tree::ptree top;
 
 
 
-      poolname = "poolinfo^" + status.fslist[i].poolname;
+      poolname = "poolinfo^" + fss->fslist[i].poolname;
 
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^poolstatus", '^'), poolst);
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), free);
       jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), tot);
 
-      poolname = "poolinfo^" + status.fslist[i].poolname + "^fsinfo^" + status.fslist[i].server + "^" + status.fslist[i].fs;
+      poolname = "poolinfo^" + fss->fslist[i].poolname + "^fsinfo^" + fss->fslist[i].server + "^" + fss->fslist[i].fs;
 
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^fsstatus", '^'), status.fslist[i].status);
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), status.fslist[i].freespace);
-      jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), status.fslist[i].physicalsize);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^fsstatus", '^'), fss->fslist[i].status);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^freespace", '^'), fss->fslist[i].freespace);
+      jresp.put(boost::property_tree::ptree::path_type(poolname+"^physicalsize", '^'), fss->fslist[i].physicalsize);
 
     }
 
   // maybe the pool contains no filesystems..
-  for (std::map <std::string, DomePoolInfo>::iterator it = status.poolslist.begin();
-       it != status.poolslist.end();
+  for (std::map <std::string, DomePoolInfo>::const_iterator it = fss->poolslist.begin();
+       it != fss->poolslist.end();
        it++) {
     if (it->second.poolname == pn) {
       std::string poolname = "poolinfo^" + it->second.poolname;
@@ -2087,16 +2321,16 @@ int DomeCore::dome_getdirspaces(DomeReq &req, FCGX_Request &request) {
   
   // Crawl
   {
-    boost::unique_lock<boost::recursive_mutex> l(status);
+    boost::shared_ptr<const DomeQuotaTables> qt = status.quotatokens.get();
     while (absPath.length() > 0) {
 
       Log(Logger::Lvl4, domelogmask, domelogname, "Processing: '" << absPath << "'");
       // Check if any matching quotatoken exists
-      std::pair <std::multimap<std::string, DomeQuotatoken>::iterator, std::multimap<std::string, DomeQuotatoken>::iterator> myintv;
-      myintv = status.quotas.equal_range(absPath);
+      std::pair <std::multimap<std::string, DomeQuotatoken>::const_iterator, std::multimap<std::string, DomeQuotatoken>::const_iterator> myintv;
+      myintv = qt->quotas.equal_range(absPath);
 
       if (myintv.first != myintv.second) {
-        for (std::multimap<std::string, DomeQuotatoken>::iterator it = myintv.first; it != myintv.second; ++it) {
+        for (std::multimap<std::string, DomeQuotatoken>::const_iterator it = myintv.first; it != myintv.second; ++it) {
           totspace += it->second.t_space;
 
           // Now find the free space in the mentioned pool
@@ -2472,7 +2706,7 @@ int DomeCore::dome_pull(DomeReq &req, FCGX_Request &request) {
 //     int64_t filesz = 0LL;
 //     {
 //
-//       std::string domeurl = CFG->GetString("disk.headnode.domeurl", (char *)"(empty url)/");
+//       std::string domeurl = CFG->GetSnapshot()->headnodedomeurl;
 //
 //       DomeTalker talker(*davixPool, req.creds, domeurl,
 //                         "GET", "dome_getstatinfo");
@@ -2527,7 +2761,7 @@ int DomeCore::dome_pull(DomeReq &req, FCGX_Request &request) {
 
       std::string fsvopfx = Url::joinPath(comps);
 
-      int freed = makespace(fsvopfx, neededspace);
+      int64_t freed = makespace(fsvopfx, neededspace, req.creds);
       if (freed < neededspace)
         return DomeReq::SendSimpleResp(request, 422, SSTR("Volatile file purging failed. Not enough disk space to pull pfn: '" << pfn << "'") );
     }
@@ -2553,7 +2787,8 @@ int DomeCore::dome_pull(DomeReq &req, FCGX_Request &request) {
     params.push_back(lfn);
     params.push_back(pfn);
     params.push_back(SSTR(neededspace));
-    int id = this->submitCmd(params);
+    int id = this->submitCmd(params, CFG->GetLong("disk.filepuller.nice", 0),
+                             ioprioFromString(CFG->GetString("disk.filepuller.ionice", (char *)"")));
 
     if (id < 0)
       return DomeReq::SendSimpleResp(request, 500, "Could not invoke file puller.");
@@ -2590,17 +2825,14 @@ int DomeCore::dome_getquotatoken(DomeReq &req, FCGX_Request &request) {
   boost::property_tree::ptree jresp;
   int cnt = 0;
 
-  // Make a local copy of the quotas to loop on
-  std::multimap <std::string, DomeQuotatoken> localquotas;
-  {
-    boost::unique_lock<boost::recursive_mutex> l(status);
-    localquotas = status.quotas;
-  }
+  // The snapshot does not change while we loop on it
+  boost::shared_ptr<const DomeQuotaTables> qt = status.quotatokens.get();
+  const std::multimap <std::string, DomeQuotatoken> &localquotas = qt->quotas;
 
   DomeMySql sql;
   DmStatus ret;
 
-  for (std::multimap<std::string, DomeQuotatoken>::iterator it = localquotas.begin(); it != localquotas.end(); ++it) {
+  for (std::multimap<std::string, DomeQuotatoken>::const_iterator it = localquotas.begin(); it != localquotas.end(); ++it) {
     bool match = false;
 
     if(absPath == it->second.path) {
@@ -2937,6 +3169,8 @@ int DomeCore::dome_pfnrm(DomeReq &req, FCGX_Request &request) {
     }
   }
 
+  status.evictionindex.remove(absPath);
+
   return DomeReq::SendSimpleResp(request, 200, SSTR("Rm successful."));
 }
 
@@ -3202,15 +3436,15 @@ int DomeCore::dome_addpool(DomeReq &req, FCGX_Request &request) {
 
   // make sure it doesn't already exist
   {
-    boost::unique_lock<boost::recursive_mutex> l(status);
+    boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
 
-    for (std::vector<DomeFsInfo>::iterator fs = status.fslist.begin(); fs != status.fslist.end(); fs++) {
+    for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
       if(fs->poolname == poolname) {
         return DomeReq::SendSimpleResp(request, 422, SSTR("poolname '" << poolname << "' already exists."));
       }
     }
 
-    if (status.poolslist.find(poolname) != status.poolslist.end()) {
+    if (fss->poolslist.find(poolname) != fss->poolslist.end()) {
       return DomeReq::SendSimpleResp(request, 422, SSTR("poolname '" << poolname << "' already exists in the groups map (may have no filesystems)."));
     }
   }
@@ -3257,9 +3491,9 @@ int DomeCore::dome_modifypool(DomeReq &req, FCGX_Request &request) {
 
   // make sure it DOES exist
   {
-    boost::unique_lock<boost::recursive_mutex> l(status);
+    boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
 
-    if (status.poolslist.find(poolname) == status.poolslist.end()) {
+    if (fss->poolslist.find(poolname) == fss->poolslist.end()) {
       return DomeReq::SendSimpleResp(request, 422, SSTR("poolname '" << poolname << "' does not exist, cannot modify it."));
     }
   }
@@ -3307,7 +3541,8 @@ int DomeCore::dome_addfstopool(DomeReq &req, FCGX_Request &request) {
     return DomeReq::SendSimpleResp(request, 422, SSTR("Invalid status '" << fsstatus << "'. Should be 0, 1 or 2."));
 
   // Make sure it's not already there or that we are not adding a parent/child of an existing fs
-  for (std::vector<DomeFsInfo>::iterator fs = status.fslist.begin(); fs != status.fslist.end(); fs++) {
+  boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
+  for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
     if ( status.PfnMatchesFS(server, newfs, *fs) )
       return DomeReq::SendSimpleResp(request, 422, SSTR("Filesystem '" << server << ":" << fs->fs << "' already exists or overlaps an existing filesystem."));
   }
@@ -3381,10 +3616,9 @@ int DomeCore::dome_modifyfs(DomeReq &req, FCGX_Request &request) {
 
   // Make sure it is already there exactly
   {
-    // Lock status!
-    boost::unique_lock<boost::recursive_mutex> l(status);
+    boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
 
-    for (std::vector<DomeFsInfo>::iterator fs = status.fslist.begin(); fs != status.fslist.end(); fs++) {
+    for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
       if ( status.PfnMatchesFS(server, newfs, *fs) ) {
         if (fs->fs.length() != newfs.length())
           return DomeReq::SendSimpleResp(request, 422, SSTR("Filesystem '" << server << ":" << newfs << "' overlaps the existing filesystem '" << fs->fs << "'"));
@@ -3450,10 +3684,9 @@ int DomeCore::dome_rmfs(DomeReq &req, FCGX_Request &request) {
   int ndel = 0;
   bool found = false;
   {
-    // Lock status!
-    boost::unique_lock<boost::recursive_mutex> l(status);
+    boost::shared_ptr<const DomeFsTables> fss = status.filesystems.get();
 
-    for (std::vector<DomeFsInfo>::iterator fs = status.fslist.begin(); fs != status.fslist.end(); fs++) {
+    for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
       if(newfs == fs->fs) {
         found = true;
         break;
@@ -3483,20 +3716,20 @@ int DomeCore::dome_rmfs(DomeReq &req, FCGX_Request &request) {
 
 
 
-static void xstat_to_ptree(const dmlite::ExtendedStat& xstat, boost::property_tree::ptree &ptree) {
-  ptree.put("fileid", xstat.stat.st_ino);
-  ptree.put("parentfileid", xstat.parent);
-  ptree.put("size", xstat.stat.st_size);
-  ptree.put("mode", xstat.stat.st_mode);
-  ptree.put("atime", xstat.stat.st_atime);
-  ptree.put("mtime", xstat.stat.st_mtime);
-  ptree.put("ctime", xstat.stat.st_ctime);
-  ptree.put("uid", xstat.stat.st_uid);
-  ptree.put("gid", xstat.stat.st_gid);
-  ptree.put("nlink", xstat.stat.st_nlink);
-  ptree.put("acl", xstat.acl.serialize());
-  ptree.put("name", xstat.name);
-  ptree.put("xattrs", xstat.serialize());
+static void xstat_to_json(const dmlite::ExtendedStat& xstat, DomeJsonWriter &json) {
+  json.field("fileid", xstat.stat.st_ino)
+      .field("parentfileid", xstat.parent)
+      .field("size", xstat.stat.st_size)
+      .field("mode", xstat.stat.st_mode)
+      .field("atime", xstat.stat.st_atime)
+      .field("mtime", xstat.stat.st_mtime)
+      .field("ctime", xstat.stat.st_ctime)
+      .field("uid", xstat.stat.st_uid)
+      .field("gid", xstat.stat.st_gid)
+      .field("nlink", xstat.stat.st_nlink)
+      .field("acl", xstat.acl.serialize())
+      .field("name", xstat.name)
+      .field("xattrs", xstat.serialize());
 }
 
 
@@ -3629,10 +3862,12 @@ int DomeCore::dome_getstatinfo(DomeReq &req, FCGX_Request &request) {
   }
 
 
-  boost::property_tree::ptree jresp;
-  xstat_to_ptree(st, jresp);
+  DomeJsonWriter json(request, 200);
+  json.beginObject();
+  xstat_to_json(st, json);
+  json.endObject();
 
-  return DomeReq::SendSimpleResp(request, 200, jresp);
+  return json.finish();
 
 }
 
@@ -3733,31 +3968,95 @@ int DomeCore::dome_getdir(DomeReq &req, FCGX_Request &request) {
   if (checkPermissions(&ctx, parent.acl, parent.stat, S_IREAD | S_IEXEC) != 0)
     return DomeReq::SendSimpleResp(request, 403, SSTR("Need READ access on '" << parentPath << "'"));
 
-  boost::property_tree::ptree jresp, jresp2;
-  DomeMySqlDir *d;
+  ExtendedStat dir;
+  ret = sql.getStatbyLFN(dir, path);
+  if (!ret.ok())
+    return DomeReq::SendSimpleResp(request, 500, SSTR("Cannot open dir: '" << path << "' err: " << ret.code() << " what: '" << ret.what() << "'"));
+  if (!S_ISDIR(dir.stat.st_mode))
+    return DomeReq::SendSimpleResp(request, 500, SSTR("Cannot open dir: '" << path << "' err: " << ENOTDIR << " what: 'Not a directory'"));
+
+  // Popular directories are listed from the cache, if their entries are
+  // all in the cache too. Otherwise it's cheaper to ask the db for all of them
+  boost::shared_ptr<const DomeDirListing> listing = DOMECACHE->getDirListing(dir.stat.st_ino);
+  if (listing) {
+    std::vector<ExtendedStat> entries(listing->entries.size());
+    size_t i;
+    for (i = 0; i < listing->entries.size(); i++) {
+      boost::shared_ptr<DomeFileInfo> dfi = DOMECACHE->getFileInfoOrCreateNewOne(listing->entries[i].second);
+      boost::unique_lock<boost::mutex> l(*dfi);
+      if ((dfi->status_statinfo != DomeFileInfo::Ok) || (dfi->statinfo.parent != dir.stat.st_ino))
+        break;
+      entries[i] = dfi->statinfo;
+    }
+
+    if (i == listing->entries.size()) {
+      DomeJsonWriter json(request, 200);
+      json.beginObject().beginArray("entries");
+
+      for (i = 0; i < entries.size(); i++) {
+        checksums::fillChecksumInXattr(entries[i]);
+
+        json.beginObject();
+        xstat_to_json(entries[i], json);
+        json.endObject();
+      }
+
+      json.endArray().endObject();
+      return json.finish();
+    }
 
+    Log(Logger::Lvl3, domelogmask, domelogname, "Entry " << listing->entries[i].second <<
+      " not in the cache, listing '" << path << "' from the db");
+  }
+
+  unsigned long long token = DOMECACHE->beginDirListing(dir.stat.st_ino);
+  unsigned long maxentries = DOMECACHE->getDirListingMaxEntries();
+  boost::shared_ptr<DomeDirListing> newlisting;
+  if (maxentries > 0) {
+    newlisting.reset(new DomeDirListing);
+    newlisting->created = time(0);
+  }
 
+  DomeMySqlDir *d;
   ret = sql.opendir(d, path);
   if (!ret.ok()) {
+    DOMECACHE->pushDirListing(dir.stat.st_ino, token, boost::shared_ptr<const DomeDirListing>());
     return DomeReq::SendSimpleResp(request, 500, SSTR("Cannot open dir: '" << path << "' err: " << ret.code() << " what: '" << ret.what() << "'"));
   }
 
+  // The entries go out while they are read, big directories are never
+  // held in memory as a whole
+  DomeJsonWriter json(request, 200);
+  json.beginObject().beginArray("entries");
+
   dmlite::ExtendedStat *st;
   while ( (st = sql.readdirx(d)) ) {
-    boost::property_tree::ptree pt;
-    pt.put("name", st->name);
-
+    // Keep the listing and the stats, unless the directory is too big
+    if (newlisting) {
+      if (newlisting->entries.size() < maxentries) {
+        newlisting->entries.push_back(DomeDirListing::Entry(st->name, st->stat.st_ino));
+        DOMECACHE->pushXstatInfo(*st, DomeFileInfo::Ok);
+      }
+      else
+        newlisting.reset();
+    }
 
     checksums::fillChecksumInXattr(*st);
-    xstat_to_ptree(*st, pt);
 
-
-    jresp2.push_back(std::make_pair("", pt));
+    json.beginObject();
+    xstat_to_json(*st, json);
+    json.endObject();
   }
 
+  // If the read failed midway, the listing is not complete
+  if (d)
+    sql.closedir(d);
+  else
+    newlisting.reset();
+  DOMECACHE->pushDirListing(dir.stat.st_ino, token, newlisting);
 
-  jresp.push_back(std::make_pair("entries", jresp2));
-  return DomeReq::SendSimpleResp(request, 200, jresp);
+  json.endArray().endObject();
+  return json.finish();
 
 }
 
@@ -4179,8 +4478,6 @@ int DomeCore::dome_getusersvec(DomeReq &req, FCGX_Request &request) {
   }
 
 
-  boost::property_tree::ptree jresp, jresp2;
-
   try {
     DomeMySql sql;
     DmStatus st;
@@ -4192,18 +4489,19 @@ int DomeCore::dome_getusersvec(DomeReq &req, FCGX_Request &request) {
       return DomeReq::SendSimpleResp(request, 500, SSTR("Cannot get users. err:" <<
       st.code() << " what: '" << st.what()));
 
+    DomeJsonWriter json(request, 200);
+    json.beginObject().beginArray("users");
     for (uint ii = 0; ii < users.size(); ii++) {
-      boost::property_tree::ptree pt;
-
-      pt.put("username", users[ii].username);
-      pt.put("userid", users[ii].userid);
-      pt.put("banned", users[ii].banned);
-      pt.put("xattr", users[ii].xattr);
-      jresp2.push_back(std::make_pair("", pt));
+      json.beginObject()
+          .field("username", users[ii].username)
+          .field("userid", users[ii].userid)
+          .field("banned", users[ii].banned)
+          .field("xattr", users[ii].xattr)
+          .endObject();
     }
-    jresp.push_back(std::make_pair("users", jresp2));
+    json.endArray().endObject();
 
-    return DomeReq::SendSimpleResp(request, 200, jresp);
+    return json.finish();
   }
   catch (DmException e) {
     return DomeReq::SendSimpleResp(request, 500, SSTR("Unable to get users. err:" <<
@@ -4228,7 +4526,6 @@ int DomeCore::dome_getreplicavec(DomeReq &req, FCGX_Request &request) {
     return DomeReq::SendSimpleResp(request, 422, SSTR("Error while parsing json body: " << e.what()));
   }
 
-  boost::property_tree::ptree jresp, jresp2;
   std::vector<Replica> reps;
 
   try {
@@ -4249,26 +4546,27 @@ int DomeCore::dome_getreplicavec(DomeReq &req, FCGX_Request &request) {
         " err: " << st.code() << " what:" << st.what()) );
     }
 
+    DomeJsonWriter json(request, 200);
+    json.beginObject().beginArray("replicas");
     for (uint ii = 0; ii < reps.size(); ii++) {
-      boost::property_tree::ptree pt;
-
-      pt.put("replicaid", reps[ii].replicaid);
-      pt.put("fileid", reps[ii].fileid);
-      pt.put("nbaccesses", reps[ii].nbaccesses);
-      pt.put("atime", reps[ii].atime);
-      pt.put("ptime", reps[ii].ptime);
-      pt.put("ltime", reps[ii].ltime);
-      pt.put("status", reps[ii].status);
-      pt.put("type", reps[ii].type);
-      pt.put("server", reps[ii].server);
-      pt.put("rfn", reps[ii].rfn);
-      pt.put("setname", reps[ii].setname);
-      pt.put("xattrs", reps[ii].serialize());
-      jresp2.push_back(std::make_pair("", pt));
-    }
-    jresp.push_back(std::make_pair("replicas", jresp2));
-
-    return DomeReq::SendSimpleResp(request, 200, jresp);
+      json.beginObject()
+          .field("replicaid", reps[ii].replicaid)
+          .field("fileid", reps[ii].fileid)
+          .field("nbaccesses", reps[ii].nbaccesses)
+          .field("atime", reps[ii].atime)
+          .field("ptime", reps[ii].ptime)
+          .field("ltime", reps[ii].ltime)
+          .field("status", reps[ii].status)
+          .field("type", reps[ii].type)
+          .field("server", reps[ii].server)
+          .field("rfn", reps[ii].rfn)
+          .field("setname", reps[ii].setname)
+          .field("xattrs", reps[ii].serialize())
+          .endObject();
+    }
+    json.endArray().endObject();
+
+    return json.finish();
   }
   catch (DmException e) {
     return DomeReq::SendSimpleResp(request, 500, SSTR("Unable to get replicas. err:" <<
@@ -4304,15 +4602,12 @@ int DomeCore::dome_getuser(DomeReq &req, FCGX_Request &request) {
     DomeUserInfo ui;
 
     // Get the user directly from the internal hashes
-    {
-    boost::unique_lock<boost::recursive_mutex> l(status);
     if (uid >= 0) {
       if (!status.getUser(uid, ui))
         return DomeReq::SendSimpleResp(request, 404, SSTR("Can't find userid " << uid));
     }
     else if (!status.getUser(username, ui))
       return DomeReq::SendSimpleResp(request, 404, SSTR("Can't find username '" << username << "'"));
-    }
 
     jresp.put("username", ui.username);
     jresp.put("userid", ui.userid);
@@ -4684,6 +4979,10 @@ int DomeCore::dome_rename(DomeReq &req, FCGX_Request &request) {
 
     t.Commit();
   }
+  // Now that it is committed, nobody can read the old listings again
+  DOMECACHE->wipeDirListing(oldParent.stat.st_ino);
+  DOMECACHE->wipeDirListing(newParent.stat.st_ino);
+
   // Done!
   return DomeReq::SendSimpleResp(request, 200, "");
 }
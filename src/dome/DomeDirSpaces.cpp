@@ -0,0 +1,190 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+/** @file   DomeDirSpaces.cpp
+ * @brief  Recomputation of the space used by the directories of the namespace
+ */
+
+#include "DomeDirSpaces.h"
+#include <algorithm>
+
+// Marks in depths
+static const int16_t DEPTH_UNKNOWN = -1;
+static const int16_t DEPTH_ORPHAN = -2;
+static const int16_t DEPTH_VISITING = -3;
+static const int16_t DEPTH_MAX = 32000;
+
+
+DomeDirSpaces::DomeDirSpaces(): lastparent(-1) {
+}
+
+int32_t DomeDirSpaces::findDir(int64_t fileid) const {
+  std::vector<int64_t>::const_iterator it = std::lower_bound(dirids.begin(), dirids.end(), fileid);
+  if ((it == dirids.end()) || (*it != fileid))
+    return -1;
+  return it - dirids.begin();
+}
+
+void DomeDirSpaces::add(int64_t fileid, int64_t parent, bool isdir, int64_t size) {
+  if (isdir) {
+    dirids.push_back(fileid);
+    parentids.push_back(parent);
+    stored.push_back(size);
+    sizes.push_back(0);
+    sum.dirs++;
+    return;
+  }
+
+  sum.files++;
+
+  // The files of a directory often come one after the other
+  int32_t p = lastparent;
+  if ((p < 0) || (dirids[p] != parent))
+    p = findDir(parent);
+
+  if (p >= 0) {
+    sizes[p] += size;
+    lastparent = p;
+  }
+  else
+    pending.push_back(std::make_pair(parent, size));
+}
+
+void DomeDirSpaces::compute() {
+  size_t n = dirids.size();
+
+  // The files that came before their parent, typically because they were moved
+  for (size_t i = 0; i < pending.size(); i++) {
+    int32_t p = findDir(pending[i].first);
+    if (p >= 0)
+      sizes[p] += pending[i].second;
+    else
+      sum.orphanfiles++;
+  }
+  std::vector<std::pair<int64_t, int64_t> >().swap(pending);
+
+  // From parent fileids to indexes
+  parents.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    if (parentids[i] == 0)
+      parents[i] = -1;
+    else {
+      int32_t p = findDir(parentids[i]);
+      parents[i] = (p >= 0) ? p : -2;
+    }
+  }
+  std::vector<int64_t>().swap(parentids);
+
+  // Depths, going up until a dir whose depth is known
+  depths.assign(n, DEPTH_UNKNOWN);
+  std::vector<int32_t> chain;
+  for (size_t i = 0; i < n; i++) {
+    if (depths[i] != DEPTH_UNKNOWN) continue;
+
+    chain.clear();
+    int32_t d = i;
+    while ((d >= 0) && (depths[d] == DEPTH_UNKNOWN)) {
+      depths[d] = DEPTH_VISITING;
+      chain.push_back(d);
+      d = parents[d];
+    }
+
+    // d is now the parent of the root, a missing parent, or a dir already seen
+    int base;
+    if (d == -1) base = -1;
+    else if (d < 0) base = DEPTH_ORPHAN;
+    else if (depths[d] < 0) base = DEPTH_ORPHAN; // a loop, or an orphan
+    else base = depths[d];
+
+    for (size_t k = chain.size(); k > 0; k--) {
+      if ((base == DEPTH_ORPHAN) || (base + 1 > DEPTH_MAX)) {
+        base = DEPTH_ORPHAN;
+        depths[chain[k-1]] = DEPTH_ORPHAN;
+        sum.orphandirs++;
+        continue;
+      }
+      depths[chain[k-1]] = ++base;
+      sum.maxdepth = std::max(sum.maxdepth, base);
+    }
+  }
+
+  // Sort the dirs by depth, and list the children of each
+  std::vector<size_t> levelstart(sum.maxdepth + 2, 0);
+  firstchild.assign(n + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    if (depths[i] < 0) continue;
+    levelstart[depths[i] + 1]++;
+    if (parents[i] >= 0) firstchild[parents[i] + 1]++;
+  }
+  for (size_t l = 1; l < levelstart.size(); l++)
+    levelstart[l] += levelstart[l-1];
+  for (size_t i = 1; i <= n; i++)
+    firstchild[i] += firstchild[i-1];
+
+  bydepth.resize(levelstart.back());
+  children.resize(firstchild[n]);
+  std::vector<size_t> nextlevel(levelstart.begin(), levelstart.end() - 1);
+  std::vector<int32_t> nextchild(firstchild.begin(), firstchild.end() - 1);
+  for (size_t i = 0; i < n; i++) {
+    if (depths[i] < 0) continue;
+    bydepth[nextlevel[depths[i]]++] = i;
+    if (parents[i] >= 0) children[nextchild[parents[i]]++] = i;
+  }
+
+  // The deepest first: when a level is summed, the one below is final.
+  // This is bound by memory, more threads were not faster
+  for (int l = sum.maxdepth; l >= 0; l--)
+    sumLevel(levelstart[l], levelstart[l+1]);
+
+  std::vector<int32_t>().swap(bydepth);
+  std::vector<int32_t>().swap(firstchild);
+  std::vector<int32_t>().swap(children);
+}
+
+void DomeDirSpaces::sumLevel(size_t from, size_t to) {
+  for (size_t i = from; i < to; i++) {
+    int32_t d = bydepth[i];
+    int64_t s = sizes[d];
+    for (int32_t c = firstchild[d]; c < firstchild[d+1]; c++)
+      s += sizes[children[c]];
+    sizes[d] = s;
+  }
+}
+
+void DomeDirSpaces::getFixes(int mindepth, int maxdepth, std::vector<Fix> &fixes) const {
+  for (size_t i = 0; i < dirids.size(); i++) {
+    if ((depths[i] < 0) || (depths[i] < mindepth) || (depths[i] > maxdepth) || (sizes[i] == stored[i]))
+      continue;
+
+    Fix f;
+    f.fileid = dirids[i];
+    f.depth = depths[i];
+    f.stored = stored[i];
+    f.computed = sizes[i];
+    fixes.push_back(f);
+  }
+}
+
+bool DomeDirSpaces::getSize(int64_t fileid, int64_t &size) const {
+  int32_t d = findDir(fileid);
+  if ((d < 0) || (depths[d] < 0))
+    return false;
+
+  size = sizes[d];
+  return true;
+}
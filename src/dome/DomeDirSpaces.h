@@ -0,0 +1,104 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMEDIRSPACES_H
+#define DOMEDIRSPACES_H
+
+
+/** @file   DomeDirSpaces.h
+ * @brief  Recomputation of the space used by the directories of the namespace
+ */
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Recomputes from scratch the sizes that addFilesizeToDirs keeps in the
+/// directories, i.e. the sum of the sizes of the files below each of them.
+/// It is fed all the entries of the namespace, in fileid order, and keeps only
+/// the directories, in flat arrays: the files just add their size to their parent.
+/// The sizes are then summed up one depth level at a time, the deepest first.
+class DomeDirSpaces {
+public:
+
+  /// A directory whose stored size is not the computed one
+  struct Fix {
+    int64_t fileid;
+    int depth;
+    int64_t stored;
+    int64_t computed;
+  };
+
+  /// What was found
+  struct Summary {
+    Summary(): dirs(0), files(0), orphandirs(0), orphanfiles(0), maxdepth(0) {}
+
+    long dirs, files;
+    /// Entries whose parents could not be found, or that are in a loop.
+    /// Their sizes are not counted anywhere
+    long orphandirs, orphanfiles;
+    int maxdepth;
+  };
+
+  DomeDirSpaces();
+
+  /// Adds an entry of the namespace. The directories must come in increasing
+  /// fileid order. The root has parent 0
+  void add(int64_t fileid, int64_t parent, bool isdir, int64_t size);
+
+  /// Sums up the sizes
+  void compute();
+
+  /// After compute, gets the directories with depth between mindepth and maxdepth
+  /// whose stored size differs from the computed one. The root has depth 0
+  void getFixes(int mindepth, int maxdepth, std::vector<Fix> &fixes) const;
+
+  /// After compute, gets the size of a directory. Returns false if it is not known
+  bool getSize(int64_t fileid, int64_t &size) const;
+
+  const Summary &summary() const { return sum; }
+
+private:
+  /// Index of a directory, or -1
+  int32_t findDir(int64_t fileid) const;
+
+  /// The parent of dir i, first as a fileid then, after compute, as an index
+  /// -1 is the parent of the root, -2 means the parent is unknown
+  std::vector<int64_t> dirids, parentids;
+  std::vector<int32_t> parents;
+  /// Sizes as stored in the db, and as computed. Before compute, sizes
+  /// holds only the files directly inside
+  std::vector<int64_t> stored, sizes;
+  std::vector<int16_t> depths;
+
+  /// Files whose parent had not been seen yet
+  std::vector<std::pair<int64_t, int64_t> > pending;
+  int32_t lastparent;
+
+  /// Used by compute: the dirs sorted by depth, and the children of each dir,
+  /// those of dir i being children[firstchild[i]] to children[firstchild[i+1]-1]
+  std::vector<int32_t> bydepth, firstchild, children;
+
+  Summary sum;
+
+  /// Adds to the dirs in bydepth[from, to) the sizes of their children
+  void sumLevel(size_t from, size_t to);
+};
+
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/** @file   DomeDirSpacesMain.cpp
+ * @brief  main() function for dome-dirspaces, which recomputes the space used
+ *         by the directories of the namespace and, if asked, fixes it in the db
+ */
+
+#include "DomeLog.h"
+#include "DomeMysql.h"
+#include "DomeDirSpaces.h"
+#include "utils/Config.hh"
+#include <iostream>
+#include <stdlib.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void usage(const char *name) {
+  cerr << "Usage: " << name << " [options] <config file>" << endl;
+  cerr << "  or set the envvar $DOME_CFGFILE" << endl;
+  cerr << "Options:" << endl;
+  cerr << "  --update          write the fixed sizes to the db. Without it, only report them" << endl;
+  cerr << "  --mindepth N      first depth to check, the root being 0 (default 2)" << endl;
+  cerr << "  --maxdepth N      last depth to check (default head.dirspacereportdepth)" << endl;
+  cerr << "  --chunk N         entries read per query (default 100000)" << endl;
+  cerr << "  --batch N         directories updated per transaction (default 1000)" << endl;
+  cerr << "  -v                print every directory to fix" << endl;
+}
+
+int main(int argc, char **argv) {
+  bool update = false, verbose = false;
+  int mindepth = 2, maxdepth = -1;
+  long chunk = 100000, batch = 1000;
+
+  static struct option longopts[] = {
+    {"update",   no_argument,       0, 'u'},
+    {"mindepth", required_argument, 0, 'm'},
+    {"maxdepth", required_argument, 0, 'M'},
+    {"chunk",    required_argument, 0, 'c'},
+    {"batch",    required_argument, 0, 'b'},
+    {"help",     no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int o;
+  while ((o = getopt_long(argc, argv, "vh", longopts, 0)) != -1) {
+    switch (o) {
+      case 'u': update = true; break;
+      case 'm': mindepth = atoi(optarg); break;
+      case 'M': maxdepth = atoi(optarg); break;
+      case 'c': chunk = atol(optarg); break;
+      case 'b': batch = atol(optarg); break;
+      case 'v': verbose = true; break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  std::string cfgfile;
+  if (optind < argc)
+    cfgfile = argv[optind];
+  else {
+    char *c = getenv("DOME_CFGFILE");
+    if (!c) {
+      usage(argv[0]);
+      return -1;
+    }
+    cfgfile = c;
+  }
+
+  if ((chunk <= 0) || (batch <= 0)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  domelogmask = Logger::get()->getMask(domelogname);
+
+  if (CFG->ProcessFile((char *)cfgfile.c_str())) {
+    cerr << "Error processing config file " << cfgfile << endl;
+    return 1;
+  }
+  Logger::get()->setLevel((Logger::Level)CFG->GetLong("glb.debug", 1));
+
+  if (maxdepth < 0)
+    maxdepth = CFG->GetSnapshot()->dirspacereportdepth;
+
+  DomeMySql::configure( CFG->GetString("head.db.host",     (char *)"localhost"),
+                        CFG->GetString("head.db.user",     (char *)"guest"),
+                        CFG->GetString("head.db.password", (char *)"none"),
+                        CFG->GetLong  ("head.db.port",     0),
+                        2 );
+
+  DomeMySql sql;
+  DomeDirSpaces spaces;
+
+  // One pass over the namespace, in fileid order. All the chunks are read in
+  // the same snapshot, so that the stored sizes and the computed ones are about
+  // the same instant, whatever dome changes in the meantime
+  double t0 = now();
+  if (sql.begin(true)) {
+    cerr << "Could not start a consistent snapshot of the namespace" << endl;
+    return 1;
+  }
+
+  std::vector<DomeMySqlEntrySize> entries;
+  int64_t last = -1;
+  long nentries = 0;
+  for (;;) {
+    entries.clear();
+    int n = sql.getEntrySizes(last, chunk, entries);
+    if (n < 0) {
+      cerr << "Could not read the namespace after fileid " << last << endl;
+      sql.rollback();
+      return 1;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+      const DomeMySqlEntrySize &e = entries[i];
+      // Like addFilesizeToDirs, only regular files are counted
+      if (S_ISDIR(e.mode))
+        spaces.add(e.fileid, e.parent, true, e.size);
+      else if (S_ISREG(e.mode))
+        spaces.add(e.fileid, e.parent, false, e.size);
+    }
+
+    nentries += n;
+    if (n < chunk) break;
+    last = entries.back().fileid;
+  }
+
+  // Nothing was written
+  sql.rollback();
+
+  double t1 = now();
+  spaces.compute();
+  double t2 = now();
+
+  std::vector<DomeDirSpaces::Fix> fixes;
+  spaces.getFixes(mindepth, maxdepth, fixes);
+
+  const DomeDirSpaces::Summary &s = spaces.summary();
+  cout << "Entries read: " << nentries << " in " << (t1 - t0) << "s" << endl;
+  cout << "Directories: " << s.dirs << " files: " << s.files << " max depth: " << s.maxdepth << endl;
+  cout << "Orphan directories: " << s.orphandirs << " orphan files: " << s.orphanfiles << endl;
+  cout << "Sizes computed in " << (t2 - t1) << "s" << endl;
+  cout << "Directories to fix, depth " << mindepth << " to " << maxdepth << ": " << fixes.size() << endl;
+
+  if (verbose) {
+    for (size_t i = 0; i < fixes.size(); i++)
+      cout << "  fileid: " << fixes[i].fileid << " depth: " << fixes[i].depth <<
+        " stored: " << fixes[i].stored << " computed: " << fixes[i].computed << endl;
+  }
+
+  if (!update || fixes.empty())
+    return 0;
+
+  // Increments rather than absolute sizes, not to lose the updates that dome
+  // did after the snapshot. Those before it are already in both stored and computed
+  std::vector<std::pair<int64_t, int64_t> > increments;
+  size_t nfixed = 0;
+  for (size_t i = 0; i < fixes.size(); i++) {
+    increments.push_back(std::make_pair(fixes[i].fileid, fixes[i].computed - fixes[i].stored));
+
+    if ((increments.size() >= (size_t)batch) || (i == fixes.size() - 1)) {
+      if (sql.addtoDirectorySizes(increments)) {
+        cerr << "Could not update the directory sizes. Directories fixed: " << nfixed << endl;
+        return 1;
+      }
+      nfixed += increments.size();
+      increments.clear();
+    }
+  }
+
+  cout << "Directories fixed: " << nfixed << " in " << (now() - t2) << "s" << endl;
+  return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/** @file   DomeEvictionIndex.cpp
+ * @brief  Index of the replicas of the volatile filesystems of a disk node, by last use
+ */
+
+#include "DomeEvictionIndex.h"
+#include "DomeLog.h"
+#include "utils/logger.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+
+DomeEvictionIndex::DomeEvictionIndex() {
+}
+
+std::string DomeEvictionIndex::trimSlashes(const std::string &path) {
+  size_t l = path.size();
+  while ((l > 1) && (path[l-1] == '/'))
+    l--;
+  return path.substr(0, l);
+}
+
+std::string DomeEvictionIndex::prefixOf(const std::string &fs, const std::string &pfn) {
+  size_t end = pfn.find('/', fs.size() + 1);
+  if (end == std::string::npos)
+    return fs;
+  return pfn.substr(0, end);
+}
+
+bool DomeEvictionIndex::addFilesystem(const std::string &fs) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  std::string f = trimSlashes(fs);
+  if (filesystems.find(f) != filesystems.end())
+    return false;
+
+  filesystems[f] = false;
+  return true;
+}
+
+bool DomeEvictionIndex::hasFilesystem(const std::string &fs) {
+  boost::unique_lock<boost::mutex> l(*this);
+  return filesystems.find(trimSlashes(fs)) != filesystems.end();
+}
+
+bool DomeEvictionIndex::isScanned(const std::string &fs) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  std::map<std::string, bool>::const_iterator f = filesystems.find(trimSlashes(fs));
+  return (f != filesystems.end()) && f->second;
+}
+
+std::string DomeEvictionIndex::findFilesystem(const std::string &pfn) {
+  for (std::map<std::string, bool>::const_iterator f = filesystems.begin(); f != filesystems.end(); ++f) {
+    const std::string &fs = f->first;
+    if ( (pfn.size() > fs.size()) && (pfn[fs.size()] == '/') && (pfn.compare(0, fs.size(), fs) == 0) )
+      return fs;
+  }
+  return "";
+}
+
+void DomeEvictionIndex::insert(const std::string &prefix, const std::string &pfn, int64_t size, time_t when, bool overwrite) {
+  Prefix &p = prefixes[prefix];
+
+  std::map<std::string, Entry>::iterator e = p.files.find(pfn);
+  if (e != p.files.end()) {
+    if (!overwrite)
+      return;
+
+    p.order.erase(std::make_pair(e->second.lastused, pfn));
+    p.counters.bytes -= e->second.size;
+    p.counters.files--;
+  }
+
+  Entry &entry = p.files[pfn];
+  entry.lastused = when;
+  entry.size = size;
+  p.order.insert(std::make_pair(when, pfn));
+  p.counters.bytes += size;
+  p.counters.files++;
+}
+
+void DomeEvictionIndex::touch(const std::string &pfn, int64_t size, time_t when) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  std::string fs = findFilesystem(pfn);
+  if (fs.empty())
+    return;
+
+  insert(prefixOf(fs, pfn), pfn, size, when, true);
+}
+
+void DomeEvictionIndex::remove(const std::string &pfn) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  std::string fs = findFilesystem(pfn);
+  if (fs.empty())
+    return;
+
+  std::map<std::string, Prefix>::iterator p = prefixes.find(prefixOf(fs, pfn));
+  if (p == prefixes.end())
+    return;
+
+  std::map<std::string, Entry>::iterator e = p->second.files.find(pfn);
+  if (e == p->second.files.end())
+    return;
+
+  p->second.order.erase(std::make_pair(e->second.lastused, pfn));
+  p->second.counters.bytes -= e->second.size;
+  p->second.counters.files--;
+  p->second.files.erase(e);
+}
+
+int64_t DomeEvictionIndex::popOldest(const std::string &prefix, int64_t bytes, unsigned int maxfiles, std::vector<Victim> &victims) {
+  boost::unique_lock<boost::mutex> l(*this);
+  int64_t total = 0;
+
+  std::map<std::string, Prefix>::iterator p = prefixes.find(trimSlashes(prefix));
+  if (p == prefixes.end())
+    return 0;
+
+  LruOrder &order = p->second.order;
+  unsigned int n = 0;
+  while ((total < bytes) && (n < maxfiles) && !order.empty()) {
+    LruOrder::iterator oldest = order.begin();
+    std::map<std::string, Entry>::iterator e = p->second.files.find(oldest->second);
+
+    Victim v;
+    v.pfn = oldest->second;
+    v.size = e->second.size;
+    v.lastused = e->second.lastused;
+    victims.push_back(v);
+    total += v.size;
+    n++;
+
+    p->second.counters.bytes -= v.size;
+    p->second.counters.files--;
+    p->second.counters.evicted++;
+    p->second.files.erase(e);
+    order.erase(oldest);
+  }
+
+  return total;
+}
+
+void DomeEvictionIndex::putBack(const std::vector<Victim> &victims) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  for (size_t i = 0; i < victims.size(); i++) {
+    std::string fs = findFilesystem(victims[i].pfn);
+    if (fs.empty())
+      continue;
+
+    std::string prefix = prefixOf(fs, victims[i].pfn);
+    insert(prefix, victims[i].pfn, victims[i].size, victims[i].lastused, false);
+    prefixes[prefix].counters.evicted--;
+  }
+}
+
+void DomeEvictionIndex::scan(const std::string &fsname) {
+  std::string fs = trimSlashes(fsname);
+  time_t start = time(0);
+  long nfiles = 0;
+
+  Log(Logger::Lvl1, domelogmask, domelogname, "Indexing the files of '" << fs << "' for eviction");
+
+  // No locks while reading the disk. The files are merged at the end of each
+  // folder, without overwriting what puts and pulls told us in the meantime
+  DIR *fsdir = opendir(fs.c_str());
+  if (!fsdir) {
+    Err(domelogname, "Cannot open '" << fs << "' to index it. errno: " << errno);
+    return;
+  }
+
+  struct dirent *vodirent;
+  while ((vodirent = readdir(fsdir))) {
+    std::string voname = vodirent->d_name;
+    if ((voname == ".") || (voname == "..") || (vodirent->d_type != DT_DIR && vodirent->d_type != DT_UNKNOWN))
+      continue;
+
+    std::string prefix = fs + "/" + voname;
+    DIR *vodir = opendir(prefix.c_str());
+    if (!vodir)
+      continue;
+
+    struct dirent *folderent;
+    while ((folderent = readdir(vodir))) {
+      std::string foldername = folderent->d_name;
+      if ((foldername == ".") || (foldername == "..") || (folderent->d_type != DT_DIR && folderent->d_type != DT_UNKNOWN))
+        continue;
+
+      std::string folder = prefix + "/" + foldername;
+      DIR *d = opendir(folder.c_str());
+      if (!d)
+        continue;
+
+      std::vector<std::pair<std::string, Entry> > found;
+      struct dirent *fileent;
+      while ((fileent = readdir(d))) {
+        if (fileent->d_type != DT_REG && fileent->d_type != DT_UNKNOWN)
+          continue;
+
+        std::string pfn = folder + "/" + fileent->d_name;
+        struct stat st;
+        if (lstat(pfn.c_str(), &st) || !S_ISREG(st.st_mode))
+          continue;
+
+        Entry e;
+        e.lastused = (st.st_atime > st.st_mtime) ? st.st_atime : st.st_mtime;
+        e.size = st.st_size;
+        found.push_back(std::make_pair(pfn, e));
+      }
+      closedir(d);
+
+      boost::unique_lock<boost::mutex> l(*this);
+      for (unsigned int i = 0; i < found.size(); i++)
+        insert(prefix, found[i].first, found[i].second.size, found[i].second.lastused, false);
+      nfiles += found.size();
+    }
+    closedir(vodir);
+  }
+  closedir(fsdir);
+
+  {
+    boost::unique_lock<boost::mutex> l(*this);
+    std::map<std::string, bool>::iterator f = filesystems.find(fs);
+    if (f != filesystems.end())
+      f->second = true;
+  }
+
+  Log(Logger::Lvl1, domelogmask, domelogname, "Indexed " << nfiles << " files of '" << fs << "' in " << time(0) - start << "s");
+}
+
+void DomeEvictionIndex::getCounters(std::map<std::string, Counters> &counters) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  counters.clear();
+  for (std::map<std::string, Prefix>::const_iterator p = prefixes.begin(); p != prefixes.end(); ++p)
+    counters[p->first] = p->second.counters;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMEEVICTIONINDEX_H
+#define DOMEEVICTIONINDEX_H
+
+
+/** @file   DomeEvictionIndex.h
+ * @brief  Index of the replicas of the volatile filesystems of a disk node, by last use
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <boost/thread.hpp>
+
+
+/// Least recently used index of the files in some filesystems of a disk node.
+/// Files are grouped by fs+vo prefix, i.e. /data/fs1/dteam, as that is
+/// what makespace frees. It is fed by the puts and the pulls that finish,
+/// and by a scan of the filesystem, done once, that catches what was there before.
+/// Picking the oldest files to evict is then O(log n) per file.
+class DomeEvictionIndex: public boost::mutex {
+public:
+
+  /// A file chosen for eviction
+  struct Victim {
+    std::string pfn;
+    int64_t size;
+    time_t lastused;
+  };
+
+  /// Counters of a fs+vo prefix, as shown by dome_info
+  struct Counters {
+    Counters(): files(0), bytes(0), evicted(0) {}
+
+    /// Files in the index
+    long files;
+    /// Their total size
+    int64_t bytes;
+    /// Files given out for eviction
+    long evicted;
+  };
+
+  DomeEvictionIndex();
+
+  /// Start indexing a filesystem. Returns true if it was not indexed yet,
+  /// in which case the caller should scan it.
+  bool addFilesystem(const std::string &fs);
+
+  /// True if the filesystem is indexed
+  bool hasFilesystem(const std::string &fs);
+
+  /// True if the filesystem is indexed, and its initial scan finished
+  bool isScanned(const std::string &fs);
+
+  /// A file was written, pulled or used. Files outside of the
+  /// indexed filesystems are ignored.
+  void touch(const std::string &pfn, int64_t size, time_t when);
+
+  /// A file is not there anymore
+  void remove(const std::string &pfn);
+
+  /// Take out of the index the least recently used files under the given
+  /// fs+vo prefix, until their size reaches the given amount, maxfiles are taken
+  /// or there are no more. Gives back the total size of the victims.
+  int64_t popOldest(const std::string &prefix, int64_t bytes, unsigned int maxfiles, std::vector<Victim> &victims);
+
+  /// Victims that could not be evicted go back in, with the time they had,
+  /// unless the file was used again meanwhile.
+  void putBack(const std::vector<Victim> &victims);
+
+  /// Walk the filesystem on disk and index the files that are not known yet.
+  /// Can take long, the index is usable meanwhile. Files are expected
+  /// to be in fs/vo/folder/file, as dome_put creates them.
+  void scan(const std::string &fs);
+
+  /// Get a copy of the counters, by fs+vo prefix
+  void getCounters(std::map<std::string, Counters> &counters);
+
+  /// The fs+vo prefix of a pfn, given the filesystem it belongs to
+  static std::string prefixOf(const std::string &fs, const std::string &pfn);
+
+private:
+  struct Entry {
+    time_t lastused;
+    int64_t size;
+  };
+
+  typedef std::set<std::pair<time_t, std::string> > LruOrder;
+
+  struct Prefix {
+    /// The files, by pfn
+    std::map<std::string, Entry> files;
+    /// The same files, least recently used first
+    LruOrder order;
+    Counters counters;
+  };
+
+  /// The indexed filesystem that holds the given pfn, without the trailing slash.
+  /// Empty if none.
+  std::string findFilesystem(const std::string &pfn);
+
+  /// Add or update a file. Must be called with the lock held.
+  void insert(const std::string &prefix, const std::string &pfn, int64_t size, time_t when, bool overwrite);
+
+  static std::string trimSlashes(const std::string &path);
+
+  /// Indexed filesystems, and whether their scan finished
+  std::map<std::string, bool> filesystems;
+  /// Files by fs+vo prefix
+  std::map<std::string, Prefix> prefixes;
+};
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+/** @file   DomeFsScan.cpp
+ * @brief  Consistency check between a filesystem of a disk node and the catalog
+ */
+
+#include "DomeFsScan.h"
+#include "DomeLog.h"
+#include <algorithm>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+
+// From linux/ioprio.h, that is not always installed
+#define DOME_IOPRIO_WHO_PROCESS 1
+
+// What getdents64 gives, not declared by older glibcs
+struct DomeDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+const char *DomeFsScan::Progress::stateName(State s) {
+  switch (s) {
+    case Queued:    return "queued";
+    case Walking:   return "walking";
+    case Comparing: return "comparing";
+    case Done:      return "done";
+    case Failed:    return "failed";
+  }
+  return "unknown";
+}
+
+DomeFsScan::DomeFsScan(const std::string &srv, const std::string &fsname, const Params &p):
+  server(srv), fs(fsname), params(p), cancelled(false), busywalkers(0), ratestart(0), ratecount(0) {
+
+  while ((fs.size() > 1) && (fs[fs.size()-1] == '/'))
+    fs.erase(fs.size() - 1);
+  if (params.nthreads < 1) params.nthreads = 1;
+  if (params.pagesize < 1) params.pagesize = 1;
+}
+
+void DomeFsScan::cancel() {
+  boost::lock_guard<boost::mutex> l(mtx);
+  cancelled = true;
+  dircond.notify_all();
+}
+
+DomeFsScan::Progress DomeFsScan::getProgress() {
+  boost::lock_guard<boost::mutex> l(mtx);
+  return progress;
+}
+
+void DomeFsScan::fail(const std::string &err) {
+  Err(domelogname, "Scan of '" << server << ":" << fs << "' failed: " << err);
+
+  boost::lock_guard<boost::mutex> l(mtx);
+  progress.state = Progress::Failed;
+  progress.err = err;
+  progress.endtime = time(0);
+}
+
+void DomeFsScan::throttle(long nentries) {
+  if (params.maxrate <= 0) return;
+
+  double wait;
+  {
+    boost::lock_guard<boost::mutex> l(ratemtx);
+    ratecount += nentries;
+    wait = (double)ratecount / params.maxrate - (now() - ratestart);
+  }
+
+  if (wait > 0)
+    usleep(wait * 1000000);
+}
+
+void DomeFsScan::walker(std::vector<std::string> *files) {
+  // Linux threads have their own IO priority
+  if (params.ioprio > 0)
+    syscall(SYS_ioprio_set, DOME_IOPRIO_WHO_PROCESS, 0, params.ioprio);
+
+  std::vector<char> buf(65536);
+  std::vector<std::string> newdirs;
+
+  for (;;) {
+    std::string dir;
+    {
+      boost::unique_lock<boost::mutex> l(mtx);
+      // Someone busy may still find more directories
+      while (dirqueue.empty() && (busywalkers > 0) && !cancelled)
+        dircond.wait(l);
+      if (dirqueue.empty() || cancelled) {
+        dircond.notify_all();
+        return;
+      }
+      // Depth first, to keep the queue short
+      dir = dirqueue.back();
+      dirqueue.pop_back();
+      busywalkers++;
+    }
+
+    newdirs.clear();
+    long nfiles = 0;
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+      Err(domelogname, "Cannot open directory '" << dir << "' err: " << errno);
+
+    while (fd >= 0) {
+      long n = syscall(SYS_getdents64, fd, &buf[0], buf.size());
+      if (n <= 0) {
+        if (n < 0) Err(domelogname, "Cannot read directory '" << dir << "' err: " << errno);
+        break;
+      }
+
+      long nentries = 0;
+      for (long off = 0; off < n; nentries++) {
+        DomeDirent64 *e = (DomeDirent64 *)&buf[off];
+        off += e->d_reclen;
+
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+          continue;
+
+        unsigned char type = e->d_type;
+        if (type == DT_UNKNOWN) {
+          // Some filesystems do not fill it
+          struct stat st;
+          if (fstatat(fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW)) continue;
+          type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR)
+          newdirs.push_back(dir + "/" + e->d_name);
+        else if (type == DT_REG) {
+          files->push_back(dir + "/" + e->d_name);
+          nfiles++;
+        }
+      }
+
+      throttle(nentries);
+    }
+    if (fd >= 0) close(fd);
+
+    boost::lock_guard<boost::mutex> l(mtx);
+    dirqueue.insert(dirqueue.end(), newdirs.begin(), newdirs.end());
+    progress.dirs++;
+    progress.files += nfiles;
+    busywalkers--;
+    dircond.notify_all();
+  }
+}
+
+void DomeFsScan::foundDark(const std::string &pfn, std::ostream *report) {
+  // Gone meanwhile, or still being written
+  struct stat st;
+  if (lstat(pfn.c_str(), &st) || (st.st_mtime + params.grace > progress.starttime))
+    return;
+
+  if (report) *report << "dark " << pfn << "\n";
+
+  boost::lock_guard<boost::mutex> l(mtx);
+  progress.darkdata++;
+  if (progress.darkexamples.size() < params.maxexamples)
+    progress.darkexamples.push_back(pfn);
+}
+
+void DomeFsScan::foundLost(const std::string &rfn, const std::string &pfn, std::ostream *report) {
+  // Written after the walk
+  struct stat st;
+  if (!lstat(pfn.c_str(), &st))
+    return;
+
+  if (report) *report << "lost " << rfn << "\n";
+
+  boost::lock_guard<boost::mutex> l(mtx);
+  progress.lost++;
+  if (progress.lostexamples.size() < params.maxexamples)
+    progress.lostexamples.push_back(rfn);
+}
+
+void DomeFsScan::run(ReplicaSource &source) {
+  Log(Logger::Lvl1, domelogmask, domelogname, "Scanning '" << server << ":" << fs << "' threads: " << params.nthreads <<
+    " maxrate: " << params.maxrate);
+
+  {
+    boost::lock_guard<boost::mutex> l(mtx);
+    progress.state = Progress::Walking;
+    progress.starttime = time(0);
+    dirqueue.clear();
+    dirqueue.push_back(fs);
+    busywalkers = 0;
+  }
+  ratestart = now();
+  ratecount = 0;
+
+  // Walk, each thread collecting its files
+  std::vector<std::vector<std::string> > found(params.nthreads);
+  boost::thread_group walkers;
+  for (int i = 0; i < params.nthreads; i++)
+    walkers.create_thread(boost::bind(&DomeFsScan::walker, this, &found[i]));
+  walkers.join_all();
+
+  {
+    boost::lock_guard<boost::mutex> l(mtx);
+    if (cancelled) {
+      progress.state = Progress::Failed;
+      progress.err = "Cancelled";
+      progress.endtime = time(0);
+      return;
+    }
+    progress.state = Progress::Comparing;
+  }
+
+  std::vector<std::string> files;
+  size_t nfiles = 0;
+  for (size_t i = 0; i < found.size(); i++)
+    nfiles += found[i].size();
+  files.reserve(nfiles);
+  for (size_t i = 0; i < found.size(); i++) {
+    files.insert(files.end(), found[i].begin(), found[i].end());
+    std::vector<std::string>().swap(found[i]);
+  }
+  std::sort(files.begin(), files.end());
+
+  std::ofstream reportstream;
+  std::ostream *report = 0;
+  if (!params.reportfile.empty()) {
+    reportstream.open(params.reportfile.c_str(), std::ios::out | std::ios::trunc);
+    if (!reportstream) {
+      fail("Cannot write report file '" + params.reportfile + "'");
+      return;
+    }
+    report = &reportstream;
+  }
+
+  // The replicas of the catalog come in rowid order, which the database can
+  // page through cheaply; they are sorted here instead
+  std::vector<std::string> rfns;
+  int64_t afterrowid = 0;
+  std::string err;
+  for (;;) {
+    size_t before = rfns.size();
+    if (source.getReplicas(server, fs, afterrowid, params.pagesize, rfns, afterrowid, err)) {
+      fail("Cannot get the replicas from the catalog: " + err);
+      return;
+    }
+
+    {
+      boost::lock_guard<boost::mutex> l(mtx);
+      progress.replicas += rfns.size() - before;
+      if (cancelled) {
+        progress.state = Progress::Failed;
+        progress.err = "Cancelled";
+        progress.endtime = time(0);
+        return;
+      }
+    }
+
+    if (rfns.size() - before < params.pagesize)
+      break;
+  }
+  std::sort(rfns.begin(), rfns.end());
+
+  // Merge the files with the replicas of the catalog, both sorted
+  const std::string prefix = server + ":";
+  size_t d = 0;
+  for (size_t i = 0; i < rfns.size(); i++) {
+    const std::string &rfn = rfns[i];
+    std::string pfn = (rfn.compare(0, prefix.size(), prefix) == 0) ? rfn.substr(prefix.size()) : rfn;
+    while ((d < files.size()) && (files[d] < pfn))
+      foundDark(files[d++], report);
+
+    if ((d < files.size()) && (files[d] == pfn))
+      d++;
+    else
+      foundLost(rfn, pfn, report);
+  }
+
+  while (d < files.size())
+    foundDark(files[d++], report);
+
+  boost::lock_guard<boost::mutex> l(mtx);
+  progress.state = Progress::Done;
+  progress.endtime = time(0);
+
+  Log(Logger::Lvl1, domelogmask, domelogname, "Scanned '" << server << ":" << fs << "' dirs: " << progress.dirs <<
+    " files: " << progress.files << " replicas: " << progress.replicas << " darkdata: " << progress.darkdata <<
+    " lost: " << progress.lost << " in " << (progress.endtime - progress.starttime) << "s");
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMEFSSCAN_H
+#define DOMEFSSCAN_H
+
+
+/** @file   DomeFsScan.h
+ * @brief  Consistency check between a filesystem of a disk node and the catalog
+ */
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <boost/thread.hpp>
+
+
+/// Finds the dark data (files on disk that the catalog does not know) and the
+/// lost replicas (replicas in the catalog whose file is not on disk) of a
+/// filesystem of this disk node.
+/// The filesystem is walked by some threads, reading the directories with
+/// getdents64, at a bounded rate. The replicas of the catalog are then read a
+/// page at a time, and both lists are sorted here and merged.
+/// The differences are checked again on disk before being reported, as the
+/// filesystem keeps changing during the scan.
+class DomeFsScan {
+public:
+
+  /// Gives the replicas that the catalog has on the filesystem, in rowid order
+  class ReplicaSource {
+  public:
+    virtual ~ReplicaSource() {}
+    /// Gets up to limit rfns with a rowid greater than afterrowid. lastrowid
+    /// gets the rowid of the last one. Returns 0 if OK
+    virtual int getReplicas(const std::string &server, const std::string &fs, int64_t afterrowid,
+                            unsigned int limit, std::vector<std::string> &rfns, int64_t &lastrowid,
+                            std::string &err) = 0;
+  };
+
+  struct Params {
+    Params(): nthreads(4), maxrate(10000), ioprio(0), pagesize(10000), maxexamples(100), grace(3600) {}
+
+    /// Threads walking the filesystem
+    int nthreads;
+    /// Directory entries read per second, at most. 0 means no limit
+    long maxrate;
+    /// IO priority of the walking threads, as in ioprio_set(2). 0 leaves it as it is
+    int ioprio;
+    /// Replicas asked to the catalog at a time
+    unsigned int pagesize;
+    /// How many differences of each kind are kept in the progress
+    unsigned int maxexamples;
+    /// Files modified less than this many seconds before the scan are not dark data
+    time_t grace;
+    /// If not empty, all the differences are written here, one per line
+    std::string reportfile;
+  };
+
+  struct Progress {
+    enum State {
+      Queued = 0,
+      Walking,
+      Comparing,
+      Done,
+      Failed
+    } state;
+
+    Progress(): state(Queued), starttime(0), endtime(0), dirs(0), files(0),
+      replicas(0), darkdata(0), lost(0) {}
+
+    time_t starttime, endtime;
+    /// What was read on disk
+    long dirs, files;
+    /// Replicas of the catalog compared so far
+    long replicas;
+    long darkdata, lost;
+    /// The first differences found, up to maxexamples. Pfns of dark data, rfns of lost replicas
+    std::vector<std::string> darkexamples, lostexamples;
+    std::string err;
+
+    static const char *stateName(State s);
+  };
+
+  DomeFsScan(const std::string &server, const std::string &fs, const Params &params);
+
+  /// Runs the whole scan. The progress can be read meanwhile
+  void run(ReplicaSource &source);
+
+  /// Stops a running scan as soon as possible
+  void cancel();
+
+  Progress getProgress();
+
+  const std::string &getFs() const { return fs; }
+
+private:
+  /// The walking threads
+  void walker(std::vector<std::string> *files);
+  /// Wait if more than maxrate entries per second were read
+  void throttle(long nentries);
+  /// A difference, if it is still there on disk
+  void foundDark(const std::string &pfn, std::ostream *report);
+  void foundLost(const std::string &rfn, const std::string &pfn, std::ostream *report);
+  void fail(const std::string &err);
+
+  std::string server, fs;
+  Params params;
+
+  boost::mutex mtx;
+  Progress progress;
+  bool cancelled;
+
+  /// Directories still to read, and how many threads are reading one
+  std::deque<std::string> dirqueue;
+  int busywalkers;
+  boost::condition_variable dircond;
+
+  /// For the rate limit
+  boost::mutex ratemtx;
+  double ratestart;
+  long ratecount;
+};
+
+
+#endif
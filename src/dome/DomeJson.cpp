@@ -0,0 +1,502 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/** @file   DomeJson.cpp
+ * @brief  Fast JSON reading and writing for the requests and the responses of dome
+ */
+
+#include "DomeJson.h"
+#include "DomeLog.h"
+#include "utils/logger.h"
+
+#include <string.h>
+#include <sstream>
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+
+namespace {
+
+/// Deeper documents are refused, to keep the recursion bounded
+const int kMaxDepth = 128;
+
+/// The writer sends to the request in chunks of about this size
+const size_t kFlushSize = 64 * 1024;
+
+class JsonParser {
+public:
+  JsonParser(const char *data, size_t len): begin(data), p(data), end(data + len) {}
+
+  bool document(boost::property_tree::ptree &tree) {
+    skipWs();
+    if (p == end)
+      return true;
+    if (!value(tree, 0))
+      return false;
+    skipWs();
+    if (p != end)
+      return fail("Unexpected characters after the document");
+    return true;
+  }
+
+  std::string err;
+
+private:
+  const char *begin, *p, *end;
+
+  bool fail(const char *what) {
+    err = SSTR(what << " at offset " << (p - begin));
+    return false;
+  }
+
+  void skipWs() {
+    while ((p < end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t')))
+      p++;
+  }
+
+  bool value(boost::property_tree::ptree &t, int depth) {
+    if (p == end)
+      return fail("Unexpected end of the document");
+
+    switch (*p) {
+      case '{': return object(t, depth + 1);
+      case '[': return array(t, depth + 1);
+      case '"': return string(t.data());
+      case 't': return literal("true", t.data());
+      case 'f': return literal("false", t.data());
+      case 'n': return literal("null", t.data());
+      default:  return number(t.data());
+    }
+  }
+
+  bool object(boost::property_tree::ptree &t, int depth) {
+    if (depth > kMaxDepth)
+      return fail("Document too deep");
+    p++;
+    skipWs();
+    if ((p < end) && (*p == '}')) {
+      p++;
+      return true;
+    }
+
+    std::string key;
+    while (true) {
+      skipWs();
+      if ((p == end) || (*p != '"'))
+        return fail("Expected a member name");
+      key.clear();
+      if (!string(key))
+        return false;
+      skipWs();
+      if ((p == end) || (*p != ':'))
+        return fail("Expected ':'");
+      p++;
+      skipWs();
+
+      boost::property_tree::ptree &child = t.push_back(std::make_pair(key, boost::property_tree::ptree()))->second;
+      if (!value(child, depth))
+        return false;
+
+      skipWs();
+      if (p == end)
+        return fail("Unterminated object");
+      if (*p == '}') {
+        p++;
+        return true;
+      }
+      if (*p != ',')
+        return fail("Expected ',' or '}'");
+      p++;
+    }
+  }
+
+  bool array(boost::property_tree::ptree &t, int depth) {
+    if (depth > kMaxDepth)
+      return fail("Document too deep");
+    p++;
+    skipWs();
+    if ((p < end) && (*p == ']')) {
+      p++;
+      return true;
+    }
+
+    while (true) {
+      skipWs();
+      boost::property_tree::ptree &child = t.push_back(std::make_pair(std::string(), boost::property_tree::ptree()))->second;
+      if (!value(child, depth))
+        return false;
+
+      skipWs();
+      if (p == end)
+        return fail("Unterminated array");
+      if (*p == ']') {
+        p++;
+        return true;
+      }
+      if (*p != ',')
+        return fail("Expected ',' or ']'");
+      p++;
+    }
+  }
+
+  bool literal(const char *word, std::string &s) {
+    size_t l = strlen(word);
+    if (((size_t)(end - p) < l) || strncmp(p, word, l))
+      return fail("Invalid value");
+    s.assign(p, l);
+    p += l;
+    return true;
+  }
+
+  bool digits() {
+    const char *start = p;
+    while ((p < end) && (*p >= '0') && (*p <= '9'))
+      p++;
+    return p > start;
+  }
+
+  bool number(std::string &s) {
+    const char *start = p;
+    if ((p < end) && (*p == '-'))
+      p++;
+    if ((p < end) && (*p == '0'))
+      p++;
+    else if (!digits())
+      return fail("Invalid value");
+
+    if ((p < end) && (*p == '.')) {
+      p++;
+      if (!digits())
+        return fail("Invalid number");
+    }
+    if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+      p++;
+      if ((p < end) && ((*p == '+') || (*p == '-')))
+        p++;
+      if (!digits())
+        return fail("Invalid number");
+    }
+
+    s.assign(start, p - start);
+    return true;
+  }
+
+  bool hex4(unsigned int &cp) {
+    if (end - p < 4)
+      return fail("Truncated \\u escape");
+    cp = 0;
+    for (int i = 0; i < 4; i++, p++) {
+      cp <<= 4;
+      if ((*p >= '0') && (*p <= '9')) cp |= *p - '0';
+      else if ((*p >= 'a') && (*p <= 'f')) cp |= *p - 'a' + 10;
+      else if ((*p >= 'A') && (*p <= 'F')) cp |= *p - 'A' + 10;
+      else return fail("Invalid \\u escape");
+    }
+    return true;
+  }
+
+  static void utf8(unsigned int cp, std::string &s) {
+    if (cp < 0x80)
+      s += (char)cp;
+    else if (cp < 0x800) {
+      s += (char)(0xC0 | (cp >> 6));
+      s += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+      s += (char)(0xE0 | (cp >> 12));
+      s += (char)(0x80 | ((cp >> 6) & 0x3F));
+      s += (char)(0x80 | (cp & 0x3F));
+    }
+    else {
+      s += (char)(0xF0 | (cp >> 18));
+      s += (char)(0x80 | ((cp >> 12) & 0x3F));
+      s += (char)(0x80 | ((cp >> 6) & 0x3F));
+      s += (char)(0x80 | (cp & 0x3F));
+    }
+  }
+
+  bool string(std::string &s) {
+    p++;
+    while (true) {
+      // Copy the plain characters in one go
+      const char *run = p;
+      while ((p < end) && (*p != '"') && (*p != '\\') && ((unsigned char)*p >= 0x20))
+        p++;
+      s.append(run, p - run);
+
+      if (p == end)
+        return fail("Unterminated string");
+      if (*p == '"') {
+        p++;
+        return true;
+      }
+      if (*p != '\\')
+        return fail("Control character in string");
+
+      p++;
+      if (p == end)
+        return fail("Unterminated string");
+      switch (*p++) {
+        case '"':  s += '"'; break;
+        case '\\': s += '\\'; break;
+        case '/':  s += '/'; break;
+        case 'b':  s += '\b'; break;
+        case 'f':  s += '\f'; break;
+        case 'n':  s += '\n'; break;
+        case 'r':  s += '\r'; break;
+        case 't':  s += '\t'; break;
+        case 'u': {
+          unsigned int cp;
+          if (!hex4(cp))
+            return false;
+          if ((cp >= 0xDC00) && (cp <= 0xDFFF))
+            return fail("Unpaired surrogate");
+          if ((cp >= 0xD800) && (cp <= 0xDBFF)) {
+            unsigned int lo;
+            if ((end - p < 2) || (p[0] != '\\') || (p[1] != 'u'))
+              return fail("Unpaired surrogate");
+            p += 2;
+            if (!hex4(lo))
+              return false;
+            if ((lo < 0xDC00) || (lo > 0xDFFF))
+              return fail("Unpaired surrogate");
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          }
+          utf8(cp, s);
+          break;
+        }
+        default:
+          p--;
+          return fail("Invalid escape");
+      }
+    }
+  }
+};
+
+}
+
+
+int DomeJsonReader::parse(const char *data, size_t len, boost::property_tree::ptree &tree, std::string &err) {
+  JsonParser parser(data, len);
+  if (!parser.document(tree)) {
+    err = parser.err;
+    return -1;
+  }
+  return 0;
+}
+
+
+
+DomeJsonWriter::DomeJsonWriter(): request(0), httpcode(0), first(true), sent(0), rc(1) {
+}
+
+DomeJsonWriter::DomeJsonWriter(FCGX_Request &request, int httpcode):
+  request(&request), httpcode(httpcode), first(true), sent(0), rc(1) {
+  buf.reserve(kFlushSize + 4096);
+  buf = SSTR("Status: " << httpcode << "\r\n" << "Content-type: text\r\n\r\n");
+}
+
+void DomeJsonWriter::key(const char *name) {
+  if (!first)
+    buf += ',';
+  first = false;
+  if (name) {
+    putString(name, strlen(name));
+    buf += ':';
+  }
+}
+
+void DomeJsonWriter::putString(const char *s, size_t len) {
+  static const char hex[] = "0123456789ABCDEF";
+
+  buf += '"';
+  const char *run = s;
+  for (const char *c = s; c < s + len; c++) {
+    unsigned char ch = *c;
+    if ((ch >= 0x20) && (ch != '"') && (ch != '\\'))
+      continue;
+
+    buf.append(run, c - run);
+    run = c + 1;
+    switch (ch) {
+      case '"':  buf += "\\\""; break;
+      case '\\': buf += "\\\\"; break;
+      case '\b': buf += "\\b"; break;
+      case '\f': buf += "\\f"; break;
+      case '\n': buf += "\\n"; break;
+      case '\r': buf += "\\r"; break;
+      case '\t': buf += "\\t"; break;
+      default:
+        buf += "\\u00";
+        buf += hex[ch >> 4];
+        buf += hex[ch & 0xF];
+    }
+  }
+  buf.append(run, s + len - run);
+  buf += '"';
+}
+
+void DomeJsonWriter::putUnsigned(unsigned long long value) {
+  char tmp[24];
+  char *d = tmp + sizeof(tmp);
+  *--d = '"';
+  do {
+    *--d = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+  *--d = '"';
+  buf.append(d, tmp + sizeof(tmp) - d);
+}
+
+void DomeJsonWriter::putSigned(long long value) {
+  if (value >= 0)
+    return putUnsigned(value);
+
+  char tmp[24];
+  char *d = tmp + sizeof(tmp);
+  unsigned long long v = -(unsigned long long)value;
+  *--d = '"';
+  do {
+    *--d = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  *--d = '-';
+  *--d = '"';
+  buf.append(d, tmp + sizeof(tmp) - d);
+}
+
+void DomeJsonWriter::flush(bool force) {
+  if (!request || buf.empty())
+    return;
+  if (!force && (buf.size() < kFlushSize))
+    return;
+
+  // After a failure the rest of the response is dropped
+  if (rc > 0) {
+    int n = FCGX_PutStr(buf.data(), buf.size(), request->out);
+    if (n < (int)buf.size())
+      rc = (n < 0) ? n : 0;
+    else
+      sent += n;
+  }
+  buf.clear();
+}
+
+DomeJsonWriter &DomeJsonWriter::beginObject(const char *name) {
+  key(name);
+  buf += '{';
+  first = true;
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::endObject() {
+  buf += '}';
+  first = false;
+  flush(false);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::beginArray(const char *name) {
+  key(name);
+  buf += '[';
+  first = true;
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::endArray() {
+  buf += ']';
+  first = false;
+  flush(false);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, const std::string &value) {
+  key(name);
+  putString(value.data(), value.size());
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, const char *value) {
+  key(name);
+  putString(value, strlen(value));
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, char value) {
+  key(name);
+  putString(&value, 1);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, bool value) {
+  key(name);
+  buf += value ? "\"true\"" : "\"false\"";
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, int value) {
+  key(name);
+  putSigned(value);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, unsigned int value) {
+  key(name);
+  putUnsigned(value);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, long value) {
+  key(name);
+  putSigned(value);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, unsigned long value) {
+  key(name);
+  putUnsigned(value);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, long long value) {
+  key(name);
+  putSigned(value);
+  return *this;
+}
+
+DomeJsonWriter &DomeJsonWriter::field(const char *name, unsigned long long value) {
+  key(name);
+  putUnsigned(value);
+  return *this;
+}
+
+int DomeJsonWriter::finish(const char *logwhereiam) {
+  if (!request)
+    return 1;
+
+  flush(true);
+
+  std::string where = logwhereiam ? logwhereiam : domelogname;
+  if (rc <= 0) {
+    Err(where, "Could not send the response. code: " << httpcode << " bytes sent: " << sent);
+    return rc;
+  }
+
+  Log(Logger::Lvl1, domelogmask, where, "Exiting: code: " << httpcode << " bytes: " << sent);
+  return 1;
+}
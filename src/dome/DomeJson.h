@@ -0,0 +1,102 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMEJSON_H
+#define DOMEJSON_H
+
+
+/** @file   DomeJson.h
+ * @brief  Fast JSON reading and writing for the requests and the responses of dome
+ */
+
+#include <string>
+#include <boost/property_tree/ptree.hpp>
+#include <fcgiapp.h>
+
+
+/// Reads a JSON document into a ptree, giving the same tree as
+/// boost::property_tree::read_json: values are kept as strings, array items
+/// are children with an empty key. It is a single pass over the buffer,
+/// without the stream and the generic parser of read_json.
+class DomeJsonReader {
+public:
+  /// Parses len bytes of data into tree. A document made only of
+  /// whitespace gives an empty tree.
+  /// Returns 0 if OK, otherwise -1 with a description of the problem in err
+  static int parse(const char *data, size_t len, boost::property_tree::ptree &tree, std::string &err);
+};
+
+
+/// Writes a JSON document field by field, without building a tree first.
+/// It can write into a string, or directly into the output stream of a FastCGI
+/// request, in which case the HTTP headers are sent first and the body goes out
+/// in chunks while it is built. The values are written as strings, like
+/// write_json does, so that the clients that read them with ptrees see no difference.
+class DomeJsonWriter {
+public:
+  /// Writes into a string, see str()
+  DomeJsonWriter();
+
+  /// Writes the response to the given request, with the given http code
+  DomeJsonWriter(FCGX_Request &request, int httpcode);
+
+  /// Start/end an object or an array. The name is needed only inside an object
+  DomeJsonWriter &beginObject(const char *name = 0);
+  DomeJsonWriter &endObject();
+  DomeJsonWriter &beginArray(const char *name = 0);
+  DomeJsonWriter &endArray();
+
+  /// Add a field to the current object
+  DomeJsonWriter &field(const char *name, const std::string &value);
+  DomeJsonWriter &field(const char *name, const char *value);
+  DomeJsonWriter &field(const char *name, char value);
+  DomeJsonWriter &field(const char *name, bool value);
+  DomeJsonWriter &field(const char *name, int value);
+  DomeJsonWriter &field(const char *name, unsigned int value);
+  DomeJsonWriter &field(const char *name, long value);
+  DomeJsonWriter &field(const char *name, unsigned long value);
+  DomeJsonWriter &field(const char *name, long long value);
+  DomeJsonWriter &field(const char *name, unsigned long long value);
+
+  /// Sends what is still buffered, if writing to a request.
+  /// Returns <= 0 if error, like DomeReq::SendSimpleResp
+  int finish(const char *logwhereiam = 0);
+
+  /// The document, if writing into a string
+  const std::string &str() const { return buf; }
+
+private:
+  /// Separator and name that come before a value
+  void key(const char *name);
+  void putString(const char *s, size_t len);
+  void putSigned(long long value);
+  void putUnsigned(unsigned long long value);
+  /// Push the buffer to the request, if it is big enough or if forced
+  void flush(bool force);
+
+  std::string buf;
+  FCGX_Request *request;
+  int httpcode;
+  /// No value was written yet in the current object or array
+  bool first;
+  /// Body bytes already sent to the request
+  size_t sent;
+  /// A write to the request failed
+  int rc;
+};
+
+#endif
@@ -26,8 +26,16 @@
 
 #include "DomeMetadataCache.hh"
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sys/time.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/thread_time.hpp>
+#include <boost/bind.hpp>
 #include "DomeMysql.h"
 #include "status.h"
 
@@ -53,7 +61,7 @@ DomeFileInfo::DomeFileInfo(DomeFileID file_id) {
   lastupdtime = t;
   lastupdreqtime = t;
   lastreftime = t;
-  
+  validuntil = 0;
   
 
 }
@@ -71,7 +79,7 @@ DomeFileInfo::DomeFileInfo(DomeFileID parentfid, std::string name) {
   lastupdtime = t;
   lastupdreqtime = t;
   lastreftime = t;
-  
+  validuntil = 0;
   
   
 }
@@ -86,8 +94,10 @@ void DomeFileInfo::setToNoInfo() {
   
   boost::unique_lock<mutex> l2(*this);
   statinfo = dmlite::ExtendedStat();
+  compiledacl = dmlite::CompiledAcl();
   
   status_statinfo = NoInfo;
+  validuntil = 0;
   
   replicas.clear();
   status_locations = NoInfo;
@@ -100,7 +110,7 @@ void DomeFileInfo::takeStat(const dmlite::ExtendedStat &st) {
   
   boost::unique_lock<mutex> l2(*this);
   
-  statinfo = st; 
+  setStat(st);
   
   status_statinfo = DomeFileInfo::Ok;
   
@@ -108,6 +118,13 @@ void DomeFileInfo::takeStat(const dmlite::ExtendedStat &st) {
 }
 
 
+void DomeFileInfo::setStat(const dmlite::ExtendedStat &st) {
+  statinfo = st;
+  compiledacl.compile(st.acl);
+  validuntil = 0;
+}
+
+
 void DomeFileInfo::addReplica( const dmlite::Replica & replica ) {
   const char *fname = "DomeFileInfo::addReplica";
   Log(Logger::Lvl4, domelogmask, fname, "Adding replica '" << replica.rfn << "' to fileid " << fileid);
@@ -589,6 +606,7 @@ boost::shared_ptr <DomeFileInfo > DomeMetadataCache::getFileInfoOrCreateNewOne(D
       // Create a new empty item
       fi.reset( new DomeFileInfo(fileid) );
       hit = false;
+      nmisses++;
       // To disable the cache, set maxitems to 0
       if (maxitems > 0) {
         databyfileid[fileid] = boost::shared_ptr <DomeFileInfo >(fi);
@@ -602,6 +620,7 @@ boost::shared_ptr <DomeFileInfo > DomeMetadataCache::getFileInfoOrCreateNewOne(D
       lrudata.insert(lrudataitem(++lrutick, fileid));
       fi = p->second;
       fi->touch();
+      checkHit(*fi);
     }
   }
   
@@ -659,6 +678,7 @@ boost::shared_ptr<DomeFileInfo> DomeMetadataCache::getFileInfoOrCreateNewOne(Dom
       // Create a new item
       fi.reset( new DomeFileInfo(parentfileid, name) );
       hit = false;
+      nmisses++;
       
       // To disable the cache, set maxitems to 0
       if (maxitems > 0) {
@@ -673,6 +693,7 @@ boost::shared_ptr<DomeFileInfo> DomeMetadataCache::getFileInfoOrCreateNewOne(Dom
       lrudata_parent.insert(lrudataitem_parent(++lrutick, k));
       fi = p->second;     
       fi->touch();
+      checkHit(*fi);
     }
   }
   
@@ -695,21 +716,340 @@ void DomeMetadataCache::tick() {
   const char *fname = "DomeMetadataCache::tick";
   Log(Logger::Lvl4, domelogmask, fname, "tick...");
   
+  time_t now = time(0);
+  bool dopersist = false;
+  
+  {
+    boost::lock_guard<DomeMetadataCache> l(*this);
+    
+    purgeExpired();
+    
+    // If we reached the max number of items, delete as much as we can
+    while (databyfileid.size() > maxitems) {
+      if (purgeLRUitem_fileid()) break;
+    }
+    while (databyparent.size() > maxitems) {
+      if (purgeLRUitem_parent()) break;
+    }
+    
+    Log(Logger::Lvl4, domelogmask, fname, "Cache status by fileid. nItems:" << databyfileid.size() << " nLRUItems: " << lrudata.size());
+    Log(Logger::Lvl4, domelogmask, fname, "Cache status by parentid+name. nItems:" << databyparent.size() << " nLRUItems: " << lrudata_parent.size());
+    
+    purgeExpiredDirListings();
+    Log(Logger::Lvl4, domelogmask, fname, "Cache status of dir listings. nItems:" << dirlistings.size() << " nPending: " << dirlistingspending.size());
+    
+    // Tell how the warm start is going, until the reloaded entries are all expired
+    if (warmstatsuntil) {
+      unsigned long n = nhits + nmisses;
+      if (now > warmstatsuntil) {
+        Log(Logger::Lvl1, domelogmask, fname, "Warm-up finished. hits: " << nhits << " misses: " << nmisses <<
+          " hit rate: " << (n ? (100 * nhits / n) : 0) << "% hits on reloaded entries: " << nwarmhits);
+        warmstatsuntil = 0;
+      }
+      else
+        Log(Logger::Lvl2, domelogmask, fname, "Warm-up hits: " << nhits << " misses: " << nmisses <<
+          " hit rate: " << (n ? (100 * nhits / n) : 0) << "% hits on reloaded entries: " << nwarmhits);
+    }
+    
+    if (!persistfile.empty() && persistinterval && !warming && (now - lastpersisttime >= persistinterval)) {
+      lastpersisttime = now;
+      dopersist = true;
+    }
+  }
+  
+  // Out of the lock, the requests can go on meanwhile
+  if (dopersist)
+    persist();
+}
+
+
+void DomeMetadataCache::checkHit(DomeFileInfo &fi) {
+  nhits++;
+  
+  boost::unique_lock<boost::mutex> l(fi);
+  if (!fi.validuntil)
+    return;
+  
+  if (fi.validuntil >= time(0)) {
+    nwarmhits++;
+    return;
+  }
+  
+  // Reloaded and not refreshed in time, the db has the last word
+  Log(Logger::Lvl4, domelogmask, "DomeMetadataCache::checkHit", "Revalidating reloaded fileid: " << fi.fileid);
+  if (fi.status_statinfo == DomeFileInfo::Ok)
+    fi.status_statinfo = DomeFileInfo::NoInfo;
+  fi.validuntil = 0;
+}
+
+
+int DomeMetadataCache::pushWarmInfo(const dmlite::ExtendedStat &xstat, time_t validuntil) {
+  DomeFileInfoParent k;
+  k.name = xstat.name;
+  k.parentfileid = xstat.parent;
+  
   boost::lock_guard<DomeMetadataCache> l(*this);
   
-  purgeExpired();
+  // What is there already is fresher
+  if ((databyfileid.find(xstat.stat.st_ino) != databyfileid.end()) ||
+      (databyparent.find(k) != databyparent.end()))
+    return 1;
+  
+  if ((databyfileid.size() >= maxitems) || (databyparent.size() >= maxitems))
+    return 2;
+  
+  boost::shared_ptr<DomeFileInfo> fi(new DomeFileInfo(xstat.stat.st_ino));
+  fi->parentfileid = xstat.parent;
+  fi->locfilename = xstat.name;
+  fi->setStat(xstat);
+  fi->status_statinfo = DomeFileInfo::Ok;
+  fi->validuntil = validuntil;
+  
+  databyfileid[xstat.stat.st_ino] = fi;
+  lrudata.insert(lrudataitem(++lrutick, xstat.stat.st_ino));
+  databyparent[k] = fi;
+  lrudata_parent.insert(lrudataitem_parent(++lrutick, k));
+  
+  return 0;
+}
+
+
+// The persistence file is local and private to this host, hence the integers
+// are written in the host byte order:
+//   magic, number of entries, then per entry
+//   fileid parent mode nlink uid gid size atime mtime ctime status
+//   name guid csumtype csumvalue acl xattrs
+static const char mdcachemagic[8] = { 'D', 'O', 'M', 'E', 'M', 'D', 'C', '1' };
+
+static void putInt(std::ostream &out, int64_t v) {
+  out.write((const char *)&v, sizeof(v));
+}
+
+static void putString(std::ostream &out, const std::string &s) {
+  putInt(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+static bool getInt(std::istream &in, int64_t &v) {
+  return !in.read((char *)&v, sizeof(v)).fail();
+}
+
+static bool getString(std::istream &in, std::string &s) {
+  int64_t n;
+  if (!getInt(in, n) || (n < 0) || (n > 1048576))
+    return false;
+  s.resize(n);
+  return (n == 0) || !in.read(&s[0], n).fail();
+}
+
+static double nowfrac() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+long DomeMetadataCache::save(const std::string &path, unsigned long maxentries) {
+  const char *fname = "DomeMetadataCache::save";
+  double t0 = nowfrac();
+  
+  // Take the references quickly, sort them out of the lock
+  typedef std::pair<time_t, boost::shared_ptr<DomeFileInfo> > RefItem;
+  std::vector<RefItem> items;
+  {
+    boost::lock_guard<DomeMetadataCache> l(*this);
+    items.reserve(databyfileid.size());
+    for (std::map< DomeFileID, boost::shared_ptr<DomeFileInfo> >::iterator i = databyfileid.begin();
+         i != databyfileid.end(); i++) {
+      if (i->second)
+        items.push_back(RefItem(i->second->lastreftime, i->second));
+    }
+  }
+  
+  if (items.size() > maxentries) {
+    std::partial_sort(items.begin(), items.begin() + maxentries, items.end(), std::greater<RefItem>());
+    items.resize(maxentries);
+  }
   
-  // If we reached the max number of items, delete as much as we can
-  while (databyfileid.size() > maxitems) {
-    if (purgeLRUitem_fileid()) break;
+  std::string tmppath = path + ".tmp";
+  std::ofstream out(tmppath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out) {
+    Err(fname, "Cannot write '" << tmppath << "'");
+    return -1;
   }
-  while (databyparent.size() > maxitems) {
-    if (purgeLRUitem_parent()) break;
+  
+  out.write(mdcachemagic, sizeof(mdcachemagic));
+  putInt(out, 0);
+  
+  int64_t n = 0;
+  dmlite::ExtendedStat st;
+  for (size_t i = 0; i < items.size(); i++) {
+    {
+      boost::unique_lock<boost::mutex> l(*items[i].second);
+      if (items[i].second->status_statinfo != DomeFileInfo::Ok)
+        continue;
+      st = items[i].second->statinfo;
+    }
+    
+    putInt(out, st.stat.st_ino);
+    putInt(out, st.parent);
+    putInt(out, st.stat.st_mode);
+    putInt(out, st.stat.st_nlink);
+    putInt(out, st.stat.st_uid);
+    putInt(out, st.stat.st_gid);
+    putInt(out, st.stat.st_size);
+    putInt(out, st.stat.st_atime);
+    putInt(out, st.stat.st_mtime);
+    putInt(out, st.stat.st_ctime);
+    putInt(out, st.status);
+    putString(out, st.name);
+    putString(out, st.guid);
+    putString(out, st.csumtype);
+    putString(out, st.csumvalue);
+    putString(out, st.acl.serialize());
+    putString(out, st.serialize());
+    n++;
   }
   
-  Log(Logger::Lvl4, domelogmask, fname, "Cache status by fileid. nItems:" << databyfileid.size() << " nLRUItems: " << lrudata.size());
-  Log(Logger::Lvl4, domelogmask, fname, "Cache status by parentid+name. nItems:" << databyparent.size() << " nLRUItems: " << lrudata_parent.size());
+  out.seekp(sizeof(mdcachemagic));
+  putInt(out, n);
+  out.close();
+  
+  if (out.fail() || rename(tmppath.c_str(), path.c_str())) {
+    Err(fname, "Cannot write '" << path << "'");
+    unlink(tmppath.c_str());
+    return -1;
+  }
   
+  Log(Logger::Lvl1, domelogmask, fname, "Saved " << n << " entries to '" << path << "' in " << (nowfrac() - t0) << "s");
+  return n;
+}
+
+
+long DomeMetadataCache::load(const std::string &path) {
+  const char *fname = "DomeMetadataCache::load";
+  double t0 = nowfrac();
+  
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    Log(Logger::Lvl1, domelogmask, fname, "Nothing to reload from '" << path << "'");
+    return -1;
+  }
+  
+  char magic[sizeof(mdcachemagic)];
+  int64_t count;
+  if (in.read(magic, sizeof(magic)).fail() || memcmp(magic, mdcachemagic, sizeof(magic)) || !getInt(in, count)) {
+    Err(fname, "'" << path << "' is not a cache persistence file");
+    return -1;
+  }
+  
+  Log(Logger::Lvl1, domelogmask, fname, "Reloading " << count << " entries from '" << path << "'");
+  
+  long loaded = 0, skipped = 0;
+  int64_t i;
+  for (i = 0; i < count; i++) {
+    int64_t fileid, parent, mode, nlink, uid, gid, size, atime, mtime, ctime, status;
+    std::string acl, xattrs;
+    dmlite::ExtendedStat st;
+    
+    if (!getInt(in, fileid) || !getInt(in, parent) || !getInt(in, mode) || !getInt(in, nlink) ||
+        !getInt(in, uid) || !getInt(in, gid) || !getInt(in, size) || !getInt(in, atime) ||
+        !getInt(in, mtime) || !getInt(in, ctime) || !getInt(in, status) ||
+        !getString(in, st.name) || !getString(in, st.guid) || !getString(in, st.csumtype) ||
+        !getString(in, st.csumvalue) || !getString(in, acl) || !getString(in, xattrs)) {
+      Err(fname, "'" << path << "' is truncated after " << i << " entries");
+      break;
+    }
+    
+    memset(&st.stat, 0, sizeof(st.stat));
+    st.stat.st_ino = fileid;
+    st.stat.st_mode = mode;
+    st.stat.st_nlink = nlink;
+    st.stat.st_uid = uid;
+    st.stat.st_gid = gid;
+    st.stat.st_size = size;
+    st.stat.st_atime = atime;
+    st.stat.st_mtime = mtime;
+    st.stat.st_ctime = ctime;
+    st.parent = parent;
+    st.status = static_cast<dmlite::ExtendedStat::FileStatus>(status);
+    st.acl = dmlite::Acl(acl);
+    try {
+      st.deserialize(xattrs);
+    }
+    catch (dmlite::DmException &e) {
+      skipped++;
+      continue;
+    }
+    
+    // Spread the expirations, so that the db sees the revalidations
+    // a bit at a time
+    int r = pushWarmInfo(st, time(0) + revalidatettl + (fileid % revalidatettl));
+    if (r == 2) {
+      Log(Logger::Lvl1, domelogmask, fname, "The cache is full, stopping the reload");
+      break;
+    }
+    if (r) skipped++;
+    else loaded++;
+    
+    if ((i + 1) % 100000 == 0)
+      Log(Logger::Lvl1, domelogmask, fname, "Reloaded " << loaded << " of " << count << " entries");
+  }
+  
+  Log(Logger::Lvl1, domelogmask, fname, "Reloaded " << loaded << " entries, skipped " << skipped <<
+      " in " << (nowfrac() - t0) << "s");
+  return loaded;
+}
+
+
+void DomeMetadataCache::warmup(std::string path) {
+  long n = load(path);
+  
+  boost::lock_guard<DomeMetadataCache> l(*this);
+  warming = false;
+  lastpersisttime = time(0);
+  // Count the hits for as long as the reloaded entries are around
+  if (n > 0) {
+    nhits = nmisses = nwarmhits = 0;
+    warmstatsuntil = time(0) + 2 * revalidatettl;
+  }
+}
+
+
+void DomeMetadataCache::startWarmup() {
+  {
+    boost::lock_guard<DomeMetadataCache> l(*this);
+    if (persistfile.empty() || warming)
+      return;
+    
+    warming = true;
+  }
+  
+  try {
+    boost::thread t(boost::bind(&DomeMetadataCache::warmup, this, persistfile));
+    t.detach();
+  }
+  catch (...) {
+    Err("DomeMetadataCache::startWarmup", "Cannot start the warm-up thread");
+    boost::lock_guard<DomeMetadataCache> l(*this);
+    warming = false;
+  }
+}
+
+
+void DomeMetadataCache::persist() {
+  std::string path;
+  unsigned long maxentries;
+  {
+    boost::lock_guard<DomeMetadataCache> l(*this);
+    // A partial reload would be saved as a smaller file
+    if (persistfile.empty() || warming)
+      return;
+    path = persistfile;
+    maxentries = persistmaxitems;
+  }
+  
+  save(path, maxentries);
 }
 
 /// Tag an entry so that it will be soon purged
@@ -808,7 +1148,7 @@ int DomeMetadataCache::pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::I
       fi = p->second;
       
       boost::unique_lock<boost::mutex> l(*fi);
-      fi->statinfo = xstat;
+      fi->setStat(xstat);
       fi->status_statinfo = newstatus_statinfo;
       fi->parentfileid = xstat.parent;
       fi->signalSomeUpdate();
@@ -821,7 +1161,7 @@ int DomeMetadataCache::pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::I
       k.name = xstat.name;
       k.parentfileid = xstat.parent;
       
-      fi->statinfo = xstat;
+      fi->setStat(xstat);
       fi->status_statinfo = DomeFileInfo::Ok;
       // To disable the cache, set maxitems to 0
       if (maxitems > 0) {
@@ -843,7 +1183,7 @@ int DomeMetadataCache::pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::I
         fi = p->second;
         
         boost::unique_lock<boost::mutex> l(*fi);
-        fi->statinfo = xstat;
+        fi->setStat(xstat);
         fi->status_statinfo = newstatus_statinfo;
         fi->fileid = xstat.stat.st_ino;
         fi->signalSomeUpdate();
@@ -853,7 +1193,7 @@ int DomeMetadataCache::pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::I
         if (!fi)
           fi.reset( new DomeFileInfo(xstat.stat.st_ino) );
         
-        fi->statinfo = xstat;
+        fi->setStat(xstat);
         fi->status_statinfo = DomeFileInfo::Ok;
         // To disable the cache, set maxitems to 0
         if (maxitems > 0) {
@@ -873,6 +1213,43 @@ int DomeMetadataCache::pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::I
 
 
 
+void DomeMetadataCache::addNlink(const dmlite::ExtendedStat &dir, int delta) {
+  const char *fname = "DomeMetadataCache::addNlink";
+  Log(Logger::Lvl4, domelogmask, fname, "fileid: " << dir.stat.st_ino << " delta: " << delta);
+
+  // The same entry may be in both indexes, it must be changed once
+  std::vector<boost::shared_ptr<DomeFileInfo> > fis;
+  {
+    boost::lock_guard<DomeMetadataCache> l(*this);
+
+    std::map< DomeFileID, boost::shared_ptr<DomeFileInfo> >::iterator p = databyfileid.find(dir.stat.st_ino);
+    if (p != databyfileid.end())
+      fis.push_back(p->second);
+
+    DomeFileInfoParent k;
+    k.name = dir.name;
+    k.parentfileid = dir.parent;
+    std::map< DomeFileInfoParent, boost::shared_ptr<DomeFileInfo> >::iterator q = databyparent.find(k);
+    if ((q != databyparent.end()) && (fis.empty() || (fis[0] != q->second)))
+      fis.push_back(q->second);
+  }
+
+  time_t now = time(0);
+  for (size_t i = 0; i < fis.size(); i++) {
+    boost::unique_lock<boost::mutex> l(*fis[i]);
+    // Anything else is going to be read from the db anyway
+    if (fis[i]->status_statinfo != DomeFileInfo::Ok)
+      continue;
+
+    fis[i]->statinfo.stat.st_nlink += delta;
+    fis[i]->statinfo.stat.st_mtime = now;
+    fis[i]->statinfo.stat.st_ctime = now;
+    fis[i]->signalSomeUpdate();
+  }
+
+  Log(Logger::Lvl3, domelogmask, fname, "Exiting. fileid: " << dir.stat.st_ino << " entries: " << fis.size());
+}
+
 int DomeMetadataCache::removeInfo(DomeFileID fileid, DomeFileID parentfileid, std::string name) {
   const char *fname = "DomeMetadataCache::removeInfo";
   
@@ -892,9 +1269,100 @@ int DomeMetadataCache::removeInfo(DomeFileID fileid, DomeFileID parentfileid, st
     // Remove the item got through the fileid
     databyfileid.erase(fileid);
     
+    // The parent lost an entry
+    dirlistings.erase(parentfileid);
+    dirlistingspending.erase(parentfileid);
+    
   }
   
   Log(Logger::Lvl3, domelogmask, fname, "Exiting. fileid: " << fileid << " parentfileid: " <<
   parentfileid << " name: '" << name << "'");
   return 0;
-}
\ No newline at end of file
+}
+
+
+
+void DomeMetadataCache::purgeExpiredDirListings() {
+  const char *fname = "DomeMetadataCache::purgeExpiredDirListings";
+  time_t timelimit = time(0) - dirlistttl;
+  int d = 0;
+  
+  std::map< DomeFileID, boost::shared_ptr<const DomeDirListing> >::iterator i = dirlistings.begin();
+  while (i != dirlistings.end()) {
+    if (i->second->created < timelimit) {
+      dirlistings.erase(i++);
+      d++;
+    }
+    else
+      i++;
+  }
+  
+  if (d > 0)
+    Log(Logger::Lvl2, domelogmask, fname, "purged " << d << " expired dir listings.");
+}
+
+
+boost::shared_ptr<const DomeDirListing> DomeMetadataCache::getDirListing(DomeFileID dirid) {
+  const char *fname = "DomeMetadataCache::getDirListing";
+  boost::lock_guard<DomeMetadataCache> l(*this);
+  
+  std::map< DomeFileID, boost::shared_ptr<const DomeDirListing> >::iterator p = dirlistings.find(dirid);
+  if (p == dirlistings.end()) {
+    Log(Logger::Lvl4, domelogmask, fname, "Exiting (miss). fileid: " << dirid);
+    return boost::shared_ptr<const DomeDirListing>();
+  }
+  
+  if (p->second->created < time(0) - dirlistttl) {
+    dirlistings.erase(p);
+    Log(Logger::Lvl4, domelogmask, fname, "Exiting (expired). fileid: " << dirid);
+    return boost::shared_ptr<const DomeDirListing>();
+  }
+  
+  Log(Logger::Lvl3, domelogmask, fname, "Exiting (hit). fileid: " << dirid << " entries: " << p->second->entries.size());
+  return p->second;
+}
+
+
+unsigned long long DomeMetadataCache::beginDirListing(DomeFileID dirid) {
+  boost::lock_guard<DomeMetadataCache> l(*this);
+  
+  // If someone else was reading it, the last one wins
+  dirlistingspending[dirid] = ++dirlisttick;
+  return dirlisttick;
+}
+
+
+void DomeMetadataCache::pushDirListing(DomeFileID dirid, unsigned long long token, boost::shared_ptr<const DomeDirListing> listing) {
+  const char *fname = "DomeMetadataCache::pushDirListing";
+  boost::lock_guard<DomeMetadataCache> l(*this);
+  
+  std::map< DomeFileID, unsigned long long >::iterator p = dirlistingspending.find(dirid);
+  if ((p == dirlistingspending.end()) || (p->second != token)) {
+    Log(Logger::Lvl4, domelogmask, fname, "Dropping the listing of fileid " << dirid << ", it changed meanwhile");
+    return;
+  }
+  dirlistingspending.erase(p);
+  
+  if (!listing || (listing->entries.size() > dirlistmaxentries))
+    return;
+  
+  if (dirlistings.size() >= dirlistmaxdirs) {
+    purgeExpiredDirListings();
+    if (dirlistings.size() >= dirlistmaxdirs) {
+      Log(Logger::Lvl4, domelogmask, fname, "Too many dir listings " << dirlistings.size() << ", not keeping fileid " << dirid);
+      return;
+    }
+  }
+  
+  dirlistings[dirid] = listing;
+  Log(Logger::Lvl3, domelogmask, fname, "Exiting. fileid: " << dirid << " entries: " << listing->entries.size());
+}
+
+
+void DomeMetadataCache::wipeDirListing(DomeFileID dirid) {
+  Log(Logger::Lvl4, domelogmask, "DomeMetadataCache::wipeDirListing", "fileid: " << dirid);
+  boost::lock_guard<DomeMetadataCache> l(*this);
+  
+  dirlistings.erase(dirid);
+  dirlistingspending.erase(dirid);
+}
@@ -33,6 +33,7 @@
 #include "DomeStatus.h"
 #include "DomeLog.h"
 #include "utils/urls.h"
+#include "utils/security.h"
 
 #include <string>
 #include <map>
@@ -126,6 +127,10 @@ public:
   /// The stat information about this entity, in its original data structure
   dmlite::ExtendedStat statinfo;
   
+  /// The ACL of statinfo, precompiled for fast permission checks.
+  /// Kept in sync with statinfo by setStat()
+  dmlite::CompiledAcl compiledacl;
+  
   /// The list of the replicas (if this is a file)
   std::vector<dmlite::Replica> replicas;
   
@@ -139,6 +144,10 @@ public:
   /// The last time this entry was referenced
   time_t lastreftime;
   
+  /// If not 0, the stat info was reloaded from the persistence file and is
+  /// trusted only until this time. After, it is fetched again from the db
+  time_t validuntil;
+  
   /// Update last reference time
   void touch() {
     // only update reference time if the entry exist, otherwise it may be stuck in internal cache 
@@ -178,6 +187,10 @@ public:
   /// @param st the stat struct to copy fields from
   void takeStat(const dmlite::ExtendedStat &st);
   
+  /// Set the stat info and recompile its ACL. The object must be already locked
+  /// @param st the stat struct to copy fields from
+  void setStat(const dmlite::ExtendedStat &st);
+  
   /// Helper. add a replica to the replicas list
   /// @params replica struct to add
   void addReplica( const dmlite::Replica & replica );
@@ -187,6 +200,15 @@ public:
   void addReplica( const std::vector<dmlite::Replica> &reps );
 };
 
+/// The content of a directory, sorted by name. Only the names and the fileids
+/// of the entries are here, their stat information is in the cache by fileid
+struct DomeDirListing {
+  typedef std::pair<std::string, DomeFileID> Entry;
+  std::vector<Entry> entries;
+  /// When it was read from the db
+  time_t created;
+};
+
 /// Instances of DomeFileInfo may be kept in a quasi-sorted way.
 /// This is the compare functor that keeps them sorted by parent_id+name
 class DomeFileInfoParentComp {
@@ -217,7 +239,9 @@ private:
   
   
   /// Private ctor
-  DomeMetadataCache() : lrutick(0) {  };
+  DomeMetadataCache() : lrutick(0), persistmaxitems(0), persistinterval(0), revalidatettl(0),
+    lastpersisttime(0), warming(false), warmstatsuntil(0), nhits(0), nmisses(0), nwarmhits(0),
+    dirlistmaxentries(0), dirlistmaxdirs(0), dirlistttl(0), dirlisttick(0) {  };
   
   /// Singleton instance
   static DomeMetadataCache *instance;
@@ -237,6 +261,39 @@ private:
   /// Max life for a NEGATIVE item (e.g. a not found) that was not recently accessed
   unsigned int maxttl_negative;
   
+  /// Where the hottest entries are persisted, empty to disable
+  std::string persistfile;
+  /// How many entries are persisted, at most
+  unsigned long persistmaxitems;
+  /// Seconds between two saves, 0 to save only at shutdown
+  unsigned int persistinterval;
+  /// Seconds the reloaded entries are trusted for, before being fetched again
+  unsigned int revalidatettl;
+  /// When the last save happened
+  time_t lastpersisttime;
+  /// True while the persistence file is being reloaded
+  bool warming;
+  
+  /// Hit rate counters, logged while the reloaded entries are around
+  time_t warmstatsuntil;
+  unsigned long nhits, nmisses, nwarmhits;
+  
+  /// Directories with more entries than this are not kept, 0 disables the listings
+  unsigned long dirlistmaxentries;
+  /// How many directory listings are kept, at most
+  unsigned long dirlistmaxdirs;
+  /// Max life of a directory listing
+  unsigned int dirlistttl;
+  /// The directory listings, by fileid of the directory
+  std::map< DomeFileID, boost::shared_ptr<const DomeDirListing> > dirlistings;
+  /// The listings being read from the db. A listing is kept only if
+  /// its directory did not change meanwhile, i.e. if it is still here
+  std::map< DomeFileID, unsigned long long > dirlistingspending;
+  unsigned long long dirlisttick;
+  
+  /// Purge the old directory listings
+  void purgeExpiredDirListings();
+  
   /// A simple implementation of an lru queue, based on a bimap
   typedef boost::bimap< time_t, DomeFileID > lrudatarepo;
   /// A simple implementation of an lru queue, based on a bimap
@@ -273,6 +330,17 @@ private:
     purgeExpired_parent();
   }
   
+  /// Count a hit, and forget the stat info of a reloaded entry that expired.
+  /// The cache must be locked
+  void checkHit(DomeFileInfo &fi);
+  
+  /// Insert an entry read from the persistence file, unless it is already known
+  /// @return 0 if inserted, 1 if already there, 2 if the cache is full
+  int pushWarmInfo(const dmlite::ExtendedStat &xstat, time_t validuntil);
+  
+  /// Body of the thread that reloads the persistence file
+  void warmup(std::string path);
+  
 public:
   
   /// @return the singleton instance
@@ -291,8 +359,35 @@ public:
     // Get the maximum allowed lifetime of an entry
     maxmaxttl = CFG->GetLong("mdcache.itemmaxttl", 1800);
     maxttl_negative = CFG->GetLong("mdcache.itemttl_negative", 10);
+    
+    // Persistence of the hottest entries across restarts
+    persistfile = CFG->GetString("mdcache.persist.file", (char *)"");
+    persistmaxitems = CFG->GetLong("mdcache.persist.maxitems", 100000);
+    persistinterval = CFG->GetLong("mdcache.persist.interval", 900);
+    revalidatettl = CFG->GetLong("mdcache.persist.revalidatettl", 60);
+    if (revalidatettl < 1) revalidatettl = 1;
+    lastpersisttime = time(0);
+    
+    // Listings of the directories, on top of the entries
+    dirlistmaxentries = CFG->GetLong("mdcache.dirlist.maxentries", 10000);
+    dirlistmaxdirs = CFG->GetLong("mdcache.dirlist.maxdirs", 10000);
+    dirlistttl = CFG->GetLong("mdcache.dirlist.ttl", maxttl);
   }
   
+  /// Reload the persistence file, if configured, in a background thread
+  void startWarmup();
+  
+  /// Save the most recently referenced entries, up to maxentries
+  /// @return the number of entries saved, negative on error
+  long save(const std::string &path, unsigned long maxentries);
+  /// Load the entries saved by save(). They are trusted for revalidatettl
+  /// seconds, plus a jitter, so that they do not all expire together
+  /// @return the number of entries loaded, negative on error
+  long load(const std::string &path);
+  
+  /// Save to the configured persistence file, if any
+  void persist();
+  
   
   //
   // Helper primitives to operate on the list of file locations
@@ -312,10 +407,27 @@ public:
   
   /// Push the stat information into the cache, update both indexes atomically
   int pushXstatInfo(dmlite::ExtendedStat xstat, DomeFileInfo::InfoStatus newstatus_statinfo);
+
+  /// A directory gained or lost entries. Its cached stat, if any, gets the
+  /// link count moved by delta and the times set to now, in place
+  void addNlink(const dmlite::ExtendedStat &dir, int delta);
   
-  /// Purge an item
+  /// Purge an item, and the listing of its parent
   int removeInfo(DomeFileID fileid, DomeFileID parentfileid, std::string name);
   
+  /// Get the listing of a directory, if known
+  boost::shared_ptr<const DomeDirListing> getDirListing(DomeFileID dirid);
+  /// Tell that the listing of a directory is going to be read from the db
+  /// @return the token to give to pushDirListing
+  unsigned long long beginDirListing(DomeFileID dirid);
+  /// Keep the listing of a directory, unless the directory changed since beginDirListing.
+  /// An empty listing pointer just ends the read
+  void pushDirListing(DomeFileID dirid, unsigned long long token, boost::shared_ptr<const DomeDirListing> listing);
+  /// Forget the listing of a directory, because an entry was added or removed
+  void wipeDirListing(DomeFileID dirid);
+  /// Directories with more entries than this are not worth keeping
+  unsigned long getDirListingMaxEntries() { return dirlistmaxentries; }
+  
   /// Gives life to this obj, purges expired items, etc
   void tick();
 };
@@ -38,8 +38,12 @@
 using namespace dmlite;
 
 #define DPM_DB "dpm_db"
+#define CNS_DB "cns_db"
 
 
+dmlite::MySqlIdAllocator *DomeMySql::fileIdAllocator = 0;
+bool DomeMySql::atomicNlink = true;
+
 DomeMySql::DomeMySql() {
   this->transactionLevel_ = 0;
   conn_ = MySqlHolder::getMySqlPool().acquire();
@@ -51,16 +55,25 @@ DomeMySql::~DomeMySql() {
 
 
 
-void DomeMySql::configure(std::string host, std::string username, std::string password, int port, int poolsize) {
+void DomeMySql::configure(std::string host, std::string username, std::string password, int port, int poolsize,
+                          int fileidblock, bool atomicnlink) {
 
 
   Log(Logger::Lvl4, domelogmask, domelogname, "Configuring MySQL access. host:'" << host <<
   "' user:'" << username <<
   "' port:'" << port <<
-  "' poolsz:" << poolsize);;
+  "' poolsz:" << poolsize <<
+  " fileidblock:" << fileidblock <<
+  " atomicnlink:" << atomicnlink);;
 
   MySqlHolder::configure(host, username, password, port, poolsize);
 
+  if (!fileIdAllocator)
+    fileIdAllocator = new MySqlIdAllocator(CNS_DB, fileidblock);
+  else
+    fileIdAllocator->setBlockSize(fileidblock);
+
+  atomicNlink = atomicnlink;
 
 }
 
@@ -70,7 +83,7 @@ void DomeMySql::configure(std::string host, std::string username, std::string pa
 
 
 
-int DomeMySql::begin()
+int DomeMySql::begin(bool snapshot)
 {
   const char *fname = "DomeMySql::begin";
   Log(Logger::Lvl4, domelogmask, domelogname, "Starting transaction");
@@ -84,7 +97,18 @@ int DomeMySql::begin()
     return -1;
   }
 
-  if (this->transactionLevel_ == 0 && mysql_query(this->conn_, "BEGIN") != 0) {
+  // A consistent snapshot needs repeatable read, whatever the server default.
+  // This applies only to the next transaction of the connection
+  if (this->transactionLevel_ == 0 && snapshot &&
+      mysql_query(this->conn_, "SET TRANSACTION ISOLATION LEVEL REPEATABLE READ") != 0) {
+    unsigned int merrno = mysql_errno(this->conn_);
+    std::string merror = mysql_error(this->conn_);
+    Err(fname, "Cannot set the isolation level: " << DMLITE_DBERR(merrno) << " " << merror);
+    return -1;
+  }
+
+  if (this->transactionLevel_ == 0 &&
+      mysql_query(this->conn_, snapshot ? "START TRANSACTION WITH CONSISTENT SNAPSHOT" : "BEGIN") != 0) {
     unsigned int merrno = mysql_errno(this->conn_);
     std::string merror = mysql_error(this->conn_);
     MySqlHolder::getMySqlPool().release(conn_);
@@ -238,7 +262,7 @@ int DomeMySql::getQuotaTokenByKeys(DomeQuotatoken &qtk)
   return cnt;
 }
 
-int DomeMySql::getSpacesQuotas(DomeStatus &st)
+int DomeMySql::getSpacesQuotas(std::vector<DomeQuotatoken> &tokens)
 {
   int cnt = 0;
   try {
@@ -276,10 +300,7 @@ int DomeMySql::getSpacesQuotas(DomeStatus &st)
 
     stmt.bindResult(8, &qt.s_gid);
 
-    std::vector<DomeQuotatoken> tokens;
     while ( stmt.fetch() ) {
-      boost::unique_lock<boost::recursive_mutex> l(st);
-
       qt.u_token = buf1;
       qt.path = buf2;
       qt.poolname = buf3;
@@ -296,14 +317,49 @@ int DomeMySql::getSpacesQuotas(DomeStatus &st)
       tokens.push_back(qt);
       cnt++;
     }
-    st.updateQuotatokens(tokens);
   }
-  catch ( ... ) {}
+  catch ( ... ) {
+    Err(domelogname, " Exception while reading quotatokens. Read:" << cnt);
+    return -1;
+  }
 
   Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. Elements read:" << cnt);
   return cnt;
 }
 
+int DomeMySql::getTablesChecksum(const std::string &tables, uint64_t &checksum)
+{
+  Log(Logger::Lvl4, domelogmask, domelogname, " Entering. tables: '" << tables << "'");
+  int cnt = 0;
+  checksum = 0;
+
+  try {
+    // This does not transfer the rows, and MyISAM tables even keep it ready
+    std::string query = "CHECKSUM TABLE " + tables;
+    Statement stmt(conn_, DPM_DB, query.c_str());
+    stmt.execute();
+
+    char buftable[1024];
+    unsigned long long cks = 0;
+
+    memset(buftable, 0, sizeof(buftable));
+    stmt.bindResult(0, buftable, 256);
+    stmt.bindResult(1, &cks);
+
+    while ( stmt.fetch() ) {
+      checksum = checksum * 1000003ULL + cks;
+      cnt++;
+    }
+  }
+  catch ( ... ) {
+    Err(domelogname, " Exception while computing the checksum of '" << tables << "'");
+    return -1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. tables: " << cnt << " checksum: " << checksum);
+  return (cnt > 0) ? 0 : -1;
+}
+
 int DomeMySql::setQuotatokenByStoken(DomeQuotatoken &qtk) {
   Log(Logger::Lvl4, domelogmask, domelogname, "Entering. u_token: '" << qtk.u_token << "' t_space: " << qtk.t_space <<
     " poolname: '" << qtk.poolname << "' path: '" << qtk.path );
@@ -705,10 +761,9 @@ int DomeMySql::rmPool(std::string &poolname)  {
 
 
 // Load all the pools
-int DomeMySql::getPools(DomeStatus &st)
+int DomeMySql::getPools(std::map<std::string, DomePoolInfo> &pools)
 {
   Log(Logger::Lvl4, domelogmask, domelogname, " Entering ");
-  if (st.role != DomeStatus::roleHead) return -1;
 
   DomePoolInfo pinfo;
   int cnt = 0;
@@ -727,24 +782,23 @@ int DomeMySql::getPools(DomeStatus &st)
 
     stmt.bindResult(2, &pinfo.stype, 1);
 
-    {
-      boost::unique_lock<boost::recursive_mutex> l(st);
-      st.poolslist.clear();
-      while ( stmt.fetch() ) {
+    while ( stmt.fetch() ) {
 
-          pinfo.poolname = bufpoolname;
+        pinfo.poolname = bufpoolname;
 
-          Log(Logger::Lvl1, domelogmask, domelogname, " Fetched pool: '" << pinfo.poolname << "' defsize: " << pinfo.defsize <<
-          " stype: '" << pinfo.stype << "'");
+        Log(Logger::Lvl1, domelogmask, domelogname, " Fetched pool: '" << pinfo.poolname << "' defsize: " << pinfo.defsize <<
+        " stype: '" << pinfo.stype << "'");
 
-          st.poolslist[bufpoolname] = pinfo;
+        pools[bufpoolname] = pinfo;
 
-          cnt++;
+        cnt++;
 
-      }
     }
   }
-  catch ( ... ) {}
+  catch ( ... ) {
+    Err(domelogname, " Exception while reading pools. Read:" << cnt);
+    return -1;
+  }
 
   Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. Elements read:" << cnt);
   return cnt;
@@ -759,7 +813,7 @@ int DomeMySql::getPools(DomeStatus &st)
 
 
 
-int DomeMySql::getFilesystems(DomeStatus &st)
+int DomeMySql::getFilesystems(std::vector<DomeFsInfo> &fslist)
 {
   Log(Logger::Lvl4, domelogmask, domelogname, " Entering ");
   DomeFsInfo fs;
@@ -786,41 +840,24 @@ int DomeMySql::getFilesystems(DomeStatus &st)
 
 
 
-    {
-      boost::unique_lock<boost::recursive_mutex> l(st);
-      std::vector <DomeFsInfo> newfslist;
-      st.servers.clear();
-
-      while ( stmt.fetch() ) {
-        DomeFsInfo oldfs;
-
-        fs.poolname = bufpoolname;
-        fs.server = bufserver;
-        fs.fs = buffs;
-
-        st.servers.insert(fs.server);
-
-        // If the fs was already in memory, keep its status
-        if ( st.PfnMatchesAnyFS(fs.server, fs.fs, oldfs) ) {
-          fs.activitystatus = oldfs.activitystatus;
-          fs.freespace = oldfs.freespace;
-          fs.physicalsize = oldfs.physicalsize;
-        }
-
-        Log(Logger::Lvl1, domelogmask, domelogname, " Fetched filesystem. server: '" << fs.server <<
-        "' fs: '" << fs.fs << "' st: " << fs.status << " pool: '" << fs.poolname << "'");
+    while ( stmt.fetch() ) {
+      fs.poolname = bufpoolname;
+      fs.server = bufserver;
+      fs.fs = buffs;
 
-        newfslist.push_back(fs);
+      Log(Logger::Lvl1, domelogmask, domelogname, " Fetched filesystem. server: '" << fs.server <<
+      "' fs: '" << fs.fs << "' st: " << fs.status << " pool: '" << fs.poolname << "'");
 
-        cnt++;
-      }
-
-      st.fslist = newfslist;
+      fslist.push_back(fs);
 
+      cnt++;
     }
 
   }
-  catch ( ... ) {}
+  catch ( ... ) {
+    Err(domelogname, " Exception while reading filesystems. Read:" << cnt);
+    return -1;
+  }
 
   Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. Elements read:" << cnt);
   return cnt;
@@ -31,6 +31,7 @@
 #include "status.h"
 #include "inode.h"
 #include "DomeMetadataCache.hh"
+#include "utils/MySqlIdAllocator.h"
 
 
 class DomeStatus;
@@ -40,6 +41,27 @@ class DomeGroupInfo;
 class DomeUserInfo;
 class DomeMySqlDir;
 
+/// The fields of a namespace entry that matter for the space accounting
+struct DomeMySqlEntrySize {
+  int64_t fileid;
+  int64_t parent;
+  mode_t mode;
+  int64_t size;
+};
+
+/// A namespace entry, with its name
+struct DomeMySqlEntry: public DomeMySqlEntrySize {
+  std::string name;
+};
+
+/// A replica, as found in Cns_file_replica
+struct DomeMySqlReplicaEntry {
+  int64_t rowid;
+  int64_t fileid;
+  char status;
+  std::string host, fs, sfn;
+};
+
 
 
 
@@ -55,32 +77,42 @@ public:
   DomeMySql();
   virtual ~DomeMySql();
 
-  static void configure(std::string host, std::string username, std::string password, int port, int poolsize);
+  /// fileidblock is how many file ids are reserved at a time. With atomicnlink the link
+  /// counts of the directories are updated in place, without reading and locking them first
+  static void configure(std::string host, std::string username, std::string password, int port, int poolsize,
+                        int fileidblock = 100, bool atomicnlink = true);
   /// Transaction control.
-  /// To have the scoped behaviour the DomeMySqlTrans can be used
-  int begin();
+  /// To have the scoped behaviour the DomeMySqlTrans can be used.
+  /// With snapshot, all the reads of the transaction see the db as it was
+  /// when it started, also the ones done with separate queries
+  int begin(bool snapshot = false);
   int rollback();
   int commit();
 
   // ------------------------------------------
   // ---------------- Functions for internal DOME usage
 
-  /// Loads spaces and quotas into the given status. Thread safe.
-  int getSpacesQuotas(DomeStatus &st);
+  /// Loads spaces and quotas. Returns how many were read, -1 on failure
+  int getSpacesQuotas(std::vector<DomeQuotatoken> &tokens);
+
+  /// Loads the groups with a gid greater than aftergid. Returns how many were read, -1 on failure
+  int getGroups(std::vector<DomeGroupInfo> &groups, int64_t aftergid = -1);
+  /// Loads the users with an uid greater than afteruid. Returns how many were read, -1 on failure
+  int getUsers(std::vector<DomeUserInfo> &users, int64_t afteruid = -1);
 
-  /// Loads groups into the given DOME status. Thread safe.
-  int getGroups(DomeStatus &st);
-  /// Loads users into the given DOME status. Thread safe.
-  int getUsers(DomeStatus &st);
+  /// Gets the combined checksum of the content of some tables, to tell cheaply
+  /// whether they changed. The tables are comma separated and qualified with their db,
+  /// e.g. "cns_db.Cns_userinfo". Returns 0 on success
+  int getTablesChecksum(const std::string &tables, uint64_t &checksum);
   
   /// Load from the DB, matching the given poolname and path
   int getQuotaTokenByKeys(DomeQuotatoken &qtk);
   
-  /// Load the defined pools
-  int getPools(DomeStatus &st);
+  /// Load the defined pools. Returns how many were read, -1 on failure
+  int getPools(std::map<std::string, DomePoolInfo> &pools);
   
-  /// Loads the defined filesystems, parses them into server names, etc. into the status
-  int getFilesystems(DomeStatus &st);
+  /// Loads the defined filesystems. Returns how many were read, -1 on failure
+  int getFilesystems(std::vector<DomeFsInfo> &fslist);
 
   // ------------------------------------------
   // ------------------ dmlite authn functions
@@ -199,6 +231,27 @@ public:
   /// Add/subtract an integer to used space of a directory
   int addtoDirectorySize(int64_t fileid, int64_t increment);
 
+  /// Reads up to maxentries namespace entries with a fileid greater than afterfileid,
+  /// in fileid order. Returns how many were read, -1 on failure
+  int getEntrySizes(int64_t afterfileid, unsigned int maxentries, std::vector<DomeMySqlEntrySize> &entries);
+
+  /// Like getEntrySizes, also reading the names
+  int getEntries(int64_t afterfileid, unsigned int maxentries, std::vector<DomeMySqlEntry> &entries);
+
+  /// Reads up to maxreplicas replicas with a rowid greater than afterrowid,
+  /// in rowid order. Returns how many were read, -1 on failure
+  int getReplicaEntries(int64_t afterrowid, unsigned int maxreplicas, std::vector<DomeMySqlReplicaEntry> &replicas);
+
+  /// Reads the rfns of up to maxreplicas replicas of a filesystem, with a rowid
+  /// greater than afterrowid, in rowid order. lastrowid gets the rowid of the
+  /// last one. Returns how many were read, -1 on failure
+  int getFsReplicas(const std::string &server, const std::string &fs, int64_t afterrowid,
+                    unsigned int maxreplicas, std::vector<std::string> &rfns, int64_t &lastrowid);
+
+  /// Adds increments to the used space of many directories, in one transaction.
+  /// Unlike addtoDirectorySize it does not touch the cache. Returns 0 on success
+  int addtoDirectorySizes(const std::vector<std::pair<int64_t, int64_t> > &increments);
+
   /// Add/subtract an integer to the u_space of a quota(space)token
   /// u_space is the free space, to be DEcremented on write
   int addtoQuotatokenUspace(DomeQuotatoken &qtk, int64_t increment);
@@ -237,6 +290,14 @@ private:
   // Connection
   MYSQL *conn_;
 
+  /// Gives the ids of the new files, shared by all the instances
+  static dmlite::MySqlIdAllocator *fileIdAllocator;
+  /// Update the link counts with nlink = nlink + delta
+  static bool atomicNlink;
+
+  /// Adds delta to the link count of a directory, in the current transaction
+  void addNlink(dmlite::ExtendedStat &dir, int delta);
+
 };
 
 
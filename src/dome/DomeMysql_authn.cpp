@@ -444,16 +444,17 @@ DmStatus DomeMySql::getGroupsVec(std::vector<DomeGroupInfo> &groups)
 }
 
 
-int DomeMySql::getGroups(DomeStatus &st)
+int DomeMySql::getGroups(std::vector<DomeGroupInfo> &groups, int64_t aftergid)
 {
-  Log(Logger::Lvl4, domelogmask, domelogname, " Entering ");
+  Log(Logger::Lvl4, domelogmask, domelogname, " Entering. aftergid: " << aftergid);
   int cnt = 0;
 
   try {
     Statement stmt(conn_, CNS_DB,
                    "SELECT gid, groupname, banned, xattr\
-                   FROM Cns_groupinfo"
+                   FROM Cns_groupinfo WHERE gid > ?"
     );
+    stmt.bindParam(0, aftergid);
     stmt.execute();
 
     DomeGroupInfo gi;
@@ -470,24 +471,22 @@ int DomeMySql::getGroups(DomeStatus &st)
     memset(buf2, 0, sizeof(buf2));
     stmt.bindResult(3, buf2, 256);
 
-    {
-      boost::unique_lock<boost::recursive_mutex> l(st);
-      while ( stmt.fetch() ) {
-        gi.groupname = buf1;
-        gi.xattr = buf2;
-        gi.banned = (DomeGroupInfo::BannedStatus)banned;
+    while ( stmt.fetch() ) {
+      gi.groupname = buf1;
+      gi.xattr = buf2;
+      gi.banned = (DomeGroupInfo::BannedStatus)banned;
 
-        Log(Logger::Lvl2, domelogmask, domelogname, " Fetched group. id:" << gi.groupid <<
-        " groupname:" << gi.groupname << " banned:" << gi.banned << " xattr: '" << gi.xattr);
+      Log(Logger::Lvl2, domelogmask, domelogname, " Fetched group. id:" << gi.groupid <<
+      " groupname:" << gi.groupname << " banned:" << gi.banned << " xattr: '" << gi.xattr);
 
-        st.insertGroup(gi);
+      groups.push_back(gi);
 
-        cnt++;
-      }
+      cnt++;
     }
   }
   catch ( ... ) {
     Err(domelogname, " Exception while reading groups. Groups read:" << cnt);
+    return -1;
   }
 
   Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. Groups read:" << cnt);
@@ -539,16 +538,17 @@ DmStatus DomeMySql::getUsersVec(std::vector<DomeUserInfo> &users)
 
 
 
-int DomeMySql::getUsers(DomeStatus &st)
+int DomeMySql::getUsers(std::vector<DomeUserInfo> &users, int64_t afteruid)
 {
   int cnt = 0;
-  Log(Logger::Lvl4, domelogmask, domelogname, " Entering ");
+  Log(Logger::Lvl4, domelogmask, domelogname, " Entering. afteruid: " << afteruid);
 
   try {
     Statement stmt(conn_, CNS_DB,
                    "SELECT userid, username, banned, xattr\
-                   FROM Cns_userinfo"
+                   FROM Cns_userinfo WHERE userid > ?"
     );
+    stmt.bindParam(0, afteruid);
     stmt.execute();
 
     DomeUserInfo ui;
@@ -565,25 +565,22 @@ int DomeMySql::getUsers(DomeStatus &st)
     memset(buf2, 0, sizeof(buf2));
     stmt.bindResult(3, buf2, 256);
 
-    {
-      boost::unique_lock<boost::recursive_mutex> l(st);
+    while ( stmt.fetch() ) {
+      ui.username = buf1;
+      ui.xattr = buf2;
+      ui.banned = (DomeUserInfo::BannedStatus)banned;
 
-      while ( stmt.fetch() ) {
-        ui.username = buf1;
-        ui.xattr = buf2;
-        ui.banned = (DomeUserInfo::BannedStatus)banned;
+      Log(Logger::Lvl2, domelogmask, domelogname, " Fetched user. id:" << ui.userid <<
+      " username:" << ui.username << " banned:" << ui.banned << " xattr: '" << ui.xattr);
 
-        Log(Logger::Lvl2, domelogmask, domelogname, " Fetched user. id:" << ui.userid <<
-        " username:" << ui.username << " banned:" << ui.banned << " xattr: '" << ui.xattr);
+      users.push_back(ui);
 
-        st.insertUser(ui);
-
-        cnt++;
-      }
+      cnt++;
     }
   }
   catch ( ... ) {
     Err("DomeMySql::getUsers", " Exception while reading users. Users read:" << cnt);
+    return -1;
   }
 
   Log(Logger::Lvl3, domelogmask, domelogname, " Exiting. Users read:" << cnt);
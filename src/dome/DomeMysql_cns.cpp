@@ -147,15 +147,40 @@ static inline void bindMetadata(Statement& stmt, CStat* meta) throw(DmException)
 
 /// Utility to check perms for a directory tree. Tells if a certain user can reach a certain file
 dmlite::DmStatus DomeMySql::traverseBackwards(const SecurityContext &secctx, dmlite::ExtendedStat& meta) {
-  ExtendedStat current = meta;
-  dmlite::DmStatus res;
+  CompiledSecurityContext csecctx(secctx);
+  int64_t parent = meta.parent;
+  
   // We want to check if we can arrive here...
-  while (current.parent != 0) {
-
-    res = getStatbyFileid(current, current.parent);
-    if (checkPermissions(&secctx, current.acl, current.stat, S_IEXEC))
+  while (parent != 0) {
+    int64_t fileid = parent;
+    
+    // Fast path: the parent is in the cache, use its precompiled ACL
+    // without copying the stat information
+    {
+      boost::shared_ptr <DomeFileInfo > dfi = DOMECACHE->getFileInfoOrCreateNewOne(fileid);
+      boost::unique_lock<boost::mutex> l(*dfi);
+      
+      if (dfi->status_statinfo == DomeFileInfo::Ok) {
+        if (checkPermissions(csecctx, dfi->compiledacl, dfi->statinfo.stat, S_IEXEC))
+          return DmStatus(EACCES, SSTR("Can not access fileid " << fileid <<
+            " user: '" << secctx.user.name << "'"));
+        
+        parent = dfi->statinfo.parent;
+        continue;
+      }
+    }
+    
+    // Slow path, this will also fill the cache entry
+    ExtendedStat current;
+    dmlite::DmStatus res = getStatbyFileid(current, fileid);
+    if (!res.ok())
+      return res;
+    
+    if (checkPermissions(csecctx, CompiledAcl(current.acl), current.stat, S_IEXEC))
       return DmStatus(EACCES, SSTR("Can not access fileid " << current.stat.st_ino <<
         " user: '" << secctx.user.name << "'"));
+    
+    parent = current.parent;
   }
 
   return DmStatus();
@@ -212,6 +237,44 @@ DmStatus DomeMySql::createfile(const dmlite::ExtendedStat &parent, std::string f
 
 }
 
+void DomeMySql::addNlink(ExtendedStat& dir, int delta)
+{
+  Log(Logger::Lvl4, domelogmask, domelogname, " fileid:" << dir.stat.st_ino << " delta:" << delta);
+
+  if (atomicNlink) {
+    // No read, the row is only locked from here to the commit
+    Statement nlinkUpdate(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
+    SET nlink = nlink + ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
+    WHERE fileid = ?");
+    nlinkUpdate.bindParam(0, delta);
+    nlinkUpdate.bindParam(1, dir.stat.st_ino);
+
+    if (nlinkUpdate.execute() == 0)
+      throw DmException(ENOENT, SSTR("Directory " << dir.stat.st_ino << " does not exist anymore"));
+
+    // Our best guess
+    dir.stat.st_nlink += delta;
+  }
+  else {
+    Statement nlinkStmt(this->conn_, CNS_DB, "SELECT nlink FROM Cns_file_metadata WHERE fileid = ? FOR UPDATE");
+    nlinkStmt.bindParam(0, dir.stat.st_ino);
+    nlinkStmt.execute();
+    nlinkStmt.bindResult(0, &dir.stat.st_nlink);
+    if (!nlinkStmt.fetch())
+      throw DmException(ENOENT, SSTR("Directory " << dir.stat.st_ino << " does not exist anymore"));
+
+    Statement nlinkUpdate(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
+    SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
+    WHERE fileid = ?");
+    dir.stat.st_nlink += delta;
+    nlinkUpdate.bindParam(0, dir.stat.st_nlink);
+    nlinkUpdate.bindParam(1, dir.stat.st_ino);
+    nlinkUpdate.execute();
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. fileid:" << dir.stat.st_ino << " nlink:" << dir.stat.st_nlink);
+}
+
 DmStatus DomeMySql::create(ExtendedStat& nf)
 {
   Log(Logger::Lvl4, domelogmask, domelogname, "Creating new namespace entity. name: '" << nf.name <<
@@ -226,46 +289,20 @@ DmStatus DomeMySql::create(ExtendedStat& nf)
     if (!r.ok()) return r;
   }
 
-  // Fetch the new file ID
+  // Fetch the new file ID, out of the transaction
   ino_t newFileId = 0;
+  try {
+    newFileId = fileIdAllocator->next();
+  }
+  catch (DmException e) {
+    return DmStatus(e);
+  }
 
   // Start transaction
   DomeMySqlTrans trans(this);
 
   try {
 
-
-    {
-      // Scope to make sure that the local objects that involve mysql
-      // are destroyed before the transaction is closed
-
-
-      Statement uniqueId(conn_, CNS_DB, "SELECT id FROM Cns_unique_id FOR UPDATE");
-
-      uniqueId.execute();
-      uniqueId.bindResult(0, &newFileId);
-
-      // Update the unique ID
-      if (uniqueId.fetch()) {
-        Statement updateUnique(conn_, CNS_DB, "UPDATE Cns_unique_id SET id = ?");
-        ++newFileId;
-        updateUnique.bindParam(0, newFileId);
-        updateUnique.execute();
-      }
-      // Couldn't get, so insert
-      else {
-        Statement insertUnique(conn_, CNS_DB, "INSERT INTO Cns_unique_id (id) VALUES (?)");
-        newFileId = 1;
-        insertUnique.bindParam(0, newFileId);
-        insertUnique.execute();
-      }
-
-
-      // Closing the scope here makes sure that no local mysql-involving objects
-      // are still around when we close the transaction
-    }
-
-
     // Regular files start with 1 link. Directories 0.
     unsigned    nlink   = S_ISDIR(nf.stat.st_mode) ? 0 : 1;
     std::string aclStr  = nf.acl.serialize();
@@ -299,23 +336,8 @@ DmStatus DomeMySql::create(ExtendedStat& nf)
     fileStmt.execute();
 
     // Increment the parent nlink
-    if (nf.parent > 0) {
-      Statement nlinkStmt(this->conn_, CNS_DB, "SELECT nlink FROM Cns_file_metadata WHERE fileid = ? FOR UPDATE");
-      nlinkStmt.bindParam(0, nf.parent);
-      nlinkStmt.execute();
-      nlinkStmt.bindResult(0, &parentMeta.stat.st_nlink);
-      nlinkStmt.fetch();
-
-      Statement nlinkUpdateStmt(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
-      SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
-      WHERE fileid = ?");
-
-      parentMeta.stat.st_nlink++;
-      nlinkUpdateStmt.bindParam(0, parentMeta.stat.st_nlink);
-      nlinkUpdateStmt.bindParam(1, parentMeta.stat.st_ino);
-
-      nlinkUpdateStmt.execute();
-    }
+    if (nf.parent > 0)
+      this->addNlink(parentMeta, 1);
 
     // Closing the scope here makes sure that no local mysql-involving objects
     // are still around when we close the transaction
@@ -337,7 +359,12 @@ DmStatus DomeMySql::create(ExtendedStat& nf)
   nf.stat.st_ino = newFileId;
 
   DOMECACHE->pushXstatInfo(nf, DomeFileInfo::Ok);
-  DOMECACHE->pushXstatInfo(parentMeta, DomeFileInfo::Ok);
+  // The count read may miss other changes, so apply only our delta
+  if (atomicNlink)
+    DOMECACHE->addNlink(parentMeta, 1);
+  else
+    DOMECACHE->pushXstatInfo(parentMeta, DomeFileInfo::Ok);
+  DOMECACHE->wipeDirListing(nf.parent);
   
   if (S_ISDIR(nf.stat.st_mode))
     Log(Logger::Lvl1, domelogmask, domelogname, "Created new directory. name: '" << nf.name <<
@@ -556,45 +583,16 @@ DmStatus DomeMySql::move(ino_t inode, ino_t dest)
       return r;
     }
 
-      Statement oldNlinkStmt(this->conn_, CNS_DB, "SELECT nlink FROM Cns_file_metadata WHERE fileid = ? FOR UPDATE");
-    oldNlinkStmt.bindParam(0, oldParent.stat.st_ino);
-    oldNlinkStmt.execute();
-    oldNlinkStmt.bindResult(0, &oldParent.stat.st_nlink);
-    oldNlinkStmt.fetch();
-
-    Statement oldNlinkUpdateStmt(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
-    SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
-    WHERE fileid = ?");
-
-    oldParent.stat.st_nlink--;
-    oldNlinkUpdateStmt.bindParam(0, oldParent.stat.st_nlink);
-    oldNlinkUpdateStmt.bindParam(1, oldParent.stat.st_ino);
-
-    if (oldNlinkUpdateStmt.execute() == 0)
-      throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
-                        "Could not update the old parent nlink!");
+    this->addNlink(oldParent, -1);
 
-      // Increment from new
-      Statement newNlinkStmt(this->conn_, CNS_DB, "SELECT nlink FROM Cns_file_metadata WHERE fileid = ? FOR UPDATE");
-    newNlinkStmt.bindParam(0, newParent.stat.st_ino);
-    newNlinkStmt.execute();
-    newNlinkStmt.bindResult(0, &newParent.stat.st_nlink);
-    newNlinkStmt.fetch();
-
-    Statement newNlinkUpdateStmt(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
-    SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
-    WHERE fileid = ?");
-
-    newParent.stat.st_nlink++;
-    newNlinkUpdateStmt.bindParam(0, newParent.stat.st_nlink);
-    newNlinkUpdateStmt.bindParam(1, newParent.stat.st_ino);
-
-    if (newNlinkUpdateStmt.execute() == 0)
-      throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
-                        "Could not update the new parent nlink!");
+    // Increment from new
+    this->addNlink(newParent, 1);
 
 
     trans.Commit();
+
+    DOMECACHE->wipeDirListing(file.parent);
+    DOMECACHE->wipeDirListing(dest);
   }
   catch ( DmException e ) {
     return DmStatus(e);
@@ -825,6 +823,192 @@ int DomeMySql::addtoDirectorySize(int64_t fileid, int64_t increment) {
 }
 
 
+int DomeMySql::getEntrySizes(int64_t afterfileid, unsigned int maxentries, std::vector<DomeMySqlEntrySize> &entries) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. afterfileid: " << afterfileid << " maxentries: " << maxentries);
+  int cnt = 0;
+
+  // The results are buffered client side, hence the chunks
+  try {
+    Statement stmt(conn_, CNS_DB,
+                   "SELECT fileid, parent_fileid, filemode, filesize\
+                    FROM Cns_file_metadata\
+                    WHERE fileid > ?\
+                    ORDER BY fileid LIMIT ?");
+
+    stmt.bindParam(0, afterfileid);
+    stmt.bindParam(1, (int64_t)maxentries);
+    stmt.execute();
+
+    DomeMySqlEntrySize e;
+    stmt.bindResult(0, &e.fileid);
+    stmt.bindResult(1, &e.parent);
+    stmt.bindResult(2, &e.mode);
+    stmt.bindResult(3, &e.size);
+
+    while (stmt.fetch()) {
+      entries.push_back(e);
+      cnt++;
+    }
+  }
+  catch (DmException e) {
+    Err(domelogname, "Could not read entries after fileid " << afterfileid << " err: " << e.what());
+    return -1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. afterfileid: " << afterfileid << " nentries: " << cnt);
+  return cnt;
+}
+
+int DomeMySql::getEntries(int64_t afterfileid, unsigned int maxentries, std::vector<DomeMySqlEntry> &entries) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. afterfileid: " << afterfileid << " maxentries: " << maxentries);
+  int cnt = 0;
+
+  try {
+    Statement stmt(conn_, CNS_DB,
+                   "SELECT fileid, parent_fileid, filemode, filesize, name\
+                    FROM Cns_file_metadata\
+                    WHERE fileid > ?\
+                    ORDER BY fileid LIMIT ?");
+
+    stmt.bindParam(0, afterfileid);
+    stmt.bindParam(1, (int64_t)maxentries);
+    stmt.execute();
+
+    DomeMySqlEntry e;
+    char cname[256];
+    stmt.bindResult(0, &e.fileid);
+    stmt.bindResult(1, &e.parent);
+    stmt.bindResult(2, &e.mode);
+    stmt.bindResult(3, &e.size);
+    stmt.bindResult(4, cname, sizeof(cname));
+
+    while (stmt.fetch()) {
+      e.name = cname;
+      entries.push_back(e);
+      cnt++;
+    }
+  }
+  catch (DmException e) {
+    Err(domelogname, "Could not read entries after fileid " << afterfileid << " err: " << e.what());
+    return -1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. afterfileid: " << afterfileid << " nentries: " << cnt);
+  return cnt;
+}
+
+int DomeMySql::getReplicaEntries(int64_t afterrowid, unsigned int maxreplicas, std::vector<DomeMySqlReplicaEntry> &replicas) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. afterrowid: " << afterrowid << " maxreplicas: " << maxreplicas);
+  int cnt = 0;
+
+  try {
+    Statement stmt(conn_, CNS_DB,
+                   "SELECT rowid, fileid, status, host, fs, sfn\
+                    FROM Cns_file_replica\
+                    WHERE rowid > ?\
+                    ORDER BY rowid LIMIT ?");
+
+    stmt.bindParam(0, afterrowid);
+    stmt.bindParam(1, (int64_t)maxreplicas);
+    stmt.execute();
+
+    DomeMySqlReplicaEntry r;
+    char chost[64], cfs[80], csfn[4096];
+    stmt.bindResult(0, &r.rowid);
+    stmt.bindResult(1, &r.fileid);
+    stmt.bindResult(2, &r.status, 1);
+    stmt.bindResult(3, chost, sizeof(chost));
+    stmt.bindResult(4, cfs, sizeof(cfs));
+    stmt.bindResult(5, csfn, sizeof(csfn));
+
+    while (stmt.fetch()) {
+      r.host = chost;
+      r.fs = cfs;
+      r.sfn = csfn;
+      replicas.push_back(r);
+      cnt++;
+    }
+  }
+  catch (DmException e) {
+    Err(domelogname, "Could not read replicas after rowid " << afterrowid << " err: " << e.what());
+    return -1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. afterrowid: " << afterrowid << " nreplicas: " << cnt);
+  return cnt;
+}
+
+int DomeMySql::getFsReplicas(const std::string &server, const std::string &fs, int64_t afterrowid,
+                             unsigned int maxreplicas, std::vector<std::string> &rfns, int64_t &lastrowid) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. server: '" << server << "' fs: '" << fs <<
+    "' afterrowid: " << afterrowid << " maxreplicas: " << maxreplicas);
+  int cnt = 0;
+
+  // The entries of INDEX(host) come in rowid order, so there is no
+  // filesort per page, as there would be ordering by sfn
+  try {
+    Statement stmt(conn_, CNS_DB,
+                   "SELECT rowid, sfn\
+                    FROM Cns_file_replica\
+                    WHERE host = ? AND fs = ? AND rowid > ?\
+                    ORDER BY rowid LIMIT ?");
+
+    stmt.bindParam(0, server);
+    stmt.bindParam(1, fs);
+    stmt.bindParam(2, afterrowid);
+    stmt.bindParam(3, (int64_t)maxreplicas);
+    stmt.execute();
+
+    int64_t rowid;
+    char csfn[4096];
+    stmt.bindResult(0, &rowid);
+    stmt.bindResult(1, csfn, sizeof(csfn));
+
+    lastrowid = afterrowid;
+    while (stmt.fetch()) {
+      rfns.push_back(csfn);
+      lastrowid = rowid;
+      cnt++;
+    }
+  }
+  catch (DmException e) {
+    Err(domelogname, "Could not read the replicas of '" << server << ":" << fs << "' err: " << e.what());
+    return -1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. server: '" << server << "' fs: '" << fs << "' nreplicas: " << cnt);
+  return cnt;
+}
+
+int DomeMySql::addtoDirectorySizes(const std::vector<std::pair<int64_t, int64_t> > &increments) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. ndirs: " << increments.size());
+
+  try {
+    DomeMySqlTrans t(this);
+
+    // A Statement can be executed only once
+    for (size_t i = 0; i < increments.size(); i++) {
+      Statement stmt(conn_, CNS_DB,
+                     "UPDATE Cns_file_metadata\
+                      SET filesize = filesize + ( ? )\
+                      WHERE fileid = ?");
+      stmt.bindParam(0, increments[i].second);
+      stmt.bindParam(1, increments[i].first);
+      stmt.execute();
+    }
+
+    t.Commit();
+  }
+  catch (DmException e) {
+    Err(domelogname, "Could not update directory sizes. ndirs: " << increments.size() << " err: " << e.what());
+    return 1;
+  }
+
+  Log(Logger::Lvl3, domelogmask, domelogname, "Directory sizes updated. ndirs: " << increments.size());
+  return 0;
+}
+
+
 
 
 
@@ -844,8 +1028,11 @@ DmStatus DomeMySql::getStatbyLFN(dmlite::ExtendedStat &meta, const std::string p
   Log(Logger::Lvl4, domelogmask, domelogname, "Entering. lfn: '" << path << "'" );
 
 
-  // Split the path always assuming absolute
-  std::vector<std::string> components = Url::splitPath(path);
+  // Walk the components over the path itself. Only following a symlink
+  // needs a new buffer, with the link and whatever was left of the path.
+  const std::string* current = &path;
+  std::string        buffer;
+  PathIterator       component(path);
 
   // Iterate starting from absolute root (parent of /) (0)
   uint64_t     parent       = 0;
@@ -865,15 +1052,15 @@ DmStatus DomeMySql::getStatbyLFN(dmlite::ExtendedStat &meta, const std::string p
   if(!st.ok()) return st;
 
   parent = meta.stat.st_ino;
-  components.erase(components.begin());
+  component.next(); // Skip the root, we are already there
 
-  for (unsigned i = 0; i < components.size(); ) {
+  while (component.next()) {
     // Check that the parent is a directory first
     if (!S_ISDIR(meta.stat.st_mode) && !S_ISLNK(meta.stat.st_mode))
       return DmStatus(ENOTDIR, SSTR("'" << meta.name << "' is not a directory, and is referenced by '" << path << "'. Internal DB error."));
 
     // Pop next component
-    c = components[i];
+    component.assignTo(c);
 
     // Stay here
     if (c == ".") {
@@ -892,14 +1079,10 @@ DmStatus DomeMySql::getStatbyLFN(dmlite::ExtendedStat &meta, const std::string p
       if(!st.ok()) {
         if(st.code() != ENOENT) return st;
 
-        while (i < components.size()) {
-          components.pop_back();
-        }
-
-        //re-add / at the beginning
-        components.insert( components.begin(),std::string(1,'/'));
+        std::string under(*current, 0, component.offset());
+        Url::normalizePathInPlace(under, false);
         return DmStatus(ENOENT, "Entry '%s' not found under '%s'",
-                        c.c_str(), Url::joinPath(components).c_str());
+                        c.c_str(), under.c_str());
       }
 
       // Symbolic link!, follow that instead
@@ -916,15 +1099,13 @@ DmStatus DomeMySql::getStatbyLFN(dmlite::ExtendedStat &meta, const std::string p
                           16);
         }
 
-        // We have the symbolic link now. Split it and push
-        // into the component
-        std::vector<std::string> symPath = Url::splitPath(link.link);
-
-        for (unsigned j = i + 1; j < components.size(); ++j)
-          symPath.push_back(components[j]);
-
-        components.swap(symPath);
-        i = 0;
+        // We have the symbolic link now. Continue with it,
+        // followed by what was left of the path
+        std::string target(link.link);
+        target.append(component.rest(), component.restSize());
+        buffer.swap(target);
+        current   = &buffer;
+        component = PathIterator(buffer);
 
         // If absolute, need to reset parent
         if (link.link[0] == '/') {
@@ -945,7 +1126,6 @@ DmStatus DomeMySql::getStatbyLFN(dmlite::ExtendedStat &meta, const std::string p
         parent = meta.stat.st_ino;
       }
     }
-    ++i; // Next in array
   }
 
   checksums::fillChecksumInXattr(meta);
@@ -1055,7 +1235,7 @@ DmStatus DomeMySql::getStatbyFileid(dmlite::ExtendedStat& xstat, int64_t fileid)
     // Now insert the new stat info into the cache and signal it.
     {
       boost::unique_lock<boost::mutex> l(*dfi);
-      dfi->statinfo = xstat;
+      dfi->setStat(xstat);
       dfi->status_statinfo = DomeFileInfo::Ok;
       dfi->signalSomeUpdate();
     }
@@ -1422,7 +1602,7 @@ DmStatus DomeMySql::getStatbyParentFileid(dmlite::ExtendedStat& xstat, int64_t f
     // Now insert the new stat info into the cache and signal it.
     {
       boost::unique_lock<boost::mutex> l(*dfi);
-      dfi->statinfo = xstat;
+      dfi->setStat(xstat);
       dfi->status_statinfo = DomeFileInfo::Ok;
       dfi->signalSomeUpdate();
     }
@@ -1511,7 +1691,8 @@ DmStatus DomeMySql::addFilesizeToDirs(ExtendedStat file, int64_t size) {
     // Avoid the contention on /dpm/voname/home
     if (idx > 0) {
       Log(Logger::Lvl4, domelogmask, domelogname, " Going to set sizes. Max depth found: " << idx);
-      for (int i = MAX(0, idx-3); i >= MAX(0, idx-1-CFG->GetLong("head.dirspacereportdepth", 6)); i--) {
+      const long depth = CFG->GetSnapshot()->dirspacereportdepth;
+      for (int i = MAX(0, idx-3); i >= MAX(0, idx-1-depth); i--) {
         Log(Logger::Lvl4, domelogmask, domelogname, " Inode: " << hierarchy[i] << " Size increment: " << size);
         addtoDirectorySize(hierarchy[i], size);
       }
@@ -1579,26 +1760,18 @@ DmStatus DomeMySql::unlink(ino_t inode)
       // Remove file itself
       Log(Logger::Lvl4, domelogmask, domelogname, "Deleting file entry.  inode:" << inode);
 
-      Statement delFile(this->conn_, CNS_DB, "DELETE FROM Cns_file_metadata WHERE fileid = ?");
+      // A directory only if it is still empty, as something may have been
+      // created in it since it was checked
+      Statement delFile(this->conn_, CNS_DB, S_ISDIR(file.stat.st_mode) ?
+                        "DELETE FROM Cns_file_metadata WHERE fileid = ? AND nlink = 0" :
+                        "DELETE FROM Cns_file_metadata WHERE fileid = ?");
       delFile.bindParam(0, inode);
-      delFile.execute();
+      if (delFile.execute() == 0 && S_ISDIR(file.stat.st_mode))
+        throw DmException(EISDIR, SSTR("Inode " << inode << " is a directory and it is not empty"));
 
       // Decrement parent nlink
       Log(Logger::Lvl4, domelogmask, domelogname, "Fixing parent nlink.  inode:" << inode << " parent: " << parent.stat.st_ino);
-
-      Statement nlinkStmt(this->conn_, CNS_DB, "SELECT nlink FROM Cns_file_metadata WHERE fileid = ? FOR UPDATE");
-      nlinkStmt.bindParam(0, parent.stat.st_ino);
-      nlinkStmt.execute();
-      nlinkStmt.bindResult(0, &parent.stat.st_nlink);
-      nlinkStmt.fetch();
-
-      Statement nlinkUpdate(this->conn_, CNS_DB, "UPDATE Cns_file_metadata\
-      SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
-      WHERE fileid = ?");
-      parent.stat.st_nlink--;
-      nlinkUpdate.bindParam(0, parent.stat.st_nlink);
-      nlinkUpdate.bindParam(1, parent.stat.st_ino);
-      nlinkUpdate.execute();
+      this->addNlink(parent, -1);
 
     }
     // Done!
@@ -1615,7 +1788,12 @@ DmStatus DomeMySql::unlink(ino_t inode)
 
   
   DOMECACHE->wipeEntry(inode, file.parent, file.name);
-  DOMECACHE->pushXstatInfo(parent, DomeFileInfo::Ok);
+  if (atomicNlink)
+    DOMECACHE->addNlink(parent, -1);
+  else
+    DOMECACHE->pushXstatInfo(parent, DomeFileInfo::Ok);
+  DOMECACHE->wipeDirListing(file.parent);
+  DOMECACHE->wipeDirListing(inode);
 
   Log(Logger::Lvl3, domelogmask, domelogname, "Exiting.  inode:" << inode);
   return DmStatus();
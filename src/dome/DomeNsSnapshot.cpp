@@ -0,0 +1,498 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+/** @file   DomeNsSnapshot.cpp
+ * @brief  A read only copy of the namespace in a file, to be queried with mmap
+ *         instead of scanning the db
+ */
+
+#include "DomeNsSnapshot.h"
+#include <algorithm>
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DomeNsSnapshotFormat;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+
+// Deeper than this, there must be a loop
+static const int MAX_DEPTH = 4096;
+
+
+//
+// Writer
+//
+
+namespace {
+
+  struct EntryByFileid {
+    bool operator()(const Entry &a, const Entry &b) const { return a.fileid < b.fileid; }
+    bool operator()(const Entry &a, int64_t b) const { return a.fileid < b; }
+  };
+
+  // By parent, then name
+  struct ChildOrder {
+    ChildOrder(const std::vector<Entry> &e, const std::vector<char> &a): entries(e), arena(a) {}
+    bool operator()(uint64_t a, uint64_t b) const {
+      const Entry &ea = entries[a], &eb = entries[b];
+      if (ea.parentidx != eb.parentidx) return ea.parentidx < eb.parentidx;
+      return strcmp(&arena[ea.name], &arena[eb.name]) < 0;
+    }
+    const std::vector<Entry> &entries;
+    const std::vector<char> &arena;
+  };
+
+  struct ReplicaOrder {
+    bool operator()(const Replica &a, const Replica &b) const {
+      if (a.location != b.location) return a.location < b.location;
+      return a.fileid < b.fileid;
+    }
+  };
+
+  int64_t findEntry(const Entry *entries, uint64_t n, int64_t fileid) {
+    const Entry *e = std::lower_bound(entries, entries + n, fileid, EntryByFileid());
+    if ((e == entries + n) || (e->fileid != fileid))
+      return -1;
+    return e - entries;
+  }
+
+  // Writes a section, padded to a multiple of 8
+  bool writeSection(FILE *f, const void *data, size_t size, uint64_t &off) {
+    static const char zeros[8] = {0};
+    if (size && (fwrite(data, size, 1, f) != 1))
+      return false;
+    off += size;
+    size_t pad = (8 - (size % 8)) % 8;
+    if (pad && (fwrite(zeros, pad, 1, f) != 1))
+      return false;
+    off += pad;
+    return true;
+  }
+
+}
+
+DomeNsSnapshotWriter::DomeNsSnapshotWriter(): sorted(true) {
+}
+
+uint64_t DomeNsSnapshotWriter::addString(const std::string &s) {
+  uint64_t off = arena.size();
+  arena.insert(arena.end(), s.begin(), s.end());
+  arena.push_back('\0');
+  return off;
+}
+
+void DomeNsSnapshotWriter::addEntry(int64_t fileid, int64_t parent, mode_t mode, int64_t size, const std::string &name) {
+  Entry e;
+  memset(&e, 0, sizeof(e));
+  e.fileid = fileid;
+  e.parent = parent;
+  e.parentidx = -1;
+  e.size = size;
+  e.mode = mode;
+  e.name = addString(name);
+
+  if (!entries.empty() && (entries.back().fileid >= fileid))
+    sorted = false;
+  entries.push_back(e);
+}
+
+void DomeNsSnapshotWriter::addReplica(int64_t fileid, const std::string &host, const std::string &fs, char status, const std::string &sfn) {
+  std::pair<std::string, std::string> key(host, fs);
+  std::map<std::pair<std::string, std::string>, uint32_t>::iterator it = locations.find(key);
+  if (it == locations.end())
+    it = locations.insert(std::make_pair(key, (uint32_t)locations.size())).first;
+
+  Replica r;
+  memset(&r, 0, sizeof(r));
+  r.fileid = fileid;
+  r.entryidx = -1;
+  r.sfn = addString(sfn);
+  r.location = it->second;
+  r.status = status;
+  replicas.push_back(r);
+}
+
+int DomeNsSnapshotWriter::write(const std::string &path, std::string &err) {
+  if (!sorted) {
+    std::sort(entries.begin(), entries.end(), EntryByFileid());
+    sorted = true;
+  }
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, snapshotmagic, sizeof(h.magic));
+  h.created = time(0);
+  h.root = -1;
+
+  // Parents as indexes
+  uint64_t n = entries.size();
+  const Entry *e0 = n ? &entries[0] : 0;
+  for (uint64_t i = 0; i < n; i++) {
+    Entry &e = entries[i];
+    e.firstchild = 0;
+    e.nchildren = 0;
+    if (e.parent == 0) {
+      e.parentidx = -1;
+      if (h.root < 0) h.root = i;
+    }
+    else
+      e.parentidx = findEntry(e0, n, e.parent);
+  }
+
+  // The children of each dir, sorted by name
+  std::vector<uint64_t> children;
+  children.reserve(n);
+  for (uint64_t i = 0; i < n; i++)
+    if (entries[i].parentidx >= 0) children.push_back(i);
+  std::sort(children.begin(), children.end(), ChildOrder(entries, arena));
+  for (uint64_t k = 0; k < children.size(); k++) {
+    Entry &p = entries[entries[children[k]].parentidx];
+    if (p.nchildren == 0) p.firstchild = k;
+    p.nchildren++;
+  }
+
+  // The locations, sorted by host and fs
+  std::vector<Location> locs(locations.size());
+  std::vector<uint32_t> newloc(locations.size());
+  uint32_t l = 0;
+  for (std::map<std::pair<std::string, std::string>, uint32_t>::iterator it = locations.begin();
+       it != locations.end(); ++it, ++l) {
+    newloc[it->second] = l;
+    memset(&locs[l], 0, sizeof(Location));
+    locs[l].host = addString(it->first.first);
+    locs[l].fs = addString(it->first.second);
+  }
+
+  for (uint64_t i = 0; i < replicas.size(); i++) {
+    Replica &r = replicas[i];
+    r.location = newloc[r.location];
+    r.entryidx = findEntry(e0, n, r.fileid);
+  }
+  std::sort(replicas.begin(), replicas.end(), ReplicaOrder());
+  for (uint64_t i = 0; i < replicas.size(); i++) {
+    Location &loc = locs[replicas[i].location];
+    if (loc.nreplicas == 0) loc.firstreplica = i;
+    loc.nreplicas++;
+  }
+
+  h.nentries = n;
+  h.nchildren = children.size();
+  h.nreplicas = replicas.size();
+  h.nlocations = locs.size();
+  h.arenasize = arena.size();
+
+  // The offsets, then the data. Write aside and rename, not to break who has it mapped
+  uint64_t off = sizeof(Header) + (8 - sizeof(Header) % 8) % 8;
+  h.entriesoff = off;
+  off += n * sizeof(Entry);
+  h.childrenoff = off;
+  off += children.size() * sizeof(uint64_t);
+  h.replicasoff = off;
+  off += replicas.size() * sizeof(Replica);
+  h.locationsoff = off;
+  off += locs.size() * sizeof(Location);
+  h.arenaoff = off;
+
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (!f) {
+    err = SSTR("Cannot create '" << tmp << "' err: " << errno);
+    return 1;
+  }
+
+  off = 0;
+  bool ok = writeSection(f, &h, sizeof(h), off) &&
+    writeSection(f, e0, n * sizeof(Entry), off) &&
+    writeSection(f, children.empty() ? 0 : &children[0], children.size() * sizeof(uint64_t), off) &&
+    writeSection(f, replicas.empty() ? 0 : &replicas[0], replicas.size() * sizeof(Replica), off) &&
+    writeSection(f, locs.empty() ? 0 : &locs[0], locs.size() * sizeof(Location), off) &&
+    writeSection(f, arena.empty() ? 0 : &arena[0], arena.size(), off);
+
+  ok = ok && (fflush(f) == 0) && (fsync(fileno(f)) == 0);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str())) {
+    err = SSTR("Cannot write '" << path << "' err: " << errno);
+    unlink(tmp.c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+
+//
+// Reader
+//
+
+namespace {
+
+  struct LocationLess {
+    LocationLess(const char *a, bool f): arena(a), withfs(f) {}
+
+    int cmp(const Location &l, const std::pair<std::string, std::string> &k) const {
+      int c = strcmp(arena + l.host, k.first.c_str());
+      if ((c == 0) && withfs) c = strcmp(arena + l.fs, k.second.c_str());
+      return c;
+    }
+    bool operator()(const Location &l, const std::pair<std::string, std::string> &k) const { return cmp(l, k) < 0; }
+    bool operator()(const std::pair<std::string, std::string> &k, const Location &l) const { return cmp(l, k) > 0; }
+
+    const char *arena;
+    bool withfs;
+  };
+
+  struct WalkItem {
+    int64_t idx;
+    int depth;
+    std::string path;
+  };
+
+  struct ChildLess {
+    ChildLess(const Entry *e, const char *a): entries(e), arena(a) {}
+    bool operator()(uint64_t c, const char *name) const { return strcmp(arena + entries[c].name, name) < 0; }
+    const Entry *entries;
+    const char *arena;
+  };
+
+  // A section of count items of the given size fits in the file
+  bool fits(uint64_t off, uint64_t count, size_t size, size_t filesize) {
+    return (off <= filesize) && (count <= (filesize - off) / size);
+  }
+
+}
+
+DomeNsSnapshot::DomeNsSnapshot(): map(0), mapsize(0), hdr(0), entries(0),
+  children(0), replicas(0), locations(0), arena(0) {
+}
+
+DomeNsSnapshot::~DomeNsSnapshot() {
+  close();
+}
+
+int DomeNsSnapshot::open(const std::string &path, std::string &err) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err = SSTR("Cannot open '" << path << "' err: " << errno);
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(Header))) {
+    err = SSTR("'" << path << "' is not a snapshot");
+    ::close(fd);
+    return 1;
+  }
+
+  void *m = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) {
+    err = SSTR("Cannot map '" << path << "' err: " << errno);
+    return 1;
+  }
+
+  map = m;
+  mapsize = st.st_size;
+
+  const Header *h = (const Header *)map;
+  if (memcmp(h->magic, snapshotmagic, sizeof(h->magic)) ||
+      !fits(h->entriesoff, h->nentries, sizeof(Entry), mapsize) ||
+      !fits(h->childrenoff, h->nchildren, sizeof(uint64_t), mapsize) ||
+      !fits(h->replicasoff, h->nreplicas, sizeof(Replica), mapsize) ||
+      !fits(h->locationsoff, h->nlocations, sizeof(Location), mapsize) ||
+      !fits(h->arenaoff, h->arenasize, 1, mapsize) ||
+      (h->root >= (int64_t)h->nentries) ||
+      (h->arenasize && ((const char *)map)[h->arenaoff + h->arenasize - 1])) {
+    err = SSTR("'" << path << "' is not a valid snapshot");
+    close();
+    return 1;
+  }
+
+  hdr = h;
+  entries = (const Entry *)((const char *)map + h->entriesoff);
+  children = (const uint64_t *)((const char *)map + h->childrenoff);
+  replicas = (const Replica *)((const char *)map + h->replicasoff);
+  locations = (const Location *)((const char *)map + h->locationsoff);
+  arena = (const char *)map + h->arenaoff;
+  return 0;
+}
+
+void DomeNsSnapshot::close() {
+  if (map) munmap(map, mapsize);
+  map = 0;
+  mapsize = 0;
+  hdr = 0;
+  entries = 0;
+  children = 0;
+  replicas = 0;
+  locations = 0;
+  arena = 0;
+}
+
+int64_t DomeNsSnapshot::findFileid(int64_t fileid) const {
+  if (!hdr) return -1;
+  return findEntry(entries, hdr->nentries, fileid);
+}
+
+int64_t DomeNsSnapshot::findChild(int64_t idx, const std::string &name) const {
+  const Entry &e = entries[idx];
+  const uint64_t *first = children + e.firstchild, *last = first + e.nchildren;
+  const uint64_t *c = std::lower_bound(first, last, name.c_str(), ChildLess(entries, arena));
+  if ((c == last) || strcmp(arena + entries[*c].name, name.c_str()))
+    return -1;
+  return *c;
+}
+
+int64_t DomeNsSnapshot::lookup(const std::string &path) const {
+  if (!hdr || (hdr->root < 0) || path.empty() || (path[0] != '/'))
+    return -1;
+
+  int64_t idx = hdr->root;
+  size_t pos = 1;
+  while ((idx >= 0) && (pos < path.size())) {
+    size_t end = path.find('/', pos);
+    if (end == std::string::npos) end = path.size();
+    if (end > pos)
+      idx = findChild(idx, path.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return idx;
+}
+
+std::string DomeNsSnapshot::getPath(int64_t idx) const {
+  if (!hdr) return "";
+
+  std::vector<int64_t> chain;
+  while (idx != hdr->root) {
+    if ((idx < 0) || (chain.size() > (size_t)MAX_DEPTH))
+      return "";
+    chain.push_back(idx);
+    idx = entries[idx].parentidx;
+  }
+
+  if (chain.empty())
+    return "/";
+
+  std::string path;
+  for (size_t k = chain.size(); k > 0; k--) {
+    path += "/";
+    path += name(entries[chain[k-1]]);
+  }
+  return path;
+}
+
+void DomeNsSnapshot::walk(int64_t idx, Visitor &v) const {
+  if (!hdr || (idx < 0)) return;
+
+  std::vector<WalkItem> stack(1);
+  stack[0].idx = idx;
+  stack[0].depth = 0;
+  stack[0].path = getPath(idx);
+
+  while (!stack.empty()) {
+    WalkItem it = stack.back();
+    stack.pop_back();
+
+    const Entry &e = entries[it.idx];
+    if (!v.visit(*this, it.idx, it.path) || !S_ISDIR(e.mode) || (it.depth >= MAX_DEPTH))
+      continue;
+
+    // Backwards, so that they are visited in name order
+    const std::string prefix = (it.path == "/") ? "" : it.path;
+    for (uint64_t k = e.nchildren; k > 0; k--) {
+      WalkItem c;
+      c.idx = children[e.firstchild + k - 1];
+      c.depth = it.depth + 1;
+      c.path = prefix + "/" + name(entries[c.idx]);
+      stack.push_back(c);
+    }
+  }
+}
+
+void DomeNsSnapshot::getTreeSize(int64_t idx, int64_t &bytes, int64_t &nfiles) const {
+  bytes = nfiles = 0;
+  if (!hdr || (idx < 0)) return;
+
+  // Like walk, without the paths
+  std::vector<std::pair<int64_t, int> > stack(1, std::make_pair(idx, 0));
+  while (!stack.empty()) {
+    std::pair<int64_t, int> it = stack.back();
+    stack.pop_back();
+
+    const Entry &e = entries[it.first];
+    if (S_ISREG(e.mode)) {
+      bytes += e.size;
+      nfiles++;
+    }
+    else if (S_ISDIR(e.mode) && (it.second < MAX_DEPTH)) {
+      for (uint64_t k = 0; k < e.nchildren; k++)
+        stack.push_back(std::make_pair((int64_t)children[e.firstchild + k], it.second + 1));
+    }
+  }
+}
+
+void DomeNsSnapshot::findLocations(const std::string &host, const std::string &fs, uint64_t &from, uint64_t &to) const {
+  from = to = 0;
+  if (!hdr) return;
+
+  std::pair<const Location *, const Location *> r =
+    std::equal_range(locations, locations + hdr->nlocations, std::make_pair(host, fs), LocationLess(arena, !fs.empty()));
+  from = r.first - locations;
+  to = r.second - locations;
+}
+
+void DomeNsSnapshot::getReplicas(const std::string &host, const std::string &fs, std::vector<const Replica *> &reps) const {
+  uint64_t from, to;
+  findLocations(host, fs, from, to);
+
+  for (uint64_t l = from; l < to; l++) {
+    const Location &loc = locations[l];
+    for (uint64_t i = 0; i < loc.nreplicas; i++)
+      reps.push_back(&replicas[loc.firstreplica + i]);
+  }
+}
+
+void DomeNsSnapshot::getReplicasSize(const std::string &host, const std::string &fs, int64_t &bytes, int64_t &nreplicas) const {
+  bytes = nreplicas = 0;
+  uint64_t from, to;
+  findLocations(host, fs, from, to);
+
+  for (uint64_t l = from; l < to; l++) {
+    const Location &loc = locations[l];
+    for (uint64_t i = 0; i < loc.nreplicas; i++) {
+      const Replica &r = replicas[loc.firstreplica + i];
+      if (r.entryidx >= 0) bytes += entries[r.entryidx].size;
+      nreplicas++;
+    }
+  }
+}
+
+void DomeNsSnapshot::getLocations(std::vector<std::string> &locs) const {
+  if (!hdr) return;
+
+  for (uint64_t l = 0; l < hdr->nlocations; l++)
+    locs.push_back(std::string(arena + locations[l].host) + ":" + (arena + locations[l].fs));
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMENSSNAPSHOT_H
+#define DOMENSSNAPSHOT_H
+
+
+/** @file   DomeNsSnapshot.h
+ * @brief  A read only copy of the namespace in a file, to be queried with mmap
+ *         instead of scanning the db
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/// The layout of a snapshot file. Everything is in the byte order of the
+/// machine that wrote it, and each section starts at a multiple of 8
+namespace DomeNsSnapshotFormat {
+
+  static const char snapshotmagic[8] = {'D', 'O', 'M', 'E', 'N', 'S', 'S', '1'};
+
+  struct Header {
+    char magic[8];
+    uint64_t nentries, nchildren, nreplicas, nlocations, arenasize;
+    int64_t created;
+    /// Index of the root, or -1 if it was not found
+    int64_t root;
+    uint64_t entriesoff, childrenoff, replicasoff, locationsoff, arenaoff;
+  };
+
+  /// An entry of Cns_file_metadata. Sorted by fileid
+  struct Entry {
+    int64_t fileid, parent;
+    /// Index of the parent, -1 for the root or if the parent is missing
+    int64_t parentidx;
+    int64_t size;
+    /// Offset of the name in the arena
+    uint64_t name;
+    /// The children are children[firstchild] to children[firstchild+nchildren-1]
+    uint64_t firstchild;
+    uint32_t nchildren;
+    uint32_t mode;
+  };
+
+  /// An entry of Cns_file_replica. Sorted by location, then fileid
+  struct Replica {
+    int64_t fileid;
+    /// Index of the file, -1 if it is missing
+    int64_t entryidx;
+    /// Offset of the sfn in the arena
+    uint64_t sfn;
+    uint32_t location;
+    char status;
+    char pad[3];
+  };
+
+  /// A server and filesystem, with its replicas. Sorted by host, then fs
+  struct Location {
+    uint64_t host, fs;
+    uint64_t firstreplica, nreplicas;
+  };
+
+}
+
+
+/// Builds a snapshot file. The children of each directory are sorted by name,
+/// so that paths can be looked up without reading the whole thing
+class DomeNsSnapshotWriter {
+public:
+  DomeNsSnapshotWriter();
+
+  /// Adds an entry of the namespace. It is faster if they come in fileid order
+  void addEntry(int64_t fileid, int64_t parent, mode_t mode, int64_t size, const std::string &name);
+
+  /// Adds a replica
+  void addReplica(int64_t fileid, const std::string &host, const std::string &fs, char status, const std::string &sfn);
+
+  /// Writes the snapshot, replacing atomically the given file. Returns 0 on success
+  int write(const std::string &path, std::string &err);
+
+private:
+  uint64_t addString(const std::string &s);
+
+  std::vector<DomeNsSnapshotFormat::Entry> entries;
+  std::vector<DomeNsSnapshotFormat::Replica> replicas;
+  std::vector<char> arena;
+  /// Locations by host and fs, with the index given in the order they were found
+  std::map<std::pair<std::string, std::string>, uint32_t> locations;
+  bool sorted;
+};
+
+
+/// A snapshot file, mapped in memory. Once open, it can be queried by many threads
+class DomeNsSnapshot {
+public:
+  typedef DomeNsSnapshotFormat::Entry Entry;
+  typedef DomeNsSnapshotFormat::Replica Replica;
+  typedef DomeNsSnapshotFormat::Location Location;
+
+  /// Called for each entry found by walk
+  class Visitor {
+  public:
+    virtual ~Visitor() {}
+    /// Returning false does not descend into a directory
+    virtual bool visit(const DomeNsSnapshot &snap, int64_t idx, const std::string &path) = 0;
+  };
+
+  DomeNsSnapshot();
+  ~DomeNsSnapshot();
+
+  /// Maps a snapshot file. Returns 0 on success
+  int open(const std::string &path, std::string &err);
+  void close();
+
+  uint64_t countEntries() const { return hdr ? hdr->nentries : 0; }
+  uint64_t countReplicas() const { return hdr ? hdr->nreplicas : 0; }
+  int64_t created() const { return hdr ? hdr->created : 0; }
+
+  const Entry &entry(int64_t idx) const { return entries[idx]; }
+  const char *name(const Entry &e) const { return arena + e.name; }
+  const char *sfn(const Replica &r) const { return arena + r.sfn; }
+
+  /// Index of the entry with the given fileid, or -1
+  int64_t findFileid(int64_t fileid) const;
+
+  /// Index of the entry with the given absolute path, or -1
+  int64_t lookup(const std::string &path) const;
+
+  /// Index of the child with the given name of a directory, or -1
+  int64_t findChild(int64_t idx, const std::string &name) const;
+
+  /// The absolute path of an entry, empty if it is not below the root
+  std::string getPath(int64_t idx) const;
+
+  /// Visits an entry and everything below it, depth first
+  void walk(int64_t idx, Visitor &v) const;
+
+  /// The total size and number of the regular files below an entry
+  void getTreeSize(int64_t idx, int64_t &bytes, int64_t &nfiles) const;
+
+  /// The replicas on a server, only on a filesystem of it if fs is not empty
+  void getReplicas(const std::string &host, const std::string &fs, std::vector<const Replica *> &reps) const;
+
+  /// The total size and number of the replicas on a server, or one of its filesystems
+  void getReplicasSize(const std::string &host, const std::string &fs, int64_t &bytes, int64_t &nreplicas) const;
+
+  /// All the servers and filesystems, as host:fs
+  void getLocations(std::vector<std::string> &locs) const;
+
+private:
+  // Not copyable
+  DomeNsSnapshot(const DomeNsSnapshot &);
+  DomeNsSnapshot &operator=(const DomeNsSnapshot &);
+
+  /// The locations of a host, as a range
+  void findLocations(const std::string &host, const std::string &fs, uint64_t &from, uint64_t &to) const;
+
+  void *map;
+  size_t mapsize;
+
+  const DomeNsSnapshotFormat::Header *hdr;
+  const Entry *entries;
+  const uint64_t *children;
+  const Replica *replicas;
+  const Location *locations;
+  const char *arena;
+};
+
+
+#endif
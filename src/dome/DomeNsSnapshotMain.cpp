@@ -0,0 +1,223 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/** @file   DomeNsSnapshotMain.cpp
+ * @brief  main() function for dome-nssnapshot, which dumps the namespace to a
+ *         snapshot file and runs the heavy queries on it, away from the db
+ */
+
+#include "DomeLog.h"
+#include "DomeMysql.h"
+#include "DomeNsSnapshot.h"
+#include "utils/Config.hh"
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void usage(const char *name) {
+  cerr << "Usage: " << name << " create <snapshot> [config file] [chunk size]" << endl;
+  cerr << "         reads the namespace from the db of the head node, config file" << endl;
+  cerr << "         defaults to $DOME_CFGFILE, chunk size to 100000" << endl;
+  cerr << "       " << name << " info <snapshot>" << endl;
+  cerr << "       " << name << " find <snapshot> <path>" << endl;
+  cerr << "         everything below path" << endl;
+  cerr << "       " << name << " du <snapshot> <path>" << endl;
+  cerr << "         size and number of the files below path" << endl;
+  cerr << "       " << name << " replicas <snapshot> <host> [fs]" << endl;
+  cerr << "         the replicas on a server or filesystem, with their size and path" << endl;
+  cerr << "       " << name << " locations <snapshot>" << endl;
+  cerr << "         size and number of the replicas on each filesystem" << endl;
+}
+
+static int create(const std::string &snapfile, const std::string &cfgfile, long chunk) {
+  domelogmask = Logger::get()->getMask(domelogname);
+
+  if (CFG->ProcessFile((char *)cfgfile.c_str())) {
+    cerr << "Error processing config file " << cfgfile << endl;
+    return 1;
+  }
+  Logger::get()->setLevel((Logger::Level)CFG->GetLong("glb.debug", 1));
+
+  DomeMySql::configure( CFG->GetString("head.db.host",     (char *)"localhost"),
+                        CFG->GetString("head.db.user",     (char *)"guest"),
+                        CFG->GetString("head.db.password", (char *)"none"),
+                        CFG->GetLong  ("head.db.port",     0),
+                        2 );
+
+  DomeMySql sql;
+  DomeNsSnapshotWriter w;
+  double t0 = now();
+
+  // Both tables in chunks, by primary key, so that no query is long
+  std::vector<DomeMySqlEntry> entries;
+  int64_t last = -1, nentries = 0;
+  for (;;) {
+    entries.clear();
+    int n = sql.getEntries(last, chunk, entries);
+    if (n < 0) {
+      cerr << "Could not read the namespace after fileid " << last << endl;
+      return 1;
+    }
+    for (size_t i = 0; i < entries.size(); i++)
+      w.addEntry(entries[i].fileid, entries[i].parent, entries[i].mode, entries[i].size, entries[i].name);
+    nentries += n;
+    if (n < chunk) break;
+    last = entries.back().fileid;
+  }
+
+  std::vector<DomeMySqlReplicaEntry> replicas;
+  int64_t nreplicas = 0;
+  last = -1;
+  for (;;) {
+    replicas.clear();
+    int n = sql.getReplicaEntries(last, chunk, replicas);
+    if (n < 0) {
+      cerr << "Could not read the replicas after rowid " << last << endl;
+      return 1;
+    }
+    for (size_t i = 0; i < replicas.size(); i++)
+      w.addReplica(replicas[i].fileid, replicas[i].host, replicas[i].fs, replicas[i].status, replicas[i].sfn);
+    nreplicas += n;
+    if (n < chunk) break;
+    last = replicas.back().rowid;
+  }
+
+  double t1 = now();
+  std::string err;
+  if (w.write(snapfile, err)) {
+    cerr << err << endl;
+    return 1;
+  }
+
+  cout << "Entries: " << nentries << " replicas: " << nreplicas << " read in " << (t1 - t0) << "s" << endl;
+  cout << "Snapshot " << snapfile << " written in " << (now() - t1) << "s" << endl;
+  return 0;
+}
+
+class Printer: public DomeNsSnapshot::Visitor {
+public:
+  bool visit(const DomeNsSnapshot &snap, int64_t idx, const std::string &path) {
+    const DomeNsSnapshot::Entry &e = snap.entry(idx);
+    cout << (S_ISDIR(e.mode) ? "d " : "- ") << e.fileid << " " << e.size << " " << path << endl;
+    return true;
+  }
+};
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  std::string cmd = argv[1], snapfile = argv[2];
+
+  if (cmd == "create") {
+    std::string cfgfile;
+    if (argc > 3)
+      cfgfile = argv[3];
+    else {
+      char *c = getenv("DOME_CFGFILE");
+      if (!c) {
+        usage(argv[0]);
+        return -1;
+      }
+      cfgfile = c;
+    }
+
+    long chunk = (argc > 4) ? atol(argv[4]) : 100000;
+    if (chunk <= 0) {
+      usage(argv[0]);
+      return -1;
+    }
+
+    return create(snapfile, cfgfile, chunk);
+  }
+
+  DomeNsSnapshot snap;
+  std::string err;
+  if (snap.open(snapfile, err)) {
+    cerr << err << endl;
+    return 1;
+  }
+
+  if (cmd == "info") {
+    time_t t = snap.created();
+    cout << "Created: " << ctime(&t);
+    cout << "Entries: " << snap.countEntries() << " replicas: " << snap.countReplicas() << endl;
+    return 0;
+  }
+
+  if (((cmd == "find") || (cmd == "du")) && (argc > 3)) {
+    int64_t idx = snap.lookup(argv[3]);
+    if (idx < 0) {
+      cerr << "Not found: " << argv[3] << endl;
+      return 1;
+    }
+
+    if (cmd == "find") {
+      Printer p;
+      snap.walk(idx, p);
+    }
+    else {
+      int64_t bytes, nfiles;
+      snap.getTreeSize(idx, bytes, nfiles);
+      cout << bytes << " bytes in " << nfiles << " files" << endl;
+    }
+    return 0;
+  }
+
+  if ((cmd == "replicas") && (argc > 3)) {
+    std::vector<const DomeNsSnapshot::Replica *> reps;
+    snap.getReplicas(argv[3], (argc > 4) ? argv[4] : "", reps);
+
+    for (size_t i = 0; i < reps.size(); i++) {
+      const DomeNsSnapshot::Replica &r = *reps[i];
+      int64_t size = (r.entryidx >= 0) ? snap.entry(r.entryidx).size : -1;
+      cout << snap.sfn(r) << " " << r.status << " " << size << " " << snap.getPath(r.entryidx) << endl;
+    }
+    return 0;
+  }
+
+  if (cmd == "locations") {
+    std::vector<std::string> locs;
+    snap.getLocations(locs);
+
+    for (size_t i = 0; i < locs.size(); i++) {
+      size_t colon = locs[i].find(':');
+      int64_t bytes, nreplicas;
+      snap.getReplicasSize(locs[i].substr(0, colon), locs[i].substr(colon + 1), bytes, nreplicas);
+      cout << locs[i] << " " << bytes << " bytes in " << nreplicas << " replicas" << endl;
+    }
+    return 0;
+  }
+
+  usage(argv[0]);
+  return -1;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/** @file   DomePlacement.cpp
+ * @brief  A helper class that chooses the filesystem where a new replica is written
+ */
+
+#include "DomePlacement.h"
+#include "DomeStatus.h"
+#include "DomeLog.h"
+#include "utils/logger.h"
+
+#include <stdlib.h>
+
+
+DomePlacement::DomePlacement(): policy(PolicyTwoChoices), timeout(3600), freespacefloor(0) {
+}
+
+void DomePlacement::configure(Policy p, int timeoutsecs, int freespacefloorpct) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  policy = p;
+  timeout = timeoutsecs;
+  freespacefloor = freespacefloorpct;
+}
+
+bool DomePlacement::policyFromString(const std::string &name, Policy &p) {
+  if (name == "freespace") {
+    p = PolicyFreeSpace;
+    return true;
+  }
+  if (name == "twochoices") {
+    p = PolicyTwoChoices;
+    return true;
+  }
+  return false;
+}
+
+std::string DomePlacement::policyToString(Policy p) {
+  switch (p) {
+    case PolicyFreeSpace:
+      return "freespace";
+    case PolicyTwoChoices:
+      return "twochoices";
+  }
+  return "unknown";
+}
+
+DomePlacement::Policy DomePlacement::getPolicy() {
+  boost::unique_lock<boost::mutex> l(*this);
+  return policy;
+}
+
+std::string DomePlacement::fsKey(const DomeFsInfo &fs) {
+  return fs.server + ":" + fs.fs;
+}
+
+long DomePlacement::load(const DomeFsInfo &fs) {
+  long l = 0;
+
+  // The puts going to the filesystem, plus the ones going to its server,
+  // as a busy server is slow for all of its filesystems
+  std::map<std::string, FsCounters>::const_iterator f = fscounters.find(fsKey(fs));
+  if (f != fscounters.end())
+    l += f->second.inflight;
+
+  std::map<std::string, long>::const_iterator s = serverinflight.find(fs.server);
+  if (s != serverinflight.end())
+    l += s->second;
+
+  return l;
+}
+
+int DomePlacement::pick(const std::vector<DomeFsInfo> &candidates) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  // Apply the free space floor, unless nobody is above it
+  std::vector<int> eligible;
+  if (freespacefloor > 0) {
+    for (unsigned int i = 0; i < candidates.size(); i++) {
+      if ( (candidates[i].physicalsize <= 0) ||
+           (candidates[i].freespace * 100 >= candidates[i].physicalsize * freespacefloor) )
+        eligible.push_back(i);
+    }
+  }
+  if (eligible.empty()) {
+    for (unsigned int i = 0; i < candidates.size(); i++)
+      eligible.push_back(i);
+  }
+
+  if ( (policy == PolicyTwoChoices) && (eligible.size() > 1) ) {
+    // Two different candidates at random
+    int a = random() % eligible.size();
+    int b = random() % (eligible.size() - 1);
+    if (b >= a) b++;
+
+    const DomeFsInfo &fsa = candidates[eligible[a]];
+    const DomeFsInfo &fsb = candidates[eligible[b]];
+    long loada = load(fsa);
+    long loadb = load(fsb);
+
+    Log(Logger::Lvl4, domelogmask, domelogname, "Choosing between '" << fsKey(fsa) << "' load: " << loada <<
+      " and '" << fsKey(fsb) << "' load: " << loadb);
+
+    if ( (loada < loadb) || ((loada == loadb) && (fsa.freespace >= fsb.freespace)) )
+      return eligible[a];
+    return eligible[b];
+  }
+
+  // Use the free space as weight for a random choice among the filesystems
+  // Nice algorithm taken from http://stackoverflow.com/questions/1761626/weighted-random-numbers#1761646
+  long sum_of_weight = 0;
+  for (unsigned int i = 0; i < eligible.size(); i++) {
+    sum_of_weight += (candidates[eligible[i]].freespace >> 20);
+  }
+  if (sum_of_weight <= 0)
+    return eligible[random() % eligible.size()];
+
+  // RAND_MAX is sufficiently big for this purpose
+  long rnd = random() % sum_of_weight;
+  for (unsigned int i = 0; i < eligible.size(); i++) {
+    if (rnd < (candidates[eligible[i]].freespace >> 20))
+      return eligible[i];
+    rnd -= (candidates[eligible[i]].freespace >> 20);
+  }
+
+  return eligible[0];
+}
+
+void DomePlacement::putStarted(const std::string &rfn, const DomeFsInfo &fs, time_t timenow) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  // The same rfn twice would be a bug somewhere else, don't count it twice
+  if (inflight.find(rfn) != inflight.end())
+    return;
+
+  InFlightPut put;
+  put.server = fs.server;
+  put.fskey = fsKey(fs);
+  put.starttime = timenow;
+  inflight[rfn] = put;
+
+  FsCounters &c = fscounters[put.fskey];
+  c.inflight++;
+  c.placed++;
+  serverinflight[put.server]++;
+}
+
+void DomePlacement::putFinished(const std::string &rfn) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  std::map<std::string, InFlightPut>::iterator p = inflight.find(rfn);
+  if (p == inflight.end())
+    return;
+
+  FsCounters &c = fscounters[p->second.fskey];
+  c.inflight--;
+  c.completed++;
+  serverinflight[p->second.server]--;
+
+  inflight.erase(p);
+}
+
+int DomePlacement::tick(time_t timenow) {
+  boost::unique_lock<boost::mutex> l(*this);
+  int n = 0;
+
+  std::map<std::string, InFlightPut>::iterator p = inflight.begin();
+  while (p != inflight.end()) {
+    if (timenow - p->second.starttime < timeout) {
+      ++p;
+      continue;
+    }
+
+    Log(Logger::Lvl2, domelogmask, domelogname, "Put of '" << p->first << "' did not finish in " << timeout << "s. Not in flight anymore.");
+
+    FsCounters &c = fscounters[p->second.fskey];
+    c.inflight--;
+    c.expired++;
+    serverinflight[p->second.server]--;
+
+    inflight.erase(p++);
+    n++;
+  }
+
+  return n;
+}
+
+void DomePlacement::getCounters(std::map<std::string, FsCounters> &fsc, std::map<std::string, long> &srvinflight) {
+  boost::unique_lock<boost::mutex> l(*this);
+
+  fsc = fscounters;
+  srvinflight = serverinflight;
+}
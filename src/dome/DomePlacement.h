@@ -0,0 +1,119 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DOMEPLACEMENT_H
+#define DOMEPLACEMENT_H
+
+
+/** @file   DomePlacement.h
+ * @brief  A helper class that chooses the filesystem where a new replica is written
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <boost/thread.hpp>
+
+class DomeFsInfo;
+
+/// Placement engine for new replicas.
+/// Keeps track of the puts that are in flight towards each filesystem and
+/// each server, from dome_put until the matching dome_putdone, or until they
+/// time out. The destination of a put is chosen among the candidates
+/// looking at this load together with the free space, according to the policy.
+class DomePlacement: public boost::mutex {
+public:
+
+  enum Policy {
+    /// Random choice weighted on the free space. What dome always did.
+    PolicyFreeSpace = 0,
+    /// Pick two candidates at random, keep the one with less puts in flight.
+    /// Ties go to the one with more free space.
+    PolicyTwoChoices
+  };
+
+  /// Counters of a filesystem, as shown by dome_info
+  struct FsCounters {
+    FsCounters(): inflight(0), placed(0), completed(0), expired(0) {}
+
+    /// Puts that did not finish yet
+    long inflight;
+    /// Puts ever sent to this filesystem
+    long placed;
+    /// Puts that finished with a putdone
+    long completed;
+    /// Puts that never got a putdone, and timed out
+    long expired;
+  };
+
+  DomePlacement();
+
+  /// Set the behaviour
+  /// @param policy the placement policy
+  /// @param timeoutsecs the time after which a put without putdone is not considered in flight anymore
+  /// @param freespacefloorpct filesystems with less than this percentage of free space are
+  ///                          chosen only if there are no others
+  void configure(Policy policy, int timeoutsecs, int freespacefloorpct);
+
+  /// Parse the name of a policy. Returns false if it's not known.
+  static bool policyFromString(const std::string &name, Policy &policy);
+  static std::string policyToString(Policy policy);
+
+  Policy getPolicy();
+
+  /// Choose one among the candidate filesystems. Gives back its index.
+  /// The candidates must be all good for writing, and there must be at least one.
+  int pick(const std::vector<DomeFsInfo> &candidates);
+
+  /// A put of rfn to the given filesystem has been accepted
+  void putStarted(const std::string &rfn, const DomeFsInfo &fs, time_t timenow);
+
+  /// A put of rfn has finished, successfully or not. Unknown rfns are ignored.
+  void putFinished(const std::string &rfn);
+
+  /// Forget the puts that are in flight since too long. Returns how many expired.
+  int tick(time_t timenow);
+
+  /// Get a copy of the counters, by server:fs, and the number of puts in flight by server
+  void getCounters(std::map<std::string, FsCounters> &fscounters, std::map<std::string, long> &serverinflight);
+
+private:
+  struct InFlightPut {
+    std::string server;
+    std::string fskey;
+    time_t starttime;
+  };
+
+  /// How loaded a candidate is
+  long load(const DomeFsInfo &fs);
+
+  static std::string fsKey(const DomeFsInfo &fs);
+
+  Policy policy;
+  int timeout;
+  int freespacefloor;
+
+  /// The puts in flight, by rfn
+  std::map<std::string, InFlightPut> inflight;
+  /// Counters by server:fs
+  std::map<std::string, FsCounters> fscounters;
+  /// Puts in flight by server
+  std::map<std::string, long> serverinflight;
+};
+
+#endif
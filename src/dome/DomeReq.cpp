@@ -25,6 +25,7 @@
 
 #include "DomeReq.h"
 #include "DomeLog.h"
+#include "DomeJson.h"
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include "cpp/utils/urls.h"
@@ -43,9 +44,18 @@ DomeReq::DomeReq(FCGX_Request &request) {
 //  if ( (s = FCGX_GetParam("HTTP_CMD", request.envp)) )
 //    domecmd = s;
 
-  std::vector<std::string> vecurl = dmlite::Url::splitPath(object);
-  if (vecurl.size() > 1)
-    domecmd = vecurl[vecurl.size()-1];
+  // The command is the last component, if there is more than one
+  dmlite::PathIterator component(object);
+  unsigned ncomponents = 0;
+  const char* last = NULL;
+  size_t lastlen = 0;
+  while (component.next()) {
+    ++ncomponents;
+    last = component.data();
+    lastlen = component.size();
+  }
+  if (ncomponents > 1)
+    domecmd.assign(last, lastlen);
 
   // Extract the authz info about the remote user
   if ( (s = FCGX_GetParam("HTTP_REMOTECLIENTDN", request.envp)) ) {
@@ -66,35 +76,34 @@ DomeReq::DomeReq(FCGX_Request &request) {
     this->clienthost = s;
 
 
-  // We assume that the body fits in 4K, otherwise we ignore it ?!?
-  char buf[4096];
-  int nb = FCGX_GetStr(buf, sizeof(buf)-1, request.in);
-  if (nb < (int)sizeof(buf)) {
-    buf[nb] = '\0';
-    Log(Logger::Lvl4, domelogmask, domelogname, "Body: '" << buf << "'");
+  // Read the whole body, whatever its size. FCGX_GetStr gives less than
+  // asked only at the end of the stream
+  std::string body;
+  char buf[65536];
+  int nb;
+  while ( (nb = FCGX_GetStr(buf, sizeof(buf), request.in)) > 0 ) {
+    body.append(buf, nb);
+    if (nb < (int)sizeof(buf)) break;
   }
+  Log(Logger::Lvl4, domelogmask, domelogname, "Body: '" << body << "'");
 
-  takeJSONbodyfields( buf );
+  takeJSONbodyfields( body.data(), body.size() );
 }
 
 
-int DomeReq::takeJSONbodyfields(char *body) {
+int DomeReq::takeJSONbodyfields(const char *body, size_t len) {
 
   // We assume that the body that we received is in JSON format
-  std::istringstream s(body);
-  Log(Logger::Lvl4, domelogmask, domelogname, "Entering: '" << body << "'");
-  if ( strlen(body) > 2 ) {
-
-    try {
-      boost::property_tree::read_json(s, bodyfields);
-    } catch (boost::property_tree::json_parser_error e) {
-      Err("takeJSONbodyfields", "Could not process JSON: " << e.what() << " '" << body << "'");
-      return -1;
-    }
+  Log(Logger::Lvl4, domelogmask, domelogname, "Entering. Body size: " << len);
 
+  std::string err;
+  if (DomeJsonReader::parse(body, len, bodyfields, err)) {
+    Err("takeJSONbodyfields", "Could not process JSON: " << err << " '" << std::string(body, len) << "'");
+    bodyfields.clear();
+    return -1;
   }
 
-  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting: '" << body << "'");
+  Log(Logger::Lvl3, domelogmask, domelogname, "Exiting. Body size: " << len);
   return 0;
 }
 
@@ -61,7 +61,7 @@ public:
 
     /// Fills the fields from a JSON representation, usually taken from the body of the incoming request
     /// Returns 0 if OK
-    int takeJSONbodyfields(char *body);
+    int takeJSONbodyfields(const char *body, size_t len);
 
     /// The request also may carry information about the client that submitted it.
     /// For example, these will be the credentials of a disk server.
@@ -31,6 +31,8 @@
 #include "utils/DomeUtils.h"
 #include "utils/Config.hh"
 #include <sys/vfs.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include "utils/DomeTalker.h"
 #include <values.h>
@@ -38,6 +40,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <fstream>
 
 #include <sys/types.h>
@@ -55,7 +58,7 @@
 using namespace dmlite;
 
 
-bool DomeFsInfo::canPullFile(DomeStatus &st) {
+bool DomeFsInfo::canPullFile(DomeStatus &st) const {
   char pooltype;
   int64_t defsz;
   st.getPoolInfo(poolname, defsz, pooltype);
@@ -65,6 +68,9 @@ bool DomeFsInfo::canPullFile(DomeStatus &st) {
 DomeStatus::DomeStatus() {
   davixPool = NULL;
   lastreloadusersgroups = lastfscheck = lastreload = 0;
+  lastfullreloadusersgroups = lastfullfscheck = lastfullreload = 0;
+  gridmapmtime = 0;
+  gridmapsize = -1;
 
   struct addrinfo hints, *info, *p;
   int gai_result;
@@ -122,12 +128,32 @@ long DomeStatus::getGlobalputcount() {
 
 
 /// Helper function that reloads all the filesystems from the DB or asking the head node
-int DomeStatus::loadFilesystems() {
+int DomeStatus::loadFilesystems(bool full) {
 
   if (role == roleHead) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     DomeMySql sql;
-    sql.getPools(*this);
-    return sql.getFilesystems(*this);
+    std::string tables = "dpm_db.dpm_fs, dpm_db.dpm_pool";
+
+    if (!tablesChanged(sql, tables, full)) {
+      noteReloadSkipped("filesystems");
+      return filesystems.get()->fslist.size();
+    }
+
+    std::map<std::string, DomePoolInfo> pools;
+    std::vector<DomeFsInfo> fss;
+    int npools = sql.getPools(pools);
+    int nfs = sql.getFilesystems(fss);
+    if ((npools < 0) || (nfs < 0)) {
+      forgetChecksum(tables);
+      return -1;
+    }
+
+    int applied = updatePools(pools);
+    applied += updateFilesystems(fss);
+    noteReload("filesystems", full, start, npools + nfs, applied);
+    return nfs;
   }
 
   // Disk node case. We ask the head node and match the
@@ -145,11 +171,11 @@ int DomeStatus::loadFilesystems() {
 
   Log(Logger::Lvl4, domelogmask, domelogname, "Head node answered: '" << talker.response() << "'");
 
+  // Parse the answer first, the status is locked only to merge it
+  std::vector<DomeFsInfo> learnt;
+  std::vector<DomePoolInfo> learntpools;
   try {
 
-    // Now overwrite the fs entries we have with the ones we got
-    boost::unique_lock<boost::recursive_mutex> l(*this);
-
     // Loop on the servers of the response, looking for one that matches this server
     BOOST_FOREACH(const boost::property_tree::ptree::value_type &srv, talker.jresp().get_child("fsinfo.")) {
       // v.first is the name of the server.
@@ -159,81 +185,186 @@ int DomeStatus::loadFilesystems() {
       // Now loop on the filesystems of the response
       // Now we loop through the filesystems reported by this server
       BOOST_FOREACH(const boost::property_tree::ptree::value_type &fs, srv.second) {
-        // v.first is the name of the server.
-        // v.second is the child tree representing the server
-
-
-        // Find the corresponding server:fs info in our array, and get the counters
-        bool found = false;
-        Log(Logger::Lvl4, domelogmask, domelogname, "Processing: " << srv.first << " " << fs.first);
-        for (unsigned int ii = 0; ii < fslist.size(); ii++) {
-
-          Log(Logger::Lvl4, domelogmask, domelogname, "Checking: " << fslist[ii].server << " " << fslist[ii].fs);
-          if (fslist[ii].fs == fs.first) {
-            found = true;
-            break;
-          }
-        }
-        if (!found) {
-          Log(Logger::Lvl1, domelogmask, domelogname, "Learning new fs from head node: " << srv.first << ":" << fs.first <<
-          " poolname: '" << fs.second.get<std::string>("poolname") << "'" );
-
-          DomeFsInfo newfs;
-          newfs.poolname = fs.second.get<std::string>("poolname");;
-          newfs.server = myhostname;
-          servers.insert(myhostname);
-          newfs.fs = fs.first;
-
-          fslist.push_back(newfs);
-        }
-
+        DomeFsInfo newfs;
+        newfs.poolname = fs.second.get<std::string>("poolname");
+        newfs.server = myhostname;
+        newfs.fs = fs.first;
+        learnt.push_back(newfs);
       } // foreach
 
-
     } // foreach
 
+    // Learn the pools too, we need to know which ones are volatile
+    boost::optional<const boost::property_tree::ptree &> pools = talker.jresp().get_child_optional("poolinfo");
+    if (pools) {
+      BOOST_FOREACH(const boost::property_tree::ptree::value_type &pool, *pools) {
+        DomePoolInfo pi;
+        pi.poolname = pool.first;
+        pi.defsize = pool.second.get<int64_t>("defsize", -1);
+        std::string stype = pool.second.get<std::string>("s_type", "");
+        if (stype.size() > 0)
+          pi.stype = stype[0];
+        else
+          pi.stype = '\0';
+        learntpools.push_back(pi);
+      }
+    }
+
   }
   catch (boost::property_tree::ptree_error &e) {
     Err("loadFilesystems", "Could not process JSON: " << e.what() << " '" << talker.response() << "'");
     return -1;
   }
 
+  // Now add the fs entries we did not have yet
+  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<DomeFsTables> t = filesystems.copy();
+
+  for (unsigned int i = 0; i < learnt.size(); i++) {
+    // Find the corresponding server:fs info in our array
+    bool found = false;
+    Log(Logger::Lvl4, domelogmask, domelogname, "Processing: " << learnt[i].server << " " << learnt[i].fs);
+    for (unsigned int ii = 0; ii < t->fslist.size(); ii++) {
+      Log(Logger::Lvl4, domelogmask, domelogname, "Checking: " << t->fslist[ii].server << " " << t->fslist[ii].fs);
+      if (t->fslist[ii].fs == learnt[i].fs) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      Log(Logger::Lvl1, domelogmask, domelogname, "Learning new fs from head node: " << learnt[i].server << ":" << learnt[i].fs <<
+      " poolname: '" << learnt[i].poolname << "'" );
+      t->servers.insert(myhostname);
+      t->fslist.push_back(learnt[i]);
+    }
+  }
+
+  // Values that were not in the answer stay as they were
+  for (unsigned int i = 0; i < learntpools.size(); i++) {
+    DomePoolInfo &pi = t->poolslist[learntpools[i].poolname];
+    pi.poolname = learntpools[i].poolname;
+    if (learntpools[i].defsize >= 0)
+      pi.defsize = learntpools[i].defsize;
+    if (learntpools[i].stype)
+      pi.stype = learntpools[i].stype;
+  }
+
+  filesystems.set(t);
   return 0;
 }
 
 /// Helper function that reloads all the quotas from the DB
-int DomeStatus::loadQuotatokens() {
+int DomeStatus::loadQuotatokens(bool full) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
   DomeMySql sql;
+  std::string tables = "dpm_db.dpm_space_reserv";
 
-  return sql.getSpacesQuotas(*this);
+  if (!tablesChanged(sql, tables, full)) {
+    noteReloadSkipped("quotatokens");
+    return quotatokens.get()->quotas.size();
+  }
+
+  std::vector<DomeQuotatoken> tokens;
+  int cnt = sql.getSpacesQuotas(tokens);
+  if (cnt < 0) {
+    forgetChecksum(tables);
+    return cnt;
+  }
+
+  noteReload("quotatokens", full, start, cnt, updateQuotatokens(tokens));
+  return cnt;
 }
 
 /// Helper function that reloads all the users from the DB. Returns 0 on failure
-int DomeStatus::loadUsersGroups() {
+int DomeStatus::loadUsersGroups(bool full) {
 
   if (role != roleHead) return 1;
 
   DomeMySql sql;
+  struct timespec start;
 
-  sql.getUsers(*this);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bool complete = hasChecksum("cns_db.Cns_userinfo");
+  if (!tablesChanged(sql, "cns_db.Cns_userinfo", full))
+    noteReloadSkipped("users");
+  else {
+    // Users are mostly added, with growing uids. So first look only for new ones,
+    // then read them all if that does not explain the change.
+    // Only after a complete read, as the last one may have missed other changes
+    int64_t afteruid = -1;
+    boost::shared_ptr<const DomeUserTables> ugt = usersgroups.get();
+    if (!full && complete && !ugt->usersbyuid.empty())
+      afteruid = ugt->usersbyuid.rbegin()->first;
+
+    std::vector<DomeUserInfo> users;
+    int cnt = sql.getUsers(users, afteruid);
+    if ((cnt == 0) && (afteruid >= 0)) {
+      afteruid = -1;
+      cnt = sql.getUsers(users);
+    }
 
-  sql.getGroups(*this);
+    // New users do not tell that the others were not changed too, e.g. banned.
+    // Forgetting the checksum makes the next reload read them all
+    if ((cnt < 0) || (afteruid >= 0))
+      forgetChecksum("cns_db.Cns_userinfo");
+    if (cnt >= 0)
+      noteReload("users", afteruid < 0, start, cnt, insertUsers(users));
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  complete = hasChecksum("cns_db.Cns_groupinfo");
+  if (!tablesChanged(sql, "cns_db.Cns_groupinfo", full))
+    noteReloadSkipped("groups");
+  else {
+    int64_t aftergid = -1;
+    boost::shared_ptr<const DomeUserTables> ugt = usersgroups.get();
+    if (!full && complete && !ugt->groupsbygid.empty())
+      aftergid = ugt->groupsbygid.rbegin()->first;
+
+    std::vector<DomeGroupInfo> groups;
+    int cnt = sql.getGroups(groups, aftergid);
+    if ((cnt == 0) && (aftergid >= 0)) {
+      aftergid = -1;
+      cnt = sql.getGroups(groups);
+    }
+
+    if ((cnt < 0) || (aftergid >= 0))
+      forgetChecksum("cns_db.Cns_groupinfo");
+    if (cnt >= 0)
+      noteReload("groups", aftergid < 0, start, cnt, insertGroups(groups));
+  }
 
   // Make sure that group 0 (root) always exists
-  DomeGroupInfo gi;
-  if ( !getGroup(0, gi) ) {
-    gi.banned = DomeGroupInfo::NoBan;
-    gi.groupid = 0;
-    gi.groupname = "root";
-    gi.xattr = "";
-    insertGroup(gi);
+  {
+    boost::unique_lock<boost::recursive_mutex> l(*this);
+    if (usersgroups.get()->groupsbygid.find(0) == usersgroups.get()->groupsbygid.end()) {
+      DomeGroupInfo gi;
+      gi.banned = DomeGroupInfo::NoBan;
+      gi.groupid = 0;
+      gi.groupname = "root";
+      gi.xattr = "";
+      insertGroup(gi);
+    }
   }
 
-  // And now also load the gridmap file
+  // And now also load the gridmap file, if it was touched
   int cnt = 0;
   FILE *mf;
   std::string gridmapfile = CFG->GetString("head.gridmapfile", (char *)"/etc/lcgdm-mapfile");
   char buf[1024];
+  struct stat gst;
+
+  memset(&gst, 0, sizeof(gst));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!stat(gridmapfile.c_str(), &gst)) {
+    boost::unique_lock<boost::mutex> l(reloadmtx);
+    if (!full && (gst.st_mtime == gridmapmtime) && (gst.st_size == gridmapsize)) {
+      l.unlock();
+      noteReloadSkipped("gridmap");
+      return 1;
+    }
+  }
 
   if ((mf = fopen(gridmapfile.c_str(), "r")) == NULL) {
     buf[0] = '\0';
@@ -246,8 +377,8 @@ int DomeStatus::loadUsersGroups() {
   char *p, *q;
   char *user, *vo;
 
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-  gridmap.clear();
+  // The file is parsed without locking, and then published
+  std::multimap <std::string, std::string> gridmap;
 
   while (fgets(buf, sizeof(buf), mf)) {
     buf[strlen (buf) - 1] = '\0';
@@ -300,26 +431,197 @@ int DomeStatus::loadUsersGroups() {
   if (fclose(mf))
     Err(domelogname, "Error closing file '" << gridmapfile.c_str() << "'");
 
+  {
+    boost::unique_lock<boost::recursive_mutex> l(*this);
+    boost::shared_ptr<DomeUserTables> t = usersgroups.copy();
+    t->gridmap.swap(gridmap);
+    usersgroups.set(t);
+  }
+
+  {
+    boost::unique_lock<boost::mutex> l(reloadmtx);
+    gridmapmtime = gst.st_mtime;
+    gridmapsize = gst.st_size;
+  }
+  noteReload("gridmap", true, start, cnt, cnt);
+
   return 1;
 }
 
-void DomeStatus::updateQuotatokens(const std::vector<DomeQuotatoken> &tokens) {
-   boost::unique_lock<boost::recursive_mutex> l(*this);
+bool DomeStatus::tablesChanged(DomeMySql &sql, const std::string &tables, bool full) {
+  uint64_t checksum;
+
+  if (sql.getTablesChecksum(tables, checksum)) {
+    // We can't tell, better read them
+    forgetChecksum(tables);
+    return true;
+  }
+
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  std::map<std::string, uint64_t>::iterator it = tablechecksums.find(tables);
+  bool changed = (full || (it == tablechecksums.end()) || (it->second != checksum));
+  tablechecksums[tables] = checksum;
+
+  return changed;
+}
+
+bool DomeStatus::hasChecksum(const std::string &tables) {
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  return (tablechecksums.find(tables) != tablechecksums.end());
+}
+
+void DomeStatus::forgetChecksum(const std::string &tables) {
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  tablechecksums.erase(tables);
+}
+
+void DomeStatus::noteReload(const std::string &what, bool full, const struct timespec &start, long read, long applied) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long duration = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+  Log(Logger::Lvl1, domelogmask, domelogname, "Reloaded " << what << (full ? " (full)" : " (incremental)") <<
+    " in " << duration << " ms. Read: " << read << " applied: " << applied);
+
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  ReloadStats &rs = reloadstats[what];
+  rs.reloads++;
+  if (full) rs.fullreloads++;
+  rs.duration = duration;
+  rs.read = read;
+  rs.applied = applied;
+}
+
+void DomeStatus::noteReloadSkipped(const std::string &what) {
+  Log(Logger::Lvl4, domelogmask, domelogname, "Unchanged, not reloading " << what);
+
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  reloadstats[what].skipped++;
+}
+
+void DomeStatus::getReloadStats(std::map<std::string, ReloadStats> &stats) {
+  boost::unique_lock<boost::mutex> l(reloadmtx);
+  stats = reloadstats;
+}
+
+static bool sameQuotatoken(const DomeQuotatoken &a, const DomeQuotatoken &b) {
+  return (a.rowid == b.rowid) && (a.s_token == b.s_token) && (a.u_token == b.u_token) &&
+    (a.poolname == b.poolname) && (a.t_space == b.t_space) && (a.path == b.path) &&
+    (a.groupsforwrite == b.groupsforwrite) && (a.s_uid == b.s_uid) && (a.s_gid == b.s_gid);
+}
+
+static bool sameFs(const DomeFsInfo &a, const DomeFsInfo &b) {
+  return (a.poolname == b.poolname) && (a.server == b.server) && (a.fs == b.fs) && (a.status == b.status);
+}
+
+static bool samePool(const DomePoolInfo &a, const DomePoolInfo &b) {
+  return (a.poolname == b.poolname) && (a.defsize == b.defsize) && (a.stype == b.stype);
+}
+
+static bool sameUser(const DomeUserInfo &a, const DomeUserInfo &b) {
+  return (a.userid == b.userid) && (a.username == b.username) && (a.banned == b.banned) &&
+    (a.ca == b.ca) && (a.xattr == b.xattr);
+}
+
+static bool sameGroup(const DomeGroupInfo &a, const DomeGroupInfo &b) {
+  return (a.groupid == b.groupid) && (a.groupname == b.groupname) && (a.banned == b.banned) &&
+    (a.xattr == b.xattr);
+}
+
+int DomeStatus::updateQuotatokens(const std::vector<DomeQuotatoken> &tokens) {
+  // overwrite all quotatokens with those in the vector
+  boost::shared_ptr<DomeQuotaTables> t(new DomeQuotaTables);
+  typedef std::multimap<std::string, DomeQuotatoken>::const_iterator MapIter;
 
-   // overwrite all quotatokens with those in the vector
-   quotas.clear();
+  for(size_t i = 0; i < tokens.size(); i++) {
+    t->quotas.insert(std::pair<std::string, DomeQuotatoken>(tokens[i].path, tokens[i]));
+  }
+
+  boost::unique_lock<boost::recursive_mutex> l(*this);
 
-   for(size_t i = 0; i < tokens.size(); i++) {
-     quotas.insert(std::pair<std::string, DomeQuotatoken>(tokens[i].path, tokens[i]));
-   }
+  // Count what is different, matching the tokens of the same path in both directions
+  boost::shared_ptr<const DomeQuotaTables> old = quotatokens.get();
+  int changes = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    const std::multimap<std::string, DomeQuotatoken> &from = pass ? old->quotas : t->quotas;
+    const std::multimap<std::string, DomeQuotatoken> &to = pass ? t->quotas : old->quotas;
+
+    for (MapIter it = from.begin(); it != from.end(); ++it) {
+      std::pair<MapIter, MapIter> intv = to.equal_range(it->first);
+      MapIter m = intv.first;
+      while ((m != intv.second) && !sameQuotatoken(m->second, it->second)) ++m;
+      if (m == intv.second) changes++;
+    }
+  }
+
+  if (changes)
+    quotatokens.set(t);
+  return changes;
+}
+
+int DomeStatus::updatePools(const std::map<std::string, DomePoolInfo> &pools) {
+  boost::unique_lock<boost::recursive_mutex> l(*this);
+
+  boost::shared_ptr<const DomeFsTables> old = filesystems.get();
+  int changes = 0;
+  for (std::map<std::string, DomePoolInfo>::const_iterator it = pools.begin(); it != pools.end(); ++it) {
+    std::map<std::string, DomePoolInfo>::const_iterator o = old->poolslist.find(it->first);
+    if ((o == old->poolslist.end()) || !samePool(o->second, it->second)) changes++;
+  }
+  for (std::map<std::string, DomePoolInfo>::const_iterator o = old->poolslist.begin(); o != old->poolslist.end(); ++o) {
+    if (pools.find(o->first) == pools.end()) changes++;
+  }
+
+  if (changes) {
+    boost::shared_ptr<DomeFsTables> t = filesystems.copy();
+    t->poolslist = pools;
+    filesystems.set(t);
+  }
+  return changes;
 }
 
-int DomeStatus::getPoolSpaces(std::string &poolname, long long &total, long long &free, int &poolstatus) {
+int DomeStatus::updateFilesystems(const std::vector<DomeFsInfo> &fss) {
+  boost::unique_lock<boost::recursive_mutex> l(*this);
+
+  boost::shared_ptr<const DomeFsTables> old = filesystems.get();
+  boost::shared_ptr<DomeFsTables> t(new DomeFsTables);
+  t->poolslist = old->poolslist;
+  t->fslist = fss;
+
+  int changes = 0;
+  std::vector<bool> kept(old->fslist.size(), false);
+  for (unsigned int i = 0; i < t->fslist.size(); i++) {
+    DomeFsInfo &fs = t->fslist[i];
+    t->servers.insert(fs.server);
+
+    // If the fs was already in memory, keep its status
+    bool same = false;
+    for (unsigned int j = 0; j < old->fslist.size(); j++) {
+      if (PfnMatchesFS(fs.server, fs.fs, old->fslist[j])) {
+        fs.activitystatus = old->fslist[j].activitystatus;
+        fs.freespace = old->fslist[j].freespace;
+        fs.physicalsize = old->fslist[j].physicalsize;
+        same = sameFs(fs, old->fslist[j]);
+        kept[j] = true;
+        break;
+      }
+    }
+    if (!same) changes++;
+  }
+  changes += std::count(kept.begin(), kept.end(), false);
+
+  if (changes)
+    filesystems.set(t);
+  return changes;
+}
+
+int DomeStatus::getPoolSpaces(const std::string &poolname, long long &total, long long &free, int &poolstatus) {
   total = 0LL;
   free = 0LL;
   bool rc = 1;
   poolstatus = DomeFsInfo::FsStaticDisabled;
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+  const std::vector<DomeFsInfo> &fslist = fss->fslist;
 
   // Loop over the filesystems and just sum the numbers
   for (unsigned int i = 0; i < fslist.size(); i++)
@@ -346,9 +648,10 @@ int DomeStatus::getPoolSpaces(std::string &poolname, long long &total, long long
   return rc;
 }
 
-bool DomeStatus::existsPool(std::string &poolname) {
+bool DomeStatus::existsPool(const std::string &poolname) {
 
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+  const std::vector<DomeFsInfo> &fslist = fss->fslist;
 
   // Loop over the filesystems and just sum the numbers
   for (unsigned int i = 0; i < fslist.size(); i++)
@@ -359,19 +662,23 @@ bool DomeStatus::existsPool(std::string &poolname) {
   return false;
 }
 
-bool DomeStatus::getPoolInfo(std::string &poolname, int64_t &pool_defsize, char &pool_stype) {
+bool DomeStatus::getPoolInfo(const std::string &poolname, int64_t &pool_defsize, char &pool_stype) {
 
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+  const std::vector<DomeFsInfo> &fslist = fss->fslist;
 
   // Loop over the filesystems and just sum the numbers
   for (unsigned int i = 0; i < fslist.size(); i++)
     if (fslist[i].poolname == poolname) {
-      try {
-        pool_defsize = poolslist[fslist[i].poolname].defsize;
-        pool_stype = poolslist[fslist[i].poolname].stype;
-      }catch ( ... ) {
-        pool_defsize = 0;
-        pool_stype = 'P';
+      std::map <std::string, DomePoolInfo>::const_iterator p = fss->poolslist.find(poolname);
+      if (p != fss->poolslist.end()) {
+        pool_defsize = p->second.defsize;
+        pool_stype = p->second.stype;
+      }
+      else {
+        DomePoolInfo defaults;
+        pool_defsize = defaults.defsize;
+        pool_stype = defaults.stype;
       }
       return true;
     }
@@ -425,31 +732,46 @@ int DomeStatus::tick(time_t timenow) {
   if ( this->role == this->roleHead && (timenow - lastreload >= CFG->GetLong("glb.reloadfsquotas", 60)) ) {
     // At regular intervals, one minute or so,
     // reloading the filesystems and the quotatokens is a good idea
-    Log(Logger::Lvl4, domelogmask, domelogname, "Reloading quotas.");
-    loadQuotatokens();
+    // Only if they changed, and completely once in a while
+    bool full = (timenow - lastfullreload >= CFG->GetLong("glb.fullreloadinterval", 600));
+    Log(Logger::Lvl4, domelogmask, domelogname, "Reloading quotas. full: " << full);
+    loadQuotatokens(full);
 
     lastreload = timenow;
+    if (full) lastfullreload = timenow;
   }
 
   if ( this->role == this->roleHead && (timenow - lastreloadusersgroups >= CFG->GetLong("glb.reloadusersgroups", 60)) ) {
     // At regular intervals, one minute or so,
     // reloading the users and groups tables is a good idea
-    Log(Logger::Lvl4, domelogmask, domelogname, "Reloading users/groups.");
-    loadUsersGroups();
+    bool full = (timenow - lastfullreloadusersgroups >= CFG->GetLong("glb.fullreloadinterval", 600));
+    Log(Logger::Lvl4, domelogmask, domelogname, "Reloading users/groups. full: " << full);
+    loadUsersGroups(full);
 
     lastreloadusersgroups = timenow;
+    if (full) lastfullreloadusersgroups = timenow;
   }
 
+  // Forget the puts that never got their putdone
+  if (this->role == this->roleHead)
+    placement.tick(timenow);
+
   if ( timenow - lastfscheck >= CFG->GetLong("glb.fscheckinterval", 60)) {
     // At regular intervals, one minute or so,
     // checking the filesystems is a good idea for a disk server
     Log(Logger::Lvl4, domelogmask, domelogname, "Checking disk spaces.");
 
+    bool full = (timenow - lastfullfscheck >= CFG->GetLong("glb.fullreloadinterval", 600));
+
     //if (role == roleDisk)
-      loadFilesystems();
+      loadFilesystems(full);
+    if (full) lastfullfscheck = timenow;
 
     checkDiskSpaces();
 
+    if (role == roleDisk)
+      indexVolatileFilesystems();
+
     lastfscheck = timenow;
   }
 
@@ -585,13 +907,43 @@ void DomeStatus::setDavixPool(dmlite::DavixCtxPool *pool) {
 }
 
 
+void DomeStatus::indexVolatileFilesystems() {
+  std::vector<std::string> toscan;
+
+  {
+    boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+    const std::vector<DomeFsInfo> &fslist = fss->fslist;
+
+    for (unsigned int i = 0; i < fslist.size(); i++) {
+      if (fslist[i].server != myhostname)
+        continue;
+
+      std::map <std::string, DomePoolInfo>::const_iterator p = fss->poolslist.find(fslist[i].poolname);
+      if ( (p == fss->poolslist.end()) || ((p->second.stype != 'V') && (p->second.stype != 'v')) )
+        continue;
+
+      if (evictionindex.addFilesystem(fslist[i].fs))
+        toscan.push_back(fslist[i].fs);
+    }
+  }
+
+  // The scans can take long, they go in the background. The index
+  // is usable meanwhile, with the files that were already found
+  for (unsigned int i = 0; i < toscan.size(); i++) {
+    Log(Logger::Lvl1, domelogmask, domelogname, "Starting the scan of volatile filesystem '" << toscan[i] << "'");
+    boost::thread t(boost::bind(&DomeEvictionIndex::scan, &evictionindex, toscan[i]));
+    t.detach();
+  }
+}
+
 // In the case of a disk server, checks the free/used space in the mountpoints
 void DomeStatus::checkDiskSpaces() {
   Log(Logger::Lvl4, domelogmask, domelogname, "Entering");
 
   if (role == roleDisk) {
-    boost::unique_lock<boost::recursive_mutex> l(*this);
-
+    // statfs can hang on a sick mountpoint, so it runs on a private copy
+    // of the filesystems, that are merged back afterwards
+    std::vector<DomeFsInfo> fslist = filesystems.get()->fslist;
 
     // Loop over the filesystems, and check those that match our hostname
 
@@ -622,6 +974,24 @@ void DomeStatus::checkDiskSpaces() {
 
     }
 
+    {
+      boost::unique_lock<boost::recursive_mutex> l(*this);
+      boost::shared_ptr<DomeFsTables> t = filesystems.copy();
+
+      for (unsigned int ii = 0; ii < t->fslist.size(); ii++) {
+        for (unsigned int i = 0; i < fslist.size(); i++) {
+          if ((fslist[i].server == myhostname) &&
+              (t->fslist[ii].server == fslist[i].server) && (t->fslist[ii].fs == fslist[i].fs)) {
+            t->fslist[ii].freespace = fslist[i].freespace;
+            t->fslist[ii].physicalsize = fslist[i].physicalsize;
+            t->fslist[ii].activitystatus = fslist[i].activitystatus;
+            break;
+          }
+        }
+      }
+
+      filesystems.set(t);
+    }
 
     Log(Logger::Lvl1, domelogmask, domelogname, "Number of local filesystems: " << nfs);
   }
@@ -630,14 +1000,11 @@ void DomeStatus::checkDiskSpaces() {
     // Head node case. We request dome_getspaceinfo to each server, then loop on the results and calculate the head numbers
     // If a server does not reply, mark as disabled all its filesystems
 
-    std::set<std::string> srv;
-    {
-      // Let's work on a local copy, to avoid a longer locking
-      boost::unique_lock<boost::recursive_mutex> l(*this);
-      srv = servers;
-    }
+    // The snapshot does not change under our feet
+    boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+    const std::set<std::string> &srv = fss->servers;
     // Contact all the servers, sequentially
-    for (std::set<std::string>::iterator servername = srv.begin(); servername != srv.end(); servername++) {
+    for (std::set<std::string>::const_iterator servername = srv.begin(); servername != srv.end(); servername++) {
 
       Log(Logger::Lvl4, domelogmask, domelogname, "Contacting disk server: " << *servername);
 
@@ -667,9 +1034,12 @@ void DomeStatus::checkDiskSpaces() {
         }
       }
 
-      // Now process the values from the Json, or just disable the filesystems. Lock the status!
+      // Now process the values from the Json, or just disable the filesystems.
+      // The answer is merged into a copy of the tables, that is then published
       {
         boost::unique_lock<boost::recursive_mutex> l(*this);
+        boost::shared_ptr<DomeFsTables> t = filesystems.copy();
+        std::vector<DomeFsInfo> &fslist = t->fslist;
         bool someerror = true;
         // Loop through the server names, childs of fsinfo
 
@@ -719,6 +1089,7 @@ void DomeStatus::checkDiskSpaces() {
 
           }  catch (boost::property_tree::ptree_error e) {
             Err("checkDiskSpaces", "Error processing JSON response: " << e.what());
+            filesystems.set(t);
             continue;
           }
 
@@ -737,6 +1108,8 @@ void DomeStatus::checkDiskSpaces() {
 
           } // loop fs
         } // if someerror
+
+        filesystems.set(t);
       } // lock
 
       // Here we should disable all the filesystems that belong to the given server
@@ -753,7 +1126,9 @@ void DomeStatus::checkDiskSpaces() {
 
 
 bool DomeStatus::getQuotatoken(const std::string &s_token, DomeQuotatoken &tk) {
-  for(std::multimap<std::string, DomeQuotatoken>::iterator it = quotas.begin(); it != quotas.end(); it++) {
+  boost::shared_ptr<const DomeQuotaTables> qt = quotatokens.get();
+
+  for(std::multimap<std::string, DomeQuotatoken>::const_iterator it = qt->quotas.begin(); it != qt->quotas.end(); it++) {
     if(it->second.s_token == s_token) {
       tk = it->second;
       return true;
@@ -764,11 +1139,12 @@ bool DomeStatus::getQuotatoken(const std::string &s_token, DomeQuotatoken &tk) {
 
 int DomeStatus::getQuotatoken(const std::string &path, const std::string &poolname, DomeQuotatoken &tk) {
 
-  std::pair <std::multimap<std::string, DomeQuotatoken>::iterator, std::multimap<std::string, DomeQuotatoken>::iterator> myintv;
-  myintv = quotas.equal_range(path);
+  boost::shared_ptr<const DomeQuotaTables> qt = quotatokens.get();
+  std::pair <std::multimap<std::string, DomeQuotatoken>::const_iterator, std::multimap<std::string, DomeQuotatoken>::const_iterator> myintv;
+  myintv = qt->quotas.equal_range(path);
 
 
-  for (std::multimap<std::string, DomeQuotatoken>::iterator it = myintv.first;
+  for (std::multimap<std::string, DomeQuotatoken>::const_iterator it = myintv.first;
        it != myintv.second;
        ++it) {
 
@@ -793,8 +1169,11 @@ int DomeStatus::getQuotatoken(const std::string &path, const std::string &poolna
 
 int DomeStatus::delQuotatoken(const std::string &path, const std::string &poolname, DomeQuotatoken &tk) {
 
+  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<DomeQuotaTables> qt = quotatokens.copy();
+
   std::pair <std::multimap<std::string, DomeQuotatoken>::iterator, std::multimap<std::string, DomeQuotatoken>::iterator> myintv;
-  myintv = quotas.equal_range(path);
+  myintv = qt->quotas.equal_range(path);
 
 
   for (std::multimap<std::string, DomeQuotatoken>::iterator it = myintv.first;
@@ -809,7 +1188,8 @@ int DomeStatus::delQuotatoken(const std::string &path, const std::string &poolna
       Log(Logger::Lvl4, domelogmask, domelogname, "Deleting quotatoken '" << it->second.u_token << "' of pool: '" <<
       it->second.poolname << "' matches path '" << path << "' quotatktotspace: " << it->second.t_space);
 
-      quotas.erase(it);
+      qt->quotas.erase(it);
+      quotatokens.set(qt);
       return 0;
     }
   }
@@ -824,7 +1204,7 @@ int DomeStatus::delQuotatoken(const std::string &path, const std::string &poolna
 //     return ( fsi.poolname == pool );
 // }
 
-bool DomeStatus::PfnMatchesFS(std::string &server, std::string &pfn, DomeFsInfo &fs) {
+bool DomeStatus::PfnMatchesFS(const std::string &server, const std::string &pfn, const DomeFsInfo &fs) {
 
   if (server != fs.server) return false;
 
@@ -840,14 +1220,12 @@ bool DomeStatus::PfnMatchesFS(std::string &server, std::string &pfn, DomeFsInfo
 
 }
 
-bool DomeStatus::PfnMatchesAnyFS(std::string &srv, std::string &pfn) {
-
+bool DomeStatus::PfnMatchesAnyFS(const std::string &srv, const std::string &pfn) {
 
-    // Lock status!
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
 
   // Loop on the filesystems, looking for one that is a proper substring of the pfn
-  for (std::vector<DomeFsInfo>::iterator fs = fslist.begin(); fs != fslist.end(); fs++) {
+  for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
 
     if (PfnMatchesFS(srv, pfn, *fs))
       return true;
@@ -859,14 +1237,12 @@ bool DomeStatus::PfnMatchesAnyFS(std::string &srv, std::string &pfn) {
 }
 
 
-bool DomeStatus::PfnMatchesAnyFS(std::string &srv, std::string &pfn, DomeFsInfo &fsinfo) {
-
+bool DomeStatus::PfnMatchesAnyFS(const std::string &srv, const std::string &pfn, DomeFsInfo &fsinfo) {
 
-    // Lock status!
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
 
   // Loop on the filesystems, looking for one that is a proper substring of the pfn
-  for (std::vector<DomeFsInfo>::iterator fs = fslist.begin(); fs != fslist.end(); fs++) {
+  for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
 
     if (PfnMatchesFS(srv, pfn, *fs)) {
       fsinfo = *fs;
@@ -881,25 +1257,25 @@ bool DomeStatus::PfnMatchesAnyFS(std::string &srv, std::string &pfn, DomeFsInfo
 
 bool DomeStatus::LfnMatchesAnyCanPullFS(std::string lfn, DomeFsInfo &fsinfo) {
 
-  // Lock status!
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeQuotaTables> qt = quotatokens.get();
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
   std::string lfn1(lfn);
 
   while (lfn1.length() > 0) {
 
     Log(Logger::Lvl4, domelogmask, domelogname, "Processing: '" << lfn1 << "'");
     // Check if any matching quotatoken exists
-    std::pair <std::multimap<std::string, DomeQuotatoken>::iterator, std::multimap<std::string, DomeQuotatoken>::iterator> myintv;
-    myintv = quotas.equal_range(lfn1);
+    std::pair <std::multimap<std::string, DomeQuotatoken>::const_iterator, std::multimap<std::string, DomeQuotatoken>::const_iterator> myintv;
+    myintv = qt->quotas.equal_range(lfn1);
 
     if (myintv.first != myintv.second) {
-      for (std::multimap<std::string, DomeQuotatoken>::iterator it = myintv.first; it != myintv.second; ++it) {
+      for (std::multimap<std::string, DomeQuotatoken>::const_iterator it = myintv.first; it != myintv.second; ++it) {
 
           Log(Logger::Lvl4, domelogmask, domelogname, "pool: '" << it->second.poolname << "' matches path '" << lfn);
 
           // Now loop on the FSs belonging to this pool
           // and check if at least one of them can pull files in from external sources
-          for (std::vector<DomeFsInfo>::iterator fs = fslist.begin(); fs != fslist.end(); fs++) {
+          for (std::vector<DomeFsInfo>::const_iterator fs = fss->fslist.begin(); fs != fss->fslist.end(); fs++) {
             if ((fs->poolname == it->second.poolname) && fs->canPullFile(*this)) {
               Log(Logger::Lvl1, domelogmask, domelogname, "CanPull pool: '" << it->second.poolname << "' matches path '" << lfn);
               fsinfo = *fs;
@@ -925,15 +1301,14 @@ bool DomeStatus::LfnMatchesAnyCanPullFS(std::string lfn, DomeFsInfo &fsinfo) {
 bool DomeStatus::whichQuotatokenForLfn(const std::string &lfn, DomeQuotatoken &token) {
   Log(Logger::Lvl4, domelogmask, domelogname, "lfn: '" << lfn << "'");
 
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  boost::shared_ptr<const DomeQuotaTables> qt = quotatokens.get();
 
   std::string path = lfn;
   while( !path.empty() ) {
     Log(Logger::Lvl4, domelogmask, domelogname, "  checking '" << path << "'");
 
-    typedef std::multimap<std::string, DomeQuotatoken>::iterator MapIter;
-    std::pair<MapIter, MapIter> interval = quotas.equal_range(path);
+    typedef std::multimap<std::string, DomeQuotatoken>::const_iterator MapIter;
+    std::pair<MapIter, MapIter> interval = qt->quotas.equal_range(path);
 
     if(interval.first != interval.second) {
       Log(Logger::Lvl4, domelogmask, domelogname, " match for lfn '" << lfn << "'" << "and quotatoken " << interval.first->second.u_token);
@@ -979,12 +1354,14 @@ long long DomeStatus::getQuotatokenUsedSpace(const DomeQuotatoken &token) {
   Log(Logger::Lvl4, domelogmask, domelogname, "tk: '" << token.u_token);
 
   long long totused;
-  boost::unique_lock<boost::recursive_mutex> l(*this);
+  // No lock is held across the db queries, the snapshot is enough
+  boost::shared_ptr<const DomeQuotaTables> qt = quotatokens.get();
+  const std::multimap<std::string, DomeQuotatoken> &quotas = qt->quotas;
 
   totused = getDirUsedSpace(token.path);
   Log(Logger::Lvl4, domelogmask, domelogname, "directory usage for '" << token.path << "': " << totused);
 
-  typedef std::multimap<std::string, DomeQuotatoken>::iterator MapIter;
+  typedef std::multimap<std::string, DomeQuotatoken>::const_iterator MapIter;
   MapIter it = quotas.lower_bound(token.path);
   if(it == quotas.end()) {
     Err(domelogname, "Error: getQuotatokenUsedSpace called on invalid quotatoken with path '" << token.path << "'");
@@ -1034,7 +1411,8 @@ bool DomeStatus::isDNaKnownServer(std::string dn) {
   if (DNMatchesHost(dn, headnodename)) return true;
 
   // We know this server if its DN matches the hostname of a disk server
-  for (std::set<std::string>::iterator i = servers.begin() ; i != servers.end(); i++) {
+  boost::shared_ptr<const DomeFsTables> fss = filesystems.get();
+  for (std::set<std::string>::const_iterator i = fss->servers.begin() ; i != fss->servers.end(); i++) {
     if (DNMatchesHost(dn, *i)) return true;
   }
 
@@ -1046,10 +1424,6 @@ bool DomeStatus::isDNaKnownServer(std::string dn) {
 
 bool DomeStatus::canwriteintoQuotatoken(DomeReq &req, DomeQuotatoken &token) {
 
-
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-
   // True if one of the groups of the remote user matches the quotatk
   // Loop on the gids written in the quotatoken
   // For each of them, check if the user belongs to it
@@ -1091,11 +1465,8 @@ int DomeStatus::getUser(int uid, DomeUserInfo &ui) {
     return 1;
   }
 
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-
   try {
-    ui = usersbyuid.at(uid);
+    ui = usersgroups.get()->usersbyuid.at(uid);
   }
   catch ( ... ) {
     return 0;
@@ -1112,11 +1483,8 @@ int DomeStatus::getUser(std::string username, DomeUserInfo &ui) {
     return 1;
   }
 
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-
   try {
-    ui = usersbyname.at(username);
+    ui = usersgroups.get()->usersbyname.at(username);
   }
   catch ( ... ) {
     return 0;
@@ -1132,11 +1500,8 @@ int DomeStatus::getGroup(int gid, DomeGroupInfo &gi) {
     return 1;
   }
 
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-
   try {
-    gi = groupsbygid.at(gid);
+    gi = usersgroups.get()->groupsbygid.at(gid);
   }
   catch ( ... ) {
     return 0;
@@ -1151,11 +1516,8 @@ int DomeStatus::getGroup(std::string groupname, DomeGroupInfo &gi) {
     return 1;
   }
 
-  // lock status
-  boost::unique_lock<boost::recursive_mutex> l(*this);
-
   try {
-    gi = groupsbyname.at(groupname);
+    gi = usersgroups.get()->groupsbyname.at(groupname);
   }
   catch ( ... ) {
     return 0;
@@ -1165,24 +1527,63 @@ int DomeStatus::getGroup(std::string groupname, DomeGroupInfo &gi) {
 }
 
 /// Inserts/overwrites an user
-int DomeStatus::insertUser(DomeUserInfo &ui) {
+int DomeStatus::insertUser(const DomeUserInfo &ui) {
+  insertUsers(std::vector<DomeUserInfo>(1, ui));
+  return 0;
+}
+/// Inserts/overwrites a group
+int DomeStatus::insertGroup(const DomeGroupInfo &gi) {
+  insertGroups(std::vector<DomeGroupInfo>(1, gi));
+  return 0;
+}
+/// Inserts/overwrites a set of users, publishing them all at once
+int DomeStatus::insertUsers(const std::vector<DomeUserInfo> &uis) {
   // lock status
   boost::unique_lock<boost::recursive_mutex> l(*this);
 
-  usersbyname[ui.username] = ui;
-  usersbyuid[ui.userid] = ui;
+  // Only what is different is applied, and the tables are copied only if there is any
+  boost::shared_ptr<const DomeUserTables> old = usersgroups.get();
+  std::vector<const DomeUserInfo *> changed;
+  for (unsigned int i = 0; i < uis.size(); i++) {
+    std::map <int, DomeUserInfo>::const_iterator o = old->usersbyuid.find(uis[i].userid);
+    if ((o == old->usersbyuid.end()) || !sameUser(o->second, uis[i]))
+      changed.push_back(&uis[i]);
+  }
+  if (changed.empty())
+    return 0;
 
-  return 0;
+  boost::shared_ptr<DomeUserTables> t = usersgroups.copy();
+  for (unsigned int i = 0; i < changed.size(); i++) {
+    t->usersbyname[changed[i]->username] = *changed[i];
+    t->usersbyuid[changed[i]->userid] = *changed[i];
+  }
+
+  usersgroups.set(t);
+  return changed.size();
 }
-/// Inserts/overwrites a group
-int DomeStatus::insertGroup(DomeGroupInfo &gi) {
+/// Inserts/overwrites a set of groups, publishing them all at once
+int DomeStatus::insertGroups(const std::vector<DomeGroupInfo> &gis) {
   // lock status
   boost::unique_lock<boost::recursive_mutex> l(*this);
 
-  groupsbygid[gi.groupid] = gi;
-  groupsbyname[gi.groupname] = gi;
+  boost::shared_ptr<const DomeUserTables> old = usersgroups.get();
+  std::vector<const DomeGroupInfo *> changed;
+  for (unsigned int i = 0; i < gis.size(); i++) {
+    std::map <int, DomeGroupInfo>::const_iterator o = old->groupsbygid.find(gis[i].groupid);
+    if ((o == old->groupsbygid.end()) || !sameGroup(o->second, gis[i]))
+      changed.push_back(&gis[i]);
+  }
+  if (changed.empty())
+    return 0;
 
-  return 0;
+  boost::shared_ptr<DomeUserTables> t = usersgroups.copy();
+  for (unsigned int i = 0; i < changed.size(); i++) {
+    t->groupsbygid[changed[i]->groupid] = *changed[i];
+    t->groupsbyname[changed[i]->groupname] = *changed[i];
+  }
+
+  usersgroups.set(t);
+  return changed.size();
 }
 
 std::string DomeQuotatoken::getGroupsString(bool putzeroifempty) {
@@ -1231,17 +1632,15 @@ DmStatus DomeStatus::getIdMap(const std::string& userName,
 
   // No VO information, so use the mapping file to get the group
   if (groupNames.empty()) {
-    std::pair<std::multimap<std::string, std::string>::iterator,
-              std::multimap<std::string, std::string>::iterator> ppp;
+    std::pair<std::multimap<std::string, std::string>::const_iterator,
+              std::multimap<std::string, std::string>::const_iterator> ppp;
 
-    {
-      // lock status
-      boost::unique_lock<boost::recursive_mutex> l(*this);
-      ppp = gridmap.equal_range(userName);
-    }
+    // The iterators stay valid as long as we hold the snapshot
+    boost::shared_ptr<const DomeUserTables> ugt = usersgroups.get();
+    ppp = ugt->gridmap.equal_range(userName);
 
     // Now loop on the matches and get the relevant groups
-    for (std::multimap<std::string, std::string>::iterator it2 = ppp.first;
+    for (std::multimap<std::string, std::string>::const_iterator it2 = ppp.first;
          it2 != ppp.second; ++it2) {
 
       Log(Logger::Lvl4, domelogmask, domelogname, "User: '" << userName << "' is a member of '" << (*it2).second);
@@ -27,13 +27,17 @@
 #define DOMESTATUS_H
 
 #include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 #include <set>
 #include "DomeGenQueue.h"
+#include "DomeEvictionIndex.h"
+#include "DomePlacement.h"
 #include "utils/DavixPool.h"
 #include "dmlite/cpp/authn.h"
 #include "status.h"
 
 class DomeReq;
+class DomeMySql;
 class DomeQuotatoken;
 class DomeStatus;
 
@@ -104,14 +108,14 @@ public:
   /// Total size of this filesystem
   long long physicalsize;
 
-  bool isGoodForWrite() {
+  bool isGoodForWrite() const {
     return ( (status == FsStaticActive) && (activitystatus == FsOnline) );
   }
-  bool isGoodForRead() {
+  bool isGoodForRead() const {
     return ( (status != FsStaticDisabled) && (activitystatus == FsOnline) );
   }
 
-  bool canPullFile(DomeStatus &st);
+  bool canPullFile(DomeStatus &st) const;
 
   /// Check if the given write request can go to the given quotatoken
   bool canwriteintoQuotatoken(DomeReq &req, DomeQuotatoken &token);
@@ -223,8 +227,73 @@ public:
 };
 
 
+/// Holds a read-mostly table as immutable versions. Readers get the current
+/// version without locking, and can keep it as long as they need: it never
+/// changes. Writers publish a whole new version, which readers see from
+/// their next get(). Writers must be serialized by the caller.
+template <class T>
+class DomeSnapshot {
+public:
+  DomeSnapshot(): current(new T()) {}
+
+  /// The current version
+  boost::shared_ptr<const T> get() const {
+    return boost::atomic_load(&current);
+  }
+
+  /// A private copy of the current version, to be changed and then published
+  boost::shared_ptr<T> copy() const {
+    return boost::shared_ptr<T>(new T(*get()));
+  }
+
+  /// Publish a new version
+  void set(const boost::shared_ptr<const T> &t) {
+    boost::atomic_store(&current, t);
+  }
+
+private:
+  boost::shared_ptr<const T> current;
+};
+
+
+/// The filesystems and the pools that are known
+struct DomeFsTables {
+  /// Trivial store for filesystems information
+  std::vector <DomeFsInfo> fslist;
+
+  /// Trivial store for pool information
+  std::map <std::string, DomePoolInfo> poolslist;
+
+  /// List of all the servers that are involved. This list is built dynamically
+  /// when populating the filesystems
+  std::set <std::string> servers;
+};
+
+/// The quotatokens
+struct DomeQuotaTables {
+  /// Simple keyvalue store for prefix-based quotas, that
+  /// represent a simplification of spacetokens
+  /// The key is the prefix without trailing slashes
+  std::multimap <std::string, DomeQuotatoken> quotas;
+};
+
+/// The users and the groups
+struct DomeUserTables {
+  /// Tables to quick translate users and groups
+  std::map <int, DomeUserInfo> usersbyuid;
+  std::map <std::string, DomeUserInfo> usersbyname;
+  std::map <int, DomeGroupInfo> groupsbygid;
+  std::map <std::string, DomeGroupInfo> groupsbyname;
+
+  /// A quick rendition of the grid mapfile, translating from user DN to VOMS group
+  /// The implementation of getIdMap may use this
+  std::multimap <std::string, std::string> gridmap;
+};
+
+
 /// Class that contains the internal status of the storage system, pools, disks, etc
-/// Accesses must lock/unlock it for operations where other threads may write
+/// The filesystems, quotatokens and users are snapshots, read without locking.
+/// The lock serializes the writers of the snapshots and protects the rest
 class DomeStatus: public boost::recursive_mutex {
 public:
 
@@ -249,26 +318,14 @@ public:
   // The hostname of the head node we refer to
   std::string headnodename;
 
-  /// Trivial store for filesystems information
-  std::vector <DomeFsInfo> fslist;
+  /// Filesystems, pools and servers
+  DomeSnapshot<DomeFsTables> filesystems;
 
-  /// Trivial store for pool information
-  std::map <std::string, DomePoolInfo> poolslist;
+  /// Quotatokens
+  DomeSnapshot<DomeQuotaTables> quotatokens;
 
-  /// Simple keyvalue store for prefix-based quotas, that
-  /// represent a simplification of spacetokens
-  /// The key is the prefix without trailing slashes
-  std::multimap <std::string, DomeQuotatoken> quotas;
-
-  /// List of all the servers that are involved. This list is built dynamically
-  /// when populating the filesystems
-  std::set <std::string> servers;
-
-  /// Tables to quick translate users and groups. To access this the status must be locked!
-  std::map <int, DomeUserInfo> usersbyuid;
-  std::map <std::string, DomeUserInfo> usersbyname;
-  std::map <int, DomeGroupInfo> groupsbygid;
-  std::map <std::string, DomeGroupInfo> groupsbyname;
+  /// Users, groups and gridmap
+  DomeSnapshot<DomeUserTables> usersgroups;
 
   dmlite::DmStatus getIdMap(const std::string& userName,
                     const std::vector<std::string>& groupNames,
@@ -276,9 +333,13 @@ public:
                     std::vector<DomeGroupInfo> &groups);
 
   /// Inserts/overwrites an user
-  int insertUser(DomeUserInfo &ui);
+  int insertUser(const DomeUserInfo &ui);
   /// Inserts/overwrites a group
-  int insertGroup(DomeGroupInfo &gi);
+  int insertGroup(const DomeGroupInfo &gi);
+  /// Inserts/overwrites many users at once. Returns how many were new or different
+  int insertUsers(const std::vector<DomeUserInfo> &users);
+  /// Inserts/overwrites many groups at once. Returns how many were new or different
+  int insertGroups(const std::vector<DomeGroupInfo> &groups);
   /// Gets user info from uid. Returns 0 on failure
   int getUser(int uid, DomeUserInfo &ui);
   /// Gets user info from name. Returns 0 on failure
@@ -288,22 +349,44 @@ public:
   /// Gets group info from name. Returns 0 on failure
   int getGroup(std::string groupname, DomeGroupInfo &gi);
 
-  /// A quick rendition of the grid mapfile, translating from user DN to VOMS group
-  /// The implementation of getIdMap may use this
-  std::multimap <std::string, std::string> gridmap;
-
-
   /// Helper function that reloads all the filesystems from the DB
-  int loadFilesystems();
+  /// If full is false the tables are read only if they changed since the last reload
+  int loadFilesystems(bool full = true);
 
   /// Helper function that reloads all the quotas from the DB
-  int loadQuotatokens();
+  /// If full is false the table is read only if it changed since the last reload
+  int loadQuotatokens(bool full = true);
 
   /// Helper function that reloads all the users from the DB
-  int loadUsersGroups();
+  /// If full is false only what changed since the last reload is read: new users
+  /// and groups if there are any, otherwise the whole tables. The gridmap file
+  /// is parsed only if its mtime or size changed
+  int loadUsersGroups(bool full = true);
+
+  /// Helper function that updates all quotatokens. Returns how many were added, changed or removed
+  int updateQuotatokens(const std::vector<DomeQuotatoken> &tokens);
+
+  /// Replaces the pools. Returns how many were added, changed or removed
+  int updatePools(const std::map<std::string, DomePoolInfo> &pools);
+
+  /// Replaces the filesystems, keeping the dynamic status of the ones already known
+  /// Returns how many were added, changed or removed
+  int updateFilesystems(const std::vector<DomeFsInfo> &fss);
+
+  /// How the reloads of a table went, as shown by dome_info
+  struct ReloadStats {
+    ReloadStats(): reloads(0), fullreloads(0), skipped(0), duration(0), read(0), applied(0) {}
+    /// Times the table was read, and how many of them read it all
+    long reloads, fullreloads;
+    /// Times the table was found unchanged, and not read
+    long skipped;
+    /// About the last time it was read: how long it took in ms,
+    /// how many entries were read and how many of them were new or different
+    long duration, read, applied;
+  };
 
-  /// Helper function that updates all quotatokens
-  void updateQuotatokens(const std::vector<DomeQuotatoken> &tokens);
+  /// Gets the reload counters of the users, groups, gridmap, quotatokens and filesystems
+  void getReloadStats(std::map<std::string, ReloadStats> &stats);
 
   /// Helper function that gets a quotatoken given its s_token
   bool getQuotatoken(const std::string &s_token, DomeQuotatoken &tk);
@@ -316,18 +399,18 @@ public:
 
   /// Calculates the total space for the given pool and the free space on the disks that belong to it
   /// Returns zero if pool was found, nonzero otherwise
-  int getPoolSpaces(std::string &poolname, long long &total, long long &free, int &poolstatus);
+  int getPoolSpaces(const std::string &poolname, long long &total, long long &free, int &poolstatus);
 
   /// Tells if a pool with the given name exists
-  bool existsPool(std::string &poolname);
+  bool existsPool(const std::string &poolname);
 
   /// Retrieves basic info about a named pool
-  bool getPoolInfo(std::string &poolname, int64_t &pool_defsize, char &pool_stype);
+  bool getPoolInfo(const std::string &poolname, int64_t &pool_defsize, char &pool_stype);
 
   // Utility ------------------------------------
   bool LfnMatchesAnyCanPullFS(std::string lfn, DomeFsInfo &fsinfo);
-  bool PfnMatchesAnyFS(std::string &srv, std::string &pfn);
-  bool PfnMatchesAnyFS(std::string &srv, std::string &pfn, DomeFsInfo &fsinfo);
+  bool PfnMatchesAnyFS(const std::string &srv, const std::string &pfn);
+  bool PfnMatchesAnyFS(const std::string &srv, const std::string &pfn, DomeFsInfo &fsinfo);
 
   // head node trusts all the disk nodes that are registered in the filesystem table
   // disk node trusts head node as defined in the config file
@@ -354,8 +437,12 @@ public:
 
   void checkDiskSpaces();
 
+  /// In the case of a disk server, start indexing the volatile filesystems
+  /// that are not indexed yet, scanning them in the background
+  void indexVolatileFilesystems();
+
   // Tells if the given pfn belongs to the given filesystem root path
-  bool PfnMatchesFS(std::string &server, std::string &pfn, DomeFsInfo &fs);
+  static bool PfnMatchesFS(const std::string &server, const std::string &pfn, const DomeFsInfo &fs);
   // ---------------------------------
 
 
@@ -374,6 +461,12 @@ public:
   /// The queue holding file pull requests
   GenPrioQueue *filepullq;
 
+  /// Chooses the destination of new replicas, knowing the puts in flight
+  DomePlacement placement;
+
+  /// Least recently used files of the volatile filesystems of a disk server
+  DomeEvictionIndex evictionindex;
+
   /// The davix pool
   dmlite::DavixCtxPool *davixPool;
   void setDavixPool(dmlite::DavixCtxPool *pool);
@@ -388,8 +481,26 @@ private:
   DomeGroupInfo rootGroupInfo;
 
   time_t lastreload, lastfscheck, lastreloadusersgroups;
+  time_t lastfullreload, lastfullfscheck, lastfullreloadusersgroups;
   long globalputcount;
 
+  /// Tells if the given tables changed since the last call, and remembers their checksum
+  bool tablesChanged(DomeMySql &sql, const std::string &tables, bool full);
+  /// Forgets the checksum of tables that could not be reloaded
+  void forgetChecksum(const std::string &tables);
+  /// Tells if the last reload of the tables read them completely
+  bool hasChecksum(const std::string &tables);
+  /// Accounts for a reload
+  void noteReload(const std::string &what, bool full, const struct timespec &start, long read, long applied);
+  void noteReloadSkipped(const std::string &what);
+
+  /// Protects the reload counters and the change detection state
+  boost::mutex reloadmtx;
+  std::map<std::string, ReloadStats> reloadstats;
+  std::map<std::string, uint64_t> tablechecksums;
+  time_t gridmapmtime;
+  off_t gridmapsize;
+
   // For the queue ticker
   boost::condition_variable queue_cond;
   boost::mutex queue_mtx;
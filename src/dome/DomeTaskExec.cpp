@@ -29,71 +29,61 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include "DomeLog.h"
 #include "utils/Config.hh"
 #include "DomeTaskExec.h"
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 #include <queue>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
 
 using namespace boost;
 using namespace std;
 
 
+// From linux/ioprio.h, that is not always installed
+#define DOME_IOPRIO_CLASS_SHIFT 13
+#define DOME_IOPRIO_CLASS_RT 1
+#define DOME_IOPRIO_CLASS_BE 2
+#define DOME_IOPRIO_CLASS_IDLE 3
+#define DOME_IOPRIO_WHO_PROCESS 1
 
-void taskfunc(DomeTaskExec *inst, int key) {
-  
-  Log(Logger::Lvl4, domelogmask, "taskfunc", "Starting task " << key << " on instance " << inst->instance);
-  
-  if (inst) {
-    map <int, DomeTask *>::iterator i = inst->tasks.find(key);
-    if ( i != inst->tasks.end() ) {
-	    Log(Logger::Lvl3, domelogmask, "taskfunc", "Found task " << key << " on instance " << inst->instance);
-	    inst->run(*i->second);
-	    Log(Logger::Lvl3, domelogmask, "taskfunc", "Finished task " << key << " on instance " << inst->instance);
-	    return;
-   }
-    
-  }  
-  Err("taskfunc", "Cannot start task " << key << " on instance " << inst->instance);
-  
-  
-}
 
 // -----------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------
 
-DomeTask::DomeTask(): finished(false) {
+DomeTask::DomeTask(): resultcode(0), finished(false), killed(false), reaped(false), niceness(0), ioprio(0) {
   starttime = time(0);
   endtime = 0;
   pid = -1;
-
-  // Initialize placeholders for individual parms for execv
-  for (int i =0; i < 64; i++)
-    parms[i] = NULL;
+  outfd = -1;
 }
 
 DomeTask::~DomeTask() {
-  boost::unique_lock <boost::mutex> lck (*this);
-  for (int i =0; i < 64; i++)
-    // Free the execv parms, if we need...
-    if (parms[i]) free((void *)parms[i]);
-    else break;
 }
 
 
 void DomeTask::splitCmd()
 {
   const char *tok;
-  char *saveptr, *str = (char *)cmd.c_str();
-  int i = 0;
+  std::string s = cmd;
+  char *saveptr, *str = (char *)s.c_str();
   
+  parms.clear();
   while ( (tok = strtok_r(str, " ", &saveptr)) ) {
-    parms[i++] = strdup(tok);
+    parms.push_back(tok);
     str = 0;
   }
 
@@ -114,15 +104,15 @@ int DomeTask::waitFinished(int sectmout) {
   { 
     boost::unique_lock <boost::mutex>  lck (*this);
     while(!finished && get_system_time() < timelimit) {
-         Log(Logger::Lvl4, domelogmask, fname, "Task not finished at time " << get_system_time());
-	condvar.wait(lck);
-	}
-  }
-  // We are here either if timeout or something happened
+      Log(Logger::Lvl4, domelogmask, fname, "Task not finished at time " << get_system_time());
+      condvar.timed_wait(lck, timelimit);
+    }
   
-  if (finished) {
-    Log(Logger::Lvl3, domelogmask, fname, "Finished task. Key: " << key << " cmd: " << cmd);
-    return 0;
+    // We are here either if timeout or something happened
+    if (finished) {
+      Log(Logger::Lvl3, domelogmask, fname, "Finished task. Key: " << key << " cmd: " << cmd);
+      return 0;
+    }
   }
   
   Log(Logger::Lvl3, domelogmask, fname, "Still running task. Key: " << key << " cmd: " << cmd);
@@ -136,141 +126,360 @@ int DomeTask::waitFinished(int sectmout) {
 // -----------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------
-DomeTaskExec::DomeTaskExec() {
+DomeTaskExec::DomeTaskExec(): running(0), reaper(NULL), dispatcher(NULL), stopping(false), wakefd(-1), epollfd(-1) {
   taskcnt = 1;
 }
 
-DomeTaskExec::~DomeTaskExec() {}
-
-/// Taken from here and slightly modified.
-/// https://sites.google.com/site/williamedwardscoder/popen3
-int DomeTaskExec::popen3(int fd[3], pid_t *pid,  const  char ** argv) {
-  int i, e;
-  int p[3][2];
-  //
-  // set all the FDs to invalid
-  for(i=0; i<3; i++)
-    p[i][0] = p[i][1] = -1;
-  
-  // create the pipes
-  for(int i=0; i<3; i++) 
-    if(pipe(p[i]))
-      goto error;
-    
-    // and fork
-    *pid = fork();
+DomeTaskExec::~DomeTaskExec() {
+  {
+    scoped_lock lck (*this);
+    stopping = true;
+    exitedcond.notify_all();
+  }
+
+  if (wakefd >= 0) {
+    uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) < 0) {}
+  }
+
+  if (reaper) {
+    reaper->join();
+    delete reaper;
+  }
+  if (dispatcher) {
+    dispatcher->join();
+    delete dispatcher;
+  }
+
+  if (wakefd >= 0) close(wakefd);
+  if (epollfd >= 0) close(epollfd);
+
+  for (map <int, DomeTask *>::iterator i = tasks.begin(); i != tasks.end(); ++i)
+    delete i->second;
+}
+
+
+int DomeTaskExec::ioprioFromString(const std::string &s) {
+  if (s.empty())
+    return 0;
+  if (s == "idle")
+    return DOME_IOPRIO_CLASS_IDLE << DOME_IOPRIO_CLASS_SHIFT;
+
+  size_t colon = s.find(':');
+  if ((colon == std::string::npos) || (colon + 2 != s.size()) ||
+      (s[colon+1] < '0') || (s[colon+1] > '7'))
+    return -1;
+
+  int level = s[colon+1] - '0';
+  std::string cls = s.substr(0, colon);
+  if (cls == "besteffort")
+    return (DOME_IOPRIO_CLASS_BE << DOME_IOPRIO_CLASS_SHIFT) | level;
+  if (cls == "realtime")
+    return (DOME_IOPRIO_CLASS_RT << DOME_IOPRIO_CLASS_SHIFT) | level;
+  return -1;
+}
+
+
+/// Start the command with vfork, so that the memory of this big process
+/// does not get copied. Stdin and stderr go to /dev/null, stdout to a pipe.
+/// The command gets its own process group, so that killing it also kills its children.
+int DomeTaskExec::spawn(DomeTask &task) {
+  int p[2];
   
-  if(-1 == *pid)
-    goto error;
+  if (task.parms.empty()) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Prepare everything before vfork, the child can't allocate
+  std::vector<char *> argv;
+  for (unsigned int i = 0; i < task.parms.size(); i++)
+    argv.push_back((char *)task.parms[i].c_str());
+  argv.push_back(NULL);
+
+  int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (devnull < 0)
+    return -1;
+
+  // Close on exec, or the other commands would keep our pipe open
+  if (pipe2(p, O_CLOEXEC)) {
+    int e = errno;
+    close(devnull);
+    errno = e;
+    return -1;
+  }
+
+  int niceness = task.niceness;
+  int ioprio = task.ioprio;
+
+  pid_t pid = vfork();
   
-  // in the parent?
-  if(*pid) {
-    // parent
-    fd[STDIN_FILENO] = p[STDIN_FILENO][1];
-    close(p[STDIN_FILENO][0]);
+  if (pid == 0) {
+    // child. Only system calls from here on
+    setpgid(0, 0);
+    if (niceness) setpriority(PRIO_PROCESS, 0, niceness);
+    if (ioprio > 0) syscall(SYS_ioprio_set, DOME_IOPRIO_WHO_PROCESS, 0, ioprio);
     
-    fd[STDOUT_FILENO] = p[STDOUT_FILENO][0];
-    close(p[STDOUT_FILENO][1]);
+    while ( (dup2(devnull, STDIN_FILENO) == -1) && (errno == EINTR) ) {};
+    while ( (dup2(p[1], STDOUT_FILENO) == -1) && (errno == EINTR) ) {};
+    while ( (dup2(devnull, STDERR_FILENO) == -1) && (errno == EINTR) ) {};
     
-    fd[STDERR_FILENO] = p[STDERR_FILENO][0];
-    close(p[STDERR_FILENO][1]);
-    
-    // success
-    return 0;
-    
-  } else {
-    // child
-    while ( (dup2(p[STDIN_FILENO][0],STDIN_FILENO) == -1) && (errno == EINTR) ) {};
-    close(p[STDIN_FILENO][1]);
-    
-    while ( (dup2(p[STDOUT_FILENO][1],STDOUT_FILENO) == -1) && (errno == EINTR) ) {};
-    close(p[STDOUT_FILENO][0]);
-    
-    while ( (dup2(p[STDERR_FILENO][1],STDERR_FILENO) == -1) && (errno == EINTR) ) {};
-    close(p[STDERR_FILENO][0]);
- 
-    execv(argv[0],(char **)argv);
+    execv(argv[0], &argv[0]);
     
     // if we are here, then we failed to launch our program
-    Err("popen3", "Cannot launch cmd: " << argv[0]);
-    fprintf(stderr," \"%s\"\n",argv[0]);
-    _exit(EXIT_FAILURE);
+    _exit(127);
   }
   
+  int e = errno;
+  close(devnull);
+  close(p[1]);
   
-  error:
-  
-  // preserve original error
-  e = errno;
-  for(i=0; i<3; i++) {
-    close(p[i][0]);
-    close(p[i][1]);
+  if (pid < 0) {
+    close(p[0]);
+    errno = e;
+    return -1;
   }
-  errno = e;
-  return -1;
+
+  fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL) | O_NONBLOCK);
+
+  task.pid = pid;
+  task.outfd = p[0];
+  return 0;
 }
 
 
-void DomeTaskExec::run(DomeTask &task) {
-  
-  Log(Logger::Lvl3, domelogmask, "taskrun", "Starting command: " << task.cmd) ;
-  //start time
+void DomeTaskExec::startThreads() {
+  // Called with the lock held
+  if (reaper)
+    return;
+
+  epollfd = epoll_create1(EPOLL_CLOEXEC);
+  wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = wakefd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+  reaper = new boost::thread(boost::bind(&DomeTaskExec::reaperLoop, this));
+  dispatcher = new boost::thread(boost::bind(&DomeTaskExec::dispatcherLoop, this));
+}
+
+
+int DomeTaskExec::enqueue(DomeTask *task) {
   {
-     boost::unique_lock <boost::mutex>  l(task);
-     time(&task.starttime);
+    scoped_lock lck (*this);
+
+    startThreads();
+    if ((epollfd < 0) || (wakefd < 0)) {
+      Err("submitCmd", "Cannot set up the task executor. errno: " << errno);
+      delete task;
+      return -1;
+    }
+
+    task->key = ++taskcnt;
+    tasks.insert( std::pair<int,DomeTask*>(task->key,task) );
+    pending.push_back(task);
   }
-  
-  task.resultcode = popen3((int *)task.fd, &task.pid, task.parms);
-  
-  /// It is then possible for the parent process to read the output of the child process from file descriptor
+
+  uint64_t one = 1;
+  if (write(wakefd, &one, sizeof(one)) < 0) {}
+
+  Log(Logger::Lvl3, domelogmask, "submitCmd", "Queued task " << task->key << " cmd: " << task->cmd);
+  return task->key;
+}
+
+
+void DomeTaskExec::taskExited(DomeTask *task) {
+  scoped_lock lck (*this);
+  exited.push_back(task);
+  exitedcond.notify_one();
+}
+
+
+void DomeTaskExec::reaperLoop() {
+  // The tasks that are being read, by fd. Only this thread touches them
+  std::map<int, DomeTask *> reading;
+  // The tasks whose output is over, waiting for their process to exit
+  std::deque<DomeTask *> exiting;
   char buffer[4096];
-  while (1) {
-    ssize_t count = read(task.fd[STDOUT_FILENO], buffer, sizeof(buffer));
-    if (count == -1) {
-      if (errno == EINTR) {
+
+  Log(Logger::Lvl3, domelogmask, "taskreaper", "Started. instance: " << instance);
+
+  while (true) {
+    // Start what the limit allows
+    std::vector<DomeTask *> failed;
+    {
+      scoped_lock lck (*this);
+      if (stopping) break;
+
+      // The queued tasks that were killed finish now, without waiting for their turn
+      for (std::deque<DomeTask *>::iterator q = pending.begin(); q != pending.end();) {
+        boost::unique_lock <boost::mutex> l(**q);
+        if ((*q)->killed) {
+          Log(Logger::Lvl3, domelogmask, "taskreaper", "Not starting killed task " << (*q)->key);
+          (*q)->resultcode = 128 + SIGKILL;
+          failed.push_back(*q);
+          q = pending.erase(q);
+        }
+        else
+          ++q;
+      }
+
+      long maxrunning = CFG->GetLong("glb.task.maxrunning", 64);
+      while (!pending.empty() && ((maxrunning <= 0) || (running < maxrunning))) {
+        DomeTask *task = pending.front();
+        pending.pop_front();
+
+        boost::unique_lock <boost::mutex> l(*task);
+
+        time(&task->starttime);
+        if (spawn(*task)) {
+          char errbuf[1024];
+          Err("taskreaper", "Cannot launch cmd: " << task->cmd << " err: " << errno << " msg: " << strerror_r(errno, errbuf, sizeof(errbuf)));
+          task->resultcode = -1;
+          failed.push_back(task);
+          continue;
+        }
+
+        Log(Logger::Lvl3, domelogmask, "taskreaper", "Started command: " << task->cmd << " key: " << task->key << " pid: " << task->pid);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = task->outfd;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, task->outfd, &ev);
+        reading[task->outfd] = task;
+        running++;
+      }
+    }
+    for (unsigned int i = 0; i < failed.size(); i++)
+      taskExited(failed[i]);
+
+    // Wait for output, or for something new. Poll if somebody is exiting
+    struct epoll_event events[64];
+    int n = epoll_wait(epollfd, events, 64, exiting.empty() ? -1 : 100);
+    if ((n < 0) && (errno != EINTR)) {
+      Err("taskreaper", "epoll_wait failed. errno: " << errno);
+      sleep(1);
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == wakefd) {
+        uint64_t v;
+        if (read(wakefd, &v, sizeof(v)) < 0) {}
         continue;
-      } else {
-        Err("popen3", "Cannot get output of cmd: " << task.cmd.c_str());
+      }
+
+      std::map<int, DomeTask *>::iterator t = reading.find(fd);
+      if (t == reading.end())
+        continue;
+      DomeTask *task = t->second;
+
+      bool over = false;
+      while (true) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count > 0) {
+          boost::unique_lock <boost::mutex> l(*task);
+          task->stdout.append(buffer, count);
+          continue;
+        }
+        if ((count < 0) && (errno == EINTR))
+          continue;
+        if ((count < 0) && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+
+        // End of the output, or an error reading it
+        if (count < 0)
+          Err("taskreaper", "Cannot get output of cmd: " << task->cmd << " errno: " << errno);
+        over = true;
         break;
       }
-      
-    }
-    
-    if (count == 0) {
-      Log(Logger::Lvl4, domelogmask, "taskrun", "End Stdout") ;
-      break;
+
+      if (over) {
+        Log(Logger::Lvl4, domelogmask, "taskreaper", "End Stdout. key: " << task->key);
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        reading.erase(t);
+        {
+          boost::unique_lock <boost::mutex> l(*task);
+          task->outfd = -1;
+        }
+        exiting.push_back(task);
+      }
     }
-    else {
-      boost::unique_lock <boost::mutex>   l(task);
-      task.stdout.append(buffer, count);
-      Log(Logger::Lvl4, domelogmask, "taskrun", "Stdout: " << task.stdout.c_str()) ;
-      Log(Logger::Lvl4, domelogmask, "taskrun", "Pid " << task.pid) ;
+
+    // Collect the processes that exited
+    for (std::deque<DomeTask *>::iterator e = exiting.begin(); e != exiting.end();) {
+      DomeTask *task = *e;
+      int status = 0;
+
+      {
+        // Reaped under the lock, so that killTask never signals a pid
+        // that may have been given to another process
+        boost::unique_lock <boost::mutex> l(*task);
+        pid_t r = waitpid(task->pid, &status, WNOHANG);
+        if (r == 0) {
+          ++e;
+          continue;
+        }
+
+        task->reaped = true;
+        if (r < 0)
+          task->resultcode = -1;
+        else if (WIFEXITED(status))
+          task->resultcode = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+          task->resultcode = 128 + WTERMSIG(status);
+        else
+          task->resultcode = -1;
+      }
+
+      Log(Logger::Lvl3, domelogmask, "taskreaper", "Exited command: " << task->cmd << " key: " << task->key << " rc: " << task->resultcode);
+
+      {
+        scoped_lock lck (*this);
+        running--;
+      }
+      taskExited(task);
+      e = exiting.erase(e);
     }
-      
   }
-  
-  Log(Logger::Lvl4, domelogmask, "taskrun", "Closing fds. key: " << task.key);
-  for(int i=0; i<3; i++) 
-    close(task.fd[i]);
-  
-  Log(Logger::Lvl4, domelogmask, "taskrun", "Finalizing key: " << task.key) ;
-  {
-    boost::unique_lock <boost::mutex> l(task);
-    waitpid(task.pid, 0, 0);
-    task.finished = true;
-    //endtime
-    time(&task.endtime);
-    task.notifyAll();
-    
-    Log(Logger::Lvl4, domelogmask, "taskrun", "Dispatching onTaskCompleted key: " << task.key) ;
-    onTaskCompleted(task);
+
+  Log(Logger::Lvl3, domelogmask, "taskreaper", "Exiting. instance: " << instance);
+}
+
+
+void DomeTaskExec::dispatcherLoop() {
+  while (true) {
+    DomeTask *task;
+    {
+      scoped_lock lck (*this);
+      while (exited.empty() && !stopping)
+        exitedcond.wait(lck);
+      if (exited.empty())
+        break;
+      task = exited.front();
+      exited.pop_front();
+    }
+
+    Log(Logger::Lvl4, domelogmask, "taskrun", "Finalizing key: " << task->key) ;
+    {
+      boost::unique_lock <boost::mutex> l(*task);
+      task->finished = true;
+      //endtime
+      time(&task->endtime);
+      task->notifyAll();
     
-  }
-  
-  Log(Logger::Lvl4, domelogmask, "taskrun", "Dispatched key: " << task.key) ;
-  
-  
+      Log(Logger::Lvl4, domelogmask, "taskrun", "Dispatching onTaskCompleted key: " << task->key) ;
+      onTaskCompleted(*task);
+    }
   
+    Log(Logger::Lvl4, domelogmask, "taskrun", "Dispatched key: " << task->key) ;
+  }
 }
 
 
@@ -278,17 +487,14 @@ int DomeTaskExec::submitCmd(std::string cmd) {
    DomeTask * task = new DomeTask();
    task->cmd= cmd;
    task->splitCmd();
-   {  
-     scoped_lock lck (*this);
-     
-     task->key = ++taskcnt; 
-     tasks.insert( std::pair<int,DomeTask*>(task->key,task));
-   }
-   boost::thread workerThread( taskfunc, this, taskcnt );
-   return taskcnt;
+   return enqueue(task);
 }
 
 int DomeTaskExec::submitCmd(std::vector<std::string> &args) {
+  return submitCmd(args, 0, 0);
+}
+
+int DomeTaskExec::submitCmd(std::vector<std::string> &args, int niceness, int ioprio) {
    DomeTask * task = NULL;
    std::ostringstream oss;
 
@@ -303,44 +509,33 @@ int DomeTaskExec::submitCmd(std::vector<std::string> &args) {
    } else return -1;
 
    assignCmd(task,args);
-   {
-     scoped_lock lck (*this);
-     
-     task->key = ++taskcnt;
-     tasks.insert( std::pair<int,DomeTask*>(task->key,task) );
-   }
-   boost::thread workerThread( taskfunc,this,taskcnt);
-   return taskcnt;
-
-
-
+   task->niceness = niceness;
+   task->ioprio = ioprio;
+   return enqueue(task);
 }
   /// Split che command string into the single parms
 void DomeTaskExec::assignCmd(DomeTask *task, std::vector<std::string> &args) {
-  int i = 0;
-  for(std::vector<string>::iterator it = args.begin() ; it != args.end(); ++it) {
-    task->parms[i++] = strdup((*it).c_str());
-  }
+  task->parms = args;
 }
 
 int DomeTaskExec::waitResult(int taskID, int tmout) {
-
+  DomeTask *task;
   
   {
     scoped_lock lck (*this);
     
     map <int, DomeTask *>::iterator i = tasks.find(taskID);
-    if ( i != tasks.end() ) {
-           Log(Logger::Lvl4, domelogmask, "waitResult", "Found task " << taskID);
-	   i->second->waitFinished(tmout);
-	   if (i->second->finished) return 0;
-    
-    }else {
- 	  Log(Logger::Lvl4, domelogmask, "waitResult", "Task with ID " << taskID << " not found");
-	  return 1;
-	}
+    if ( i == tasks.end() ) {
+      Log(Logger::Lvl4, domelogmask, "waitResult", "Task with ID " << taskID << " not found");
+      return 1;
+    }
+    Log(Logger::Lvl4, domelogmask, "waitResult", "Found task " << taskID);
+    task = i->second;
   }
-  return 1;
+
+  // Don't wait with the lock, or nothing could finish meanwhile.
+  // The task is not purged before it's finished
+  return task->waitFinished(tmout);
 }
 
 int DomeTaskExec::killTask(int taskID){
@@ -381,17 +576,21 @@ int DomeTaskExec::killTask(DomeTask *task){
   boost::lock_guard<DomeTask> l(*task);
   
 
-  if (task->finished){
+  if (task->finished || task->reaped){
     Log(Logger::Lvl4, domelogmask, "killTask", "Task " << task->key << " already finished");
     return 0;
   } else if ( task->pid == -1) {
-    Log(Logger::Lvl4, domelogmask, "killTask", "Task " << task->key << " not yet started");
+    // The reaper will not start it
+    task->killed = true;
+    uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) < 0) {}
+    Log(Logger::Lvl4, domelogmask, "killTask", "Task " << task->key << " not yet started, cancelled");
     return 0;
   } else {
+    task->killed = true;
+    // The whole process group, the reaper will see its output end
+    kill(-task->pid, SIGKILL);
     kill(task->pid, SIGKILL);
-    //close fd related to the task
-    for(int k=0; k<3; k++) 
-      close(task->fd[k]);
     Log(Logger::Lvl4, domelogmask, "killedTask", "Task " << task->key);
     return 0;
   }
@@ -403,6 +602,7 @@ int DomeTaskExec::killTask(DomeTask *task){
 
 void DomeTaskExec::tick() {
   std::deque<DomeTask *> notifq_running;
+  std::deque<DomeTask *> tokill;
   
   int maxruntime = CFG->GetLong("glb.task.maxrunningtime", 3600);
   int purgetime = CFG->GetLong("glb.task.purgetime", 3600);
@@ -414,7 +614,7 @@ void DomeTaskExec::tick() {
     map <int, DomeTask *>::iterator i;
     
     
-    for( i = tasks.begin(); i != tasks.end(); ++i ) {
+    for( i = tasks.begin(); i != tasks.end(); ) {
       Log(Logger::Lvl4, domelogmask, "tick", "Found task " << i->first << " with command " << i->second->cmd);
       Log(Logger::Lvl4, domelogmask, "tick", "The status of the task is " << i->second->finished);
       Log(Logger::Lvl4, domelogmask, "tick", "StartTime " << i->second->starttime << " EndTime " << i->second->endtime);
@@ -422,6 +622,7 @@ void DomeTaskExec::tick() {
       time_t timenow;
       time(&timenow);
       bool terminated = false;
+      bool purge = false;
       
       // Treat the task object, in locked state, and accumulate events to be sent later
       {
@@ -429,27 +630,36 @@ void DomeTaskExec::tick() {
         
         if (!i->second->finished && ( (i->second->starttime< (timenow - (maxruntime*1000))))) {
           Log(Logger::Lvl4, domelogmask, "tick", "endtime " << i->second->endtime<< " timelimit " << (timenow - (maxruntime*1000)));
-          //we kill the task
-          killTask(i->second);
+          //we kill the task, once we release it
+          tokill.push_back(i->second);
           Log(Logger::Lvl3, domelogmask, "tick", "Task with id  " << i->first << " exceed maxrunnngtime");
 
           terminated = true;
-          Log(Logger::Lvl3, domelogmask, "tick", "Task killed ");
         }
         
         //check if purgetime has exceeded and clean
         if (i->second->finished && ( i->second->endtime < (timenow - (purgetime*1000)))) {
           Log(Logger::Lvl4, domelogmask, "tick", "Task with id  " << i->first << " to purge");
-          //delete the task
-          delete i->second;
-          //remove from map
-          tasks.erase(i);
-          Log(Logger::Lvl3, domelogmask, "tick", "Task with id  " << i->first << " purged");
+          purge = true;
         }
         else if (!terminated && !i->second->finished)
           notifq_running.push_back( i->second );
       }
-      
+
+      if (purge) {
+        //delete the task
+        Log(Logger::Lvl3, domelogmask, "tick", "Task with id  " << i->first << " purged");
+        delete i->second;
+        //remove from map
+        tasks.erase(i++);
+      }
+      else
+        ++i;
+    }
+
+    for( std::deque<DomeTask *>::iterator k = tokill.begin(); k != tokill.end(); ++k ) {
+      killTask(*k);
+      Log(Logger::Lvl3, domelogmask, "tick", "Task killed ");
     }
   } // lock
   
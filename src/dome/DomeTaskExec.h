@@ -26,6 +26,8 @@
 
 #include <boost/thread.hpp>
 #include <signal.h>
+#include <deque>
+#include <map>
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -47,12 +49,17 @@ public:
   DomeTask(const DomeTask &o) {
     key = o.key;
     cmd = o.cmd;
-    for(unsigned int i = 0; i < sizeof(parms); i++) parms[i] = NULL;
+    parms = o.parms;
     resultcode = o.resultcode;
     starttime = o.starttime;
     endtime = o.endtime;
     finished = o.finished;
-    fd[0] = 0; fd[1] = 0; fd[2] = 0;
+    killed = o.killed;
+    reaped = o.reaped;
+    niceness = o.niceness;
+    ioprio = o.ioprio;
+    outfd = -1;
+    pid = o.pid;
     this->stdout = o.stdout;
   }
     
@@ -60,14 +67,27 @@ public:
   int key;
   
   std::string cmd;
-  const char *parms[64];
+  /// The command and its arguments
+  std::vector<std::string> parms;
 
+  /// The exit code of the command, or 128+signal if it was killed
+  /// -1 if it could not be started
   int resultcode;
   
   time_t starttime, endtime;
   bool finished;
-  
-  int fd[3];
+  /// Somebody asked to kill it
+  bool killed;
+  /// The process was collected, so its pid may belong to another one by now
+  bool reaped;
+
+  /// CPU priority of the command, as in nice(1). 0 leaves it as it is
+  int niceness;
+  /// IO priority of the command, as in ioprio_set(2). 0 leaves it as it is
+  int ioprio;
+
+  /// The read end of the stdout of the command
+  int outfd;
   pid_t pid;
   std::string stdout;
 
@@ -90,28 +110,40 @@ public:
 /// know the list of commands that are still running.
 /// Objects belonging to this class in general are created in the disk nodes,
 /// e.g. for running checksums or file copies and pulls
+///
+/// The commands are spawned by a single reaper thread, that also collects their
+/// output through epoll and their exit. At most glb.task.maxrunning commands
+/// run at the same time, the others wait in a queue. The completion events
+/// are dispatched by another thread, so a slow onTaskCompleted does not stop
+/// the collection of the output of the other commands.
 class DomeTaskExec: public boost::recursive_mutex {
   
 public:
   DomeTaskExec();
-  ~DomeTaskExec(); 
+  virtual ~DomeTaskExec(); 
   std::string instance;
   /// Executes a command. Returns a positive integer as a key to reference
   /// the execution status and the result
-  /// The mechanics is that a detached thread is started. This guy invokes popen3
-  /// and blocks waiting for the process to end. Upon end it updates the corresponding
-  /// instance of DomeTask with the result and the stdout
+  /// The command is queued, and started by the reaper thread as soon as
+  /// the limit of running commands allows it. Upon end the corresponding
+  /// instance of DomeTask is updated with the result and the stdout
   int submitCmd(std::string cmd);
 	
 	
   /// Executes a command. Returns a positive integer as a key to reference
   //  the execution status and the result
-  //  The mechanics is that a detached thread is started. This guy invokes popen3
-  //  and blocks waiting for the process to end. Upon end it updates the corresponding
-  //   instance of DomeTask with the result and the stdout
   //   -1 is returned in case of error in the submission
   int submitCmd(std::vector<std::string> &args);
 
+  /// Same as above, running the command with the given CPU and IO priorities
+  /// @param niceness as in nice(1), 0 to inherit the one of this process
+  /// @param ioprio   as in ioprio_set(2), see ioprioFromString. 0 to inherit it
+  int submitCmd(std::vector<std::string> &args, int niceness, int ioprio);
+
+  /// Parse an IO priority, as idle, besteffort:N or realtime:N, N being 0-7.
+  /// Gives back 0 for an empty string, -1 if it's invalid
+  static int ioprioFromString(const std::string &s);
+
   /// Split che command string into the single parms
   void assignCmd(DomeTask *task, std::vector<std::string> &args);
   
@@ -148,20 +180,44 @@ protected:
   virtual void onTaskRunning(DomeTask &task);
 private:
 
-  int popen3(int fd[3], pid_t *pid,  const char ** argv );
+  /// Start the command of the task, with its stdout going to a pipe
+  int spawn(DomeTask &task);
+
+  /// Queue a task and wake up the reaper
+  int enqueue(DomeTask *task);
+
+  /// Start the reaper and the dispatcher, if they are not running yet
+  void startThreads();
+
+  /// Starts the queued commands, reads their output and collects their exits
+  void reaperLoop();
+
+  /// Marks the finished tasks as such, and invokes onTaskCompleted
+  void dispatcherLoop();
+
+  /// The command of the task has exited, or could not start
+  void taskExited(DomeTask *task);
   
   /// Used to create keys to be inserted into the map. This has to be treated modulo MAXINT or similar big number
   int taskcnt;
   /// This map works like a sparse array :-)
   std::map<int, DomeTask*> tasks;
-  
-  
-  /// Here we invoke popen3
-  /// and block waiting for the process to end. Upon end it updates the corresponding
-  /// instance of DomeTask with the result and the stdout
-  virtual void run(DomeTask &task);
-  
-  friend void taskfunc(DomeTaskExec *, int);
+
+  /// Tasks waiting to be started
+  std::deque<DomeTask*> pending;
+  /// Commands that are running
+  long running;
+
+  /// Tasks that exited, for the dispatcher
+  std::deque<DomeTask*> exited;
+  boost::condition_variable_any exitedcond;
+
+  boost::thread *reaper;
+  boost::thread *dispatcher;
+  bool stopping;
+  /// Wakes up the reaper
+  int wakefd;
+  int epollfd;
 
   //kill a specific task
   int killTask(DomeTask *task);
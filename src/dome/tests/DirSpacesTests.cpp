@@ -0,0 +1,171 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeDirSpaces.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/time.h>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+static int64_t sizeOf(const DomeDirSpaces &s, int64_t fileid) {
+  int64_t size = -1;
+  ASSERTm(s.getSize(fileid, size), fileid);
+  return size;
+}
+
+// A small tree, with a file moved under a dir created after it
+void test1() {
+  DECLARE_TEST();
+
+  DomeDirSpaces s;
+  s.add(1, 0, true, 0);       // /
+  s.add(2, 1, true, 0);       // /dpm
+  s.add(3, 2, true, 999);     // /dpm/cern.ch
+  s.add(4, 3, true, 30);      // /dpm/cern.ch/home
+  s.add(5, 4, false, 10);
+  s.add(6, 4, false, 20);
+  s.add(7, 9, false, 100);    // moved into 9
+  s.add(8, 3, false, 1);
+  s.add(9, 4, true, 100);
+  s.compute();
+
+  ASSERT(sizeOf(s, 9) == 100);
+  ASSERT(sizeOf(s, 4) == 130);
+  ASSERT(sizeOf(s, 3) == 131);
+  ASSERT(sizeOf(s, 1) == 131);
+  ASSERT(s.summary().dirs == 5);
+  ASSERT(s.summary().files == 4);
+  ASSERT(s.summary().maxdepth == 4);
+
+  std::vector<DomeDirSpaces::Fix> fixes;
+  s.getFixes(2, 6, fixes);
+  ASSERTm(fixes.size() == 2, fixes.size());
+  ASSERT(fixes[0].fileid == 3);
+  ASSERT(fixes[0].depth == 2);
+  ASSERT(fixes[0].stored == 999);
+  ASSERT(fixes[0].computed == 131);
+  ASSERT(fixes[1].fileid == 4);
+  ASSERT(fixes[1].computed == 130);
+}
+
+// Entries in a loop or without a parent are not counted anywhere
+void test2() {
+  DECLARE_TEST();
+
+  DomeDirSpaces s;
+  s.add(1, 0, true, 0);
+  s.add(2, 1, true, 0);
+  s.add(3, 4, true, 0);       // 3 and 4 are in a loop
+  s.add(4, 3, true, 0);
+  s.add(5, 50, true, 0);      // Missing parent
+  s.add(6, 5, true, 0);
+  s.add(7, 2, false, 5);
+  s.add(8, 6, false, 7);
+  s.add(9, 4, false, 11);
+  s.add(10, 77, false, 13);   // Missing parent
+  s.compute();
+
+  ASSERT(sizeOf(s, 1) == 5);
+  int64_t size;
+  ASSERT(!s.getSize(3, size));
+  ASSERT(!s.getSize(6, size));
+  ASSERT(s.summary().orphandirs == 4);
+  ASSERT(s.summary().orphanfiles == 1);
+
+  std::vector<DomeDirSpaces::Fix> fixes;
+  s.getFixes(0, 100, fixes);
+  ASSERT(fixes.size() == 2);
+}
+
+static void fill(DomeDirSpaces &s, int64_t ndirs, int64_t nfiles) {
+  srand(42);
+  s.add(1, 0, true, 0);
+  for (int64_t i = 2; i <= ndirs; i++)
+    s.add(i, 1 + rand() % (i - 1), true, 0);
+  for (int64_t i = 0; i < nfiles; i++) {
+    int64_t parent = 1 + rand() % ndirs;
+    s.add(ndirs + 1 + i, parent, false, rand() % 1000);
+  }
+}
+
+// The same sizes as adding each file to all the dirs above it
+void test3() {
+  DECLARE_TEST();
+
+  const int64_t ndirs = 100000, nfiles = 300000;
+  DomeDirSpaces s;
+  fill(s, ndirs, nfiles);
+  s.compute();
+
+  srand(42);
+  std::vector<int64_t> parent(ndirs + 1, 0), expected(ndirs + 1, 0);
+  for (int64_t i = 2; i <= ndirs; i++)
+    parent[i] = 1 + rand() % (i - 1);
+  for (int64_t i = 0; i < nfiles; i++) {
+    int64_t d = 1 + rand() % ndirs;
+    int64_t size = rand() % 1000;
+    for (; d != 0; d = parent[d])
+      expected[d] += size;
+  }
+
+  for (int64_t i = 1; i <= ndirs; i++)
+    ASSERTm(sizeOf(s, i) == expected[i], "dir " << i);
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void bench() {
+  DECLARE_TEST();
+
+  DomeDirSpaces s;
+  fill(s, 1000000, 5000000);
+  double t0 = now();
+  s.compute();
+  std::cout << "1M dirs, 5M files: " << (now() - t0) << "s" << std::endl;
+}
+
+int main() {
+  test1();
+  test2();
+  test3();
+  bench();
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "TestDomeTaskExec.h"
+#include "utils/Config.hh"
 #include <iostream>
 #include <cppunit/TestFixture.h>
 #include <cppunit/TestAssert.h>
@@ -78,11 +79,57 @@ public:
 
   }
 
+  void testResultCode() {
+    std::cout << "Test ResultCode" << std::endl;
+    int ok = core.submitCmd("/bin/echo Andrea");
+    int ko = core.submitCmd("/bin/false");
+    int missing = core.submitCmd("/bin/nonexisting-command");
+    CPPUNIT_ASSERT(core.waitResult(ok) == 0);
+    CPPUNIT_ASSERT(core.waitResult(ko) == 0);
+    CPPUNIT_ASSERT(core.waitResult(missing) == 0);
+    CPPUNIT_ASSERT(core.getTask(ok)->resultcode == 0);
+    CPPUNIT_ASSERT(core.getTask(ok)->stdout == "Andrea\n");
+    CPPUNIT_ASSERT(core.getTask(ko)->resultcode == 1);
+    CPPUNIT_ASSERT(core.getTask(missing)->resultcode == 127);
+
+    CPPUNIT_ASSERT(DomeTaskExec::ioprioFromString("") == 0);
+    CPPUNIT_ASSERT(DomeTaskExec::ioprioFromString("idle") == (3 << 13));
+    CPPUNIT_ASSERT(DomeTaskExec::ioprioFromString("besteffort:7") == ((2 << 13) | 7));
+    CPPUNIT_ASSERT(DomeTaskExec::ioprioFromString("besteffort:8") == -1);
+    CPPUNIT_ASSERT(DomeTaskExec::ioprioFromString("fast") == -1);
+  }
+
+  void testMaxRunning() {
+    std::cout << "Test MaxRunning" << std::endl;
+    CFG->SetLong("glb.task.maxrunning", 2);
+    int key[4];
+    for (int i = 0; i < 4; i++)
+      key[i] = core.submitCmd("/bin/sleep 100");
+    sleep(1);
+    // Only two started, the others are queued. Killing a queued one
+    // means it will never run
+    CPPUNIT_ASSERT(core.getTask(key[2])->pid == -1);
+    core.killTask(key[3]);
+    core.killTask(key[0]);
+    CPPUNIT_ASSERT(core.waitResult(key[0]) == 0);
+    CPPUNIT_ASSERT(core.waitResult(key[3]) == 0);
+    CPPUNIT_ASSERT(core.getTask(key[3])->pid == -1);
+    sleep(1);
+    CPPUNIT_ASSERT(core.getTask(key[2])->pid != -1);
+    core.killTask(key[1]);
+    core.killTask(key[2]);
+    CPPUNIT_ASSERT(core.waitResult(key[1]) == 0);
+    CPPUNIT_ASSERT(core.waitResult(key[2]) == 0);
+    CFG->SetLong("glb.task.maxrunning", 64);
+  }
+
   CPPUNIT_TEST_SUITE(DomeTaskTest);
   CPPUNIT_TEST(testSubmitCmd);
   CPPUNIT_TEST(testKill);
   CPPUNIT_TEST(testParallel);
   CPPUNIT_TEST(testParallelVectorArgs);
+  CPPUNIT_TEST(testResultCode);
+  CPPUNIT_TEST(testMaxRunning);
   CPPUNIT_TEST_SUITE_END();
 
 };
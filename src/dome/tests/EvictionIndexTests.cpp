@@ -0,0 +1,170 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeEvictionIndex.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+// The least recently used go first, and only from the asked prefix
+void test1() {
+  DECLARE_TEST();
+
+  DomeEvictionIndex index;
+  ASSERT(index.addFilesystem("/fs1/"));
+  ASSERT(!index.addFilesystem("/fs1"));
+
+  index.touch("/fs1/dteam/2016-01-01/c", 10, 300);
+  index.touch("/fs1/dteam/2016-01-01/a", 10, 100);
+  index.touch("/fs1/dteam/2016-01-02/b", 10, 200);
+  index.touch("/fs1/atlas/2016-01-01/x", 10, 50);
+  index.touch("/fs2/dteam/2016-01-01/y", 10, 10);   // Not indexed
+
+  // Used again, so it goes last
+  index.touch("/fs1/dteam/2016-01-01/a", 10, 400);
+
+  std::vector<DomeEvictionIndex::Victim> victims;
+  int64_t freed = index.popOldest("/fs1/dteam", 15, 100, victims);
+  ASSERTm(freed == 20, freed);
+  ASSERT(victims.size() == 2);
+  ASSERT(victims[0].pfn == "/fs1/dteam/2016-01-02/b");
+  ASSERT(victims[1].pfn == "/fs1/dteam/2016-01-01/c");
+
+  // Limited by the number of files
+  victims.clear();
+  index.popOldest("/fs1/dteam/", 1000, 0, victims);
+  ASSERT(victims.empty());
+
+  index.remove("/fs1/dteam/2016-01-01/a");
+  index.popOldest("/fs1/dteam", 1000, 100, victims);
+  ASSERT(victims.empty());
+
+  std::map<std::string, DomeEvictionIndex::Counters> counters;
+  index.getCounters(counters);
+  ASSERT(counters["/fs1/dteam"].files == 0);
+  ASSERT(counters["/fs1/dteam"].evicted == 2);
+  ASSERT(counters["/fs1/atlas"].files == 1);
+  ASSERT(counters["/fs1/atlas"].bytes == 10);
+  ASSERT(counters.find("/fs2/dteam") == counters.end());
+}
+
+static void mkfile(const std::string &path, int size, time_t when) {
+  std::ofstream f(path.c_str());
+  f << std::string(size, 'x');
+  f.close();
+
+  struct timeval times[2];
+  times[0].tv_sec = times[1].tv_sec = when;
+  times[0].tv_usec = times[1].tv_usec = 0;
+  utimes(path.c_str(), times);
+}
+
+// The scan finds what is on disk, but does not override what is already known
+void test2() {
+  DECLARE_TEST();
+
+  char tmpl[] = "/tmp/dome-eviction-XXXXXX";
+  std::string fs = mkdtemp(tmpl);
+  mkdir((fs + "/dteam").c_str(), 0755);
+  mkdir((fs + "/dteam/2016-01-01").c_str(), 0755);
+  mkdir((fs + "/dteam/2016-01-02").c_str(), 0755);
+  mkfile(fs + "/dteam/2016-01-01/old", 3, 1000);
+  mkfile(fs + "/dteam/2016-01-02/new", 5, 2000);
+  mkfile(fs + "/dteam/2016-01-02/known", 7, 500);
+
+  DomeEvictionIndex index;
+  ASSERT(index.addFilesystem(fs));
+  ASSERT(!index.isScanned(fs));
+
+  index.touch(fs + "/dteam/2016-01-02/known", 7, 3000);
+  index.scan(fs);
+  ASSERT(index.isScanned(fs));
+
+  std::vector<DomeEvictionIndex::Victim> victims;
+  index.popOldest(fs + "/dteam", 1000, 100, victims);
+  ASSERTm(victims.size() == 3, victims.size());
+  ASSERT(victims[0].pfn == fs + "/dteam/2016-01-01/old");
+  ASSERT(victims[0].size == 3);
+  ASSERT(victims[1].pfn == fs + "/dteam/2016-01-02/new");
+  ASSERT(victims[2].pfn == fs + "/dteam/2016-01-02/known");
+
+  system(SSTR("rm -rf " << fs).c_str());
+}
+
+// What could not be evicted goes back where it was
+void test3() {
+  DECLARE_TEST();
+
+  DomeEvictionIndex index;
+  index.addFilesystem("/fs1");
+  index.touch("/fs1/dteam/2016-01-01/a", 10, 100);
+  index.touch("/fs1/dteam/2016-01-01/b", 10, 200);
+  index.touch("/fs1/dteam/2016-01-01/c", 10, 300);
+
+  std::vector<DomeEvictionIndex::Victim> victims;
+  index.popOldest("/fs1/dteam", 20, 100, victims);
+  ASSERT(victims.size() == 2);
+  ASSERT(victims[0].lastused == 100);
+
+  // b was used while being evicted, that time is kept
+  index.touch("/fs1/dteam/2016-01-01/b", 10, 400);
+  index.putBack(victims);
+
+  std::map<std::string, DomeEvictionIndex::Counters> counters;
+  index.getCounters(counters);
+  ASSERT(counters["/fs1/dteam"].files == 3);
+  ASSERT(counters["/fs1/dteam"].bytes == 30);
+  ASSERT(counters["/fs1/dteam"].evicted == 0);
+
+  victims.clear();
+  index.popOldest("/fs1/dteam", 1000, 100, victims);
+  ASSERTm(victims.size() == 3, victims.size());
+  ASSERT(victims[0].pfn == "/fs1/dteam/2016-01-01/a");
+  ASSERT(victims[1].pfn == "/fs1/dteam/2016-01-01/c");
+  ASSERT(victims[2].pfn == "/fs1/dteam/2016-01-01/b");
+}
+
+int main() {
+  test1();
+  test2();
+  test3();
+  return 0;
+}
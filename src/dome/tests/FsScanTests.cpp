@@ -0,0 +1,169 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeFsScan.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+/// A catalog in memory, the rowid of a replica is its position plus one
+class FakeSource: public DomeFsScan::ReplicaSource {
+public:
+  FakeSource(): calls(0) {}
+
+  int getReplicas(const std::string &server, const std::string &fs, int64_t afterrowid,
+                  unsigned int limit, std::vector<std::string> &out, int64_t &lastrowid, std::string &err) {
+    calls++;
+    lastrowid = afterrowid;
+    for (unsigned int n = 0; (lastrowid < (int64_t)rfns.size()) && (n < limit); n++)
+      out.push_back(rfns[lastrowid++]);
+    return 0;
+  }
+
+  std::vector<std::string> rfns;
+  int calls;
+};
+
+static void mkfile(const std::string &path, time_t when) {
+  std::ofstream f(path.c_str());
+  f << "x";
+  f.close();
+
+  struct timeval times[2];
+  times[0].tv_sec = times[1].tv_sec = when;
+  times[0].tv_usec = times[1].tv_usec = 0;
+  utimes(path.c_str(), times);
+}
+
+// Dark data and lost replicas are found, recent files are not dark data
+void test1() {
+  DECLARE_TEST();
+
+  char tmpl[] = "/tmp/dome-fsscan-XXXXXX";
+  std::string fs = mkdtemp(tmpl);
+  mkdir((fs + "/dteam").c_str(), 0755);
+  mkdir((fs + "/dteam/2016-01-01").c_str(), 0755);
+  mkdir((fs + "/dteam/2016-01-02").c_str(), 0755);
+  mkdir((fs + "/atlas").c_str(), 0755);
+
+  FakeSource source;
+  for (int i = 0; i < 50; i++) {
+    std::string pfn = SSTR(fs << "/dteam/2016-01-01/f" << i);
+    mkfile(pfn, 1000);
+    source.rfns.push_back("disk1:" + pfn);
+  }
+  mkfile(fs + "/dteam/2016-01-02/dark", 1000);
+  mkfile(fs + "/atlas/new", time(0));
+  source.rfns.push_back("disk1:" + fs + "/atlas/lost");
+  source.rfns.push_back("disk1:" + fs + "/dteam/2016-01-02/lost");
+  // Not in rfn order, as they come by rowid
+  std::reverse(source.rfns.begin(), source.rfns.end());
+
+  DomeFsScan::Params params;
+  params.nthreads = 3;
+  params.pagesize = 7;
+  params.reportfile = fs + ".report";
+
+  DomeFsScan scan("disk1", fs + "/", params);
+  ASSERT(scan.getProgress().state == DomeFsScan::Progress::Queued);
+  scan.run(source);
+
+  DomeFsScan::Progress p = scan.getProgress();
+  ASSERTm(p.state == DomeFsScan::Progress::Done, p.err);
+  ASSERTm(p.dirs == 5, p.dirs);
+  ASSERT(p.files == 52);
+  ASSERT(p.replicas == 52);
+  ASSERT(source.calls == 8);
+  ASSERT(p.darkdata == 1);
+  ASSERT(p.darkexamples[0] == fs + "/dteam/2016-01-02/dark");
+  ASSERT(p.lost == 2);
+  ASSERT(p.lostexamples[0] == "disk1:" + fs + "/atlas/lost");
+
+  std::ifstream report(params.reportfile.c_str());
+  std::string line;
+  int nlines = 0;
+  while (std::getline(report, line)) nlines++;
+  ASSERT(nlines == 3);
+
+  system(SSTR("rm -rf " << fs << " " << params.reportfile).c_str());
+}
+
+// The rate limit is respected
+void test2() {
+  DECLARE_TEST();
+
+  char tmpl[] = "/tmp/dome-fsscan-XXXXXX";
+  std::string fs = mkdtemp(tmpl);
+  for (int i = 0; i < 40; i++)
+    mkfile(SSTR(fs << "/f" << i), 1000);
+
+  FakeSource source;
+  source.rfns.push_back("disk1:" + fs + "/f2");
+  source.rfns.push_back("disk1:" + fs + "/f1");
+
+  DomeFsScan::Params params;
+  params.maxrate = 100;
+  params.maxexamples = 3;
+
+  struct timeval t0, t1;
+  gettimeofday(&t0, 0);
+  DomeFsScan scan("disk1", fs, params);
+  scan.run(source);
+  gettimeofday(&t1, 0);
+
+  // 42 entries, with . and ..
+  ASSERT((t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec) >= 400000);
+
+  DomeFsScan::Progress p = scan.getProgress();
+  ASSERTm(p.state == DomeFsScan::Progress::Done, p.err);
+  ASSERT(p.lost == 0);
+  ASSERT(p.darkdata == 38);
+  ASSERT(p.darkexamples.size() == 3);
+
+  system(SSTR("rm -rf " << fs).c_str());
+}
+
+int main() {
+  test1();
+  test2();
+  return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeJson.h"
+#include <boost/property_tree/json_parser.hpp>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <sys/time.h>
+
+using namespace std;
+using boost::property_tree::ptree;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+static ptree boostParse(const std::string &doc) {
+  ptree t;
+  std::istringstream is(doc);
+  boost::property_tree::read_json(is, t);
+  return t;
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// The reader gives the same trees as read_json
+void test1() {
+  DECLARE_TEST();
+
+  const char *docs[] = {
+    "{}",
+    "  {\"lfn\": \"/dpm/cern.ch/home/dteam/file\", \"fileid\": 1234 }\n",
+    "{\"a\": {\"b\": [1, -2.5e3, \"x\", true, false, null, {\"c\": []}]}, \"a\": \"dup\"}",
+    "{\"esc\": \"q\\\"b\\\\s\\/n\\nt\\tu\\u00e9\\ud83d\\ude00\", \"utf8\": \"\xc3\xa9\"}",
+    "[\"a\", [\"b\"], {}]",
+    0
+  };
+
+  for (int i = 0; docs[i]; i++) {
+    ptree mine;
+    std::string err;
+    ASSERTm(DomeJsonReader::parse(docs[i], strlen(docs[i]), mine, err) == 0, docs[i] << " " << err);
+    ASSERTm(mine == boostParse(docs[i]), docs[i]);
+  }
+
+  ptree empty;
+  std::string err;
+  ASSERT(DomeJsonReader::parse(" \n", 2, empty, err) == 0);
+  ASSERT(empty.empty());
+
+  const char *bad[] = {
+    "{", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "{\"a\": tru}", "{\"a\": 01}",
+    "{\"a\": \"\\x\"}", "{\"a\": \"\\ud83d\"}", "{\"a\": \"tab\there\"}", "{} {}", "-",
+    0
+  };
+  for (int i = 0; bad[i]; i++) {
+    ptree t;
+    ASSERTm(DomeJsonReader::parse(bad[i], strlen(bad[i]), t, err) != 0, bad[i]);
+  }
+
+  std::string deep(1000, '[');
+  ptree t;
+  ASSERT(DomeJsonReader::parse(deep.data(), deep.size(), t, err) != 0);
+}
+
+// What the writer produces reads back as what write_json would have given
+void test2() {
+  DECLARE_TEST();
+
+  DomeJsonWriter json;
+  json.beginObject()
+      .field("name", std::string("we\"ird\\ na/me\n\x01 \xc3\xa9"))
+      .field("size", (long)-42)
+      .field("fileid", (unsigned long long)18446744073709551615ULL)
+      .field("status", '-')
+      .field("banned", true)
+      .beginArray("entries")
+        .beginObject().field("a", 1).endObject()
+        .beginObject().field("b", "x").endObject()
+      .endArray()
+      .field("last", "")
+      .endObject();
+
+  ptree expected, e1, e2, entries;
+  expected.put("name", std::string("we\"ird\\ na/me\n\x01 \xc3\xa9"));
+  expected.put("size", -42L);
+  expected.put("fileid", 18446744073709551615ULL);
+  expected.put("status", '-');
+  expected.put("banned", true);
+  e1.put("a", 1);
+  e2.put("b", "x");
+  entries.push_back(std::make_pair("", e1));
+  entries.push_back(std::make_pair("", e2));
+  expected.push_back(std::make_pair("entries", entries));
+  expected.put("last", "");
+
+  ASSERTm(boostParse(json.str()) == expected, json.str());
+
+  ptree mine;
+  std::string err;
+  ASSERT(DomeJsonReader::parse(json.str().data(), json.str().size(), mine, err) == 0);
+  ASSERT(mine == expected);
+}
+
+// Cost per entry of a dome_getdir-like listing, ptree against DomeJson
+void bench() {
+  DECLARE_TEST();
+
+  const int nentries = 20000;
+  std::string xattrs = "{\"checksum.adler32\":\"0a1b2c3d\",\"pool\":\"pool01\"}";
+
+  double t0 = now();
+  ptree jresp, jresp2;
+  for (int i = 0; i < nentries; i++) {
+    ptree pt;
+    pt.put("name", SSTR("file" << i));
+    pt.put("fileid", 100000 + i);
+    pt.put("parentfileid", 99);
+    pt.put("size", (long)i * 4096);
+    pt.put("mode", 0100644);
+    pt.put("atime", 1450000000L + i);
+    pt.put("mtime", 1450000000L + i);
+    pt.put("ctime", 1450000000L + i);
+    pt.put("uid", 101);
+    pt.put("gid", 102);
+    pt.put("nlink", 1);
+    pt.put("acl", "");
+    pt.put("xattrs", xattrs);
+    jresp2.push_back(std::make_pair("", pt));
+  }
+  jresp.push_back(std::make_pair("entries", jresp2));
+  std::ostringstream os;
+  boost::property_tree::write_json(os, jresp);
+  double t1 = now();
+
+  DomeJsonWriter json;
+  json.beginObject().beginArray("entries");
+  for (int i = 0; i < nentries; i++) {
+    json.beginObject()
+        .field("name", SSTR("file" << i))
+        .field("fileid", 100000 + i)
+        .field("parentfileid", 99)
+        .field("size", (long)i * 4096)
+        .field("mode", 0100644)
+        .field("atime", 1450000000L + i)
+        .field("mtime", 1450000000L + i)
+        .field("ctime", 1450000000L + i)
+        .field("uid", 101)
+        .field("gid", 102)
+        .field("nlink", 1)
+        .field("acl", "")
+        .field("xattrs", xattrs)
+        .endObject();
+  }
+  json.endArray().endObject();
+  double t2 = now();
+
+  ptree boostTree = boostParse(os.str());
+  double t3 = now();
+
+  ptree mine;
+  std::string err;
+  ASSERT(DomeJsonReader::parse(json.str().data(), json.str().size(), mine, err) == 0);
+  double t4 = now();
+
+  ASSERT(mine == boostTree);
+
+  std::cout << "Encode per entry: ptree " << (t1 - t0) * 1e9 / nentries << " ns, DomeJsonWriter "
+            << (t2 - t1) * 1e9 / nentries << " ns" << std::endl;
+  std::cout << "Decode per entry: read_json " << (t3 - t2) * 1e9 / nentries << " ns, DomeJsonReader "
+            << (t4 - t3) * 1e9 / nentries << " ns" << std::endl;
+}
+
+int main() {
+  test1();
+  test2();
+  bench();
+  return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeMetadataCache.hh"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+static std::string tmpFile() {
+  char tmpl[] = "/tmp/dome-mdcache-XXXXXX";
+  int fd = mkstemp(tmpl);
+  close(fd);
+  return tmpl;
+}
+
+static dmlite::ExtendedStat makeStat(int64_t fileid) {
+  dmlite::ExtendedStat st;
+  memset(&st.stat, 0, sizeof(st.stat));
+  st.stat.st_ino = fileid;
+  st.stat.st_mode = S_IFREG | 0644;
+  st.stat.st_size = fileid * 10;
+  st.parent = 1;
+  st.name = SSTR("file" << fileid);
+  st.status = dmlite::ExtendedStat::kOnline;
+  st.csumtype = "AD";
+  st.csumvalue = "1234abcd";
+  st.acl = dmlite::Acl("A6101,B6102,C4000,E70");
+  st["checksum.adler32"] = std::string("1234abcd");
+  return st;
+}
+
+// The entries come back as they were, and are fetched again when they expire
+void test1() {
+  DECLARE_TEST();
+
+  DomeMetadataCache *cache = DOMECACHE;
+  cache->Init();
+
+  for (int64_t i = 10; i < 20; i++)
+    cache->pushXstatInfo(makeStat(i), DomeFileInfo::Ok);
+
+  std::string file = tmpFile(), small = tmpFile();
+  ASSERT(cache->save(file, 100) == 10);
+  ASSERT(cache->save(small, 4) == 4);
+
+  for (int64_t i = 10; i < 20; i++)
+    cache->removeInfo(i, 1, SSTR("file" << i));
+  // Something fresher than the file is not overwritten
+  dmlite::ExtendedStat fresh = makeStat(15);
+  fresh.stat.st_size = 42;
+  cache->pushXstatInfo(fresh, DomeFileInfo::Ok);
+
+  ASSERT(cache->load(file) == 9);
+  ASSERT(cache->load(file) == 0);
+
+  boost::shared_ptr<DomeFileInfo> fi = cache->getFileInfoOrCreateNewOne(12);
+  {
+    boost::unique_lock<boost::mutex> l(*fi);
+    ASSERT(fi->status_statinfo == DomeFileInfo::Ok);
+    ASSERT(fi->validuntil > time(0));
+    ASSERT(fi->statinfo.stat.st_size == 120);
+    ASSERT(fi->statinfo.name == "file12");
+    ASSERT(fi->statinfo.csumvalue == "1234abcd");
+    ASSERT(fi->statinfo.acl.size() == 4);
+    ASSERT(fi->statinfo.acl.serialize() == makeStat(12).acl.serialize());
+    ASSERT(fi->statinfo.getString("checksum.adler32") == "1234abcd");
+  }
+  ASSERT(cache->getFileInfoOrCreateNewOne(1, "file12") == fi);
+  ASSERT(cache->getFileInfoOrCreateNewOne(15)->statinfo.stat.st_size == 42);
+
+  // Expired, the next lookup has to go to the db
+  fi->validuntil = time(0) - 1;
+  fi = cache->getFileInfoOrCreateNewOne(12);
+  ASSERT(fi->status_statinfo == DomeFileInfo::NoInfo);
+  ASSERT(fi->validuntil == 0);
+
+  unlink(file.c_str());
+  unlink(small.c_str());
+}
+
+// Files that were not saved by the cache are refused
+void test2() {
+  DECLARE_TEST();
+
+  DomeMetadataCache *cache = DOMECACHE;
+  std::string file = tmpFile();
+  ASSERT(cache->load(file) < 0);
+
+  std::ofstream f(file.c_str());
+  f << std::string(4096, 'x');
+  f.close();
+  ASSERT(cache->load(file) < 0);
+
+  ASSERT(cache->load("/nonexistent/mdcache") < 0);
+  ASSERT(cache->save("/nonexistent/mdcache", 10) < 0);
+  unlink(file.c_str());
+}
+
+static boost::shared_ptr<DomeDirListing> makeListing(int n) {
+  boost::shared_ptr<DomeDirListing> listing(new DomeDirListing);
+  listing->created = time(0);
+  for (int i = 0; i < n; i++)
+    listing->entries.push_back(DomeDirListing::Entry(SSTR("file" << i), 100 + i));
+  return listing;
+}
+
+// Directory listings are kept unless the directory changes while being read
+void test3() {
+  DECLARE_TEST();
+
+  DomeMetadataCache *cache = DOMECACHE;
+  cache->Init();
+  ASSERT(!cache->getDirListing(5));
+
+  unsigned long long token = cache->beginDirListing(5);
+  cache->pushDirListing(5, token, makeListing(3));
+  boost::shared_ptr<const DomeDirListing> listing = cache->getDirListing(5);
+  ASSERT(listing && (listing->entries.size() == 3));
+  ASSERT(listing->entries[2].second == 102);
+
+  // An entry is added while the listing is read
+  cache->wipeDirListing(5);
+  ASSERT(!cache->getDirListing(5));
+  token = cache->beginDirListing(5);
+  cache->wipeDirListing(5);
+  cache->pushDirListing(5, token, makeListing(3));
+  ASSERT(!cache->getDirListing(5));
+
+  // Two readers, the last one wins
+  unsigned long long token1 = cache->beginDirListing(5);
+  unsigned long long token2 = cache->beginDirListing(5);
+  cache->pushDirListing(5, token1, makeListing(1));
+  ASSERT(!cache->getDirListing(5));
+  cache->pushDirListing(5, token2, makeListing(2));
+  ASSERT(cache->getDirListing(5)->entries.size() == 2);
+
+  // Renaming an entry drops the listing of its parent
+  cache->removeInfo(101, 5, "file1");
+  ASSERT(!cache->getDirListing(5));
+
+  // Too big
+  token = cache->beginDirListing(6);
+  cache->pushDirListing(6, token, makeListing(cache->getDirListingMaxEntries() + 1));
+  ASSERT(!cache->getDirListing(6));
+}
+
+// The link count of a cached directory moves in place, once per change
+void test4() {
+  DECLARE_TEST();
+
+  DomeMetadataCache *cache = DOMECACHE;
+  cache->Init();
+
+  dmlite::ExtendedStat dir = makeStat(30);
+  dir.stat.st_mode = S_IFDIR | 0755;
+  dir.stat.st_nlink = 5;
+  dir.stat.st_mtime = 100;
+  cache->pushXstatInfo(dir, DomeFileInfo::Ok);
+
+  time_t before = time(0);
+  cache->addNlink(dir, 1);
+  cache->addNlink(dir, 1);
+  cache->addNlink(dir, -3);
+
+  boost::shared_ptr<DomeFileInfo> fi = cache->getFileInfoOrCreateNewOne(30);
+  ASSERT(cache->getFileInfoOrCreateNewOne(1, "file30") == fi);
+  {
+    boost::unique_lock<boost::mutex> l(*fi);
+    ASSERTm(fi->statinfo.stat.st_nlink == 4, fi->statinfo.stat.st_nlink);
+    ASSERT(fi->statinfo.stat.st_mtime >= before);
+  }
+
+  // Nothing to move when it is going to be read again
+  cache->wipeEntry(dir);
+  cache->addNlink(dir, 1);
+  ASSERT(fi->status_statinfo == DomeFileInfo::NoInfo);
+  ASSERT(fi->statinfo.stat.st_nlink == 4);
+
+  // Nor when it is not cached
+  cache->addNlink(makeStat(31), 1);
+  cache->removeInfo(30, 1, "file30");
+}
+
+int main() {
+  test1();
+  test2();
+  test3();
+  test4();
+  return 0;
+}
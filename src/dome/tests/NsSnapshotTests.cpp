@@ -0,0 +1,216 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomeNsSnapshot.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+class Collector: public DomeNsSnapshot::Visitor {
+public:
+  bool visit(const DomeNsSnapshot &snap, int64_t idx, const std::string &path) {
+    paths.push_back(path);
+    return path != "/dpm/cern.ch/skip";
+  }
+  std::vector<std::string> paths;
+};
+
+static std::string tmpFile() {
+  char tmpl[] = "/tmp/dome-nssnapshot-XXXXXX";
+  int fd = mkstemp(tmpl);
+  close(fd);
+  return tmpl;
+}
+
+// Paths, walks and replicas of a small namespace, added out of order
+void test1() {
+  DECLARE_TEST();
+
+  std::string file = tmpFile();
+  {
+    DomeNsSnapshotWriter w;
+    w.addEntry(1, 0, S_IFDIR | 0755, 0, "/");
+    w.addEntry(2, 1, S_IFDIR | 0755, 0, "dpm");
+    w.addEntry(3, 2, S_IFDIR | 0755, 0, "cern.ch");
+    w.addEntry(10, 3, S_IFREG | 0644, 100, "b");
+    w.addEntry(5, 3, S_IFDIR | 0755, 0, "skip");
+    w.addEntry(6, 5, S_IFREG | 0644, 7, "hidden");
+    w.addEntry(4, 3, S_IFREG | 0644, 10, "a");
+    w.addEntry(7, 99, S_IFREG | 0644, 1, "orphan");
+
+    w.addReplica(4, "disk1", "/fs1", '-', "disk1:/fs1/a");
+    w.addReplica(10, "disk2", "/fs1", '-', "disk2:/fs1/b");
+    w.addReplica(6, "disk1", "/fs2", '-', "disk1:/fs2/hidden");
+    w.addReplica(10, "disk1", "/fs1", 'P', "disk1:/fs1/b");
+    w.addReplica(42, "disk1", "/fs2", '-', "disk1:/fs2/dark");
+
+    std::string err;
+    ASSERTm(w.write(file, err) == 0, err);
+  }
+
+  DomeNsSnapshot snap;
+  std::string err;
+  ASSERTm(snap.open(file, err) == 0, err);
+  ASSERT(snap.countEntries() == 8);
+  ASSERT(snap.countReplicas() == 5);
+
+  ASSERT(snap.lookup("/") == snap.findFileid(1));
+  int64_t idx = snap.lookup("/dpm/cern.ch/b");
+  ASSERT(idx >= 0);
+  ASSERT(snap.entry(idx).fileid == 10);
+  ASSERT(snap.lookup("/dpm//cern.ch/skip/") == snap.findFileid(5));
+  ASSERT(snap.lookup("/dpm/cern.ch/c") < 0);
+  ASSERT(snap.lookup("dpm") < 0);
+  ASSERT(snap.getPath(snap.findFileid(6)) == "/dpm/cern.ch/skip/hidden");
+  ASSERT(snap.getPath(snap.findFileid(7)) == "");
+
+  Collector c;
+  snap.walk(snap.lookup("/dpm"), c);
+  ASSERTm(c.paths.size() == 5, c.paths.size());
+  ASSERT(c.paths[0] == "/dpm");
+  ASSERT(c.paths[1] == "/dpm/cern.ch");
+  ASSERT(c.paths[2] == "/dpm/cern.ch/a");
+  ASSERT(c.paths[3] == "/dpm/cern.ch/b");
+  ASSERT(c.paths[4] == "/dpm/cern.ch/skip");
+
+  int64_t bytes, nfiles;
+  snap.getTreeSize(snap.lookup("/"), bytes, nfiles);
+  ASSERT(bytes == 117);
+  ASSERT(nfiles == 3);
+
+  std::vector<const DomeNsSnapshot::Replica *> reps;
+  snap.getReplicas("disk1", "/fs1", reps);
+  ASSERT(reps.size() == 2);
+  ASSERT(std::string(snap.sfn(*reps[0])) == "disk1:/fs1/a");
+  ASSERT(reps[1]->status == 'P');
+
+  reps.clear();
+  snap.getReplicas("disk1", "", reps);
+  ASSERT(reps.size() == 4);
+  ASSERT(reps[3]->entryidx < 0);
+
+  int64_t nreplicas;
+  snap.getReplicasSize("disk1", "", bytes, nreplicas);
+  ASSERT(bytes == 117);
+  ASSERT(nreplicas == 4);
+  snap.getReplicasSize("disk3", "", bytes, nreplicas);
+  ASSERT(nreplicas == 0);
+
+  std::vector<std::string> locs;
+  snap.getLocations(locs);
+  ASSERT(locs.size() == 3);
+  ASSERT(locs[0] == "disk1:/fs1");
+  ASSERT(locs[2] == "disk2:/fs1");
+
+  unlink(file.c_str());
+}
+
+// Files that are not snapshots are refused
+void test2() {
+  DECLARE_TEST();
+
+  std::string file = tmpFile();
+  DomeNsSnapshot snap;
+  std::string err;
+  ASSERT(snap.open(file, err) != 0);
+
+  std::ofstream f(file.c_str());
+  f << std::string(4096, 'x');
+  f.close();
+  ASSERT(snap.open(file, err) != 0);
+  ASSERT(snap.lookup("/") < 0);
+
+  ASSERT(snap.open("/nonexistent/snapshot", err) != 0);
+  unlink(file.c_str());
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void bench() {
+  DECLARE_TEST();
+
+  std::string file = tmpFile();
+  {
+    DomeNsSnapshotWriter w;
+    w.addEntry(1, 0, S_IFDIR | 0755, 0, "/");
+    for (int64_t d = 0; d < 1000; d++) {
+      w.addEntry(2 + d, 1, S_IFDIR | 0755, 0, SSTR("dir" << d));
+      for (int64_t f = 0; f < 1000; f++) {
+        int64_t fileid = 10000 + d * 1000 + f;
+        w.addEntry(fileid, 2 + d, S_IFREG | 0644, f, SSTR("file" << f));
+        w.addReplica(fileid, SSTR("disk" << (f % 10)), "/fs1", '-', SSTR("/fs1/" << fileid));
+      }
+    }
+
+    double t0 = now();
+    std::string err;
+    ASSERTm(w.write(file, err) == 0, err);
+    std::cout << "1M entries written in " << (now() - t0) << "s" << std::endl;
+  }
+
+  DomeNsSnapshot snap;
+  std::string err;
+  ASSERTm(snap.open(file, err) == 0, err);
+
+  double t0 = now();
+  for (int i = 0; i < 100000; i++)
+    ASSERT(snap.lookup(SSTR("/dir" << (i % 1000) << "/file" << (i % 997))) >= 0);
+  std::cout << "100k lookups: " << (now() - t0) << "s" << std::endl;
+
+  t0 = now();
+  int64_t bytes, n;
+  snap.getReplicasSize("disk3", "", bytes, n);
+  ASSERT(n == 100000);
+  std::cout << "Size of the replicas on a server: " << (now() - t0) << "s" << std::endl;
+
+  unlink(file.c_str());
+}
+
+int main() {
+  test1();
+  test2();
+  bench();
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2015 CERN
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "DomePlacement.h"
+#include "DomeStatus.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+#define SSTR(message) static_cast<std::ostringstream&>(std::ostringstream().flush() << message).str()
+#define DECLARE_TEST() TestDeclaration __test_declaration(__FUNCTION__)
+#define ASSERTm(assertion, msg) \
+    if((assertion) == false) throw std::runtime_error( SSTR(__FILE__ << ":" << __LINE__ << " (" << __func__ << "): Assertion " << #assertion << " failed.\n" << msg))
+#define ASSERT(assertion) ASSERTm((assertion), "")
+
+class TestDeclaration {
+public:
+  TestDeclaration(std::string name) {
+    std::cout << " ----- Performing test: " << name << std::endl;
+  }
+
+  ~TestDeclaration() {
+    std::cout << " -- test successful" << std::endl;
+  }
+};
+
+DomeFsInfo fs(string server, string path, long long freegb, long long sizegb) {
+  DomeFsInfo fs;
+  fs.server = server;
+  fs.fs = path;
+  fs.poolname = "pool";
+  fs.freespace = freegb << 30;
+  fs.physicalsize = sizegb << 30;
+  fs.status = DomeFsInfo::FsStaticActive;
+  fs.activitystatus = DomeFsInfo::FsOnline;
+  return fs;
+}
+
+std::map<std::string, DomePlacement::FsCounters> counters(DomePlacement &placement) {
+  std::map<std::string, DomePlacement::FsCounters> fsc;
+  std::map<std::string, long> srv;
+  placement.getCounters(fsc, srv);
+  return fsc;
+}
+
+// A new, empty server must not take all the writes
+void test1() {
+  DECLARE_TEST();
+
+  DomePlacement placement;
+  placement.configure(DomePlacement::PolicyTwoChoices, 3600, 0);
+
+  std::vector<DomeFsInfo> fss;
+  fss.push_back(fs("new", "/fs1", 100000, 100000));
+  fss.push_back(fs("old1", "/fs1", 1000, 100000));
+  fss.push_back(fs("old2", "/fs1", 1000, 100000));
+
+  for (int i = 0; i < 300; i++) {
+    int pos = placement.pick(fss);
+    placement.putStarted(SSTR(fss[pos].server << ":/fs1/file" << i), fss[pos], 0);
+  }
+
+  std::map<std::string, DomePlacement::FsCounters> fsc = counters(placement);
+  ASSERTm(fsc["new:/fs1"].inflight < 150, fsc["new:/fs1"].inflight);
+  ASSERTm(fsc["old1:/fs1"].inflight > 50, fsc["old1:/fs1"].inflight);
+  ASSERTm(fsc["old2:/fs1"].inflight > 50, fsc["old2:/fs1"].inflight);
+
+  // The historical policy sends almost everything to the empty one
+  DomePlacement freespace;
+  freespace.configure(DomePlacement::PolicyFreeSpace, 3600, 0);
+  int tonew = 0;
+  for (int i = 0; i < 300; i++)
+    if (freespace.pick(fss) == 0) tonew++;
+  ASSERTm(tonew > 250, tonew);
+}
+
+// putdone and timeouts decrement the load
+void test2() {
+  DECLARE_TEST();
+
+  DomePlacement placement;
+  placement.configure(DomePlacement::PolicyTwoChoices, 10, 0);
+  DomeFsInfo f = fs("srv", "/fs1", 10, 10);
+
+  placement.putStarted("srv:/fs1/a", f, 100);
+  placement.putStarted("srv:/fs1/b", f, 105);
+  placement.putStarted("srv:/fs1/b", f, 105);
+  ASSERT(counters(placement)["srv:/fs1"].inflight == 2);
+
+  placement.putFinished("srv:/fs1/a");
+  placement.putFinished("srv:/fs1/unknown");
+  ASSERT(counters(placement)["srv:/fs1"].inflight == 1);
+  ASSERT(counters(placement)["srv:/fs1"].completed == 1);
+
+  ASSERT(placement.tick(110) == 0);
+  ASSERT(placement.tick(115) == 1);
+  ASSERT(counters(placement)["srv:/fs1"].inflight == 0);
+  ASSERT(counters(placement)["srv:/fs1"].expired == 1);
+  ASSERT(counters(placement)["srv:/fs1"].placed == 2);
+
+  // A putdone after the timeout is ignored
+  placement.putFinished("srv:/fs1/b");
+  ASSERT(counters(placement)["srv:/fs1"].completed == 1);
+}
+
+// The free space floor
+void test3() {
+  DECLARE_TEST();
+
+  DomePlacement placement;
+  placement.configure(DomePlacement::PolicyTwoChoices, 3600, 10);
+
+  std::vector<DomeFsInfo> fss;
+  fss.push_back(fs("full", "/fs1", 5, 100));
+  fss.push_back(fs("free", "/fs1", 50, 100));
+
+  for (int i = 0; i < 100; i++)
+    ASSERT(placement.pick(fss) == 1);
+
+  // If all are below, all are candidates. Without load, the one with more space wins
+  fss[1].freespace = 1LL << 30;
+  for (int i = 0; i < 100; i++)
+    ASSERT(placement.pick(fss) == 0);
+
+  // Nothing free at all
+  fss[0].freespace = fss[1].freespace = 0;
+  DomePlacement freespace;
+  freespace.configure(DomePlacement::PolicyFreeSpace, 3600, 0);
+  int pos = freespace.pick(fss);
+  ASSERT(pos == 0 || pos == 1);
+}
+
+int main() {
+  test1();
+  test2();
+  test3();
+  return 0;
+}
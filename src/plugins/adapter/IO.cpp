@@ -360,3 +360,30 @@ bool StdIOHandler::eof(void) throw (DmException)
 {
   return eof_;
 }
+
+
+
+size_t StdIOHandler::preadv(IOSegment* segments, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, adapterlogmask, adapterlogname, " fd:" << this->fd_ << " segments:" << count);
+
+  return IOHandler::preadvFd(this->fd_, segments, count);
+}
+
+
+
+size_t StdIOHandler::transferTo(int outfd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, adapterlogmask, adapterlogname, " fd:" << this->fd_ << " outfd:" << outfd << " offs:" << offset << " count:" << count);
+
+  return IOHandler::sendFile(this->fd_, offset, outfd, count);
+}
+
+
+
+size_t StdIOHandler::transferFrom(int infd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, adapterlogmask, adapterlogname, " fd:" << this->fd_ << " infd:" << infd << " offs:" << offset << " count:" << count);
+
+  return IOHandler::receiveFile(infd, this->fd_, offset, count);
+}
@@ -73,6 +73,11 @@ namespace dmlite {
     void   flush(void) throw (DmException);
     bool   eof  (void) throw (DmException);
 
+    size_t preadv(IOSegment* segments, size_t count) throw (DmException);
+
+    size_t transferTo  (int outfd, off_t offset, size_t count) throw (DmException);
+    size_t transferFrom(int infd, off_t offset, size_t count) throw (DmException);
+
   protected:
     int  fd_;
     bool eof_;
@@ -17,7 +17,8 @@ using namespace dmlite;
 Logger::bitmask dmlite::domeadapterlogmask = ~0;
 Logger::component dmlite::domeadapterlogname = "DomeAdapter";
 
-DomeAdapterFactory::DomeAdapterFactory() throw (DmException) : davixPool_(&davixFactory_, 64) {
+DomeAdapterFactory::DomeAdapterFactory() throw (DmException) : davixPool_(&davixFactory_, 64),
+  tokenDigest_(kDefaultTokenDigest) {
   domeadapterlogmask = Logger::get()->getMask(domeadapterlogname);
 
 }
@@ -36,6 +37,11 @@ void DomeAdapterFactory::configure(const std::string& key, const std::string& va
   else if(key == "TokenPassword") {
     tokenPasswd_ = value;
   }
+  else if(key == "TokenDigest") {
+    // Check it early
+    TokenEngine::get(tokenPasswd_, value);
+    tokenDigest_ = value;
+  }
   else if (key == "TokenId") {
     if (strcasecmp(value.c_str(), "ip") == 0)
       this->tokenUseIp_ = true;
@@ -43,6 +43,7 @@ namespace dmlite {
     std::string domehead_;
     bool tokenUseIp_;
     std::string tokenPasswd_;
+    std::string tokenDigest_;
     unsigned tokenLife_;
 
   friend class DomeAdapterPoolManager;
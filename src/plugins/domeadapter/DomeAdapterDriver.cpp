@@ -311,9 +311,9 @@ Location DomeAdapterPoolHandler::whereToWrite(const std::string& lfn) throw (DmE
     else
       userId1 = driver_->userId_;
     
-    single.url.query["token"]    = dmlite::generateToken(userId1, single.url.path,
-                                                         driver_->factory_->tokenPasswd_,
-                                                         driver_->factory_->tokenLife_, true);
+    single.url.query["token"]    = TokenEngine::get(driver_->factory_->tokenPasswd_,
+                                                    driver_->factory_->tokenDigest_)->generate(userId1, single.url.path,
+                                                                                               driver_->factory_->tokenLife_, true);
     return Location(1, single);
   }
   catch(boost::property_tree::ptree_error &e) {
@@ -345,9 +345,9 @@ Location DomeAdapterPoolHandler::whereToRead(const Replica& replica) throw (DmEx
     single.size = 0;
   }
 
-  single.url.query["token"] = dmlite::generateToken(driver_->userId_, rloc.path,
-                                                    driver_->factory_->tokenPasswd_,
-                                                    driver_->factory_->tokenLife_);
+  single.url.query["token"] = TokenEngine::get(driver_->factory_->tokenPasswd_,
+                                               driver_->factory_->tokenDigest_)->generate(driver_->userId_, rloc.path,
+                                                                                          driver_->factory_->tokenLife_);
 
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " poolname:" << poolname_ << " replica:" << replica.rfn << " returns" << single.toString());
   return Location(1, single);
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <stdio.h>
 
+#include <boost/bind.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
@@ -21,7 +22,8 @@ using namespace dmlite;
 using namespace Davix;
 
 DomeIOFactory::DomeIOFactory()
-: tunnelling_protocol_("http"), tunnelling_port_("80"), passwd_("default"), useIp_(true), davixPool_(&davixFactory_, 10)
+: tunnelling_protocol_("http"), tunnelling_port_("80"), passwd_("default"), digest_(kDefaultTokenDigest),
+  useIp_(true), davixPool_(&davixFactory_, 10)
 {
   domeadapterlogmask = Logger::get()->getMask(domeadapterlogname);
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " Ctor");
@@ -40,6 +42,11 @@ void DomeIOFactory::configure(const std::string& key, const std::string& value)
   if (key == "TokenPassword") {
     this->passwd_ = value;
   }
+  else if (key == "TokenDigest") {
+    // Check it early
+    TokenEngine::get(this->passwd_, value);
+    this->digest_ = value;
+  }
   else if (key == "TokenId") {
     if (strcasecmp(value.c_str(), "ip") == 0)
       this->useIp_ = true;
@@ -69,6 +76,15 @@ void DomeIOFactory::configure(const std::string& key, const std::string& value)
   else if (key == "DomeAdapterTunnellingPort") {
     tunnelling_port_ = value;
   }
+  else if (key == "DomeAdapterTunnellingReadAheadBlock") {
+    tunnelParams_.readAheadBlock = strtoul(value.c_str(), NULL, 10);
+  }
+  else if (key == "DomeAdapterTunnellingReadAheadDepth") {
+    tunnelParams_.readAheadDepth = strtoul(value.c_str(), NULL, 10);
+  }
+  else if (key == "DomeAdapterTunnellingWriteBehind") {
+    tunnelParams_.writeBehind = strtoul(value.c_str(), NULL, 10);
+  }
   // if parameter starts with "Davix", pass it on to the factory
   else if( key.find("Davix") != std::string::npos) {
     Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, "Received davix pool parameter: " << key << "," << value);
@@ -82,13 +98,16 @@ void DomeIOFactory::configure(const std::string& key, const std::string& value)
 
 IODriver* DomeIOFactory::createIODriver(PluginManager* pm) throw (DmException)
 {
-  return new DomeIODriver(tunnelling_protocol_, tunnelling_port_, passwd_, useIp_, domedisk_, davixPool_);
+  return new DomeIODriver(tunnelling_protocol_, tunnelling_port_, passwd_, digest_, useIp_, domedisk_,
+                          tunnelParams_, davixPool_);
 }
 
 DomeIODriver::DomeIODriver(std::string tunnelling_protocol, std::string tunnelling_port,
-                           std::string passwd, bool useIp, std::string domedisk, DavixCtxPool &davixPool)
+                           std::string passwd, std::string digest, bool useIp, std::string domedisk,
+                           const DomeTunnelParams &tunnelParams, DavixCtxPool &davixPool)
 : secCtx_(0), tunnelling_protocol_(tunnelling_protocol), tunnelling_port_(tunnelling_port),
-  passwd_(passwd), useIp_(useIp), domedisk_(domedisk), davixPool_(davixPool)
+  passwd_(passwd), digest_(digest), useIp_(useIp), domedisk_(domedisk), tunnelParams_(tunnelParams),
+  davixPool_(davixPool)
 {
   // Nothing
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " Ctor");
@@ -131,8 +150,9 @@ IOHandler* DomeIODriver::createIOHandler(const std::string& pfn,
       else
         userId = this->secCtx_->credentials.clientName;
 
-      if(dmlite::validateToken(extras.getString("token"), userId, pfn,
-                               this->passwd_, flags != O_RDONLY) != kTokenOK) {
+      TokenEngine* tokens = TokenEngine::get(this->passwd_, this->digest_);
+      if(tokens->validate(extras.getString("token"), userId, pfn,
+                          flags != O_RDONLY) != kTokenOK) {
         throw DmException(EACCES, "Token does not validate (using %s) on pfn %s",
             this->useIp_?"IP":"DN", pfn.c_str());
       }
@@ -155,11 +175,11 @@ IOHandler* DomeIODriver::createIOHandler(const std::string& pfn,
   std::string path = DomeUtils::pfn_from_rfio_syntax(pfn);
 
   // we are a disk server doing tunnelling, use kGeneircUser as userId which is accepted always
-  std::string supertoken = dmlite::generateToken(dmlite::kGenericUser, path, this->passwd_, 50000, flags != O_RDONLY);
+  std::string supertoken = TokenEngine::get(this->passwd_, this->digest_)->generate(dmlite::kGenericUser, path, 50000, flags != O_RDONLY);
 
   std::string url = SSTR(tunnelling_protocol_ << "://" << server << ":" << tunnelling_port_
                          << "/" << Uri::escapeString(path) << "?token=" << Uri::escapeString(supertoken));
-  return new DomeTunnelHandler(davixPool_, url, flags, mode);
+  return new DomeTunnelHandler(davixPool_, url, flags, mode, tunnelParams_);
 }
 
 void DomeIODriver::doneWriting(const Location& loc) throw (DmException)
@@ -195,8 +215,11 @@ void DomeIODriver::doneWriting(const Location& loc) throw (DmException)
   Log(Logger::Lvl3, domeadapterlogmask, domeadapterlogname, "doneWriting was successful - putdone sent to domedisk");
 }
 
-DomeTunnelHandler::DomeTunnelHandler(DavixCtxPool &pool, const std::string &url, int flags, mode_t mode) throw(DmException)
-  : url_(url), grabber_(pool), ds_(grabber_), dpos_(ds_->ctx) {
+DomeTunnelHandler::DomeTunnelHandler(DavixCtxPool &pool, const std::string &url, int flags, mode_t mode,
+                                     const DomeTunnelParams &params) throw(DmException)
+  : pool_(pool), params_(params), url_(url), grabber_(pool), ds_(grabber_), dpos_(ds_->ctx),
+    pos_(0), lastRead_(1), nextRead_(0), end_(-1), wbufferOffset_(0), wflightOffset_(0),
+    writer_(NULL), writeFailed_(false) {
 
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " Tunnelling '" << url_ << "', flags: " << flags << ", mode: " << mode);
 
@@ -204,18 +227,42 @@ DomeTunnelHandler::DomeTunnelHandler(DavixCtxPool &pool, const std::string &url,
   ds_->parms->addHeader("Content-Range", "bytes 0-/*");
   fd_ = dpos_.open(ds_->parms, url_, flags, &err);
   checkErr(&err);
-
-  lastRead_ = 1;
 }
 
 DomeTunnelHandler::~DomeTunnelHandler() {
-
+  // Nobody can get the error anymore, but the data has to go
+  try {
+    if (fd_ != NULL)
+      flush();
+  }
+  catch (DmException &e) {
+    Err(domeadapterlogname, " Lost buffered writes to '" << url_ << "': " << e.what());
+  }
+  waitWriter();
+  dropBlocks();
 }
 
 void DomeTunnelHandler::close() throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " Closing");
+
+  // Close anyway, and then report the writes that failed
+  bool failed = false;
+  DmException error;
+  try {
+    flush();
+  }
+  catch (DmException &e) {
+    failed = true;
+    error = e;
+  }
+  dropBlocks();
+
   DavixError *err = NULL;
   dpos_.close(fd_, &err);
+  fd_ = NULL;
+
+  if (failed)
+    throw error;
   checkErr(&err);
 }
 
@@ -232,17 +279,22 @@ void DomeTunnelHandler::checkErr(DavixError **err) throw (DmException) {
 size_t DomeTunnelHandler::read(char* buffer, size_t count) throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. Read " << count << " bytes");
 
-  DavixError *err = NULL;
-  lastRead_ = dpos_.read(fd_, buffer, count, &err);
-  checkErr(&err);
-  return lastRead_;
+  size_t ret = pread(buffer, count, pos_);
+  pos_ += ret;
+  return ret;
 }
 
 size_t DomeTunnelHandler::write(const char* buffer, size_t count) throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. Write " << count << " bytes");
 
+  size_t ret = pwrite(buffer, count, pos_);
+  pos_ += ret;
+  return ret;
+}
+
+size_t DomeTunnelHandler::directRead(void* buffer, size_t count, off_t offset) throw (DmException) {
   DavixError *err = NULL;
-  size_t ret = dpos_.write(fd_, buffer, count, &err);
+  dav_ssize_t ret = dpos_.pread(fd_, buffer, count, offset, &err);
   checkErr(&err);
   return ret;
 }
@@ -250,39 +302,317 @@ size_t DomeTunnelHandler::write(const char* buffer, size_t count) throw (DmExcep
 size_t DomeTunnelHandler::pread(void* buffer, size_t count, off_t offset) throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. pread " << count << " bytes with offset " << offset);
 
+  // What was written has to be readable
+  flush();
+
+  if (params_.readAheadDepth == 0 || params_.readAheadBlock == 0) {
+    lastRead_ = directRead(buffer, count, offset);
+    return lastRead_;
+  }
+
+  // Read ahead only if the reads are sequential
+  if (offset == nextRead_)
+    readAhead(offset);
+  else
+    dropBlocks();
+
+  size_t done = 0;
+  while (done < count) {
+    off_t pos = offset + done;
+
+    std::map<off_t, Block*>::iterator i = blocks_.upper_bound(pos);
+    if (i == blocks_.begin()) {
+      done += directRead(static_cast<char*>(buffer) + done, count - done, pos);
+      break;
+    }
+    --i;
+    Block *b = i->second;
+    if (pos >= b->offset + (off_t)params_.readAheadBlock) {
+      done += directRead(static_cast<char*>(buffer) + done, count - done, pos);
+      break;
+    }
+
+    if (b->thread) {
+      b->thread->join();
+      delete b->thread;
+      b->thread = NULL;
+    }
+    if (b->failed) {
+      dropBlock(i);
+      done += directRead(static_cast<char*>(buffer) + done, count - done, pos);
+      break;
+    }
+
+    off_t available = b->offset + (off_t)b->nbytes - pos;
+    if (available <= 0)
+      break;
+    size_t n = std::min(count - done, (size_t)available);
+    memcpy(static_cast<char*>(buffer) + done, &b->data[pos - b->offset], n);
+    done += n;
+  }
+
+  nextRead_ = offset + done;
+  dropBlocksBefore(nextRead_);
+
+  lastRead_ = done;
+  return lastRead_;
+}
+
+size_t DomeTunnelHandler::preadv(IOSegment* segments, size_t count) throw (DmException) {
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. preadv " << count << " segments");
+
+  flush();
+  return directReadv(segments, count);
+}
+
+// Davix wants them in its own structures
+static dav_ssize_t readVec(DavPosix &dpos, DAVIX_FD *fd, IOSegment* segments, size_t count, DavixError **err) {
+  std::vector<DavIOVecInput> in(count);
+  std::vector<DavIOVecOuput> out(count);
+  for (size_t i = 0; i < count; ++i) {
+    in[i].diov_buffer = segments[i].buffer;
+    in[i].diov_offset = segments[i].offset;
+    in[i].diov_size   = segments[i].count;
+  }
+
+  dav_ssize_t ret = dpos.preadVec(fd, &in[0], &out[0], count, err);
+
+  for (size_t i = 0; i < count; ++i)
+    segments[i].nbytes = (out[i].diov_size > 0) ? out[i].diov_size : 0;
+  return ret;
+}
+
+size_t DomeTunnelHandler::directReadv(IOSegment* segments, size_t count) throw (DmException) {
+  if (count == 0)
+    return 0;
+
   DavixError *err = NULL;
-  lastRead_ = dpos_.pread(fd_, buffer, count, offset, &err);
+  dav_ssize_t ret = readVec(dpos_, fd_, segments, count, &err);
   checkErr(&err);
-  return lastRead_;
+  return ret;
 }
 
-size_t DomeTunnelHandler::pwrite(const void* buffer, size_t count, off_t offset) throw (DmException) {
-  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. pwrite " << count << " bytes with offset " << offset);
+size_t DomeTunnelHandler::fetch(DavixStuff* ds, IOSegment* segments, size_t count) throw (DmException) {
+  if (count == 0)
+    return 0;
+
+  DavPosix dpos(ds->ctx);
 
   DavixError *err = NULL;
-  size_t ret = dpos_.pwrite(fd_, buffer, count, offset, &err);
+  DAVIX_FD *fd = dpos.open(ds->parms, url_, O_RDONLY, &err);
+  checkErr(&err);
+
+  dav_ssize_t ret = readVec(dpos, fd, segments, count, &err);
+  DavixError *closeErr = NULL;
+  dpos.close(fd, &closeErr);
+  DavixError::clearError(&closeErr);
   checkErr(&err);
   return ret;
 }
 
+void DomeTunnelHandler::readAhead(off_t offset) {
+  off_t first = offset - (offset % params_.readAheadBlock);
+
+  for (unsigned k = 0; k < params_.readAheadDepth; ++k) {
+    off_t o = first + (off_t)k * params_.readAheadBlock;
+    if ((end_ >= 0) && (o >= end_))
+      break;
+    if (blocks_.find(o) != blocks_.end())
+      continue;
+
+    // Without a free context, the reads are done directly, one after the other
+    DavixStuff *ds;
+    try {
+      ds = pool_.acquire(false);
+    }
+    catch (...) {
+      break;
+    }
+
+    Block *b = new Block();
+    b->offset = o;
+    b->data.resize(params_.readAheadBlock);
+    b->nbytes = 0;
+    b->failed = false;
+    b->thread = NULL;
+    b->ds     = ds;
+    blocks_[o] = b;
+
+    try {
+      b->thread = new boost::thread(boost::bind(&DomeTunnelHandler::readBlock, this, b));
+    }
+    catch (...) {
+      pool_.release(ds);
+      b->ds = NULL;
+      b->failed = true;
+    }
+  }
+}
+
+void DomeTunnelHandler::readBlock(Block *b) {
+  IOSegment seg;
+  seg.buffer = &b->data[0];
+  seg.count  = b->data.size();
+  seg.offset = b->offset;
+  seg.nbytes = 0;
+
+  try {
+    fetch(b->ds, &seg, 1);
+    b->nbytes = seg.nbytes;
+  }
+  catch (DmException &e) {
+    Log(Logger::Lvl3, domeadapterlogmask, domeadapterlogname, " Read ahead of " << b->offset << " failed: " << e.what());
+    b->failed = true;
+  }
+  catch (...) {
+    b->failed = true;
+  }
+
+  pool_.release(b->ds);
+  b->ds = NULL;
+}
+
+void DomeTunnelHandler::dropBlock(std::map<off_t, Block*>::iterator i) {
+  Block *b = i->second;
+  if (b->thread) {
+    b->thread->join();
+    delete b->thread;
+  }
+  // A short block is the end of the file
+  if (!b->failed && (b->nbytes < b->data.size()) && ((end_ < 0) || (b->offset + (off_t)b->nbytes < end_)))
+    end_ = b->offset + b->nbytes;
+  delete b;
+  blocks_.erase(i);
+}
+
+void DomeTunnelHandler::dropBlocksBefore(off_t offset) {
+  while (!blocks_.empty() && (blocks_.begin()->first + (off_t)params_.readAheadBlock <= offset))
+    dropBlock(blocks_.begin());
+}
+
+void DomeTunnelHandler::dropBlocks() {
+  while (!blocks_.empty())
+    dropBlock(blocks_.begin());
+}
+
+void DomeTunnelHandler::directWrite(const char* buffer, size_t count, off_t offset) throw (DmException) {
+  while (count > 0) {
+    DavixError *err = NULL;
+    dav_ssize_t ret = dpos_.pwrite(fd_, buffer, count, offset, &err);
+    checkErr(&err);
+    if (ret <= 0)
+      throw DmException(EIO, SSTR("Short write to '" << url_ << "' at offset " << offset));
+    buffer += ret;
+    offset += ret;
+    count  -= ret;
+  }
+}
+
+size_t DomeTunnelHandler::pwrite(const void* buffer, size_t count, off_t offset) throw (DmException) {
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. pwrite " << count << " bytes with offset " << offset);
+
+  // Whatever was read ahead may be stale now
+  dropBlocks();
+  nextRead_ = -1;
+
+  if (params_.writeBehind == 0) {
+    directWrite(static_cast<const char*>(buffer), count, offset);
+    return count;
+  }
+
+  // Only contiguous writes are buffered together
+  if (!wbuffer_.empty() && (offset != wbufferOffset_ + (off_t)wbuffer_.size()))
+    sendBuffered();
+
+  if (wbuffer_.empty())
+    wbufferOffset_ = offset;
+  wbuffer_.insert(wbuffer_.end(), static_cast<const char*>(buffer), static_cast<const char*>(buffer) + count);
+
+  if (wbuffer_.size() >= params_.writeBehind)
+    sendBuffered();
+
+  return count;
+}
+
+void DomeTunnelHandler::sendBuffered() throw (DmException) {
+  // At most one buffer in flight, so the memory stays bounded
+  waitWriter();
+  if (writeFailed_)
+    throw writeError_;
+  if (wbuffer_.empty())
+    return;
+
+  wflight_.swap(wbuffer_);
+  wflightOffset_ = wbufferOffset_;
+  wbuffer_.clear();
+
+  try {
+    writer_ = new boost::thread(boost::bind(&DomeTunnelHandler::writeBehind, this));
+  }
+  catch (...) {
+    writeBehind();
+  }
+}
+
+void DomeTunnelHandler::writeBehind() {
+  try {
+    directWrite(&wflight_[0], wflight_.size(), wflightOffset_);
+  }
+  catch (DmException &e) {
+    Err(domeadapterlogname, " Write to '" << url_ << "' failed: " << e.what());
+    writeError_  = e;
+    writeFailed_ = true;
+  }
+  catch (...) {
+    writeError_  = DmException(EIO, SSTR("Unexpected error writing to '" << url_ << "'"));
+    writeFailed_ = true;
+  }
+  wflight_.clear();
+}
+
+void DomeTunnelHandler::waitWriter() {
+  if (writer_) {
+    writer_->join();
+    delete writer_;
+    writer_ = NULL;
+  }
+}
+
 void DomeTunnelHandler::seek(off_t offset, Whence whence) throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. seek at offset " << offset << ", whence " << whence);
-  DavixError *err = NULL;
-  dpos_.lseek(fd_, offset, whence, &err);
-  checkErr(&err);
+
+  switch (whence) {
+    case kSet:
+      pos_ = offset;
+      break;
+    case kCur:
+      pos_ += offset;
+      break;
+    default: {
+      // The remote size has to be current
+      flush();
+      DavixError *err = NULL;
+      off_t ret = dpos_.lseek(fd_, offset, whence, &err);
+      checkErr(&err);
+      pos_ = ret;
+    }
+  }
 }
 
 off_t DomeTunnelHandler::tell(void) throw (DmException) {
   Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. tell");
-  DavixError *err = NULL;
-  off_t ret = dpos_.lseek(fd_, 0, SEEK_CUR, &err);
-  checkErr(&err);
-  return ret;
+  return pos_;
 }
 
 void DomeTunnelHandler::flush(void) throw (DmException) {
-  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. flush (noop)");
-  // nothing
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " DomeTunnelHandler. flush");
+
+  if (!wbuffer_.empty())
+    sendBuffered();
+  waitWriter();
+
+  if (writeFailed_)
+    throw writeError_;
 }
 
 bool DomeTunnelHandler::eof(void) throw (DmException) {
@@ -473,3 +803,30 @@ bool DomeIOHandler::eof(void) throw (DmException)
 {
   return eof_;
 }
+
+
+
+size_t DomeIOHandler::preadv(IOSegment* segments, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " fd:" << this->fd_ << " segments:" << count);
+
+  return IOHandler::preadvFd(this->fd_, segments, count);
+}
+
+
+
+size_t DomeIOHandler::transferTo(int outfd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " fd:" << this->fd_ << " outfd:" << outfd << " offs:" << offset << " count:" << count);
+
+  return IOHandler::sendFile(this->fd_, offset, outfd, count);
+}
+
+
+
+size_t DomeIOHandler::transferFrom(int infd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, domeadapterlogmask, domeadapterlogname, " fd:" << this->fd_ << " infd:" << infd << " offs:" << offset << " count:" << count);
+
+  return IOHandler::receiveFile(infd, this->fd_, offset, count);
+}
@@ -7,12 +7,27 @@
 #include <dmlite/cpp/dmlite.h>
 #include <dmlite/cpp/io.h>
 #include <fstream>
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
 #include "utils/DavixPool.h"
 
 namespace dmlite {
   extern Logger::bitmask domeadapterlogmask;
   extern Logger::component domeadapterlogname;
 
+  /// Tuning of the tunnelled IO
+  struct DomeTunnelParams {
+    DomeTunnelParams(): readAheadBlock(1024 * 1024), readAheadDepth(4), writeBehind(4 * 1024 * 1024) {}
+
+    /// Size of the ranges requested when reading ahead
+    size_t   readAheadBlock;
+    /// How many of them can be in flight. 0 disables the read-ahead
+    unsigned readAheadDepth;
+    /// Writes are buffered up to this size before being sent. 0 disables it
+    size_t   writeBehind;
+  };
+
   class DomeIOFactory: public IODriverFactory {
   public:
     DomeIOFactory();
@@ -26,10 +41,13 @@ namespace dmlite {
     std::string tunnelling_port_;
 
     std::string passwd_;
+    std::string digest_;
     bool        useIp_;
     std::string domedisk_;
     std::string domehead_;
 
+    DomeTunnelParams tunnelParams_;
+
     DavixCtxFactory davixFactory_;
     DavixCtxPool davixPool_;
   };
@@ -37,7 +55,8 @@ namespace dmlite {
  class DomeIODriver: public IODriver {
    public:
     DomeIODriver(std::string tunnelling_protocol, std::string tunnelling_port,
-                 std::string passwd, bool useIp, std::string domedisk, DavixCtxPool &davixPool);
+                 std::string passwd, std::string digest, bool useIp, std::string domedisk,
+                 const DomeTunnelParams &tunnelParams, DavixCtxPool &davixPool);
     virtual ~DomeIODriver();
 
     std::string getImplId() const throw();
@@ -58,15 +77,22 @@ namespace dmlite {
     std::string tunnelling_port_;
 
     std::string passwd_;
+    std::string digest_;
     bool        useIp_;
 
     std::string domedisk_;
+    DomeTunnelParams tunnelParams_;
     DavixCtxPool &davixPool_;
   };
 
+  /// IO on a file of another disk server, over HTTP.
+  /// Sequential reads are anticipated with range requests sent in parallel,
+  /// each with its own davix context, and writes are sent in big
+  /// chunks while the next one is being filled.
   class DomeTunnelHandler : public IOHandler {
   public:
-    DomeTunnelHandler(DavixCtxPool &pool, const std::string &url, int flags, mode_t mode) throw (DmException);
+    DomeTunnelHandler(DavixCtxPool &pool, const std::string &url, int flags, mode_t mode,
+                      const DomeTunnelParams &params = DomeTunnelParams()) throw (DmException);
     virtual ~DomeTunnelHandler();
 
     void   close(void) throw (DmException);
@@ -77,14 +103,48 @@ namespace dmlite {
 
     size_t pread(void* buffer, size_t count, off_t offset) throw (DmException);
     size_t pwrite(const void* buffer, size_t count, off_t offset) throw (DmException);
+    size_t preadv(IOSegment* segments, size_t count) throw (DmException);
 
     void   seek (off_t offset, Whence whence) throw (DmException);
     off_t  tell (void) throw (DmException);
     void   flush(void) throw (DmException);
     bool   eof  (void) throw (DmException);
   private:
+    /// A range being read ahead
+    struct Block {
+      off_t             offset;
+      std::vector<char> data;
+      size_t            nbytes;
+      bool              failed;
+      boost::thread*    thread;
+      DavixStuff*       ds;      ///< Context of the pool the block is read with
+    };
+
     void checkErr(Davix::DavixError **err) throw (DmException);
 
+    /// Read the segments with another context, so that it can be done
+    /// in parallel with anything else
+    size_t fetch(DavixStuff* ds, IOSegment* segments, size_t count) throw (DmException);
+
+    /// Read with the context of this handler
+    size_t directRead(void* buffer, size_t count, off_t offset) throw (DmException);
+    size_t directReadv(IOSegment* segments, size_t count) throw (DmException);
+    /// Write with the context of this handler
+    void   directWrite(const char* buffer, size_t count, off_t offset) throw (DmException);
+
+    void readAhead(off_t offset);
+    void readBlock(Block* b);
+    void dropBlocksBefore(off_t offset);
+    void dropBlocks();
+    void dropBlock(std::map<off_t, Block*>::iterator i);
+
+    void sendBuffered() throw (DmException);
+    void writeBehind();
+    void waitWriter();
+
+    DavixCtxPool &pool_;
+    DomeTunnelParams params_;
+
     std::string url_;
     DavixGrabber grabber_;
     DavixStuff *ds_;
@@ -92,7 +152,26 @@ namespace dmlite {
     Davix::DavPosix dpos_;
     DAVIX_FD *fd_;
 
+    off_t  pos_;
     size_t lastRead_;
+
+    /// Read ahead blocks, by offset
+    std::map<off_t, Block*> blocks_;
+    /// Where the previous read ended
+    off_t nextRead_;
+    /// Where the file ends, once a block found it. -1 if unknown
+    off_t end_;
+
+    /// Writes not sent yet, and where they go
+    std::vector<char> wbuffer_;
+    off_t             wbufferOffset_;
+    /// Writes being sent by writer_
+    std::vector<char> wflight_;
+    off_t             wflightOffset_;
+    boost::thread*    writer_;
+    /// Once a write fails, all the following ones and the flushes fail
+    bool              writeFailed_;
+    DmException       writeError_;
   };
 
 
@@ -120,6 +199,11 @@ namespace dmlite {
     void   flush(void) throw (DmException);
     bool   eof  (void) throw (DmException);
 
+    size_t preadv(IOSegment* segments, size_t count) throw (DmException);
+
+    size_t transferTo  (int outfd, off_t offset, size_t count) throw (DmException);
+    size_t transferFrom(int infd, off_t offset, size_t count) throw (DmException);
+
   protected:
     int  fd_;
     bool eof_;
@@ -152,7 +152,7 @@ Location DomeAdapterPoolManager::whereToRead(const std::string& path) throw (DmE
       std::string pfn = it->second.get<std::string>("pfn");
 
       Chunk chunk(host + ":" + pfn, 0, 0);
-      chunk.url.query["token"] = dmlite::generateToken(userId_, pfn, factory_->tokenPasswd_, factory_->tokenLife_);
+      chunk.url.query["token"] = TokenEngine::get(factory_->tokenPasswd_, factory_->tokenDigest_)->generate(userId_, pfn, factory_->tokenLife_);
       loc.push_back(chunk);
     }
     return loc;
@@ -204,7 +204,7 @@ Location DomeAdapterPoolManager::whereToWrite(const std::string& path) throw (Dm
     else
       userId1 = userId_;
 
-    chunk.url.query["token"] = dmlite::generateToken(userId1, pfn, factory_->tokenPasswd_, factory_->tokenLife_, true);
+    chunk.url.query["token"] = TokenEngine::get(factory_->tokenPasswd_, factory_->tokenDigest_)->generate(userId1, pfn, factory_->tokenLife_, true);
     return Location(1, chunk);
   }
   catch(boost::property_tree::ptree &err) {
@@ -725,7 +725,10 @@ std::string MemcacheCommon::getAbsolutePath(const std::string& path)
     if (path.length() == 1 && path[0] == '.') {
       return cwd;
     }
-    return Url::normalizePath(cwd + "/" + path, false);
+    cwd.reserve(cwd.length() + path.length() + 1);
+    cwd.append(1, '/').append(path);
+    Url::normalizePathInPlace(cwd, false);
+    return cwd;
   }
 }
 
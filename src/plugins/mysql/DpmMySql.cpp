@@ -21,8 +21,10 @@ boost::shared_mutex   MySqlPoolManager::poolmtx_;
 
 MySqlPoolManager::MySqlPoolManager(DpmMySqlFactory* factory,
                                    const std::string& dpmDb,
-                                   const std::string& adminUsername) throw (DmException):
-      stack_(0x00), dpmDb_(dpmDb), factory_(factory), adminUsername_(adminUsername)
+                                   const std::string& adminUsername,
+                                   ReplicaSelector* selector) throw (DmException):
+      stack_(0x00), dpmDb_(dpmDb), factory_(factory), secCtx_(0x00), adminUsername_(adminUsername),
+      selector_(selector), handlersLastUpd_(0)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, " Ctor");
   // Nothing
@@ -33,7 +35,7 @@ MySqlPoolManager::MySqlPoolManager(DpmMySqlFactory* factory,
 MySqlPoolManager::~MySqlPoolManager()
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, " Dtor");
-  // Nothing
+  this->clearPoolHandlers();
 }
 
 
@@ -47,6 +49,9 @@ std::string MySqlPoolManager::getImplId() const throw ()
 
 void MySqlPoolManager::setStackInstance(StackInstance* si) throw (DmException)
 {
+  // The handlers come from the pool drivers of the stack
+  if (this->stack_ != si)
+    this->clearPoolHandlers();
   this->stack_ = si;
 }
 
@@ -60,6 +65,15 @@ void MySqlPoolManager::setSecurityContext(const SecurityContext* ctx) throw (DmE
 
 
 std::vector<Pool> MySqlPoolManager::getPools(PoolAvailability availability) throw (DmException)
+{
+  // No handler is held yet, so they can be dropped here
+  this->checkPoolHandlers();
+  return this->getCachedPools(availability);
+}
+
+
+
+std::vector<Pool> MySqlPoolManager::getCachedPools(PoolAvailability availability) throw (DmException)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "Poolavailability: " << availability);
 
@@ -102,8 +116,7 @@ std::vector<Pool> MySqlPoolManager::filterPools(std::vector<Pool>& pools, PoolAv
     std::vector<Pool> filtered;
 
     for (unsigned i = 0; i < pools.size(); ++i) {
-      PoolHandler* handler = this->stack_->getPoolDriver(pools[i].type)->
-                               createPoolHandler(pools[i].name);
+      PoolHandler* handler = this->getPoolHandler(pools[i]);
 
       bool isAvailable = handler->poolIsAvailable(availability == kForWrite ||
                                                   availability == kForBoth);
@@ -111,8 +124,6 @@ std::vector<Pool> MySqlPoolManager::filterPools(std::vector<Pool>& pools, PoolAv
       if ((availability == kNone && !isAvailable) ||
           (availability != kNone && isAvailable))
         filtered.push_back(pools[i]);
-
-      delete handler;
     }
 
     Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. npools:" << pools.size());
@@ -122,6 +133,59 @@ std::vector<Pool> MySqlPoolManager::filterPools(std::vector<Pool>& pools, PoolAv
 
 
 
+PoolHandler* MySqlPoolManager::getPoolHandler(const Pool& pool) throw (DmException)
+{
+  std::map<std::string, PoolHandler*>::iterator i = this->handlers_.find(pool.name);
+  if (i != this->handlers_.end())
+    return i->second;
+
+  PoolHandler* handler = this->stack_->getPoolDriver(pool.type)->createPoolHandler(pool.name);
+  this->handlers_[pool.name] = handler;
+  return handler;
+}
+
+
+
+PoolHandler* MySqlPoolManager::getPoolHandler(const std::string& poolname) throw (DmException)
+{
+  std::map<std::string, PoolHandler*>::iterator i = this->handlers_.find(poolname);
+  if (i != this->handlers_.end())
+    return i->second;
+
+  return this->getPoolHandler(this->getPool(poolname));
+}
+
+
+
+void MySqlPoolManager::checkPoolHandlers(void)
+{
+  time_t lastupd;
+  {
+    boost::shared_lock<boost::shared_mutex> l(poolmtx_);
+    lastupd = pools_.pool_lastupd;
+  }
+
+  // Same validity as the pool cache, so changes in the pools are seen
+  time_t timenow = time(0);
+  if (lastupd != this->handlersLastUpd_ ||
+      lastupd > timenow + 60 || lastupd < timenow - 60) {
+    this->clearPoolHandlers();
+    this->handlersLastUpd_ = lastupd;
+  }
+}
+
+
+
+void MySqlPoolManager::clearPoolHandlers(void)
+{
+  std::map<std::string, PoolHandler*>::iterator i;
+  for (i = this->handlers_.begin(); i != this->handlers_.end(); ++i)
+    delete i->second;
+  this->handlers_.clear();
+}
+
+
+
 std::vector<Pool> MySqlPoolManager::getPoolsFromMySql() throw (DmException)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "");
@@ -197,7 +261,7 @@ Pool MySqlPoolManager::getPool(const std::string& poolname) throw (DmException)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, " poolname:" << poolname);
 
-  std::vector<Pool> pools = getPools(kAny);
+  std::vector<Pool> pools = this->getCachedPools(kAny);
   std::vector<Pool>::iterator it;
   for (it = pools.begin(); it != pools.end(); ++it) {
     if (it->name == poolname) {
@@ -393,26 +457,25 @@ Location MySqlPoolManager::whereToRead(ino_t inode) throw (DmException)
 Location MySqlPoolManager::whereToRead(const std::vector<Replica>& replicas) throw (DmException)
 {
   unsigned i;
-  std::vector<Location> available;
+  std::vector<Replica>      available;
+  std::vector<PoolHandler*> availableHandlers;
 
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, " nr:" << replicas.size());
 
   if (replicas.size() == 0)
     throw DmException(DMLITE_NO_REPLICAS, "No replicas");
 
+  this->checkPoolHandlers();
 
-  // See if available, and translate
+  // See which ones are available
   for (i = 0; i < replicas.size(); ++i) {
     if (replicas[i].hasField("pool")) {
-      Pool pool = this->getPool(replicas[i].getString("pool"));
-
       try {
-        PoolHandler* handler = this->stack_->getPoolDriver(pool.type)->
-                                  createPoolHandler(pool.name);
-        if (handler->replicaIsAvailable(replicas[i]))
-          available.push_back(handler->whereToRead(replicas[i]));
-
-        delete handler;
+        PoolHandler* handler = this->getPoolHandler(replicas[i].getString("pool"));
+        if (handler->replicaIsAvailable(replicas[i])) {
+          available.push_back(replicas[i]);
+          availableHandlers.push_back(handler);
+        }
       }
       catch (DmException& e) {
         if (e.code() != DMLITE_NO_SUCH_POOL) throw;
@@ -420,16 +483,16 @@ Location MySqlPoolManager::whereToRead(const std::vector<Replica>& replicas) thr
     }
   }
 
-  // Pick a random one from the available
-  if (available.size() > 0) {
-    i = rand() % available.size();
-    Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. rep:" << available[i].toString());
-    return available[i];
-  }
-  else {
+  if (available.size() == 0)
     throw DmException(DMLITE_NO_REPLICAS,
                       "None of the replicas is available for reading");
-  }
+
+  // Let the policy choose, and translate only that one
+  i = this->selector_->select(this->secCtx_, available);
+  Location loc = availableHandlers[i]->whereToRead(available[i]);
+
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. rep:" << loc.toString());
+  return loc;
 }
 
 
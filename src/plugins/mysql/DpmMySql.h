@@ -4,11 +4,13 @@
 #ifndef DPMMYSQL_H
 #define	DPMMYSQL_H
 
+#include <map>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 #include "NsMySql.h"
 #include <dmlite/cpp/poolmanager.h>
+#include <dmlite/cpp/utils/replicaselector.h>
 
 namespace dmlite {
   
@@ -45,7 +47,8 @@ namespace dmlite {
   class MySqlPoolManager: public PoolManager {
    public:
     MySqlPoolManager(DpmMySqlFactory* factory, const std::string& dpmDb,
-                     const std::string& adminUsername) throw (DmException);
+                     const std::string& adminUsername,
+                     ReplicaSelector* selector) throw (DmException);
     ~MySqlPoolManager();
 
     std::string getImplId(void) const throw ();
@@ -69,9 +72,22 @@ namespace dmlite {
    protected:
      Location whereToRead(const std::vector<Replica>& replicas) throw (DmException);
 
+     /// The pools, from the cache. Unlike getPools, it does not drop the
+     /// handlers, so it can be used while some are held.
+     std::vector<Pool> getCachedPools(PoolAvailability availability) throw (DmException);
      std::vector<Pool> filterPools(std::vector<Pool>& pools, PoolAvailability availability) throw (DmException);
      std::vector<Pool> getPoolsFromMySql() throw (DmException);
 
+     /// Get the handler of a pool, creating it only the first time.
+     /// The handler belongs to the pool manager, do not delete it.
+     PoolHandler* getPoolHandler(const Pool& pool) throw (DmException);
+     PoolHandler* getPoolHandler(const std::string& poolname) throw (DmException);
+
+     /// Drop the cached handlers if the cache of the pools was refreshed.
+     /// Only at the public entry points, before any handler is taken.
+     void checkPoolHandlers(void);
+     void clearPoolHandlers(void);
+
    private:
     /// Plugin stack.
     StackInstance* stack_;
@@ -88,6 +104,14 @@ namespace dmlite {
     /// Admin username for replication.
     const std::string adminUsername_;
 
+    /// Chooses the replica to read from. Belongs to the factory.
+    ReplicaSelector* selector_;
+
+    /// Pool handlers of this stack, by pool name, and the
+    /// refresh of the pool cache they were created for.
+    std::map<std::string, PoolHandler*> handlers_;
+    time_t handlersLastUpd_;
+
     /// Cache of the pools.
     static poolinfo pools_;
     static boost::shared_mutex poolmtx_;
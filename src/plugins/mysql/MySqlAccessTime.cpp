@@ -0,0 +1,156 @@
+/// @file   MySqlAccessTime.cpp
+/// @brief  Deferred, coalesced updates of the access times in the name space.
+#include <sstream>
+#include <boost/bind.hpp>
+#include <dmlite/cpp/utils/poolcontainer.h>
+
+#include "utils/MySqlWrapper.h"
+#include "utils/mysqlpools.h"
+#include "MySqlAccessTime.h"
+#include "MySqlFactories.h"
+
+using namespace dmlite;
+
+
+
+MySqlAccessTimeWriter::MySqlAccessTimeWriter(const std::string& db, unsigned maxPending,
+                                             unsigned batchSize, unsigned flushInterval):
+  db_(db), maxPending_(maxPending), batchSize_(batchSize), flushInterval_(flushInterval),
+  stop_(false), dropped_(0), thread_(0)
+{
+  if (this->batchSize_ < 1)     this->batchSize_ = 1;
+  if (this->flushInterval_ < 1) this->flushInterval_ = 1;
+
+  this->thread_ = new boost::thread(boost::bind(&MySqlAccessTimeWriter::run, this));
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Access time writer started. maxPending: " << maxPending <<
+      " batchSize: " << batchSize << " flushInterval: " << flushInterval);
+}
+
+
+
+MySqlAccessTimeWriter::~MySqlAccessTimeWriter()
+{
+  {
+    boost::lock_guard<boost::mutex> l(this->mutex_);
+    this->stop_ = true;
+    this->cond_.notify_all();
+  }
+  this->thread_->join();
+  delete this->thread_;
+
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Access time writer stopped. dropped: " << this->dropped_);
+}
+
+
+
+bool MySqlAccessTimeWriter::push(ino_t inode, time_t atime)
+{
+  boost::lock_guard<boost::mutex> l(this->mutex_);
+
+  std::map<ino_t, time_t>::iterator i = this->pending_.find(inode);
+  if (i != this->pending_.end()) {
+    if (i->second < atime)
+      i->second = atime;
+    return true;
+  }
+
+  if (this->pending_.size() >= this->maxPending_) {
+    // Say it once in a while
+    if ((this->dropped_++ % 10000) == 0)
+      Log(Logger::Lvl1, mysqllogmask, mysqllogname, "Too many pending access time updates, dropping. dropped: " <<
+          this->dropped_);
+    return false;
+  }
+
+  this->pending_[inode] = atime;
+  if (this->pending_.size() >= this->batchSize_)
+    this->cond_.notify_all();
+  return true;
+}
+
+
+
+size_t MySqlAccessTimeWriter::pending()
+{
+  boost::lock_guard<boost::mutex> l(this->mutex_);
+  return this->pending_.size();
+}
+
+
+
+void MySqlAccessTimeWriter::flush()
+{
+  std::map<ino_t, time_t> todo;
+  {
+    boost::lock_guard<boost::mutex> l(this->mutex_);
+    todo.swap(this->pending_);
+  }
+
+  std::vector<std::pair<ino_t, time_t> > batch;
+  batch.reserve(this->batchSize_);
+  for (std::map<ino_t, time_t>::const_iterator i = todo.begin(); i != todo.end(); ++i) {
+    batch.push_back(*i);
+    if (batch.size() >= this->batchSize_) {
+      this->write(batch);
+      batch.clear();
+    }
+  }
+  if (!batch.empty())
+    this->write(batch);
+}
+
+
+
+void MySqlAccessTimeWriter::run()
+{
+  for (;;) {
+    bool stop;
+    {
+      boost::unique_lock<boost::mutex> l(this->mutex_);
+      if (!this->stop_ && (this->pending_.size() < this->batchSize_))
+        this->cond_.timed_wait(l, boost::posix_time::seconds(this->flushInterval_));
+      stop = this->stop_;
+    }
+
+    this->flush();
+    if (stop) return;
+  }
+}
+
+
+
+void MySqlAccessTimeWriter::write(const std::vector<std::pair<ino_t, time_t> >& batch)
+{
+  // UPDATE ... SET atime = GREATEST(atime, CASE fileid WHEN ? THEN ? ... END)
+  //        WHERE fileid IN (?, ...)
+  std::ostringstream query;
+  query << "UPDATE Cns_file_metadata SET atime = GREATEST(atime, CASE fileid";
+  for (size_t i = 0; i < batch.size(); ++i)
+    query << " WHEN ? THEN ?";
+  query << " END) WHERE fileid IN (";
+  for (size_t i = 0; i < batch.size(); ++i)
+    query << (i ? ",?" : "?");
+  query << ")";
+
+  try {
+    PoolGrabber<MYSQL*> conn(MySqlHolder::getMySqlPool());
+    Statement stmt(conn, this->db_, query.str().c_str());
+
+    unsigned p = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      stmt.bindParam(p++, batch[i].first);
+      stmt.bindParam(p++, batch[i].second);
+    }
+    for (size_t i = 0; i < batch.size(); ++i)
+      stmt.bindParam(p++, batch[i].first);
+
+    stmt.execute();
+  }
+  catch (DmException& e) {
+    // Not worth retrying, the next access will queue them again
+    Err(mysqllogname, "Cannot update the access time of " << batch.size() << " inodes: " << e.what());
+    return;
+  }
+
+  Log(Logger::Lvl4, mysqllogmask, mysqllogname, "Updated the access time of " << batch.size() << " inodes");
+}
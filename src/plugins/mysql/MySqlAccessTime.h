@@ -0,0 +1,60 @@
+/// @file   MySqlAccessTime.h
+/// @brief  Deferred, coalesced updates of the access times in the name space.
+#ifndef MYSQLACCESSTIME_H
+#define	MYSQLACCESSTIME_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <time.h>
+#include <boost/thread.hpp>
+
+namespace dmlite {
+
+  /// Keeps the access times to be written, one per inode, and writes them
+  /// from a thread of its own, many rows per statement. Only the atime
+  /// column is touched, and it never goes backwards.
+  /// Access times are not worth blocking for: when too many are pending,
+  /// the new ones are dropped.
+  class MySqlAccessTimeWriter {
+   public:
+    /// @param db            The name space database.
+    /// @param maxPending    Inodes waiting to be written, at most.
+    /// @param batchSize     Inodes written per statement.
+    /// @param flushInterval Seconds an update can wait before being written.
+    MySqlAccessTimeWriter(const std::string& db, unsigned maxPending,
+                          unsigned batchSize, unsigned flushInterval);
+
+    /// Writes what is still pending.
+    ~MySqlAccessTimeWriter();
+
+    /// Queue an update. Returns false if it was dropped.
+    bool push(ino_t inode, time_t atime);
+
+    /// Write everything that is pending, in the calling thread.
+    void flush();
+
+    /// Number of inodes waiting to be written.
+    size_t pending();
+
+   private:
+    void run();
+    void write(const std::vector<std::pair<ino_t, time_t> >& batch);
+
+    std::string db_;
+    unsigned    maxPending_;
+    unsigned    batchSize_;
+    unsigned    flushInterval_;
+
+    boost::mutex              mutex_;
+    boost::condition_variable cond_;
+    std::map<ino_t, time_t>   pending_;
+    bool                      stop_;
+    unsigned long             dropped_;
+    boost::thread*            thread_;
+  };
+
+};
+
+#endif	// MYSQLACCESSTIME_H
@@ -35,7 +35,9 @@ Logger::component dmlite::mysqllogname = "Mysql";
 
 NsMySqlFactory::NsMySqlFactory() throw(DmException):
   nsDb_("cns_db"),
-  mapFile_("/etc/lcgdm-mapfile"), hostDnIsRoot_(false), hostDn_("")
+  mapFile_("/etc/lcgdm-mapfile"), hostDnIsRoot_(false), hostDn_(""),
+  aTimeMaxPending_(100000), aTimeBatchSize_(500), aTimeFlushInterval_(5), aTimeWriter_(0),
+  dirChunkSize_(1000), atomicNlink_(true), fileIdBlockSize_(100), fileIdAllocator_(0)
 {
   dirspacereportdepth = 6;
   Log(Logger::Lvl3, mysqllogmask, mysqllogname, "NsMySqlFactory started");
@@ -47,6 +49,9 @@ NsMySqlFactory::NsMySqlFactory() throw(DmException):
 NsMySqlFactory::~NsMySqlFactory()
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "");
+  // Writes what is pending
+  delete this->aTimeWriter_;
+  delete this->fileIdAllocator_;
   mysql_library_end();
   
   Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting.");
@@ -69,6 +74,24 @@ void NsMySqlFactory::configure(const std::string& key, const std::string& value)
     this->nsDb_ = value; 
   else if (key == "MySqlDirectorySpaceReportDepth")
     this->dirspacereportdepth = atoi(value.c_str());
+  else if (key == "AccessTimeMaxPending")
+    this->aTimeMaxPending_ = atoi(value.c_str());
+  else if (key == "AccessTimeBatchSize")
+    this->aTimeBatchSize_ = atoi(value.c_str());
+  else if (key == "AccessTimeFlushInterval")
+    this->aTimeFlushInterval_ = atoi(value.c_str());
+  else if (key == "FileIdBlockSize") {
+    boost::lock_guard<boost::mutex> l(this->fileIdMutex_);
+    this->fileIdBlockSize_ = atoi(value.c_str());
+    if (this->fileIdAllocator_)
+      this->fileIdAllocator_->setBlockSize(this->fileIdBlockSize_);
+  }
+  else if (key == "AtomicNlinkUpdates")
+    this->atomicNlink_ = (value != "no");
+  else if (key == "DirectoryChunkSize") {
+    int n = atoi(value.c_str());
+    this->dirChunkSize_ = (n > 0 ? n : 1);
+  }
   else
     gotit = MySqlHolder::configure(key, value);
   
@@ -85,6 +108,27 @@ INode* NsMySqlFactory::createINode(PluginManager*) throw(DmException)
   return new INodeMySql(this, this->nsDb_);
 }
 
+MySqlIdAllocator* NsMySqlFactory::getFileIdAllocator()
+{
+  boost::lock_guard<boost::mutex> l(this->fileIdMutex_);
+  if (!this->fileIdAllocator_)
+    this->fileIdAllocator_ = new MySqlIdAllocator(this->nsDb_, this->fileIdBlockSize_);
+  return this->fileIdAllocator_;
+}
+
+MySqlAccessTimeWriter* NsMySqlFactory::getAccessTimeWriter()
+{
+  if (this->aTimeBatchSize_ == 0)
+    return 0x00;
+
+  // Started the first time it's needed, when the configuration is known
+  boost::lock_guard<boost::mutex> l(this->aTimeMutex_);
+  if (!this->aTimeWriter_)
+    this->aTimeWriter_ = new MySqlAccessTimeWriter(this->nsDb_, this->aTimeMaxPending_,
+                                                   this->aTimeBatchSize_, this->aTimeFlushInterval_);
+  return this->aTimeWriter_;
+}
+
 Authn* NsMySqlFactory::createAuthn(PluginManager*) throw (DmException)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "");
@@ -127,6 +171,10 @@ void DpmMySqlFactory::configure(const std::string& key, const std::string& value
     this->dpmDb_ = value;
   else if (key == "AdminUsername")
     this->adminUsername_ = value;
+  else if (key == "ReplicaSelection")
+    this->selector_.setCriteria(value);
+  else if (key == "ReplicaSubnetPrefix")
+    this->selector_.setSubnetPrefixes(value);
   else
     NsMySqlFactory::configure(key, value);
 }
@@ -135,7 +183,7 @@ PoolManager* DpmMySqlFactory::createPoolManager(PluginManager*) throw (DmExcepti
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "");
   pthread_once(&initialize_mysql_thread, init_thread);
-  return new MySqlPoolManager(this, this->dpmDb_, this->adminUsername_);
+  return new MySqlPoolManager(this, this->dpmDb_, this->adminUsername_, &this->selector_);
 }
 
 
@@ -9,8 +9,11 @@
 #include "dmlite/cpp/poolmanager.h"
 #include "dmlite/cpp/io.h"
 #include "dmlite/cpp/utils/poolcontainer.h"
+#include "dmlite/cpp/utils/replicaselector.h"
 #include <mysql/mysql.h>
 #include "utils/mysqlpools.h"
+#include "MySqlAccessTime.h"
+#include "utils/MySqlIdAllocator.h"
 
 namespace dmlite {
 
@@ -32,6 +35,18 @@ public:
   virtual INode* createINode(PluginManager* pm) throw (DmException);
   virtual Authn* createAuthn(PluginManager* pm) throw (DmException);
   
+  /// The writer of the access times, NULL if they are written right away
+  MySqlAccessTimeWriter* getAccessTimeWriter();
+
+  /// Gives the ids of the new files
+  MySqlIdAllocator* getFileIdAllocator();
+
+  /// Whether the link counts of the directories are updated in place,
+  /// without reading and locking them first
+  bool atomicNlinkUpdates() const { return atomicNlink_; }
+
+  /// How many entries of a directory are read from the db at a time
+  unsigned getDirectoryChunkSize() const { return dirChunkSize_; }
   
   int dirspacereportdepth;
 protected:
@@ -48,6 +63,24 @@ protected:
   /// Host DN
   std::string hostDn_;
   
+  /// Deferred access times. A batch size of 0 disables them
+  unsigned aTimeMaxPending_;
+  unsigned aTimeBatchSize_;
+  unsigned aTimeFlushInterval_;
+  MySqlAccessTimeWriter* aTimeWriter_;
+  boost::mutex aTimeMutex_;
+
+  /// Entries read per query when listing a directory
+  unsigned dirChunkSize_;
+
+  /// Update the link counts with nlink = nlink + delta
+  bool atomicNlink_;
+
+  /// File ids reserved at a time
+  unsigned fileIdBlockSize_;
+  MySqlIdAllocator* fileIdAllocator_;
+  boost::mutex fileIdMutex_;
+  
 
 private:
 };
@@ -72,6 +105,9 @@ protected:
 
   /// Admin username for replication.
   std::string adminUsername_;
+
+  /// Policy to choose the replica to read from.
+  ReplicaSelector selector_;
 };
 
 
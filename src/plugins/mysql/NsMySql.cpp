@@ -220,6 +220,42 @@ void INodeMySql::rollback(void) throw (DmException)
 
 
 
+void INodeMySql::addNlink(ExtendedStat& dir, int delta) throw (DmException)
+{
+  Log(Logger::Lvl4, mysqllogmask, mysqllogname, " inode:" << dir.stat.st_ino << " delta:" << delta);
+
+  if (this->factory_->atomicNlinkUpdates()) {
+    // No read, the row is only locked from here to the commit
+    Statement nlinkUpdate(this->conn_, this->nsDb_, STMT_ADD_NLINK);
+    nlinkUpdate.bindParam(0, delta);
+    nlinkUpdate.bindParam(1, dir.stat.st_ino);
+
+    if (nlinkUpdate.execute() == 0)
+      throw DmException(ENOENT, "Directory %ld does not exist anymore", dir.stat.st_ino);
+
+    // Our best guess
+    dir.stat.st_nlink += delta;
+  }
+  else {
+    Statement nlinkStmt(this->conn_, this->nsDb_, STMT_NLINK_FOR_UPDATE);
+    nlinkStmt.bindParam(0, dir.stat.st_ino);
+    nlinkStmt.execute();
+    nlinkStmt.bindResult(0, &dir.stat.st_nlink);
+    if (!nlinkStmt.fetch())
+      throw DmException(ENOENT, "Directory %ld does not exist anymore", dir.stat.st_ino);
+
+    Statement nlinkUpdate(this->conn_, this->nsDb_, STMT_UPDATE_NLINK);
+    dir.stat.st_nlink += delta;
+    nlinkUpdate.bindParam(0, dir.stat.st_nlink);
+    nlinkUpdate.bindParam(1, dir.stat.st_ino);
+    nlinkUpdate.execute();
+  }
+
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. inode:" << dir.stat.st_ino << " nlink:" << dir.stat.st_nlink);
+}
+
+
+
 ExtendedStat INodeMySql::create(const ExtendedStat& nf) throw (DmException)
 {
   Log(Logger::Lvl4, mysqllogmask, mysqllogname, "");
@@ -240,47 +276,14 @@ ExtendedStat INodeMySql::create(const ExtendedStat& nf) throw (DmException)
 
 
 
-  // Fetch the new file ID
-  ino_t newFileId = 0;
+  // Fetch the new file ID, out of the transaction
+  ino_t newFileId = this->factory_->getFileIdAllocator()->next();
 
   // Start transaction
   InodeMySqlTrans trans(this);
 
   try {
 
-
-    {
-      // Scope to make sure that the local objects that involve mysql
-      // are destroyed before the transaction is closed
-
-
-      Statement uniqueId(this->conn_, this->nsDb_, STMT_SELECT_UNIQ_ID_FOR_UPDATE);
-
-      uniqueId.execute();
-      uniqueId.bindResult(0, &newFileId);
-
-      // Update the unique ID
-      if (uniqueId.fetch()) {
-        Statement updateUnique(this->conn_, this->nsDb_, STMT_UPDATE_UNIQ_ID);
-        ++newFileId;
-        updateUnique.bindParam(0, newFileId);
-        updateUnique.execute();
-      }
-      // Couldn't get, so insert
-      else {
-        Statement insertUnique(this->conn_, this->nsDb_, STMT_INSERT_UNIQ_ID);
-        newFileId = 1;
-        insertUnique.bindParam(0, newFileId);
-        insertUnique.execute();
-      }
-
-
-      // Closing the scope here makes sure that no local mysql-involving objects
-      // are still around when we close the transaction
-    }
-
-
-
     // Get parent metadata, if it is not root
     if (nf.parent > 0) {
       parentMeta = this->extendedStat(nf.parent);
@@ -312,21 +315,8 @@ ExtendedStat INodeMySql::create(const ExtendedStat& nf) throw (DmException)
     fileStmt.execute();
 
     // Increment the parent nlink
-    if (nf.parent > 0) {
-      Statement nlinkStmt(this->conn_, this->nsDb_, STMT_NLINK_FOR_UPDATE);
-      nlinkStmt.bindParam(0, nf.parent);
-      nlinkStmt.execute();
-      nlinkStmt.bindResult(0, &parentMeta.stat.st_nlink);
-      nlinkStmt.fetch();
-
-      Statement nlinkUpdateStmt(this->conn_, this->nsDb_, STMT_UPDATE_NLINK);
-
-      parentMeta.stat.st_nlink++;
-      nlinkUpdateStmt.bindParam(0, parentMeta.stat.st_nlink);
-      nlinkUpdateStmt.bindParam(1, parentMeta.stat.st_ino);
-
-      nlinkUpdateStmt.execute();
-    }
+    if (nf.parent > 0)
+      this->addNlink(parentMeta, 1);
 
     // Closing the scope here makes sure that no local mysql-involving objects
     // are still around when we close the transaction
@@ -396,23 +386,17 @@ void INodeMySql::unlink(ino_t inode) throw (DmException)
       // Scope to make sure that the local objects that involve mysql
       // are destroyed before the transaction is closed
 
-      // Remove file itself
-      Statement delFile(this->conn_, this->nsDb_, STMT_DELETE_FILE);
+      // Remove file itself. A directory only if it is still empty, as
+      // something may have been created in it since it was checked
+      Statement delFile(this->conn_, this->nsDb_,
+                        S_ISDIR(file.stat.st_mode) ? STMT_DELETE_EMPTY_DIR : STMT_DELETE_FILE);
       delFile.bindParam(0, inode);
-      delFile.execute();
+      if (delFile.execute() == 0 && S_ISDIR(file.stat.st_mode))
+        throw DmException(EISDIR,
+                          "Inode %ld is a directory and it is not empty", inode);
 
       // Decrement parent nlink
-      Statement nlinkStmt(this->conn_, this->nsDb_, STMT_NLINK_FOR_UPDATE);
-      nlinkStmt.bindParam(0, parent.stat.st_ino);
-      nlinkStmt.execute();
-      nlinkStmt.bindResult(0, &parent.stat.st_nlink);
-      nlinkStmt.fetch();
-
-      Statement nlinkUpdate(this->conn_, this->nsDb_, STMT_UPDATE_NLINK);
-      parent.stat.st_nlink--;
-      nlinkUpdate.bindParam(0, parent.stat.st_nlink);
-      nlinkUpdate.bindParam(1, parent.stat.st_ino);
-      nlinkUpdate.execute();
+      this->addNlink(parent, -1);
 
     }
     // Done!
@@ -484,43 +468,12 @@ void INodeMySql::move(ino_t inode, ino_t dest) throw (DmException)
       throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
 			"Could not update the parent ino!");
 
-      // Reduce nlinks from old parent
-      ExtendedStat oldParent = this->extendedStat(file.parent);
-
-    Statement oldNlinkStmt(this->conn_, this->nsDb_, STMT_NLINK_FOR_UPDATE);
-    oldNlinkStmt.bindParam(0, oldParent.stat.st_ino);
-    oldNlinkStmt.execute();
-    oldNlinkStmt.bindResult(0, &oldParent.stat.st_nlink);
-    oldNlinkStmt.fetch();
-
-    Statement oldNlinkUpdateStmt(this->conn_, this->nsDb_, STMT_UPDATE_NLINK);
-
-    oldParent.stat.st_nlink--;
-    oldNlinkUpdateStmt.bindParam(0, oldParent.stat.st_nlink);
-    oldNlinkUpdateStmt.bindParam(1, oldParent.stat.st_ino);
-
-    if (oldNlinkUpdateStmt.execute() == 0)
-      throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
-			"Could not update the old parent nlink!");
-
-      // Increment from new
-      Statement newNlinkStmt(this->conn_, this->nsDb_, STMT_NLINK_FOR_UPDATE);
-    newNlinkStmt.bindParam(0, newParent.stat.st_ino);
-    newNlinkStmt.execute();
-    newNlinkStmt.bindResult(0, &newParent.stat.st_nlink);
-    newNlinkStmt.fetch();
-
-    Statement newNlinkUpdateStmt(this->conn_, this->nsDb_, STMT_UPDATE_NLINK);
-
-    newParent.stat.st_nlink++;
-    newNlinkUpdateStmt.bindParam(0, newParent.stat.st_nlink);
-    newNlinkUpdateStmt.bindParam(1, newParent.stat.st_ino);
-
-    if (newNlinkUpdateStmt.execute() == 0)
-      throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
-			"Could not update the new parent nlink!");
-
+    // Reduce nlinks from old parent
+    ExtendedStat oldParent = this->extendedStat(file.parent);
+    this->addNlink(oldParent, -1);
 
+    // Increment from new
+    this->addNlink(newParent, 1);
 
       // Closing the scope here makes sure that no local mysql-involving objects
       // are still around when we close the transaction
@@ -1068,6 +1021,29 @@ void INodeMySql::utime(ino_t inode, const struct utimbuf* buf) throw (DmExceptio
 
 
 
+void INodeMySql::updateAccessTime(const ExtendedStat& meta, time_t atime) throw (DmException)
+{
+  Log(Logger::Lvl4, mysqllogmask, mysqllogname, " inode:" << meta.stat.st_ino << " atime:" << atime);
+
+  // Most likely later, together with others
+  MySqlAccessTimeWriter* writer = this->factory_->getAccessTimeWriter();
+  if (writer) {
+    writer->push(meta.stat.st_ino, atime);
+    return;
+  }
+
+  PoolGrabber<MYSQL*> conn(MySqlHolder::getMySqlPool());
+  Statement stmt(conn, this->nsDb_, STMT_UPDATE_ATIME);
+  stmt.bindParam(0, atime);
+  stmt.bindParam(1, meta.stat.st_ino);
+
+  stmt.execute();
+
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. inode:" << meta.stat.st_ino);
+}
+
+
+
 void INodeMySql::setMode(ino_t inode, uid_t uid, gid_t gid,
                          mode_t mode, const Acl& acl) throw (DmException)
 {
@@ -1261,18 +1237,9 @@ IDirectory* INodeMySql::openDir(ino_t inode) throw (DmException)
   dir->dir = meta;
 
   try {
-    dir->conn_ = 0; // in case an exception is thrown on the following line
-    dir->conn_ = MySqlHolder::getMySqlPool().acquire();
-    dir->stmt = new Statement(dir->conn_, this->nsDb_, STMT_GET_LIST_FILES);
-    dir->stmt->bindParam(0, inode);
-    dir->stmt->execute();
-    bindMetadata(*dir->stmt, &dir->cstat);
-
-    dir->eod = !dir->stmt->fetch();
+    this->readDirChunk(dir);
   }
   catch (...) {
-    if (dir->conn_) MySqlHolder::getMySqlPool().release(dir->conn_);
-    dir->conn_ = 0;
     delete dir;
     throw;
   }
@@ -1283,6 +1250,43 @@ IDirectory* INodeMySql::openDir(ino_t inode) throw (DmException)
 
 
 
+void INodeMySql::readDirChunk(NsMySqlDir* dir) throw (DmException)
+{
+  unsigned chunkSize = this->factory_->getDirectoryChunkSize();
+  CStat    cstat;
+
+  Log(Logger::Lvl4, mysqllogmask, mysqllogname, " inode:" << dir->dir.stat.st_ino <<
+      " after:'" << dir->lastName << "' chunk:" << chunkSize);
+
+  dir->chunk.clear();
+  dir->next = 0;
+
+  // The connection goes back to the pool before the entries are returned
+  {
+    PoolGrabber<MYSQL*> conn(MySqlHolder::getMySqlPool());
+    Statement stmt(conn, this->nsDb_, STMT_GET_LIST_FILES_CHUNK);
+    stmt.bindParam(0, dir->dir.stat.st_ino);
+    stmt.bindParam(1, dir->lastName);
+    stmt.bindParam(2, chunkSize);
+    stmt.execute();
+    bindMetadata(stmt, &cstat);
+
+    while (stmt.fetch()) {
+      dir->chunk.push_back(ExtendedStat());
+      dumpCStat(cstat, &dir->chunk.back());
+    }
+  }
+
+  dir->eod = (dir->chunk.size() < chunkSize);
+  if (!dir->chunk.empty())
+    dir->lastName = dir->chunk.back().name;
+
+  Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. inode:" << dir->dir.stat.st_ino <<
+      " nentries:" << dir->chunk.size());
+}
+
+
+
 void INodeMySql::closeDir(IDirectory* dir) throw (DmException)
 {
   NsMySqlDir *dirp;
@@ -1295,14 +1299,9 @@ void INodeMySql::closeDir(IDirectory* dir) throw (DmException)
 
   dirp = dynamic_cast<NsMySqlDir*>(dir);
 
-  if (dirp->conn_) MySqlHolder::getMySqlPool().release(dirp->conn_);
-  dirp->conn_ = 0;
-
   Log(Logger::Lvl3, mysqllogmask, mysqllogname, "Exiting. dir:" << dirp->dir.name);
 
-  delete dirp->stmt;
   delete dirp;
-
 }
 
 
@@ -1319,15 +1318,17 @@ ExtendedStat* INodeMySql::readDirx(IDirectory* dir) throw (DmException)
 
   dirp = dynamic_cast<NsMySqlDir*>(dir);
 
-  if (!dirp->eod) {
-    dumpCStat(dirp->cstat, &dirp->current);
+  // Chunk consumed, get the next one
+  if (dirp->next >= dirp->chunk.size() && !dirp->eod)
+    this->readDirChunk(dirp);
+
+  if (dirp->next < dirp->chunk.size()) {
+    dirp->current = dirp->chunk[dirp->next++];
     dirp->ds.d_ino  = dirp->current.stat.st_ino;
     strncpy(dirp->ds.d_name,
             dirp->current.name.c_str(),
             sizeof(dirp->ds.d_name));
 
-    dirp->eod = !dirp->stmt->fetch();
-
     Log(Logger::Lvl4, mysqllogmask, mysqllogname, "Exiting. item:" << dirp->current.name);
     return &dirp->current;
   }
@@ -29,16 +29,18 @@ namespace dmlite {
   };
 
   /// Struct used internally to read drectories.
+  /// The entries are read a chunk at a time, after the last name read, so
+  /// no connection is kept between two reads.
   struct NsMySqlDir: public IDirectory {
     virtual ~NsMySqlDir() {};
 
     ExtendedStat  dir;           ///< Directory being read.
-    CStat         cstat;         ///< Used for the binding
     ExtendedStat  current;       ///< Current entry metadata.
     struct dirent ds;            ///< The structure used to hold the returned data.
-    Statement    *stmt;          ///< The statement.
-    bool          eod;           ///< True when end of dir is reached.
-    MYSQL *conn_;                ///< The connection the statement is relying on.
+    std::vector<ExtendedStat> chunk; ///< The entries of the last chunk read.
+    size_t        next;          ///< Next entry of the chunk to return.
+    std::string   lastName;      ///< Name of the last entry of the chunk.
+    bool          eod;           ///< True when there is nothing after the chunk.
   };
 
   // Forward declaration
@@ -96,6 +98,7 @@ namespace dmlite {
     void    updateReplica(const Replica& replica) throw (DmException);
 
     void utime(ino_t inode, const struct utimbuf* buf) throw (DmException);
+    void updateAccessTime(const ExtendedStat& meta, time_t atime) throw (DmException);
 
     void setMode(ino_t inode, uid_t uid, gid_t gid,
                 mode_t mode, const Acl& acl) throw (DmException);
@@ -126,6 +129,12 @@ namespace dmlite {
     unsigned transactionLevel_;
 
    private:
+    /// Reads the entries that follow dir->lastName, up to the chunk size
+    void readDirChunk(NsMySqlDir* dir) throw (DmException);
+
+    /// Adds delta to the link count of a directory, in the current transaction
+    void addNlink(ExtendedStat& dir, int delta) throw (DmException);
+
     /// NS DB.
     std::string nsDb_;
 
@@ -22,13 +22,14 @@ const char* STMT_GET_FILE_BY_NAME =
             csumtype, csumvalue, acl, xattr\
         FROM Cns_file_metadata \
         WHERE parent_fileid = ? AND name = ?";
-const char* STMT_GET_LIST_FILES =
+const char* STMT_GET_LIST_FILES_CHUNK =
     "SELECT fileid, parent_fileid, guid, name, filemode, nlink, owner_uid, gid,\
           filesize, atime, mtime, ctime, fileclass, status,\
           csumtype, csumvalue, acl, xattr\
         FROM Cns_file_metadata \
-        WHERE parent_fileid = ?\
-        ORDER BY name ASC";
+        WHERE parent_fileid = ? AND name > ?\
+        ORDER BY name ASC\
+        LIMIT ?";
 const char* STMT_GET_SYMLINK =
     "SELECT fileid, linkname FROM Cns_symlinks WHERE fileid = ?";
 const char* STMT_GET_FILE_REPLICAS =
@@ -84,14 +85,10 @@ const char* STMT_INSERT_SYMLINK =
           (fileid, linkname)\
         VALUES\
           (?, ?)";
-const char* STMT_SELECT_UNIQ_ID_FOR_UPDATE =
-    "SELECT id FROM Cns_unique_id FOR UPDATE";
-const char* STMT_UPDATE_UNIQ_ID =
-    "UPDATE Cns_unique_id SET id = ?";
-const char* STMT_INSERT_UNIQ_ID =
-    "INSERT INTO Cns_unique_id (id) VALUES (?)";
 const char* STMT_DELETE_FILE =
     "DELETE FROM Cns_file_metadata WHERE fileid = ?";
+const char* STMT_DELETE_EMPTY_DIR =
+    "DELETE FROM Cns_file_metadata WHERE fileid = ? AND nlink = 0";
 const char* STMT_DELETE_COMMENT =
     "DELETE FROM Cns_user_metadata WHERE u_fileid = ?";
 const char* STMT_DELETE_SYMLINK =
@@ -102,6 +99,10 @@ const char* STMT_UPDATE_NLINK =
     "UPDATE Cns_file_metadata\
         SET nlink = ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
         WHERE fileid = ?";
+const char* STMT_ADD_NLINK =
+    "UPDATE Cns_file_metadata\
+        SET nlink = nlink + ?, mtime = UNIX_TIMESTAMP(), ctime = UNIX_TIMESTAMP()\
+        WHERE fileid = ?";
 const char* STMT_UPDATE_PERMS =
     "UPDATE Cns_file_metadata\
         SET owner_uid = if(? = -1, owner_uid, ?),\
@@ -143,6 +144,10 @@ const char* STMT_UTIME =
     "UPDATE Cns_file_metadata\
         SET atime = ?, mtime = ?, ctime = UNIX_TIMESTAMP()\
         WHERE fileid = ?";
+const char* STMT_UPDATE_ATIME =
+    "UPDATE Cns_file_metadata\
+        SET atime = GREATEST(atime, ?)\
+        WHERE fileid = ?";
 const char* STMT_UPDATE_REPLICA =
     "UPDATE Cns_file_replica\
         SET nbaccesses = ?, ctime = UNIX_TIMESTAMP(), atime = ?, ptime = ?, ltime = ?, \
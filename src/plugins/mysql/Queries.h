@@ -7,7 +7,7 @@
 extern const char* STMT_GET_FILE_BY_ID;
 extern const char* STMT_GET_FILE_BY_GUID;
 extern const char* STMT_GET_FILE_BY_NAME;
-extern const char* STMT_GET_LIST_FILES;
+extern const char* STMT_GET_LIST_FILES_CHUNK;
 extern const char* STMT_GET_SYMLINK;
 extern const char* STMT_GET_FILE_REPLICAS;
 extern const char* STMT_GET_REPLICA_BY_URL;
@@ -19,14 +19,13 @@ extern const char* STMT_SET_COMMENT;
 extern const char* STMT_INSERT_COMMENT;
 extern const char* STMT_INSERT_FILE;
 extern const char* STMT_INSERT_SYMLINK;
-extern const char* STMT_SELECT_UNIQ_ID_FOR_UPDATE;
-extern const char* STMT_UPDATE_UNIQ_ID;
-extern const char* STMT_INSERT_UNIQ_ID;
 extern const char* STMT_DELETE_FILE;
+extern const char* STMT_DELETE_EMPTY_DIR;
 extern const char* STMT_DELETE_COMMENT;
 extern const char* STMT_DELETE_SYMLINK;
 extern const char* STMT_NLINK_FOR_UPDATE;
 extern const char* STMT_UPDATE_NLINK;
+extern const char* STMT_ADD_NLINK;
 extern const char* STMT_UPDATE_PERMS;
 extern const char* STMT_DELETE_REPLICA;
 extern const char* STMT_DELETE_ALL_REPLICAS;
@@ -35,6 +34,7 @@ extern const char* STMT_TRUNCATE_FILE;
 extern const char* STMT_CHANGE_NAME;
 extern const char* STMT_CHANGE_PARENT;
 extern const char* STMT_UTIME;
+extern const char* STMT_UPDATE_ATIME;
 extern const char* STMT_UPDATE_REPLICA;
 extern const char* STMT_CHANGE_SIZE;
 extern const char* STMT_INCREMENT_SIZE;
@@ -122,23 +122,37 @@ size_t ProfilerIOHandler::readv(const struct iovec* vector, size_t count) throw
   Log(Logger::Lvl4, profilerlogmask, profilerlogname, " count:" << count);
 
   PROFILE_ASSIGN(size_t, readv, vector, count);
-  xfrstats_.readv += ret;
+  countReadv(ret, count);
 
-  opsstats_.readv += 1;
-  // ret: the number of bytes read
-  if (opsstats_.rvMin > (int) ret)
-    opsstats_.rvMin = ret;
-  if (opsstats_.rvMax < (int) ret)
-    opsstats_.rvMax = ret;
-  // count: the number of segments to be read into
-  opsstats_.rsegs += count;
-  if (opsstats_.rsMin > (int) count)
-    opsstats_.rsMin = count;
-  if (opsstats_.rsMax < (int) count)
-    opsstats_.rsMax = count;
-
-  ssq_.readv += static_cast<double>(ret) * static_cast<double>(ret);
-  ssq_.rsegs += static_cast<double>(count) * static_cast<double>(count);
+  return ret;
+}
+size_t ProfilerIOHandler::preadv(IOSegment* segments, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, profilerlogmask, profilerlogname, " count:" << count);
+
+  PROFILE_ASSIGN(size_t, preadv, segments, count);
+  countReadv(ret, count);
+
+  return ret;
+}
+int ProfilerIOHandler::submitAsync(IOSegment* segments, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, profilerlogmask, profilerlogname, " count:" << count);
+
+  PROFILE_ASSIGN(int, submitAsync, segments, count);
+  asyncSegments_[ret] = count;
+
+  return ret;
+}
+size_t ProfilerIOHandler::waitAsync(int id) throw (DmException)
+{
+  Log(Logger::Lvl4, profilerlogmask, profilerlogname, " id:" << id);
+
+  size_t count = asyncSegments_[id];
+  asyncSegments_.erase(id);
+
+  PROFILE_ASSIGN(size_t, waitAsync, id);
+  countReadv(ret, count);
 
   return ret;
 }
@@ -207,6 +221,62 @@ bool ProfilerIOHandler::eof(void) throw (DmException)
 {
   PROFILE_RETURN(bool, eof);
 }
+size_t ProfilerIOHandler::transferTo(int outfd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, profilerlogmask, profilerlogname, " count:" << count);
+
+  // Accounted as a read, the data just does not go through us
+  PROFILE_ASSIGN(size_t, transferTo, outfd, offset, count);
+  xfrstats_.read += ret;
+
+  opsstats_.read += 1;
+  if (opsstats_.rdMin > (int) ret)
+    opsstats_.rdMin = ret;
+  if (opsstats_.rdMax < (int) ret)
+    opsstats_.rdMax = ret;
+
+  ssq_.read += static_cast<double>(ret) * static_cast<double>(ret);
+
+  return ret;
+}
+size_t ProfilerIOHandler::transferFrom(int infd, off_t offset, size_t count) throw (DmException)
+{
+  Log(Logger::Lvl4, profilerlogmask, profilerlogname, " count:" << count);
+
+  PROFILE_ASSIGN(size_t, transferFrom, infd, offset, count);
+  xfrstats_.write += ret;
+
+  opsstats_.write += 1;
+  if (opsstats_.wrMin > (int) ret)
+    opsstats_.wrMin = ret;
+  if (opsstats_.wrMax < (int) ret)
+    opsstats_.wrMax = ret;
+
+  ssq_.write += static_cast<double>(ret) * static_cast<double>(ret);
+
+  return ret;
+}
+
+void ProfilerIOHandler::countReadv(size_t nbytes, size_t nsegments)
+{
+  xfrstats_.readv += nbytes;
+
+  opsstats_.readv += 1;
+  // nbytes: the number of bytes read
+  if (opsstats_.rvMin > (int) nbytes)
+    opsstats_.rvMin = nbytes;
+  if (opsstats_.rvMax < (int) nbytes)
+    opsstats_.rvMax = nbytes;
+  // nsegments: the number of segments to be read into
+  opsstats_.rsegs += nsegments;
+  if (opsstats_.rsMin > (int) nsegments)
+    opsstats_.rsMin = nsegments;
+  if (opsstats_.rsMax < (int) nsegments)
+    opsstats_.rsMax = nsegments;
+
+  ssq_.readv += static_cast<double>(nbytes) * static_cast<double>(nbytes);
+  ssq_.rsegs += static_cast<double>(nsegments) * static_cast<double>(nsegments);
+}
 
 void ProfilerIOHandler::resetCounters()
 {
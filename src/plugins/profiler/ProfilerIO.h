@@ -37,12 +37,21 @@ namespace dmlite {
     virtual off_t tell(void) throw (DmException);
     virtual void flush(void) throw (DmException);
     virtual bool eof(void) throw (DmException);
+    virtual size_t preadv(IOSegment* segments, size_t count) throw (DmException);
+    virtual int submitAsync(IOSegment* segments, size_t count) throw (DmException);
+    virtual size_t waitAsync(int id) throw (DmException);
+    virtual size_t transferTo(int outfd, off_t offset, size_t count) throw (DmException);
+    virtual size_t transferFrom(int infd, off_t offset, size_t count) throw (DmException);
 
   protected:
     IOHandler* decorated_;
     char*      decoratedId_;
 
+    /// Number of segments of the asynchronous reads in flight, by id
+    std::map<int, size_t> asyncSegments_;
+
     void resetCounters();
+    void countReadv(size_t nbytes, size_t nsegments);
   };
 
 
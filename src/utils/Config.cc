@@ -198,11 +198,52 @@ int Config::ProcessFile(char *filename) {
     return -1;
   }
 
+  Compile();
   return 0;
 }
 
 
 
+ConfigSnapshot::ConfigSnapshot():
+  dirspacereportdepth(6), putminfreespace_bytes(1024LL*4 * 1024*1024),
+  headnodedomeurl("(empty url)/")
+{
+}
+
+
+
+void Config::Compile() {
+  ConfigSnapshot *s = new ConfigSnapshot();
+
+  s->dirspacereportdepth   = GetLong("head.dirspacereportdepth", 6);
+  s->putminfreespace_bytes = (int64_t)GetLong("head.put.minfreespace_mb", 1024*4) * 1024*1024;
+  s->headnodedomeurl       = GetString("disk.headnode.domeurl", (char *)"(empty url)/");
+
+  std::map<std::string, std::vector<std::string> >::const_iterator dns = arrdata.find("glb.auth.authorizeDN");
+  if (dns != arrdata.end()) {
+    for (unsigned int i = 0; i < dns->second.size(); ++i) {
+      std::string dn = dns->second[i];
+
+      if (!dn.empty() && dn[0] == '"') {
+        if (dn.length() < 2 || dn[dn.length()-1] != '"') {
+          Err("Config::Compile", "Mismatched quotes in authorizeDN directive, ignoring it: " << dn);
+          continue;
+        }
+        dn = dn.substr(1, dn.length()-2);
+      }
+
+      if (!dn.empty())
+        s->authorizedDNs.insert(dn);
+    }
+  }
+
+  const ConfigSnapshot *old = snapshot.exchange(s, boost::memory_order_acq_rel);
+  if (old)
+    retired.push_back(old);
+}
+
+
+
 
 
 
@@ -222,10 +263,12 @@ void Config::SetLong(const char *name, long val) {
 
   sprintf(buf, "%ld", val);
   data[name] = buf;
+  Compile();
 }
 
 void Config::SetString(const char *name, char *val) {
   data[name] = val;
+  Compile();
 }
 
 
@@ -23,6 +23,9 @@
 #include <map>
 #include <string>
 #include <vector>
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/unordered_set.hpp>
 
 
 /// The macro to be used to access the cfg options
@@ -34,6 +37,29 @@ std::vector<std::string> tokenize(const std::string& str, const std::string& del
 // Utility to get filename entries in a directory
 std::vector<std::string> ReadDirectory(const std::string& path);
 
+/// Typed, immutable view of the parameters that are read on hot paths,
+/// with the values already parsed. Get it with Config::GetSnapshot.
+struct ConfigSnapshot {
+    ConfigSnapshot();
+
+    /// head.dirspacereportdepth
+    long dirspacereportdepth;
+
+    /// head.put.minfreespace_mb, in bytes
+    int64_t putminfreespace_bytes;
+
+    /// disk.headnode.domeurl
+    std::string headnodedomeurl;
+
+    /// glb.auth.authorizeDN, without the surrounding quotes
+    boost::unordered_set<std::string> authorizedDNs;
+
+    /// True if the DN is explicitly authorized by glb.auth.authorizeDN
+    bool isDNAuthorized(const std::string &dn) const {
+        return authorizedDNs.find(dn) != authorizedDNs.end();
+    }
+};
+
 /// Singleton class that implements a simple config manager
 /// Once initialized with ProcessFile, it will contain all
 /// the config parameters, organized as:
@@ -49,7 +75,7 @@ class Config {
 protected:
     static Config *inst;
 
-    Config() {
+    Config(): snapshot(new ConfigSnapshot()) {
     };
 
     /// Stores the simple parameters
@@ -57,6 +83,16 @@ protected:
 
     /// Stores the array parameters
     std::map<std::string, std::vector<std::string> > arrdata;
+
+    /// The published snapshot. Readers only do an atomic load.
+    boost::atomic<const ConfigSnapshot*> snapshot;
+
+    /// Snapshots that have been replaced. Some reader may still be using
+    /// them, and reloads are rare, so they are never freed.
+    std::vector<const ConfigSnapshot*> retired;
+
+    /// Build a new snapshot from the current parameters and publish it
+    void Compile();
 public:
 
     /// We are a singleton
@@ -72,6 +108,13 @@ public:
     /// @param filename Configuration file to parse
     int ProcessFile(char *filename);
 
+    /// Get the current snapshot of the hot parameters. Does not lock.
+    /// The pointer remains valid for the life of the process, but a
+    /// later reload may publish a newer one.
+    const ConfigSnapshot *GetSnapshot() const {
+        return snapshot.load(boost::memory_order_acquire);
+    }
+
     /// Set a value of type long
     /// @param name The name of the parameter
     /// @param val  The value for the parameter
@@ -0,0 +1,108 @@
+/// @file   MySqlIdAllocator.cpp
+/// @brief  Allocation of the file ids of the name space, a block at a time.
+#include "MySqlIdAllocator.h"
+#include "MySqlWrapper.h"
+
+#include <dmlite/cpp/utils/mysqlpools.h>
+#include <dmlite/cpp/utils/poolcontainer.h>
+
+using namespace dmlite;
+
+
+
+MySqlIdAllocator::MySqlIdAllocator(const std::string& db, unsigned blockSize):
+  db_(db), blockSize_(blockSize > 0 ? blockSize : 1), next_(0), end_(0), refilling_(false)
+{
+}
+
+
+
+void MySqlIdAllocator::setBlockSize(unsigned blockSize)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  blockSize_ = (blockSize > 0 ? blockSize : 1);
+}
+
+
+
+int64_t MySqlIdAllocator::next() throw (DmException)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (next_ >= end_) {
+    if (refilling_) {
+      cond_.wait(lock);
+      continue;
+    }
+
+    // Reserve without the lock, so a wait for the pool does not stall
+    // the threads that only need an id
+    refilling_ = true;
+    unsigned blockSize = blockSize_;
+    lock.unlock();
+
+    int64_t first;
+    try {
+      first = this->reserve(blockSize);
+    }
+    catch (...) {
+      lock.lock();
+      refilling_ = false;
+      cond_.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    next_ = first;
+    end_  = first + blockSize;
+    refilling_ = false;
+    cond_.notify_all();
+  }
+
+  return next_++;
+}
+
+
+
+int64_t MySqlIdAllocator::reserve(unsigned blockSize) throw (DmException)
+{
+  Log(Logger::Lvl4, Logger::unregistered, Logger::unregisteredname, " blockSize:" << blockSize);
+
+  PoolGrabber<MYSQL*> conn(MySqlHolder::getMySqlPool());
+  int64_t last = 0;
+
+  if (mysql_query(conn, "BEGIN") != 0)
+    throw DmException(DMLITE_DBERR(mysql_errno(conn)), mysql_error(conn));
+
+  try {
+    // Scope to make sure that the statements are gone before the commit
+    {
+      Statement select(conn, db_, "SELECT id FROM Cns_unique_id FOR UPDATE");
+      select.execute();
+      select.bindResult(0, &last);
+
+      if (select.fetch()) {
+        Statement update(conn, db_, "UPDATE Cns_unique_id SET id = ?");
+        update.bindParam(0, last + blockSize);
+        update.execute();
+      }
+      // Couldn't get, so insert
+      else {
+        Statement insert(conn, db_, "INSERT INTO Cns_unique_id (id) VALUES (?)");
+        last = 0;
+        insert.bindParam(0, blockSize);
+        insert.execute();
+      }
+    }
+
+    if (mysql_query(conn, "COMMIT") != 0)
+      throw DmException(DMLITE_DBERR(mysql_errno(conn)), mysql_error(conn));
+  }
+  catch (...) {
+    mysql_query(conn, "ROLLBACK");
+    throw;
+  }
+
+  Log(Logger::Lvl3, Logger::unregistered, Logger::unregisteredname, "Exiting. Reserved ids from " << (last + 1) << " to " << (last + blockSize));
+  return last + 1;
+}
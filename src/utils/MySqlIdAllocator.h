@@ -0,0 +1,49 @@
+/// @file   MySqlIdAllocator.h
+/// @brief  Allocation of the file ids of the name space, a block at a time.
+#ifndef MYSQLIDALLOCATOR_H
+#define	MYSQLIDALLOCATOR_H
+
+#include <dmlite/cpp/exceptions.h>
+#include <stdint.h>
+#include <string>
+#include <boost/thread.hpp>
+
+namespace dmlite {
+
+  /// Gives out the file ids. They are reserved from Cns_unique_id a block
+  /// at a time, in a short transaction of their own, and then handed out
+  /// from memory. The row is not locked anymore for the whole creation of
+  /// a file.
+  /// Ids are unique among processes and restarts, but the ones reserved and
+  /// not used are lost, so there can be gaps.
+  class MySqlIdAllocator {
+   public:
+    /// @param db        The name space database.
+    /// @param blockSize Ids reserved at a time. 1 reserves them one by one.
+    MySqlIdAllocator(const std::string& db, unsigned blockSize);
+
+    /// An id never given before.
+    int64_t next() throw (DmException);
+
+    /// Applies from the next reservation.
+    void setBlockSize(unsigned blockSize);
+
+   private:
+    /// Reserves blockSize more ids, and returns the first one.
+    /// Called without mutex_, as it waits for a connection of the pool.
+    int64_t reserve(unsigned blockSize) throw (DmException);
+
+    std::string  db_;
+    unsigned     blockSize_;
+
+    boost::mutex              mutex_;
+    boost::condition_variable cond_;
+    /// Ids from next_ to end_, not included, are reserved and not given yet.
+    int64_t      next_, end_;
+    /// A thread is reserving more, the others wait on cond_.
+    bool         refilling_;
+  };
+
+};
+
+#endif	// MYSQLIDALLOCATOR_H
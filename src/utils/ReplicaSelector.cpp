@@ -0,0 +1,367 @@
+/// @file   utils/ReplicaSelector.cpp
+/// @brief  Policy to choose the replica a client reads from.
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <boost/thread/mutex.hpp>
+#include <dmlite/cpp/dmlite.h>
+#include <dmlite/cpp/utils/replicaselector.h>
+#include "utils/logger.h"
+
+using namespace dmlite;
+
+
+
+/// Redirections are counted in windows of this many seconds.
+/// The previous window counts half, older ones do not count.
+static const time_t kRedirectionWindow = 60;
+
+/// Seconds a resolved server name is trusted.
+static const time_t kResolutionTtl = 300;
+
+/// Seconds a server name that did not resolve is not tried again.
+static const time_t kNegativeResolutionTtl = 60;
+
+
+
+namespace {
+  struct Redirections {
+    Redirections(): window(0), current(0), previous(0) {}
+
+    time_t        window;
+    unsigned long current;
+    unsigned long previous;
+
+    void roll(time_t now)
+    {
+      time_t w = now / kRedirectionWindow;
+      if (w == window)
+        return;
+      previous = (w == window + 1) ? current : 0;
+      current  = 0;
+      window   = w;
+    }
+
+    unsigned long recent(void) const
+    {
+      return current + previous / 2;
+    }
+  };
+
+  /// An address, in network order, with its family.
+  struct Address {
+    int           family;
+    unsigned char bytes[16];
+  };
+
+  struct Resolution {
+    time_t               expires;
+    std::vector<Address> addresses;
+  };
+
+  boost::mutex                                redirectionsMtx;
+  std::map<std::string, Redirections>         redirections;
+
+  boost::mutex                                resolutionsMtx;
+  std::map<std::string, Resolution>           resolutions;
+}
+
+
+
+/// Parse a numeric address. IPv4 mapped IPv6 addresses are returned as IPv4.
+static bool parseAddress(const std::string& str, Address& addr)
+{
+  std::string s(str);
+  if (s.size() > 1 && s[0] == '[' && s[s.size() - 1] == ']')
+    s = s.substr(1, s.size() - 2);
+
+  if (inet_pton(AF_INET, s.c_str(), addr.bytes) == 1) {
+    addr.family = AF_INET;
+    return true;
+  }
+  if (inet_pton(AF_INET6, s.c_str(), addr.bytes) == 1) {
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+    if (memcmp(addr.bytes, mapped, sizeof(mapped)) == 0) {
+      memmove(addr.bytes, addr.bytes + 12, 4);
+      addr.family = AF_INET;
+    }
+    else {
+      addr.family = AF_INET6;
+    }
+    return true;
+  }
+  return false;
+}
+
+
+
+/// True if the first bits of both addresses are the same.
+static bool samePrefix(const Address& a, const Address& b, unsigned bits)
+{
+  if (a.family != b.family)
+    return false;
+
+  unsigned maxBits = (a.family == AF_INET) ? 32 : 128;
+  if (bits > maxBits)
+    bits = maxBits;
+
+  unsigned bytes = bits / 8;
+  if (memcmp(a.bytes, b.bytes, bytes) != 0)
+    return false;
+  if (bits % 8 == 0)
+    return true;
+
+  unsigned char mask = 0xFF << (8 - bits % 8);
+  return (a.bytes[bytes] & mask) == (b.bytes[bytes] & mask);
+}
+
+
+
+/// Resolve a server name, going through the cache.
+static std::vector<Address> resolve(const std::string& server)
+{
+  time_t now = time(NULL);
+
+  {
+    boost::mutex::scoped_lock lock(resolutionsMtx);
+    std::map<std::string, Resolution>::const_iterator i = resolutions.find(server);
+    if (i != resolutions.end() && i->second.expires > now)
+      return i->second.addresses;
+  }
+
+  // Not under the lock, this may take a while
+  Resolution resolution;
+  Address    address;
+
+  if (parseAddress(server, address)) {
+    resolution.addresses.push_back(address);
+  }
+  else {
+    struct addrinfo  hints;
+    struct addrinfo* result = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(server.c_str(), NULL, &hints, &result) == 0) {
+      for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+          address.family = AF_INET;
+          memcpy(address.bytes, &((struct sockaddr_in*)ai->ai_addr)->sin_addr, 4);
+          resolution.addresses.push_back(address);
+        }
+        else if (ai->ai_family == AF_INET6) {
+          address.family = AF_INET6;
+          memcpy(address.bytes, &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr, 16);
+          resolution.addresses.push_back(address);
+        }
+      }
+      freeaddrinfo(result);
+    }
+    else {
+      Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname,
+          "Could not resolve " << server << ". Will not be considered local");
+    }
+  }
+
+  resolution.expires = now + (resolution.addresses.empty() ? kNegativeResolutionTtl : kResolutionTtl);
+
+  boost::mutex::scoped_lock lock(resolutionsMtx);
+  resolutions[server] = resolution;
+  return resolution.addresses;
+}
+
+
+
+ReplicaSelector::ReplicaSelector(): ipv4Prefix_(24), ipv6Prefix_(64)
+{
+  criteria_.push_back(kLeastLoaded);
+}
+
+
+
+ReplicaSelector::~ReplicaSelector()
+{
+  // Nothing
+}
+
+
+
+void ReplicaSelector::setCriteria(const std::string& criteria) throw (DmException)
+{
+  std::vector<Criterion> parsed;
+  std::istringstream     stream(criteria);
+  std::string            name;
+
+  while (std::getline(stream, name, ',')) {
+    size_t b = name.find_first_not_of(" \t");
+    size_t e = name.find_last_not_of(" \t");
+    if (b == std::string::npos)
+      continue;
+    name = name.substr(b, e - b + 1);
+
+    if (name == "local")
+      parsed.push_back(kLocal);
+    else if (name == "permanent")
+      parsed.push_back(kPermanent);
+    else if (name == "load")
+      parsed.push_back(kLeastLoaded);
+    else if (name != "random")
+      throw DmException(DMLITE_CFGERR(EINVAL),
+                        "Unknown replica selection criterion '%s'", name.c_str());
+  }
+
+  criteria_.swap(parsed);
+}
+
+
+
+void ReplicaSelector::setSubnetPrefixes(const std::string& spec) throw (DmException)
+{
+  unsigned    v4, v6;
+  char        slash;
+  std::istringstream stream(spec);
+
+  if (!(stream >> v4 >> slash >> v6) || slash != '/' || v4 > 32 || v6 > 128)
+    throw DmException(DMLITE_CFGERR(EINVAL),
+                      "Invalid subnet prefixes '%s', expected ipv4/ipv6 (i.e. 24/64)",
+                      spec.c_str());
+
+  ipv4Prefix_ = v4;
+  ipv6Prefix_ = v6;
+}
+
+
+
+bool ReplicaSelector::isLocal(const std::string& clientAddress, const std::string& server)
+{
+  Address client;
+  if (clientAddress.empty() || server.empty() || !parseAddress(clientAddress, client))
+    return false;
+
+  std::vector<Address> addresses = resolve(server);
+  for (unsigned i = 0; i < addresses.size(); ++i) {
+    unsigned bits = (addresses[i].family == AF_INET) ? ipv4Prefix_ : ipv6Prefix_;
+    if (samePrefix(client, addresses[i], bits))
+      return true;
+  }
+  return false;
+}
+
+
+
+unsigned long ReplicaSelector::score(Criterion criterion, const std::string& clientAddress,
+                                     const Replica& replica)
+{
+  switch (criterion) {
+    case kLocal:
+      return isLocal(clientAddress, replica.server) ? 0 : 1;
+    case kPermanent:
+      return replica.type == Replica::kVolatile ? 1 : 0;
+    case kLeastLoaded:
+      return recentRedirections(replica.server);
+  }
+  return 0;
+}
+
+
+
+unsigned ReplicaSelector::select(const SecurityContext* ctx, const std::vector<Replica>& replicas)
+{
+  if (replicas.empty())
+    throw DmException(DMLITE_NO_REPLICAS, "No replicas");
+
+  std::string clientAddress;
+  if (ctx != NULL)
+    clientAddress = ctx->credentials.remoteAddress;
+
+  // Narrow down the candidates one criterion at a time
+  std::vector<unsigned> candidates;
+  for (unsigned i = 0; i < replicas.size(); ++i)
+    candidates.push_back(i);
+
+  for (unsigned c = 0; c < criteria_.size() && candidates.size() > 1; ++c) {
+    std::vector<unsigned> best;
+    unsigned long         bestScore = 0;
+
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+      unsigned long s = this->score(criteria_[c], clientAddress, replicas[candidates[i]]);
+      if (best.empty() || s < bestScore) {
+        best.clear();
+        bestScore = s;
+      }
+      if (s == bestScore)
+        best.push_back(candidates[i]);
+    }
+
+    candidates.swap(best);
+  }
+
+  unsigned chosen = candidates[rand() % candidates.size()];
+
+  {
+    boost::mutex::scoped_lock lock(redirectionsMtx);
+    Redirections& r = redirections[replicas[chosen].server];
+    r.roll(time(NULL));
+    ++r.current;
+  }
+
+  Log(Logger::Lvl4, Logger::unregistered, Logger::unregisteredname,
+      "Chose " << replicas[chosen].rfn << " out of " << replicas.size() <<
+      " replicas, " << candidates.size() << " tied");
+
+  return chosen;
+}
+
+
+
+unsigned long ReplicaSelector::recentRedirections(const std::string& server)
+{
+  boost::mutex::scoped_lock lock(redirectionsMtx);
+
+  std::map<std::string, Redirections>::iterator i = redirections.find(server);
+  if (i == redirections.end())
+    return 0;
+
+  i->second.roll(time(NULL));
+  return i->second.recent();
+}
+
+
+
+void ReplicaSelector::removeExcluded(StackInstance* si, std::vector<Replica>& replicas) throw (DmException)
+{
+  std::vector<boost::any> excluded;
+
+  try {
+    boost::any excludedAny = si->get("ExcludeReplicas");
+    excluded = boost::any_cast<std::vector<boost::any> >(excludedAny);
+  }
+  catch (boost::bad_any_cast&) {
+    throw DmException(EINVAL, "ExcludeReplicas is not an array");
+  }
+  catch (DmException& e) {
+    if (e.code() != DMLITE_SYSERR(DMLITE_UNKNOWN_KEY)) throw;
+  }
+
+  if (excluded.empty())
+    return;
+
+  std::vector<Replica>::iterator i;
+  for (i = replicas.begin(); i != replicas.end();) {
+    bool isExcluded = false;
+    for (unsigned j = 0; j < excluded.size() && !isExcluded; ++j)
+      isExcluded = (Extensible::anyToU64(excluded[j]) == static_cast<uint64_t>(i->replicaid));
+
+    if (isExcluded)
+      i = replicas.erase(i);
+    else
+      ++i;
+  }
+}
@@ -3,8 +3,14 @@
 /// @details This is not a plugin!
 /// @author  Alejandro Álvarez Ayllón <aalvarez@cern.ch>
 #include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/unordered_map.hpp>
 #include <cctype>
 #include <cstring>
 #include <dmlite/common/errno.h>
@@ -14,10 +20,16 @@
 #include <map>
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
+#include <openssl/evp.h>
 #include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <sstream>
+#include <unistd.h>
 #include "utils/logger.h"
 
 using namespace dmlite;
@@ -30,13 +42,52 @@ const uint8_t AclEntry::kMask;
 const uint8_t AclEntry::kOther;
 const uint8_t AclEntry::kDefault;
 
-struct MapFileEntry {
-  time_t      lastModified;
-  std::map<std::string, std::string> voForDn;
-  boost::shared_mutex mutex;
+const unsigned CompiledAcl::kInlineEntries;
+
+/// Contents of a mapfile. Immutable once published.
+struct VoMapping {
+  VoMapping(): error(0), mtime(0), size(0), ino(0) {}
+
+  int         error;    ///< errno if the mapfile could not be read.
+  std::string errorMsg;
+  time_t      mtime;
+  off_t       size;
+  ino_t       ino;
+  boost::unordered_map<std::string, std::string> voForDn;
+};
+
+typedef boost::shared_ptr<const VoMapping> VoMappingPtr;
+
+/// What each thread remembers of a mapfile, so lookups do not
+/// touch the shared reference count unless there is a new version.
+struct LocalVoMapping {
+  unsigned     generation;
+  VoMappingPtr mapping;
+};
+
+/// A mapfile, and the last version loaded.
+/// current is only accessed with boost::atomic_load/atomic_store, and
+/// generation is increased after each store. 0 means never loaded.
+struct MapFile {
+  MapFile(const std::string& p): path(p), generation(0), nextCheck(0), refreshing(false) {}
+
+  const std::string       path;
+  VoMappingPtr            current;
+  boost::atomic<unsigned> generation;
+  boost::atomic<time_t>   nextCheck;
+  boost::atomic<bool>     refreshing;
+  boost::mutex            loadMutex;
+  boost::thread_specific_ptr<LocalVoMapping> local;
 };
 
-typedef std::map<std::string, struct MapFileEntry*> MapFileCache;
+typedef boost::unordered_map<std::string, MapFile*> MapFileCache;
+
+/// Seconds between checks for changes in a mapfile
+static boost::atomic<time_t> mapFileCheckInterval(kDefaultMapFileCheckInterval);
+/// A mapfile changed less than this seconds ago may still be being written
+static const time_t kMapFileSettleTime = 2;
+/// Reads of a mapfile being written, when there is nothing loaded to keep
+static const int    kMapFileLoadAttempts = 10;
 
 
 bool AclEntry::operator == (const AclEntry& e) const
@@ -324,108 +375,240 @@ bool dmlite::hasGroup(const std::vector<GroupInfo>& groups, gid_t gid)
 
 
 
+CompiledAcl::CompiledAcl() throw ():
+  empty(true), mask(0x7F), groupObjPerm(0), nUsers(0), nGroups(0)
+{
+  // Nothing
+}
+
+
+
+CompiledAcl::CompiledAcl(const Acl& acl) throw ()
+{
+  this->compile(acl);
+}
+
+
+
+CompiledAcl::CompiledAcl(const CompiledAcl& c) throw ():
+  empty(c.empty), mask(c.mask), groupObjPerm(c.groupObjPerm),
+  nUsers(c.nUsers), nGroups(c.nGroups), spill_(c.spill_)
+{
+  if (spill_.empty())
+    std::copy(c.inline_, c.inline_ + nUsers + nGroups, this->inline_);
+}
+
+
+
+CompiledAcl& CompiledAcl::operator = (const CompiledAcl& c) throw ()
+{
+  if (this != &c) {
+    this->empty        = c.empty;
+    this->mask         = c.mask;
+    this->groupObjPerm = c.groupObjPerm;
+    this->nUsers       = c.nUsers;
+    this->nGroups      = c.nGroups;
+    this->spill_       = c.spill_;
+    if (this->spill_.empty())
+      std::copy(c.inline_, c.inline_ + nUsers + nGroups, this->inline_);
+  }
+  return *this;
+}
+
+
+
+void CompiledAcl::compile(const Acl& acl) throw ()
+{
+  this->empty        = acl.empty();
+  this->mask         = 0x7F;
+  this->groupObjPerm = 0;
+  this->nUsers       = 0;
+  this->nGroups      = 0;
+  this->spill_.clear();
+
+  unsigned n = 0;
+  Acl::const_iterator i;
+  for (i = acl.begin(); i != acl.end(); ++i) {
+    switch (i->type) {
+      case AclEntry::kMask:
+        this->mask = i->perm;
+        break;
+      case AclEntry::kGroupObj:
+        this->groupObjPerm = i->perm;
+        break;
+      case AclEntry::kUser:
+        ++this->nUsers;
+        ++n;
+        break;
+      case AclEntry::kGroup:
+        ++this->nGroups;
+        ++n;
+        break;
+      default:
+        break;
+    }
+  }
+
+  AclEntry* dest = this->inline_;
+  if (n > kInlineEntries) {
+    this->spill_.resize(n);
+    dest = &this->spill_[0];
+  }
+
+  AclEntry* users  = dest;
+  AclEntry* groups = dest + this->nUsers;
+  for (i = acl.begin(); i != acl.end(); ++i) {
+    if (i->type == AclEntry::kUser)
+      *users++ = *i;
+    else if (i->type == AclEntry::kGroup)
+      *groups++ = *i;
+  }
+
+  std::sort(dest, dest + this->nUsers);
+  std::sort(dest + this->nUsers, dest + n);
+}
+
+
+
+CompiledSecurityContext::CompiledSecurityContext() throw ():
+  uid(-1), banned(true)
+{
+  // Nothing
+}
+
+
+
+CompiledSecurityContext::CompiledSecurityContext(const SecurityContext& ctx)
+{
+  this->compile(ctx);
+}
+
+
+
+void CompiledSecurityContext::compile(const SecurityContext& ctx)
+{
+  this->uid      = ctx.user.getUnsigned("uid");
+  this->banned   = ctx.user.getLong("banned") != 0;
+  this->userName = ctx.user.name;
+  this->gids.clear();
+
+  // If user's primary group is banned, the user is also banned
+  if (ctx.groups.size() && ctx.groups[0].getLong("banned")) {
+    Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname, "Group" << ctx.groups[0].name << " is banned for user " << ctx.user.name);
+    this->banned = true;
+  }
+
+  this->gids.reserve(ctx.groups.size());
+  std::vector<GroupInfo>::const_iterator i;
+  for (i = ctx.groups.begin(); i != ctx.groups.end(); ++i) {
+    if (i->hasField("banned") && i->getLong("banned"))
+      continue;
+    this->gids.push_back(i->getUnsigned("gid"));
+  }
+  std::sort(this->gids.begin(), this->gids.end());
+  this->gids.erase(std::unique(this->gids.begin(), this->gids.end()),
+                   this->gids.end());
+}
+
+
+
+bool CompiledSecurityContext::hasGroup(gid_t gid) const throw ()
+{
+  return std::binary_search(this->gids.begin(), this->gids.end(), gid);
+}
+
+
+
 int dmlite::checkPermissions(const SecurityContext* context,
                              const Acl& acl, const struct stat &stat,
                              mode_t mode)
 {
-  int iacl;
-  uint8_t  aclMask = 0x7F;
-  uid_t    aclId;
-  int      accPerm = 0;
-  int      nGroups = 0;
-
   // If Context is NULL, abort
   if (context == 0)
     throw DmException(DMLITE_SYSERR(EINVAL),
                       "Security context not initialized!!");
 
-  // Extract used metadata
-  uid_t uid = context->user.getUnsigned("uid");
-
   // Root can do anything
-  if (uid == 0)
+  if (context->user.getUnsigned("uid") == 0)
     return 0;
 
-  // Check if the user is banned
-  long banned = context->user.getLong("banned");
+  return checkPermissions(CompiledSecurityContext(*context),
+                          CompiledAcl(acl), stat, mode);
+}
 
-  // If user's primary group is banned, the user is also banned
-  if (context->groups.size() && context->groups[0].getLong("banned")) {
-    Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname, "Group" << context->groups[0].name << " is banned for user " << context->user.name);
-    banned = 1;
-  }
+
+
+int dmlite::checkPermissions(const CompiledSecurityContext& context,
+                             const CompiledAcl& acl, const struct stat &stat,
+                             mode_t mode)
+{
+  uint8_t  aclMask = acl.mask;
+  int      accPerm = 0;
+  int      nGroups = 0;
+
+  // Root can do anything
+  if (context.uid == 0)
+    return 0;
 
   // Banned user, rejected
-  if (banned) {
-    Err("checkPermissions", "Banned user " << context->user.name);
+  if (context.banned) {
+    Err("checkPermissions", "Banned user " << context.userName);
     return 1;
   }
 
   // Check user. If owner, straigh-forward.
-  if (stat.st_uid == uid) {
+  if (stat.st_uid == context.uid) {
 
     return ((stat.st_mode & mode) != mode);
   }
 
   // There is no ACL's?
-  if (acl.empty()) {
+  if (acl.empty) {
     Log(Logger::Lvl4, Logger::unregistered, Logger::unregisteredname, "Empty acl for " << stat.st_ino);
 
     // The user is not the owner
     mode >>= 3;
     // Belong to the group?
-    if (!hasGroup(context->groups, stat.st_gid))
+    if (!context.hasGroup(stat.st_gid))
       mode >>= 3;
 
     return ((stat.st_mode & mode) != mode);
   }
 
-  Log(Logger::Lvl4, Logger::unregistered, Logger::unregisteredname, "Acl for " << stat.st_ino << ": " << acl.serialize());
   // We have ACL's!
   // Adapted from Cns_acl.c
-
-  // Get ACL_MASK if any
-  if ((iacl = acl.has(AclEntry::kMask)) != -1)
-    aclMask =  acl[iacl].perm;
   mode >>= 6;
 
-  // check ACL_USER entries if any
-  for (iacl = 0; iacl < (int) acl.size(); ++iacl)
-  {
-    if (acl[iacl].type > AclEntry::kUser)
-      break;
-    if (acl[iacl].type < AclEntry::kUser)
-      continue;
-    aclId = acl[iacl].id;
-    if (uid == aclId) {
-      Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname,
-          "Matched user ACL entry id " << acl[iacl].id << "' (" << acl[iacl].perm << ") mask:" << aclMask << " mode:" << mode);
-      return ((acl[iacl].perm & aclMask & mode) != mode);
-    }
-    if (uid < aclId)
-      break;
+  // check ACL_USER entries if any. They are sorted by id.
+  const AclEntry* users    = acl.entries();
+  const AclEntry* usersEnd = users + acl.nUsers;
+  AclEntry        key;
+  key.type = AclEntry::kUser;
+  key.perm = 0;
+  key.id   = context.uid;
+  const AclEntry* user = std::lower_bound(users, usersEnd, key);
+  if (user != usersEnd && user->id == context.uid) {
+    Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname,
+        "Matched user ACL entry id " << user->id << "' (" << user->perm << ") mask:" << aclMask << " mode:" << mode);
+    return ((user->perm & aclMask & mode) != mode);
   }
 
   // Check GROUP
-  iacl = acl.has(AclEntry::kGroupObj);
-  if (hasGroup(context->groups, stat.st_gid)) {
-    accPerm = acl[iacl].perm;
+  if (context.hasGroup(stat.st_gid)) {
+    accPerm = acl.groupObjPerm;
     nGroups++;
     if (aclMask == 0x7F) // no extended ACLs
       return ((accPerm & aclMask & mode) != mode);
   }
 
   // Check ACL_GROUP entries if any
-  for ( ; iacl < (int) acl.size(); ++iacl) {
-    if (acl[iacl].type > AclEntry::kGroup)
-      break;
-    if (acl[iacl].type < AclEntry::kGroup)
-      continue;
-    aclId = acl[iacl].id;
-    if (hasGroup(context->groups, aclId)) {
+  const AclEntry* groups    = usersEnd;
+  const AclEntry* groupsEnd = groups + acl.nGroups;
+  for ( ; groups != groupsEnd; ++groups) {
+    if (context.hasGroup(groups->id)) {
       Log(Logger::Lvl2, Logger::unregistered, Logger::unregisteredname,
-          "Matched group ACL entry: '" << acl[iacl].id << "' (" << acl[iacl].perm << ") mask:" << aclMask << " mode:" << mode);
-      accPerm |= acl[iacl].perm;
+          "Matched group ACL entry: '" << groups->id << "' (" << groups->perm << ") mask:" << aclMask << " mode:" << mode);
+      accPerm |= groups->perm;
       nGroups++;
     }
   }
@@ -438,14 +621,19 @@ int dmlite::checkPermissions(const SecurityContext* context,
 
 
 
-static void _fillVoMapping(MapFileEntry* mfe, FILE* mf)
+/// @return false if the last line was cut, as when the file is still being written
+static bool _fillVoMapping(VoMapping* mapping, FILE* mf)
 {
   char  buf[1024];
   char *p, *q;
   char *user, *vo;
+  bool  complete = true;
 
   while (fgets(buf, sizeof(buf), mf)) {
-    buf[strlen (buf) - 1] = '\0';
+    size_t len = strlen(buf);
+    complete = (len > 0 && buf[len - 1] == '\n');
+    if (complete)
+      buf[len - 1] = '\0';
     p = buf;
 
     // Skip leading blanks
@@ -481,73 +669,221 @@ static void _fillVoMapping(MapFileEntry* mfe, FILE* mf)
     vo = q;
 
     // Insert
-    mfe->voForDn[user] = vo;
+    mapping->voForDn[user] = vo;
   }
+
+  return complete;
 }
 
 
 
-std::string dmlite::voFromDn(const std::string& mapfile, const std::string& dn)
+/// Read the mapfile into mapping
+/// @return true if it looks like it was caught in the middle of a rewrite
+static bool _readMapFile(const std::string& path, VoMapping* mapping)
 {
-  static MapFileCache cache;
-  static boost::shared_mutex cacheMutex;
+  struct stat mfStat, afterStat;
+  FILE       *f;
+  bool        partial;
+
+  if (stat(path.c_str(), &mfStat) == -1) {
+    mapping->error    = errno;
+    mapping->errorMsg = "Can not stat " + path;
+    return false;
+  }
+  if ((f = fopen(path.c_str(), "r")) == NULL) {
+    mapping->error    = errno;
+    mapping->errorMsg = "Can not open " + path;
+    return false;
+  }
 
-  // Scope so cacheCheckLock is automatically unlocked!
-  {
-    // If the mapfile is not in the cache, insert it
-    boost::upgrade_lock<boost::shared_mutex> cacheCheckLock(cacheMutex);
-    if (cache.find(mapfile) == cache.end()) {
-      boost::upgrade_to_unique_lock<boost::shared_mutex> cacheWriteLock(cacheCheckLock);
-      // Need to make sure again it is not there, maybe we locked waiting for another
-      // thread inserting the same!
-      if (cache.find(mapfile) == cache.end()) {
-        MapFileEntry* empty = new MapFileEntry();
-        empty->lastModified = 0;
-        cache.insert(std::pair<std::string, MapFileEntry*>(mapfile, empty));
-      }
+  mapping->mtime = mfStat.st_mtime;
+  mapping->size  = mfStat.st_size;
+  mapping->ino   = mfStat.st_ino;
+  bool complete = _fillVoMapping(mapping, f);
+  // Changed while reading, or the last line is still being written
+  partial = fstat(fileno(f), &afterStat) == -1 ||
+            afterStat.st_size != mfStat.st_size || afterStat.st_mtime != mfStat.st_mtime ||
+            (!complete && mfStat.st_mtime >= time(NULL) - kMapFileSettleTime);
+  fclose(f);
+
+  Log(Logger::Lvl1, Logger::unregistered, Logger::unregisteredname,
+      "Loaded " << mapping->voForDn.size() << " entries from " << path);
+  return partial;
+}
+
+
+
+/// Read the mapfile into a new mapping, and publish it.
+/// If there is a good mapping already, it is kept when the file can not be
+/// read, or looks like it was caught in the middle of a rewrite. The next
+/// check will try again, as the file still looks changed.
+static void _loadMapFile(MapFile* mf)
+{
+  VoMappingPtr previous = boost::atomic_load(&mf->current);
+  bool         havePrevious = (previous && previous->error == 0);
+
+  boost::shared_ptr<VoMapping> mapping(new VoMapping());
+  bool partial = _readMapFile(mf->path, mapping.get());
+
+  // Nothing to fall back to, so give the writer some time
+  for (int attempt = 1; partial && !havePrevious && attempt < kMapFileLoadAttempts; ++attempt) {
+    usleep(100000);
+    mapping.reset(new VoMapping());
+    partial = _readMapFile(mf->path, mapping.get());
+  }
+
+  if (havePrevious) {
+    // Shrunk right now, most likely truncated to be written again.
+    // If it stays like that, it is what the admin wanted
+    bool recent = (mapping->error == 0 && mapping->mtime >= time(NULL) - kMapFileSettleTime);
+    partial = partial || (recent && mapping->voForDn.size() < previous->voForDn.size());
+
+    if (mapping->error || partial) {
+      Log(Logger::Lvl1, Logger::unregistered, Logger::unregisteredname,
+          "Keeping the " << previous->voForDn.size() << " entries loaded from " << mf->path <<
+          ": " << (mapping->error ? mapping->errorMsg : "the file is being written"));
+      mf->nextCheck.store(time(NULL) + mapFileCheckInterval.load());
+      return;
     }
   }
 
-  MapFileEntry* mfe = NULL;
+  VoMappingPtr published(mapping);
+  boost::atomic_store(&mf->current, published);
+  mf->generation.fetch_add(1, boost::memory_order_release);
+  mf->nextCheck.store(time(NULL) + mapFileCheckInterval.load());
+}
+
+
+
+/// Load in the background, while lookups keep using the previous version
+static void _reloadMapFile(MapFile* mf)
+{
   {
-    boost::shared_lock<boost::shared_mutex> cacheReadLock(cacheMutex);
-    mfe = cache[mapfile];
-    // cacheReadLock released inmediately! We already got what we wanted
+    boost::mutex::scoped_lock lock(mf->loadMutex);
+    _loadMapFile(mf);
+  }
+  mf->refreshing.store(false);
+}
+
+
+
+/// If the check interval expired, see if the mapfile changed.
+/// Only one thread checks, the rest keep going with what is loaded.
+static void _checkMapFile(MapFile* mf)
+{
+  time_t now = time(NULL);
+  if (now < mf->nextCheck.load(boost::memory_order_relaxed))
+    return;
+  if (mf->refreshing.exchange(true))
+    return;
+
+  VoMappingPtr mapping = boost::atomic_load(&mf->current);
+  struct stat  mfStat;
+  bool         changed;
+
+  if (stat(mf->path.c_str(), &mfStat) == -1)
+    changed = (mapping->error == 0);
+  else
+    changed = mapping->error != 0 ||
+              mfStat.st_mtime != mapping->mtime ||
+              mfStat.st_size  != mapping->size  ||
+              mfStat.st_ino   != mapping->ino;
+
+  if (!changed) {
+    mf->nextCheck.store(now + mapFileCheckInterval.load());
+    mf->refreshing.store(false);
+    return;
   }
 
-  // Check the last modification time
-  struct stat mfStat;
-  if (stat(mapfile.c_str(), &mfStat) == -1)
-    throw DmException(DMLITE_SYSERR(errno),
-                      "Can not stat " + mapfile);
+  try {
+    boost::thread loader(_reloadMapFile, mf);
+    loader.detach();
+  }
+  catch (const boost::thread_resource_error&) {
+    _reloadMapFile(mf);
+  }
+}
 
-  if (mfStat.st_mtime > mfe->lastModified) {
-    FILE *mf;
 
-    // Need to update the mapping!
-    boost::unique_lock<boost::shared_mutex> writeLock(mfe->mutex, boost::try_to_lock);
 
-    if (writeLock.owns_lock()) {
-      if ((mf = fopen(mapfile.c_str(), "r")) == NULL)
-        throw DmException(DMLITE_SYSERR(errno),
-                          "Can not open " + mapfile);
+/// Get the entry for the mapfile, creating it if needed.
+/// The registry itself is an immutable map swapped on insertion.
+static MapFile* _getMapFile(const std::string& path)
+{
+  static boost::atomic<const MapFileCache*> registry(new MapFileCache());
+  static std::vector<const MapFileCache*>   retiredRegistries;
+  static boost::mutex                       registryMutex;
+
+  const MapFileCache* cache = registry.load(boost::memory_order_acquire);
+  MapFileCache::const_iterator i = cache->find(path);
+  if (i != cache->end())
+    return i->second;
+
+  boost::mutex::scoped_lock lock(registryMutex);
+  // Need to make sure again it is not there, maybe we locked waiting for another
+  // thread inserting the same!
+  cache = registry.load(boost::memory_order_acquire);
+  i = cache->find(path);
+  if (i != cache->end())
+    return i->second;
+
+  MapFile*      mf     = new MapFile(path);
+  MapFileCache* copy   = new MapFileCache(*cache);
+  copy->insert(std::make_pair(path, mf));
+  registry.store(copy, boost::memory_order_release);
+  // There are few mapfiles, so there are few versions of the registry.
+  // Keep the old ones, some reader may still be looking at them.
+  retiredRegistries.push_back(cache);
+
+  return mf;
+}
 
-      _fillVoMapping(mfe, mf);
 
-      fclose (mf);
-      mfe->lastModified = mfStat.st_mtime;
-    }
-    // If didn't get the lock, will block later on until the thread who
-    // got it updates and releases
+
+void dmlite::setMapFileCheckInterval(time_t seconds)
+{
+  mapFileCheckInterval.store(seconds);
+}
+
+
+
+std::string dmlite::voFromDn(const std::string& mapfile, const std::string& dn)
+{
+  MapFile* mf = _getMapFile(mapfile);
+
+  unsigned generation = mf->generation.load(boost::memory_order_acquire);
+  if (generation == 0) {
+    // First time, everyone waits for it
+    boost::mutex::scoped_lock lock(mf->loadMutex);
+    if (mf->generation.load(boost::memory_order_acquire) == 0)
+      _loadMapFile(mf);
+    generation = mf->generation.load(boost::memory_order_acquire);
+  }
+  else {
+    _checkMapFile(mf);
   }
 
-  // Get the entry
-  boost::shared_lock<boost::shared_mutex> readLock(mfe->mutex);
-  if (mfe->voForDn.count(dn) == 0)
+  LocalVoMapping* local = mf->local.get();
+  if (local == NULL) {
+    local = new LocalVoMapping();
+    local->generation = 0;
+    mf->local.reset(local);
+  }
+  if (local->generation != generation) {
+    local->mapping    = boost::atomic_load(&mf->current);
+    local->generation = generation;
+  }
+
+  const VoMapping* mapping = local->mapping.get();
+  if (mapping->error)
+    throw DmException(DMLITE_SYSERR(mapping->error), mapping->errorMsg);
+
+  boost::unordered_map<std::string, std::string>::const_iterator i = mapping->voForDn.find(dn);
+  if (i == mapping->voForDn.end())
     throw DmException(DMLITE_SYSERR(DMLITE_NO_USER_MAPPING),
                       "Could not map " + dn);
 
-  return mfe->voForDn[dn];
+  return i->second;
 }
 
 
@@ -600,34 +936,201 @@ std::string dmlite::getCertificateSubject(const std::string& path)
 
 
 
-// Base 64 encoding
-static unsigned base64_encode(const char *input, unsigned length, char* output)
+/// Max number of validated tokens remembered by a TokenEngine
+static const size_t kTokenCacheSize = 4096;
+
+// HMAC_* is deprecated from OpenSSL 3, where EVP_MAC replaces it
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX MacCtx;
+#else
+typedef HMAC_CTX MacCtx;
+#endif
+
+/// HMAC state of a thread
+struct HmacThreadCtx {
+  MacCtx* ctx;
+};
+
+/// A context keyed with passwd, or NULL on failure
+static MacCtx* macCtxNew(const std::string& passwd, const EVP_MD* md)
 {
-  BIO *bmem, *b64;
-  BUF_MEM *bptr;
-  unsigned written;
+  #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_MAC* mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+  if (mac == NULL)
+    return NULL;
+  EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(mac);
+  EVP_MAC_free(mac);
+  if (ctx == NULL)
+    return NULL;
+
+  OSSL_PARAM params[2];
+  params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                               const_cast<char*>(EVP_MD_get0_name(md)), 0);
+  params[1] = OSSL_PARAM_construct_end();
+  if (!EVP_MAC_init(ctx, (const unsigned char*)passwd.c_str(), passwd.length(), params)) {
+    EVP_MAC_CTX_free(ctx);
+    return NULL;
+  }
+  return ctx;
+  #else
+  #if OPENSSL_VERSION_NUMBER < 0x10100000
+  HMAC_CTX* ctx = new HMAC_CTX;
+  HMAC_CTX_init(ctx);
+  #else
+  HMAC_CTX* ctx = HMAC_CTX_new();
+  #endif
+  HMAC_Init_ex(ctx, passwd.c_str(), passwd.length(), md, NULL);
+  return ctx;
+  #endif
+}
 
-  b64  = BIO_new(BIO_f_base64());
-  bmem = BIO_new(BIO_s_mem());
-  b64  = BIO_push(b64, bmem);
-  BIO_write(b64, input, length);
-  BIO_ctrl(b64, BIO_CTRL_FLUSH, 0, NULL);
-  BIO_get_mem_ptr(b64, &bptr);
+/// Copy of a keyed context, so the key is not set up again
+static MacCtx* macCtxDup(MacCtx* master)
+{
+  #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return EVP_MAC_CTX_dup(master);
+  #else
+  #if OPENSSL_VERSION_NUMBER < 0x10100000
+  HMAC_CTX* ctx = new HMAC_CTX;
+  HMAC_CTX_init(ctx);
+  #else
+  HMAC_CTX* ctx = HMAC_CTX_new();
+  #endif
+  HMAC_CTX_copy(ctx, master);
+  return ctx;
+  #endif
+}
 
-  written = bptr->length - 1;
-  memcpy(output, bptr->data, written);
-  output[written] = 0;
+static void macCtxFree(MacCtx* ctx)
+{
+  #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_MAC_CTX_free(ctx);
+  #elif OPENSSL_VERSION_NUMBER < 0x10100000
+  HMAC_CTX_cleanup(ctx);
+  delete ctx;
+  #else
+  HMAC_CTX_free(ctx);
+  #endif
+}
 
-  BIO_free_all(b64);
+/// MAC of data with the key already set in ctx
+static unsigned macSign(MacCtx* ctx, const char* data, unsigned len,
+                        unsigned char mac[EVP_MAX_MD_SIZE])
+{
+  #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  size_t macLen = 0;
+  EVP_MAC_init(ctx, NULL, 0, NULL);
+  EVP_MAC_update(ctx, (const unsigned char*)data, len);
+  EVP_MAC_final(ctx, mac, &macLen, EVP_MAX_MD_SIZE);
+  #else
+  unsigned macLen = 0;
+  HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);
+  HMAC_Update(ctx, (const unsigned char*)data, len);
+  HMAC_Final(ctx, mac, &macLen);
+  #endif
+  return macLen;
+}
 
-  return written;
+static void hmacThreadCtxCleanup(HmacThreadCtx* tctx)
+{
+  macCtxFree(tctx->ctx);
+  delete tctx;
 }
 
+struct TokenEngine::Internal {
+  Internal(): tls(hmacThreadCtxCleanup) {}
 
+  /// Keyed context, copied into each thread
+  MacCtx* master;
+  /// Per thread copies of master
+  boost::thread_specific_ptr<HmacThreadCtx> tls;
 
-std::string dmlite::generateToken(const std::string& id, const std::string& pfn,
-                                  const std::string& passwd, time_t lifetime,
-                                  bool write)
+  /// Recently validated tokens (by token, pfn and id) and their expiration
+  std::map<std::string, time_t> validated;
+  boost::mutex                  validatedMutex;
+};
+
+
+
+TokenEngine::TokenEngine(const std::string& passwd, const std::string& digest) throw (DmException)
+{
+  const EVP_MD* md = EVP_get_digestbyname(digest.c_str());
+  if (md == NULL)
+    throw DmException(DMLITE_SYSERR(EINVAL),
+                      "Unknown token digest '%s'", digest.c_str());
+
+  MacCtx* master = macCtxNew(passwd, md);
+  if (master == NULL)
+    throw DmException(DMLITE_SYSERR(DMLITE_INTERNAL_ERROR),
+                      "Could not set up the HMAC with digest '%s'", digest.c_str());
+
+  d_ = new Internal();
+  d_->master = master;
+}
+
+
+
+TokenEngine::~TokenEngine()
+{
+  macCtxFree(d_->master);
+  delete d_;
+}
+
+
+
+TokenEngine* TokenEngine::get(const std::string& passwd, const std::string& digest) throw (DmException)
+{
+  static std::map<std::string, TokenEngine*> engines;
+  static boost::shared_mutex                 enginesMutex;
+
+  std::string key = digest + '\035' + passwd;
+
+  {
+    boost::shared_lock<boost::shared_mutex> readLock(enginesMutex);
+    std::map<std::string, TokenEngine*>::const_iterator i = engines.find(key);
+    if (i != engines.end())
+      return i->second;
+  }
+
+  boost::unique_lock<boost::shared_mutex> writeLock(enginesMutex);
+  TokenEngine*& engine = engines[key];
+  if (engine == NULL) {
+    try {
+      engine = new TokenEngine(passwd, digest);
+    }
+    catch (...) {
+      engines.erase(key);
+      throw;
+    }
+  }
+  return engine;
+}
+
+
+
+/// Sign the data, and write the base64 encoded signature into output
+/// @return The length of the signature
+static unsigned signToken(MacCtx* master,
+                          boost::thread_specific_ptr<HmacThreadCtx>& tls,
+                          const char* data, unsigned len, char* output)
+{
+  HmacThreadCtx* tctx = tls.get();
+  if (tctx == NULL) {
+    tctx = new HmacThreadCtx();
+    tctx->ctx = macCtxDup(master);
+    tls.reset(tctx);
+  }
+
+  unsigned char mac[EVP_MAX_MD_SIZE];
+  unsigned      macLen = macSign(tctx->ctx, data, len, mac);
+
+  return EVP_EncodeBlock((unsigned char*)output, mac, macLen);
+}
+
+
+
+std::string TokenEngine::generate(const std::string& id, const std::string& pfn,
+                                  time_t lifetime, bool write)
 {
   char     buffer1[1024];
   char     buffer2[1024];
@@ -636,73 +1139,123 @@ std::string dmlite::generateToken(const std::string& id, const std::string& pfn,
   time_t expires = time(NULL) + lifetime;
 
   // Concatenate
-  inl = snprintf((char*)buffer1, sizeof(buffer1),
+  inl = snprintf(buffer1, sizeof(buffer1),
                  "%s\035%s\035%ld\035%d", pfn.c_str(), id.c_str(), expires, write);
+  if (inl >= sizeof(buffer1))
+    inl = sizeof(buffer1) - 1;
 
-  // HMAC auth code
-  HMAC(EVP_sha1(), passwd.c_str(), passwd.length(),
-       (unsigned char*)buffer1, inl,
-       (unsigned char*)buffer2, &outl);
-
-  // Base64
-  outl = base64_encode(buffer2, outl, buffer1);
-  snprintf(buffer1 + outl, sizeof(buffer1) - outl, "@%ld@%d", expires, write);
+  // HMAC auth code, base64
+  outl = signToken(d_->master, d_->tls, buffer1, inl, buffer2);
+  snprintf(buffer2 + outl, sizeof(buffer2) - outl, "@%ld@%d", expires, write);
 
   // Done
-  return std::string(buffer1);
+  return std::string(buffer2);
 }
 
 
 
-TokenResult dmlite::validateToken(const std::string& token, const std::string& id,
-                                  const std::string& pfn,
-                                  const std::string& passwd, bool write)
+TokenResult TokenEngine::validate(const std::string& token, const std::string& id,
+                                  const std::string& pfn, bool write)
 {
   char     buffer1[1024];
   char     buffer2[1024];
-  char     buffer1nouser[1024];
-  char     buffer2nouser[1024];
   long     expires;
   unsigned tokenForWrite;
   unsigned inl, outl;
-  unsigned inlnouser, outlnouser;
 
-  // Search for '='
+  // Search for '@'
   size_t separator = token.find('@');
   if (separator == std::string::npos)
     return kTokenMalformed;
 
   // Grab expiration and write mode
-  sscanf(token.c_str() + separator + 1, "%ld@%d", &expires, &tokenForWrite);
+  if (sscanf(token.c_str() + separator + 1, "%ld@%u", &expires, &tokenForWrite) != 2)
+    return kTokenMalformed;
 
-  // Generate validation string
-  inl = snprintf(buffer1, sizeof(buffer1),
-                 "%s\035%s\035%ld\035%d", pfn.c_str(), id.c_str(), expires, tokenForWrite);
-  HMAC(EVP_sha1(), passwd.c_str(), passwd.length(),
-       (unsigned char*)buffer1, inl,
-       (unsigned char*)buffer2, &outl);
-  outl = base64_encode(buffer2, outl, buffer1);
-
-  // Generate user-independent validation string
-  inlnouser = snprintf(buffer1nouser, sizeof(buffer1nouser),
-                 "%s\035%s\035%ld\035%d", pfn.c_str(), kGenericUser.c_str(), expires, tokenForWrite);
-  HMAC(EVP_sha1(), passwd.c_str(), passwd.length(),
-       (unsigned char*)buffer1nouser, inlnouser,
-       (unsigned char*)buffer2nouser, &outlnouser);
-  outlnouser = base64_encode(buffer2nouser, outlnouser, buffer1nouser);
-
-  // Compare validation strings
-  if (strncmp(buffer1, token.c_str(), outl) != 0 &&
-      strncmp(buffer1nouser, token.c_str(), outlnouser) != 0)
-    return kTokenInvalid;
-
-  // Expiration and mode
+  std::string cacheKey;
+  cacheKey.reserve(token.length() + pfn.length() + id.length() + 2);
+  cacheKey.append(token).append(1, '\035').append(pfn).append(1, '\035').append(id);
+
+  bool cached;
+  {
+    boost::mutex::scoped_lock lock(d_->validatedMutex);
+    cached = (d_->validated.count(cacheKey) > 0);
+  }
+
+  // The signature goes first, so a forged token is reported as such
+  // whatever expiration and mode it claims
+  if (!cached) {
+    // Generate validation string
+    inl = snprintf(buffer1, sizeof(buffer1),
+                   "%s\035%s\035%ld\035%d", pfn.c_str(), id.c_str(), expires, tokenForWrite);
+    if (inl >= sizeof(buffer1))
+      inl = sizeof(buffer1) - 1;
+    outl = signToken(d_->master, d_->tls, buffer1, inl, buffer2);
+
+    // If it does not match, try the user-independent validation string
+    if (strncmp(buffer2, token.c_str(), outl) != 0) {
+      inl = snprintf(buffer1, sizeof(buffer1),
+                     "%s\035%s\035%ld\035%d", pfn.c_str(), kGenericUser.c_str(), expires, tokenForWrite);
+      if (inl >= sizeof(buffer1))
+        inl = sizeof(buffer1) - 1;
+      outl = signToken(d_->master, d_->tls, buffer1, inl, buffer2);
+
+      if (strncmp(buffer2, token.c_str(), outl) != 0)
+        return kTokenInvalid;
+    }
+  }
+
+  // Expiration and mode, now that we know they are genuine
   if ((expires < time(NULL)))
     return kTokenExpired;
 
   if (write && !tokenForWrite)
     return kTokenInvalidMode;
 
+  // Remember it until it expires
+  if (!cached) {
+    boost::mutex::scoped_lock lock(d_->validatedMutex);
+
+    if (d_->validated.size() >= kTokenCacheSize) {
+      time_t now = time(NULL);
+      std::map<std::string, time_t>::iterator i = d_->validated.begin();
+      while (i != d_->validated.end()) {
+        if (i->second < now)
+          d_->validated.erase(i++);
+        else
+          ++i;
+      }
+      // Still full, start again
+      if (d_->validated.size() >= kTokenCacheSize)
+        d_->validated.clear();
+    }
+
+    d_->validated[cacheKey] = expires;
+  }
+
   // We are good!
   return kTokenOK;
 }
+
+
+
+std::string dmlite::generateToken(const std::string& id, const std::string& pfn,
+                                  const std::string& passwd, time_t lifetime,
+                                  bool write)
+{
+  return TokenEngine::get(passwd)->generate(id, pfn, lifetime, write);
+}
+
+
+
+TokenResult dmlite::validateToken(const std::string& token, const std::string& id,
+                                  const std::string& pfn,
+                                  const std::string& passwd, bool write)
+{
+  try {
+    return TokenEngine::get(passwd)->validate(token, id, pfn, write);
+  }
+  catch (DmException& e) {
+    return kTokenInternalError;
+  }
+}
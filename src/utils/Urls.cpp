@@ -258,26 +258,62 @@ std::string Url::toString(void) const
 
 
 
+PathIterator::PathIterator(const std::string& path) throw ():
+  begin_(path.data()), end_(path.data() + path.size()),
+  pos_(begin_), cur_(begin_), len_(0)
+{
+}
+
+
+
+PathIterator::PathIterator(const char* path, size_t length) throw ():
+  begin_(path), end_(path + length),
+  pos_(begin_), cur_(begin_), len_(0)
+{
+}
+
+
+
+bool PathIterator::next(void) throw ()
+{
+  // The root is a component on its own
+  if (pos_ == begin_ && pos_ != end_ && *pos_ == '/') {
+    cur_ = pos_++;
+    len_ = 1;
+    return true;
+  }
+
+  while (pos_ != end_ && *pos_ == '/')
+    ++pos_;
+  if (pos_ == end_) {
+    cur_ = end_;
+    len_ = 0;
+    return false;
+  }
+
+  cur_ = pos_;
+  while (pos_ != end_ && *pos_ != '/')
+    ++pos_;
+  len_ = pos_ - cur_;
+  return true;
+}
+
+
+
+bool PathIterator::equals(const char* str) const throw ()
+{
+  return strncmp(cur_, str, len_) == 0 && str[len_] == '\0';
+}
+
+
+
 std::vector<std::string> Url::splitPath(const std::string& path) throw()
 {
   std::vector<std::string> components;
-  size_t s, e;
-  
-  if (!path.empty() && path[0] == '/')
-    components.push_back("/");
-
-  s = path.find_first_not_of('/');
-  while (s != std::string::npos) {
-    e = path.find('/', s);
-    if (e != std::string::npos) {
-      components.push_back(path.substr(s, e - s));
-      s = path.find_first_not_of('/', e);
-    }
-    else {
-      components.push_back(path.substr(s));
-      s = e;
-    }
-  }
+  PathIterator             i(path);
+
+  while (i.next())
+    components.push_back(std::string(i.data(), i.size()));
 
   return components;
 }
@@ -288,12 +324,17 @@ std::string Url::joinPath(const std::vector<std::string>& components) throw()
 {
   std::vector<std::string>::const_iterator i;
   std::string path;
+  size_t      length = 0;
+
+  for (i = components.begin(); i != components.end(); ++i)
+    length += i->length() + 1;
+  path.reserve(length);
 
   for (i = components.begin(); i != components.end(); ++i) {
     if (*i != "/")
-      path += *i + "/";
+      path.append(*i).append(1, '/');
     else
-      path += "/";
+      path.append(1, '/');
   }
   
   if (!path.empty())
@@ -306,30 +347,40 @@ std::string Url::joinPath(const std::vector<std::string>& components) throw()
 
 std::string Url::normalizePath(const std::string& path, const bool add_trailing_slash) throw ()
 {
-  std::vector<std::string> components = Url::splitPath(path);
-  std::string              result;
-  
-  result.reserve(path.length());
-  
-  unsigned i;
-  if (components[0] == "/") {
-    i      = 1;
-    result = "/";
-  } else {
-    i = 0;
-  }
-  
-  for ( ; i < components.size(); ++i) {
-    result.append(components[i]);
-    if (i < components.size() - 1)
-      result.append("/");
-  }
-  
-  if (add_trailing_slash) {
-    if (components.size() > 1 && path[path.length() - 1] == '/')
-      result.append("/");
-  }
-  
+  std::string result(path);
+  Url::normalizePathInPlace(result, add_trailing_slash);
   return result;
 }
 
+
+
+void Url::normalizePathInPlace(std::string& path, const bool add_trailing_slash) throw ()
+{
+  if (path.empty())
+    return;
+
+  char*    p           = &path[0];
+  size_t   length      = path.length();
+  size_t   w           = 0;
+  unsigned ncomponents = 0;
+
+  // Collapse multiple slashes, counting components as splitPath would
+  for (size_t r = 0; r < length; ++r) {
+    if (p[r] == '/') {
+      if (w > 0 && p[w - 1] == '/')
+        continue;
+      if (w == 0)
+        ++ncomponents;
+    }
+    else if (w == 0 || p[w - 1] == '/') {
+      ++ncomponents;
+    }
+    p[w++] = p[r];
+  }
+
+  // The trailing slash is kept only if there is more than one component
+  if (w > 1 && p[w - 1] == '/' && !(add_trailing_slash && ncomponents > 1))
+    --w;
+
+  path.resize(w);
+}
@@ -0,0 +1,66 @@
+#include <cstdlib>
+#include <iostream>
+#include <dmlite/cpp/authn.h>
+#include <dmlite/cpp/utils/logger.h>
+#include <dmlite/cpp/utils/security.h>
+#include "bench-common.h"
+
+
+int main(int argc, char **argv)
+{
+  unsigned n = 1000000;
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  // Measure the checks, not the logging
+  Logger::get()->setLevel(Logger::Lvl0);
+
+  // A user that is not the owner, with a few secondary groups,
+  // checking a directory with an extended ACL
+  dmlite::SecurityContext ctx;
+  ctx.user.name   = "/DC=ch/DC=cern/CN=bench";
+  ctx.user["uid"] = 500u;
+  for (unsigned g = 0; g < 8; ++g) {
+    dmlite::GroupInfo group;
+    group.name   = "group";
+    group["gid"] = 600u + g;
+    ctx.groups.push_back(group);
+  }
+
+  dmlite::Acl acl("A70,B7101,B5102,C7102,D5103,D5607,E70,F00,a70,c70,f50");
+  struct stat st;
+  st.st_ino  = 1;
+  st.st_uid  = 200;
+  st.st_gid  = 200;
+  st.st_mode = S_IFDIR | 0750;
+
+  int    r = 0;
+  double start;
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += dmlite::checkPermissions(&ctx, acl, st, S_IEXEC);
+  reportPerItem("SecurityContext + Acl", n, "check", now() - start);
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i) {
+    dmlite::Acl parsed("A70,B7101,B5102,C7102,D5103,D5607,E70,F00,a70,c70,f50");
+    r += dmlite::checkPermissions(&ctx, parsed, st, S_IEXEC);
+  }
+  reportPerItem("Parse + SecurityContext + Acl", n, "check", now() - start);
+
+  dmlite::CompiledSecurityContext cctx(ctx);
+  dmlite::CompiledAcl             cacl(acl);
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += dmlite::checkPermissions(cctx, cacl, st, S_IEXEC);
+  reportPerItem("Compiled context + compiled ACL", n, "check", now() - start);
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += dmlite::checkPermissions(cctx, dmlite::CompiledAcl(acl), st, S_IEXEC);
+  reportPerItem("Compiled context + Acl compiled per check", n, "check", now() - start);
+
+  // All of them should have been allowed
+  return r != 0;
+}
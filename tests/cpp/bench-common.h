@@ -0,0 +1,38 @@
+#ifndef BENCH_COMMON_H
+#define	BENCH_COMMON_H
+
+#include <sys/time.h>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+/// Wall clock time, in seconds
+inline double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+
+/// Prints the time taken by each of n operations, i.e.
+/// "- what   n units in elapsed s   ns/unit"
+inline void reportPerItem(const char* what, size_t n, const std::string& unit, double elapsed)
+{
+  std::cout << "- " << what << "\t" << n << " " << unit << "s in " << elapsed << " s\t"
+            << (elapsed * 1e9 / n) << " ns/" << unit << std::endl;
+}
+
+
+
+/// Prints how much of something n operations did per second, i.e.
+/// "- what   n units in elapsed s   amount/elapsed amountUnit/s"
+inline void reportRate(const char* what, size_t n, const std::string& unit, double elapsed,
+                       double amount, const std::string& amountUnit)
+{
+  std::cout << "- " << what << "\t" << n << " " << unit << "s in " << elapsed << " s\t"
+            << (amount / elapsed) << " " << amountUnit << "/s" << std::endl;
+}
+
+#endif
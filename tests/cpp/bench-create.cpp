@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <dmlite/cpp/catalog.h>
+#include <dmlite/cpp/dmlite.h>
+#include <dmlite/cpp/utils/logger.h>
+#include "bench-common.h"
+
+
+struct Creator {
+  dmlite::PluginManager*   pm;
+  dmlite::SecurityContext* ctx;
+  std::string              dir;
+  unsigned                 id;
+  unsigned                 nfiles;
+  unsigned                 failed;
+};
+
+
+
+static std::string filePath(const Creator& c, unsigned i)
+{
+  std::ostringstream path;
+  path << c.dir << "/bench-create-" << c.id << "-" << i;
+  return path.str();
+}
+
+
+
+// Each thread creates its own files, and then removes them
+void* createFiles(void* udata)
+{
+  Creator* c = static_cast<Creator*>(udata);
+
+  dmlite::StackInstance si(c->pm);
+  si.setSecurityContext(*c->ctx);
+  dmlite::Catalog* catalog = si.getCatalog();
+
+  for (unsigned i = 0; i < c->nfiles; ++i) {
+    try {
+      catalog->create(filePath(*c, i), 0644);
+    }
+    catch (dmlite::DmException& e) {
+      ++c->failed;
+    }
+  }
+
+  return NULL;
+}
+
+
+
+void* removeFiles(void* udata)
+{
+  Creator* c = static_cast<Creator*>(udata);
+
+  dmlite::StackInstance si(c->pm);
+  si.setSecurityContext(*c->ctx);
+  dmlite::Catalog* catalog = si.getCatalog();
+
+  for (unsigned i = 0; i < c->nfiles; ++i) {
+    try {
+      catalog->unlink(filePath(*c, i));
+    }
+    catch (dmlite::DmException& e) {
+      // Not created
+    }
+  }
+
+  return NULL;
+}
+
+
+
+static double runThreads(void* (*worker)(void*), std::vector<Creator>& creators)
+{
+  std::vector<pthread_t> threads(creators.size());
+
+  double start = now();
+  for (size_t i = 0; i < creators.size(); ++i)
+    pthread_create(&threads[i], NULL, worker, &creators[i]);
+  for (size_t i = 0; i < creators.size(); ++i)
+    pthread_join(threads[i], NULL);
+  return now() - start;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <config> <directory> [threads] [files per thread] [id block size]" << std::endl;
+    return 1;
+  }
+
+  unsigned nthreads = (argc > 3) ? atoi(argv[3]) : 16;
+  unsigned nfiles   = (argc > 4) ? atoi(argv[4]) : 500;
+  std::string block = (argc > 5) ? argv[5] : "100";
+
+  // Measure the creations, not the logging
+  Logger::get()->setLevel(Logger::Lvl0);
+
+  dmlite::PluginManager pm;
+  pm.loadConfiguration(argv[1]);
+
+  dmlite::GroupInfo group;
+  group.name   = "root";
+  group["gid"] = 0u;
+
+  dmlite::SecurityContext root;
+  root.user["uid"] = 0u;
+  root.groups.push_back(group);
+
+  std::vector<Creator> creators(nthreads);
+  for (unsigned i = 0; i < nthreads; ++i) {
+    creators[i].pm     = &pm;
+    creators[i].ctx    = &root;
+    creators[i].dir    = argv[2];
+    creators[i].id     = i;
+    creators[i].nfiles = nfiles;
+  }
+
+  // One id reserved per file, and then a block of them at a time. Both take
+  // the ids in a transaction of their own, so this compares block sizes, not
+  // against the counter locked during each creation
+  const char* blocks[] = {"1", block.c_str()};
+  for (unsigned b = 0; b < 2; ++b) {
+    pm.configure("FileIdBlockSize", blocks[b]);
+
+    for (unsigned i = 0; i < nthreads; ++i)
+      creators[i].failed = 0;
+
+    double elapsed = runThreads(createFiles, creators);
+
+    unsigned failed = 0;
+    for (unsigned i = 0; i < nthreads; ++i)
+      failed += creators[i].failed;
+
+    unsigned n = nthreads * nfiles;
+    std::cout << "- FileIdBlockSize " << blocks[b] << "\t" << n << " files by " << nthreads << " threads in "
+              << elapsed << " s\t" << (n / elapsed) << " files/s\t" << failed << " failed" << std::endl;
+
+    runThreads(removeFiles, creators);
+  }
+
+  return 0;
+}
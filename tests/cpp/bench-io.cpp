@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <dmlite/cpp/authn.h>
+#include <dmlite/cpp/dmlite.h>
+#include <dmlite/cpp/io.h>
+#include <dmlite/cpp/utils/logger.h>
+#include "bench-common.h"
+
+
+static const size_t kReadSize = 4096;
+
+
+
+// Compares the ways of doing many small random reads
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <config> [file] [size in MB] [reads] [reads per batch]" << std::endl;
+    return 1;
+  }
+
+  std::string path = (argc > 2) ? argv[2] : "/tmp/bench-io";
+  size_t fileSize  = ((argc > 3) ? atoi(argv[3]) : 64) * 1024 * 1024;
+  size_t nReads    = (argc > 4) ? atoi(argv[4]) : 8192;
+  size_t batch     = (argc > 5) ? atoi(argv[5]) : 256;
+
+  // Measure the reads, not the logging
+  Logger::get()->setLevel(Logger::Lvl0);
+
+  dmlite::PluginManager pm;
+  pm.loadConfiguration(argv[1]);
+
+  dmlite::GroupInfo group;
+  group.name   = "root";
+  group["gid"] = 0u;
+
+  dmlite::SecurityContext root;
+  root.user["uid"] = 0u;
+  root.groups.push_back(group);
+
+  dmlite::StackInstance si(&pm);
+  si.setSecurityContext(root);
+
+  dmlite::IOHandler* os = si.getIODriver()->createIOHandler(path,
+                                                            O_RDWR | O_CREAT | O_TRUNC | dmlite::IODriver::kInsecure,
+                                                            dmlite::Extensible());
+
+  // Each block of the file holds its number, to check what was read
+  std::vector<char> chunk(1024 * 1024);
+  for (size_t written = 0; written < fileSize; written += chunk.size()) {
+    for (size_t i = 0; i < chunk.size(); ++i)
+      chunk[i] = static_cast<char>((written + i) / kReadSize);
+    os->write(&chunk[0], chunk.size());
+  }
+
+  srand(1234);
+  std::vector<char> buffer(nReads * kReadSize);
+  std::vector<dmlite::IOSegment> segs(nReads);
+  for (size_t i = 0; i < nReads; ++i) {
+    segs[i].buffer = &buffer[i * kReadSize];
+    segs[i].count  = kReadSize;
+    segs[i].offset = (rand() % (fileSize / kReadSize)) * kReadSize;
+  }
+
+  size_t failed = 0;
+  double start;
+  double mbytes = nReads * kReadSize / (1024.0 * 1024.0);
+
+  start = now();
+  for (size_t i = 0; i < nReads; ++i)
+    failed += (os->pread(segs[i].buffer, kReadSize, segs[i].offset) != kReadSize);
+  reportRate("pread", nReads, "read", now() - start, mbytes, "MB");
+
+  start = now();
+  for (size_t i = 0; i < nReads; i += batch) {
+    size_t n = std::min(batch, nReads - i);
+    failed += (os->preadv(&segs[i], n) != n * kReadSize);
+  }
+  reportRate("preadv", nReads, "read", now() - start, mbytes, "MB");
+
+  start = now();
+  std::vector<int> ids;
+  std::vector<size_t> sizes;
+  for (size_t i = 0; i < nReads; i += batch) {
+    sizes.push_back(std::min(batch, nReads - i));
+    ids.push_back(os->submitAsync(&segs[i], sizes.back()));
+  }
+  for (size_t i = 0; i < ids.size(); ++i)
+    failed += (os->waitAsync(ids[i]) != sizes[i] * kReadSize);
+  reportRate("submitAsync", nReads, "read", now() - start, mbytes, "MB");
+
+  for (size_t i = 0; i < nReads; ++i)
+    failed += (buffer[i * kReadSize] != static_cast<char>(segs[i].offset / kReadSize));
+
+  delete os;
+  unlink(path.c_str());
+
+  if (failed) {
+    std::cerr << failed << " reads failed or were wrong" << std::endl;
+    return 1;
+  }
+  return 0;
+}
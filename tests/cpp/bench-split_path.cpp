@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <dmlite/cpp/utils/urls.h>
+#include "bench-common.h"
+
+
+int main(int argc, char **argv)
+{
+  unsigned n = 1000000;
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  // A typical lfn
+  const std::string path("/dpm/cern.ch/home/dteam//generated/2024-01-01/file.root");
+  size_t r = 0;
+  double start;
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i) {
+    std::vector<std::string> components = dmlite::Url::splitPath(path);
+    r += components.size();
+  }
+  reportPerItem("splitPath", n, "path", now() - start);
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i) {
+    dmlite::PathIterator component(path);
+    while (component.next())
+      ++r;
+  }
+  reportPerItem("PathIterator", n, "path", now() - start);
+
+  // What a resolver does: copy each component into a reused string
+  std::string c;
+  start = now();
+  for (unsigned i = 0; i < n; ++i) {
+    dmlite::PathIterator component(path);
+    while (component.next()) {
+      component.assignTo(c);
+      r += c.size();
+    }
+  }
+  reportPerItem("PathIterator + assign", n, "path", now() - start);
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += dmlite::Url::normalizePath(path).size();
+  reportPerItem("normalizePath", n, "path", now() - start);
+
+  std::string buffer;
+  buffer.reserve(path.size());
+  start = now();
+  for (unsigned i = 0; i < n; ++i) {
+    buffer.assign(path);
+    dmlite::Url::normalizePathInPlace(buffer);
+    r += buffer.size();
+  }
+  reportPerItem("normalizePathInPlace", n, "path", now() - start);
+
+  return r == 0;
+}
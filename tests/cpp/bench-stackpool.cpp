@@ -0,0 +1,104 @@
+#include <pthread.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <dmlite/cpp/authn.h>
+#include <dmlite/cpp/catalog.h>
+#include <dmlite/cpp/dmlite.h>
+#include <dmlite/cpp/utils/logger.h>
+#include <dmlite/cpp/utils/stackinstancepool.h>
+#include "bench-common.h"
+
+
+struct StackRequests {
+  dmlite::PluginManager*       pm;
+  dmlite::StackInstancePool*   pool;
+  dmlite::SecurityCredentials* cred;
+  unsigned                     nrequests;
+};
+
+
+
+// One request: authenticate and stat
+static void oneRequest(dmlite::StackInstance* si, const dmlite::SecurityCredentials& cred)
+{
+  si->setSecurityCredentials(cred);
+  si->getCatalog()->extendedStat("/");
+}
+
+
+
+// A stack built for each request
+void* constructPerRequest(void* udata)
+{
+  StackRequests* req = static_cast<StackRequests*>(udata);
+
+  for (unsigned i = 0; i < req->nrequests; ++i) {
+    dmlite::StackInstance si(req->pm);
+    oneRequest(&si, *req->cred);
+  }
+
+  return NULL;
+}
+
+
+
+// A stack taken from the pool for each request
+void* pooledPerRequest(void* udata)
+{
+  StackRequests* req = static_cast<StackRequests*>(udata);
+
+  for (unsigned i = 0; i < req->nrequests; ++i) {
+    dmlite::StackInstanceGrabber si(*req->pool);
+    oneRequest(si, *req->cred);
+  }
+
+  return NULL;
+}
+
+
+
+static double runRequests(void* (*worker)(void*), StackRequests* req, unsigned nthreads)
+{
+  std::vector<pthread_t> threads(nthreads);
+
+  double start = now();
+  for (unsigned i = 0; i < nthreads; ++i)
+    pthread_create(&threads[i], NULL, worker, req);
+  for (unsigned i = 0; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+  return now() - start;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <config> [threads] [requests per thread] [client DN]" << std::endl;
+    return 1;
+  }
+
+  unsigned nthreads = (argc > 2) ? atoi(argv[2]) : 8;
+  unsigned nrequests = (argc > 3) ? atoi(argv[3]) : 2000;
+
+  // Measure the stacks, not the logging
+  Logger::get()->setLevel(Logger::Lvl0);
+
+  dmlite::PluginManager pm;
+  pm.loadConfiguration(argv[1]);
+
+  dmlite::SecurityCredentials cred;
+  cred.clientName = (argc > 4) ? argv[4] : "/C=CH/O=CERN/OU=GD/CN=Test user 0";
+  cred.fqans.push_back("dteam");
+  cred.mech       = "NONE";
+
+  dmlite::StackInstancePool pool(&pm, nthreads);
+  StackRequests req = {&pm, &pool, &cred, nrequests};
+
+  unsigned n = nthreads * nrequests;
+  reportRate("New stack", n, "request", runRequests(constructPerRequest, &req, nthreads), n, "requests");
+  reportRate("Pooled",    n, "request", runRequests(pooledPerRequest, &req, nthreads), n, "requests");
+
+  return 0;
+}
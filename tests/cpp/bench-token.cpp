@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <dmlite/cpp/utils/logger.h>
+#include <dmlite/cpp/utils/security.h>
+#include "bench-common.h"
+
+
+int main(int argc, char **argv)
+{
+  unsigned n = 100000;
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  // Measure the tokens, not the logging
+  Logger::get()->setLevel(Logger::Lvl0);
+
+  const std::string passwd("bench-secret-bench-secret");
+  const std::string id("/DC=ch/DC=cern/CN=bench");
+
+  // A few hundred different files, as a disk server would see
+  std::vector<std::string> pfns;
+  for (unsigned i = 0; i < 256; ++i) {
+    std::ostringstream pfn;
+    pfn << "/srv/dpm/01/dteam/2024-01-01/file." << i << ".root";
+    pfns.push_back(pfn.str());
+  }
+
+  std::vector<std::string> tokens;
+  for (unsigned i = 0; i < pfns.size(); ++i)
+    tokens.push_back(dmlite::generateToken(id, pfns[i], passwd, 3600));
+
+  dmlite::TokenEngine* engine = dmlite::TokenEngine::get(passwd);
+  int    r = 0;
+  double start;
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    engine->generate(id, pfns[i % pfns.size()], 3600);
+  reportPerItem("Generate", n, "token", now() - start);
+
+  // The first pass over the tokens can not hit the cache
+  start = now();
+  for (unsigned i = 0; i < tokens.size(); ++i)
+    r += engine->validate(tokens[i], id, pfns[i]);
+  reportPerItem("Validate, cold", tokens.size(), "token", now() - start);
+
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += engine->validate(tokens[i % tokens.size()], id, pfns[i % pfns.size()]);
+  reportPerItem("Validate, warm", n, "token", now() - start);
+
+  // A different id forces both HMAC (user and generic user) and a miss
+  start = now();
+  for (unsigned i = 0; i < n; ++i)
+    r += (engine->validate(tokens[i % tokens.size()], "other", pfns[i % pfns.size()]) != dmlite::kTokenInvalid);
+  reportPerItem("Validate, invalid", n, "token", now() - start);
+
+  // All of them should have been valid (or invalid, for the last loop)
+  return r != 0;
+}
@@ -0,0 +1,145 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestAssert.h>
+#include <fstream>
+#include <sstream>
+#include <time.h>
+#include <dmlite/cpp/utils/mysqlpools.h>
+#include "plugins/mysql/MySqlAccessTime.h"
+#include "test-base.h"
+
+// The writer is compiled into this test, not taken from the plugin
+namespace dmlite {
+  Logger::bitmask   mysqllogmask = ~0;
+  Logger::component mysqllogname = "Mysql";
+}
+
+static std::string nsDb = "cns_db";
+
+class TestAccessTime: public TestBase
+{
+protected:
+  const static char *FILE;
+  const static char *FILE2;
+
+  ino_t  inode, inode2;
+  time_t future;
+
+public:
+
+  void setUp()
+  {
+    TestBase::setUp();
+    this->catalog->create(FILE, 0644);
+    this->catalog->create(FILE2, 0644);
+
+    this->inode  = this->catalog->extendedStat(FILE).stat.st_ino;
+    this->inode2 = this->catalog->extendedStat(FILE2).stat.st_ino;
+
+    // Ahead of the atime set by the creation, so the updates show
+    this->future = time(NULL) + 10000;
+  }
+
+  void tearDown()
+  {
+    if (this->catalog != 0x00) {
+      IGNORE_NOT_EXIST(this->catalog->unlink(FILE));
+      IGNORE_NOT_EXIST(this->catalog->unlink(FILE2));
+    }
+    TestBase::tearDown();
+  }
+
+  time_t atime(const char* path)
+  {
+    return this->catalog->extendedStat(path).stat.st_atime;
+  }
+
+  void testCoalesce()
+  {
+    dmlite::MySqlAccessTimeWriter writer(nsDb, 100, 100, 3600);
+
+    CPPUNIT_ASSERT(writer.push(this->inode, this->future));
+    CPPUNIT_ASSERT(writer.push(this->inode, this->future + 10));
+    CPPUNIT_ASSERT(writer.push(this->inode2, this->future));
+    CPPUNIT_ASSERT_EQUAL((size_t)2, writer.pending());
+
+    writer.flush();
+    CPPUNIT_ASSERT_EQUAL((size_t)0, writer.pending());
+    CPPUNIT_ASSERT_EQUAL(this->future + 10, this->atime(FILE));
+    CPPUNIT_ASSERT_EQUAL(this->future, this->atime(FILE2));
+  }
+
+  void testNeverBackwards()
+  {
+    dmlite::MySqlAccessTimeWriter writer(nsDb, 100, 100, 3600);
+
+    // Older time queued after a newer one
+    writer.push(this->inode, this->future + 10);
+    writer.push(this->inode, this->future);
+    writer.flush();
+    CPPUNIT_ASSERT_EQUAL(this->future + 10, this->atime(FILE));
+
+    // Older time than the one already in the database
+    writer.push(this->inode, this->future + 5);
+    writer.flush();
+    CPPUNIT_ASSERT_EQUAL(this->future + 10, this->atime(FILE));
+  }
+
+  void testDropWhenFull()
+  {
+    dmlite::MySqlAccessTimeWriter writer(nsDb, 1, 100, 3600);
+
+    CPPUNIT_ASSERT(writer.push(this->inode, this->future));
+    CPPUNIT_ASSERT(!writer.push(this->inode2, this->future));
+    // A pending inode can still move forward
+    CPPUNIT_ASSERT(writer.push(this->inode, this->future + 10));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, writer.pending());
+
+    writer.flush();
+    CPPUNIT_ASSERT_EQUAL(this->future + 10, this->atime(FILE));
+    CPPUNIT_ASSERT(this->atime(FILE2) < this->future);
+  }
+
+  void testFlushOnDestruction()
+  {
+    dmlite::MySqlAccessTimeWriter* writer =
+        new dmlite::MySqlAccessTimeWriter(nsDb, 100, 100, 3600);
+
+    writer->push(this->inode, this->future);
+    CPPUNIT_ASSERT(this->atime(FILE) < this->future);
+
+    delete writer;
+    CPPUNIT_ASSERT_EQUAL(this->future, this->atime(FILE));
+  }
+
+  CPPUNIT_TEST_SUITE(TestAccessTime);
+  CPPUNIT_TEST(testCoalesce);
+  CPPUNIT_TEST(testNeverBackwards);
+  CPPUNIT_TEST(testDropWhenFull);
+  CPPUNIT_TEST(testFlushOnDestruction);
+  CPPUNIT_TEST_SUITE_END();
+};
+
+const char* TestAccessTime::FILE  = "test-accesstime";
+const char* TestAccessTime::FILE2 = "test-accesstime2";
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestAccessTime);
+
+int main(int argn, char **argv)
+{
+  // The writer uses the connection pool of this process, so give it
+  // the same database settings as the plugin
+  if (argn > 1) {
+    std::ifstream conf(argv[1]);
+    std::string   line, key, value;
+    while (std::getline(conf, line)) {
+      std::istringstream fields(line);
+      if (!(fields >> key >> value)) continue;
+      if (key == "NsDatabase")
+        nsDb = value;
+      else
+        dmlite::MySqlHolder::configure(key, value);
+    }
+  }
+
+  return testBaseMain(argn, argv);
+}
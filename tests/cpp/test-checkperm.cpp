@@ -4,6 +4,9 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <dmlite/cpp/authn.h>
 #include <dmlite/cpp/utils/security.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
 
 class ChkPerm: public CppUnit::TestFixture {
 protected:
@@ -230,6 +233,49 @@ public:
     CPPUNIT_ASSERT_EQUAL(std::string("dteam"), vo);
   }
 
+  void testGetVoFromDn()
+  {
+    char path[] = "/tmp/test-checkperm-mapfile.XXXXXX";
+    int  fd = mkstemp(path);
+    CPPUNIT_ASSERT(fd >= 0);
+    close(fd);
+
+    std::ofstream mapfile(path);
+    mapfile << "# Comment" << std::endl
+            << "\"/DC=ch/CN=quoted user\" dteam" << std::endl
+            << "/DC=ch/CN=plain atlas,cms" << std::endl;
+    mapfile.close();
+
+    dmlite::setMapFileCheckInterval(0);
+    CPPUNIT_ASSERT_EQUAL(std::string("dteam"), dmlite::voFromDn(path, "/DC=ch/CN=quoted user"));
+    CPPUNIT_ASSERT_EQUAL(std::string("atlas"), dmlite::voFromDn(path, "/DC=ch/CN=plain"));
+    CPPUNIT_ASSERT_THROW(dmlite::voFromDn(path, "/DC=ch/CN=nobody"), dmlite::DmException);
+
+    // Changes are picked up in the background
+    mapfile.open(path);
+    mapfile << "/DC=ch/CN=other lhcb" << std::endl;
+    mapfile.close();
+
+    bool reloaded = false;
+    for (int i = 0; i < 100 && !reloaded; ++i) {
+      try {
+        reloaded = (dmlite::voFromDn(path, "/DC=ch/CN=other") == "lhcb");
+      }
+      catch (const dmlite::DmException&) {
+        usleep(10000);
+      }
+    }
+    CPPUNIT_ASSERT(reloaded);
+    // Old entries are gone
+    CPPUNIT_ASSERT_THROW(dmlite::voFromDn(path, "/DC=ch/CN=plain"), dmlite::DmException);
+
+    unlink(path);
+    dmlite::setMapFileCheckInterval(dmlite::kDefaultMapFileCheckInterval);
+
+    CPPUNIT_ASSERT_THROW(dmlite::voFromDn("/tmp/does-not-exist.mapfile", "/DC=ch/CN=plain"),
+                         dmlite::DmException);
+  }
+
   void testAclSerialization()
   {
     dmlite::Acl acl("A6101,B6101,C4101,D7101,E70,F40");
@@ -342,6 +388,10 @@ public:
     sleep(2);
     CPPUNIT_ASSERT_EQUAL(dmlite::kTokenExpired,
                          dmlite::validateToken(token, "myid", "/pfn", "dummy"));
+
+    /// Forged and expired
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenInvalid,
+                         dmlite::validateToken(token, "myid", "/pfn", "forgot"));
   }
   
   void testTokenWrite()
@@ -380,6 +430,105 @@ public:
                          dmlite::validateToken(token, "myid", "/pfn", "dummy", true));
   }
 
+  void testCompiledAcl()
+  {
+    dmlite::GroupInfo group;
+
+    // Big enough to spill out of the inline entries
+    std::ostringstream aclStr;
+    aclStr << "A70";
+    for (unsigned i = 0; i < 2 * dmlite::CompiledAcl::kInlineEntries; ++i)
+      aclStr << ",B" << (i % 8) << (300 + i);
+    aclStr << ",C50";
+    for (unsigned i = 0; i < 2 * dmlite::CompiledAcl::kInlineEntries; ++i)
+      aclStr << ",D" << (i % 8) << (400 + i);
+    aclStr << ",E60,F00";
+    std::string bigAcl = aclStr.str();
+
+    const char* acls[] = {"", "A70,B7101,C7102,D5103,E70,F00,a70,c70,f50",
+                          "A70,C50,F00", bigAcl.c_str()};
+
+    group["gid"] = 500u;
+    context->groups.push_back(group);
+    group["gid"] = 200u;
+    context->groups.push_back(group);
+
+    for (unsigned a = 0; a < sizeof(acls) / sizeof(acls[0]); ++a) {
+      dmlite::Acl         acl(acls[a]);
+      dmlite::CompiledAcl compiled(acl);
+      dmlite::CompiledAcl copy;
+      copy = compiled;
+
+      for (unsigned uid = 100; uid < 330; ++uid) {
+        for (unsigned gid = 100; gid < 430; gid += 7) {
+          context->user["uid"]      = uid;
+          context->groups[1]["gid"] = gid;
+          dmlite::CompiledSecurityContext cctx(*context);
+
+          for (mode_t mode = S_IEXEC; mode <= (S_IREAD | S_IWRITE | S_IEXEC); mode += S_IEXEC) {
+            int expected = dmlite::checkPermissions(context, acl, stat_, mode);
+            CPPUNIT_ASSERT_EQUAL(expected, dmlite::checkPermissions(cctx, compiled, stat_, mode));
+            CPPUNIT_ASSERT_EQUAL(expected, dmlite::checkPermissions(cctx, copy, stat_, mode));
+          }
+        }
+      }
+    }
+
+    // Spilled entries must be honored, masked
+    dmlite::Acl acl(bigAcl);
+    context->user["uid"] = 323u;
+    dmlite::CompiledSecurityContext cctx(*context);
+    CPPUNIT_ASSERT_EQUAL(0, dmlite::checkPermissions(cctx, dmlite::CompiledAcl(acl),
+                                                     stat_, S_IREAD | S_IWRITE));
+    CPPUNIT_ASSERT_EQUAL(1, dmlite::checkPermissions(cctx, dmlite::CompiledAcl(acl),
+                                                     stat_, S_IEXEC));
+
+    // A default compiled context is denied everything
+    CPPUNIT_ASSERT_EQUAL(1, dmlite::checkPermissions(dmlite::CompiledSecurityContext(),
+                                                     dmlite::CompiledAcl(), stat_, S_IREAD));
+  }
+
+  void testTokenEngine()
+  {
+    dmlite::TokenEngine* sha1   = dmlite::TokenEngine::get("dummy");
+    dmlite::TokenEngine* sha256 = dmlite::TokenEngine::get("dummy", "sha256");
+
+    // Engines are shared
+    CPPUNIT_ASSERT(sha1 == dmlite::TokenEngine::get("dummy", "sha1"));
+    CPPUNIT_ASSERT(sha1 != sha256);
+    CPPUNIT_ASSERT_THROW(dmlite::TokenEngine::get("dummy", "nosuchdigest"),
+                         dmlite::DmException);
+
+    // Compatible with the free functions
+    std::string token = dmlite::generateToken("myid", "/pfn", "dummy", 1000);
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenOK, sha1->validate(token, "myid", "/pfn"));
+    token = sha1->generate("myid", "/pfn", 1000);
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenOK,
+                         dmlite::validateToken(token, "myid", "/pfn", "dummy"));
+
+    // Validated twice, the second comes from the cache
+    token = sha256->generate("myid", "/pfn", 1000, true);
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenOK, sha256->validate(token, "myid", "/pfn", true));
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenOK, sha256->validate(token, "myid", "/pfn", true));
+
+    // The cache must not validate for other pfns or ids
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenInvalid, sha256->validate(token, "myid", "/other", true));
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenInvalid, sha256->validate(token, "owned", "/pfn", true));
+
+    // Digests do not mix
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenInvalid, sha1->validate(token, "myid", "/pfn", true));
+
+    // Tampered
+    std::string tampered(token);
+    tampered[0] = (tampered[0] == 'A') ? 'B' : 'A';
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenInvalid, sha256->validate(tampered, "myid", "/pfn", true));
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenMalformed, sha256->validate("nothing", "myid", "/pfn"));
+
+    // Generic user
+    token = sha256->generate(dmlite::kGenericUser, "/pfn", 1000);
+    CPPUNIT_ASSERT_EQUAL(dmlite::kTokenOK, sha256->validate(token, "anyone", "/pfn"));
+  }
+
   CPPUNIT_TEST_SUITE(ChkPerm);
   CPPUNIT_TEST(testOwner);
   CPPUNIT_TEST(testGroup);
@@ -389,12 +538,15 @@ public:
   CPPUNIT_TEST(testMainGroupBanned);
   CPPUNIT_TEST(testSecondaryBanned);
   CPPUNIT_TEST(testAclBanned);
+  CPPUNIT_TEST(testCompiledAcl);
   CPPUNIT_TEST(testGetVoFromRole);
+  CPPUNIT_TEST(testGetVoFromDn);
   CPPUNIT_TEST(testAclSerialization);
   CPPUNIT_TEST(testAclValidation);
   CPPUNIT_TEST(testAclInheritance);
   CPPUNIT_TEST(testTokenRead);
   CPPUNIT_TEST(testTokenWrite);
+  CPPUNIT_TEST(testTokenEngine);
   CPPUNIT_TEST_SUITE_END();
 };
 
@@ -1,8 +1,51 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cppunit/TestAssert.h>
 #include <dmlite/cpp/utils/security.h>
+#include <pthread.h>
 #include "test-base.h"
 
+static const unsigned kCreators        = 20;
+static const unsigned kFilesPerCreator = 200;
+static const unsigned kRemoveRounds    = 5;
+
+struct Creator {
+  dmlite::PluginManager*   pm;
+  dmlite::SecurityContext* ctx;
+  std::string              dir;
+  unsigned                 id;
+  bool                     remove;
+  unsigned                 failed;
+};
+
+
+
+// Creates, or removes, its own files in a directory shared with the others
+void* createOrRemove(void* udata)
+{
+  Creator* c = static_cast<Creator*>(udata);
+
+  dmlite::StackInstance si(c->pm);
+  si.setSecurityContext(*c->ctx);
+  dmlite::Catalog* catalog = si.getCatalog();
+
+  for (unsigned i = 0; i < kFilesPerCreator; ++i) {
+    std::ostringstream path;
+    path << c->dir << "/file-" << c->id << "-" << i;
+    try {
+      if (c->remove)
+        catalog->unlink(path.str());
+      else
+        catalog->create(path.str(), 0644);
+    }
+    catch (dmlite::DmException&) {
+      ++c->failed;
+    }
+  }
+
+  return NULL;
+}
+
+
 class TestCreate: public TestBase
 {
 protected:
@@ -331,6 +374,122 @@ public:
     CPPUNIT_ASSERT(child.acl.has(dmlite::AclEntry::kDefault | dmlite::AclEntry::kUserObj) > -1);
   }
 
+  // Many threads creating and removing in the same directory
+  // keep its link count exact
+  void testConcurrentNlink()
+  {
+    std::vector<Creator>   creators(kCreators);
+    std::vector<pthread_t> threads(kCreators);
+
+    for (unsigned i = 0; i < kCreators; ++i) {
+      creators[i].pm     = this->pluginManager;
+      creators[i].ctx    = &this->root;
+      creators[i].dir    = BASE_DIR + "/" + FOLDER;
+      creators[i].id     = i;
+      creators[i].remove = false;
+      creators[i].failed = 0;
+    }
+
+    for (unsigned i = 0; i < kCreators; ++i)
+      pthread_create(&threads[i], NULL, createOrRemove, &creators[i]);
+    for (unsigned i = 0; i < kCreators; ++i)
+      pthread_join(threads[i], NULL);
+
+    for (unsigned i = 0; i < kCreators; ++i)
+      CPPUNIT_ASSERT_EQUAL(0u, creators[i].failed);
+    struct stat s = this->catalog->extendedStat(FOLDER).stat;
+    CPPUNIT_ASSERT_EQUAL(kCreators * kFilesPerCreator, (unsigned)s.st_nlink);
+
+    // Not empty
+    this->stackInstance->setSecurityContext(root);
+    CPPUNIT_ASSERT_THROW(this->catalog->removeDir(FOLDER), dmlite::DmException);
+
+    for (unsigned i = 0; i < kCreators; ++i)
+      creators[i].remove = true;
+    for (unsigned i = 0; i < kCreators; ++i)
+      pthread_create(&threads[i], NULL, createOrRemove, &creators[i]);
+    for (unsigned i = 0; i < kCreators; ++i)
+      pthread_join(threads[i], NULL);
+
+    for (unsigned i = 0; i < kCreators; ++i)
+      CPPUNIT_ASSERT_EQUAL(0u, creators[i].failed);
+    s = this->catalog->extendedStat(FOLDER).stat;
+    CPPUNIT_ASSERT_EQUAL(0, (int)s.st_nlink);
+  }
+
+  // Empties the directory and removes it, again while it keeps being filled
+  void emptyAndRemove(const std::string& dir)
+  {
+    for (;;) {
+      try {
+        this->catalog->removeDir(dir);
+        return;
+      }
+      catch (dmlite::DmException& e) {
+        if (e.code() != ENOTEMPTY) throw;
+      }
+
+      std::vector<std::string> names;
+      dmlite::Directory* d = this->catalog->openDir(dir);
+      dmlite::ExtendedStat* x;
+      while ((x = this->catalog->readDirx(d)) != NULL)
+        names.push_back(x->name);
+      this->catalog->closeDir(d);
+
+      for (size_t i = 0; i < names.size(); ++i)
+        IGNORE_NOT_EXIST(this->catalog->unlink(dir + "/" + names[i]));
+    }
+  }
+
+  // Removing a directory while others create in it never
+  // leaves a file under the removed directory
+  void testRemoveDirWhileCreating()
+  {
+    std::vector<Creator>   creators(kCreators);
+    std::vector<pthread_t> threads(kCreators);
+    std::string            dir = std::string(FOLDER) + "/race";
+
+    this->stackInstance->setSecurityContext(root);
+    dmlite::INode* inode = this->stackInstance->getINode();
+
+    for (unsigned round = 0; round < kRemoveRounds; ++round) {
+      this->catalog->makeDir(dir, MODE);
+      ino_t dirIno = this->catalog->extendedStat(dir).stat.st_ino;
+
+      for (unsigned i = 0; i < kCreators; ++i) {
+        creators[i].pm     = this->pluginManager;
+        creators[i].ctx    = &this->root;
+        creators[i].dir    = BASE_DIR + "/" + dir;
+        creators[i].id     = i;
+        creators[i].remove = false;
+        creators[i].failed = 0;
+        pthread_create(&threads[i], NULL, createOrRemove, &creators[i]);
+      }
+
+      this->emptyAndRemove(dir);
+
+      for (unsigned i = 0; i < kCreators; ++i)
+        pthread_join(threads[i], NULL);
+
+      // Whatever the creators managed to do, nothing is left behind
+      for (unsigned i = 0; i < kCreators; ++i) {
+        for (unsigned j = 0; j < kFilesPerCreator; ++j) {
+          std::ostringstream name;
+          name << "file-" << i << "-" << j;
+          dmlite::ExtendedStat xs;
+          bool orphan = false;
+          try {
+            orphan = inode->extendedStat(xs, dirIno, name.str()).ok();
+          }
+          catch (dmlite::DmException& e) {
+            if (e.code() != ENOENT) throw;
+          }
+          CPPUNIT_ASSERT(!orphan);
+        }
+      }
+    }
+  }
+
   CPPUNIT_TEST_SUITE(TestCreate);
   CPPUNIT_TEST(testRegular);
   CPPUNIT_TEST(testSetGid);
@@ -342,6 +501,8 @@ public:
   CPPUNIT_TEST(testSetSize);
   CPPUNIT_TEST(testICreate);
   CPPUNIT_TEST(testCreateWithDefaultAcl);
+  CPPUNIT_TEST(testConcurrentNlink);
+  CPPUNIT_TEST(testRemoveDirWhileCreating);
   CPPUNIT_TEST_SUITE_END();
 };
 
@@ -11,7 +11,9 @@
 #include <iostream>
 #include <ios>
 #include <iosfwd>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 
 class TestIO: public CppUnit::TestFixture
@@ -244,7 +246,103 @@ public:
     CPPUNIT_ASSERT_EQUAL(fstat.st_size, pstat.st_size);
   }
 
-  
+  void testTransferTo(void)
+  {
+    const char ostring[] = "0123456789abcdefghij";
+
+    dmlite::IOHandler* os = io->createIOHandler("/tmp/test-io-transfer",
+                                                O_RDWR | O_CREAT | O_TRUNC | dmlite::IODriver::kInsecure,
+                                                dmlite::Extensible());
+    CPPUNIT_ASSERT_EQUAL(strlen(ostring), os->write(ostring, strlen(ostring)));
+
+    int sv[2];
+    CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+    // Offset is honored, and the file offset is not changed
+    CPPUNIT_ASSERT_EQUAL((size_t)5, os->transferTo(sv[0], 10, 5));
+    CPPUNIT_ASSERT_EQUAL((off_t)strlen(ostring), os->tell());
+    // Short at the end of the file
+    CPPUNIT_ASSERT_EQUAL((size_t)5, os->transferTo(sv[0], 15, 100));
+    delete os;
+    close(sv[0]);
+
+    char buffer[512] = "";
+    size_t nb = 0;
+    ssize_t n;
+    while ((n = ::read(sv[1], buffer + nb, sizeof(buffer) - nb - 1)) > 0)
+      nb += n;
+    close(sv[1]);
+
+    CPPUNIT_ASSERT_EQUAL(std::string("abcdefghij"), std::string(buffer));
+  }
+
+  void testTransferFrom(void)
+  {
+    const char ostring[] = "transferred";
+
+    int p[2];
+    CPPUNIT_ASSERT_EQUAL(0, pipe(p));
+    CPPUNIT_ASSERT_EQUAL((ssize_t)strlen(ostring), ::write(p[1], ostring, strlen(ostring)));
+    close(p[1]);
+
+    dmlite::IOHandler* os = io->createIOHandler("/tmp/test-io-transfer",
+                                                O_RDWR | O_CREAT | O_TRUNC | dmlite::IODriver::kInsecure,
+                                                dmlite::Extensible());
+    CPPUNIT_ASSERT_EQUAL((size_t)3, os->write("abc", 3));
+
+    // Stops when the input ends
+    CPPUNIT_ASSERT_EQUAL(strlen(ostring), os->transferFrom(p[0], 3, 100));
+    CPPUNIT_ASSERT_EQUAL((off_t)3, os->tell());
+    close(p[0]);
+
+    char buffer[512] = "";
+    CPPUNIT_ASSERT_EQUAL(strlen(ostring) + 3, os->pread(buffer, sizeof(buffer), 0));
+    CPPUNIT_ASSERT_EQUAL(std::string("abctransferred"), std::string(buffer));
+
+    delete os;
+  }
+
+  void testPReadV(void)
+  {
+    char data[4096];
+    for (size_t i = 0; i < sizeof(data); ++i)
+      data[i] = 'a' + (i % 26);
+
+    dmlite::IOHandler* os = io->createIOHandler("/tmp/test-io-preadv",
+                                                O_RDWR | O_CREAT | O_TRUNC | dmlite::IODriver::kInsecure,
+                                                dmlite::Extensible());
+    CPPUNIT_ASSERT_EQUAL(sizeof(data), os->write(data, sizeof(data)));
+
+    // Out of order, adjacent, and past the end of the file
+    char buffer[4][16];
+    dmlite::IOSegment segs[4];
+    off_t offsets[4] = {100, 116, 10, 4090};
+    for (int i = 0; i < 4; ++i) {
+      segs[i].buffer = buffer[i];
+      segs[i].count  = sizeof(buffer[i]);
+      segs[i].offset = offsets[i];
+    }
+
+    CPPUNIT_ASSERT_EQUAL((size_t)54, os->preadv(segs, 4));
+    CPPUNIT_ASSERT_EQUAL((off_t)sizeof(data), os->tell());
+    for (int i = 0; i < 3; ++i) {
+      CPPUNIT_ASSERT_EQUAL((size_t)16, segs[i].nbytes);
+      CPPUNIT_ASSERT(memcmp(buffer[i], data + offsets[i], 16) == 0);
+    }
+    CPPUNIT_ASSERT_EQUAL((size_t)6, segs[3].nbytes);
+    CPPUNIT_ASSERT(memcmp(buffer[3], data + 4090, 6) == 0);
+
+    // Same, in the background
+    memset(buffer, 0, sizeof(buffer));
+    int id = os->submitAsync(segs, 4);
+    CPPUNIT_ASSERT_EQUAL((size_t)54, os->waitAsync(id));
+    CPPUNIT_ASSERT(memcmp(buffer[2], data + 10, 16) == 0);
+    CPPUNIT_ASSERT_THROW(os->waitAsync(id), dmlite::DmException);
+
+    delete os;
+    unlink("/tmp/test-io-preadv");
+  }
+
   CPPUNIT_TEST_SUITE(TestIO);
   CPPUNIT_TEST(testOpen);
   CPPUNIT_TEST(testNotExist);
@@ -254,6 +352,9 @@ public:
   CPPUNIT_TEST(testReadv);
   CPPUNIT_TEST(testPReadWrite);
   CPPUNIT_TEST(testFStat);
+  CPPUNIT_TEST(testTransferTo);
+  CPPUNIT_TEST(testTransferFrom);
+  CPPUNIT_TEST(testPReadV);
   CPPUNIT_TEST_SUITE_END();
 };
 
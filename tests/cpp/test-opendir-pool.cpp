@@ -0,0 +1,116 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestAssert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "test-base.h"
+
+// Must run with NsMySqlSmallPool.conf, as the connection pool of the
+// process can only grow once created
+static const size_t kWalkers = 20;
+static const size_t kEntries = 10;
+
+struct Walker {
+  dmlite::PluginManager*   pm;
+  dmlite::SecurityContext* ctx;
+  std::string              dir;
+  size_t                   nread;
+};
+
+
+
+// Lists a directory slowly, like a client on a bad network
+void* walkDir(void* udata)
+{
+  Walker* w = static_cast<Walker*>(udata);
+
+  try {
+    dmlite::StackInstance si(w->pm);
+    si.setSecurityContext(*w->ctx);
+
+    dmlite::Catalog* catalog = si.getCatalog();
+    dmlite::Directory* d = catalog->openDir(w->dir);
+    while (catalog->readDirx(d) != NULL) {
+      ++w->nread;
+      usleep(100000);
+    }
+    catalog->closeDir(d);
+  }
+  catch (...) {
+    // nread tells
+  }
+
+  return NULL;
+}
+
+
+class TestOpendirPool: public TestBase
+{
+protected:
+  const static char *FOLDER;
+
+public:
+
+  void setUp()
+  {
+    TestBase::setUp();
+    this->catalog->makeDir(FOLDER, 0700);
+
+    for (size_t i = 0; i < kEntries; ++i) {
+      std::ostringstream path;
+      path << FOLDER << "/file" << i;
+      this->catalog->create(path.str(), 0644);
+    }
+  }
+
+  void tearDown()
+  {
+    if (this->catalog != 0x00) {
+      for (size_t i = 0; i < kEntries; ++i) {
+        std::ostringstream path;
+        path << FOLDER << "/file" << i;
+        IGNORE_NOT_EXIST(this->catalog->unlink(path.str()));
+      }
+      this->catalog->removeDir(FOLDER);
+    }
+    TestBase::tearDown();
+  }
+
+  // Many slow listings must not exhaust a small connection pool
+  void testManyWalkersSmallPool()
+  {
+    std::vector<Walker>    walkers(kWalkers);
+    std::vector<pthread_t> threads(kWalkers);
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    for (size_t i = 0; i < kWalkers; ++i) {
+      walkers[i].pm    = this->pluginManager;
+      walkers[i].ctx   = &this->root;
+      walkers[i].dir   = BASE_DIR + "/" + FOLDER;
+      walkers[i].nread = 0;
+      pthread_create(&threads[i], NULL, walkDir, &walkers[i]);
+    }
+    for (size_t i = 0; i < kWalkers; ++i)
+      pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+
+    for (size_t i = 0; i < kWalkers; ++i)
+      CPPUNIT_ASSERT_EQUAL(kEntries, walkers[i].nread);
+    // Holding a connection per open directory waits for the 60s pool timeout
+    CPPUNIT_ASSERT(end.tv_sec - start.tv_sec < 30);
+  }
+
+
+  CPPUNIT_TEST_SUITE(TestOpendirPool);
+  CPPUNIT_TEST(testManyWalkersSmallPool);
+  CPPUNIT_TEST_SUITE_END();
+};
+
+const char* TestOpendirPool::FOLDER  = "test-opendir-pool";
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestOpendirPool);
+
+int main(int argn, char **argv)
+{
+  return testBaseMain(argn, argv);
+}
@@ -41,6 +41,9 @@ public:
   {
     struct stat before, after;
 
+    // Write the access time right away, not from the batching thread
+    this->pluginManager->configure("AccessTimeBatchSize", "0");
+
     before = this->catalog->extendedStat(FOLDER).stat;
 
     sleep(2);
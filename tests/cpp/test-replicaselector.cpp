@@ -0,0 +1,125 @@
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestAssert.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <dmlite/cpp/authn.h>
+#include <dmlite/cpp/utils/replicaselector.h>
+#include <map>
+
+class TestReplicaSelector: public CppUnit::TestFixture {
+protected:
+  dmlite::SecurityContext context;
+
+  static dmlite::Replica replica(const std::string& server,
+                                 dmlite::Replica::ReplicaType type = dmlite::Replica::kPermanent)
+  {
+    dmlite::Replica r;
+    r.server = server;
+    r.rfn    = server + ":/storage/file";
+    r.type   = type;
+    return r;
+  }
+
+public:
+
+  void setUp()
+  {
+    context.credentials.remoteAddress = "10.1.2.3";
+  }
+
+  void testCriteria()
+  {
+    dmlite::ReplicaSelector selector;
+
+    selector.setCriteria("local, permanent,load");
+    selector.setCriteria("random");
+    selector.setCriteria("");
+    CPPUNIT_ASSERT_THROW(selector.setCriteria("local,nearest"), dmlite::DmException);
+
+    selector.setSubnetPrefixes("16/48");
+    CPPUNIT_ASSERT_THROW(selector.setSubnetPrefixes("16"), dmlite::DmException);
+    CPPUNIT_ASSERT_THROW(selector.setSubnetPrefixes("33/64"), dmlite::DmException);
+  }
+
+  void testPermanent()
+  {
+    dmlite::ReplicaSelector selector;
+    std::vector<dmlite::Replica> replicas;
+
+    selector.setCriteria("permanent");
+    replicas.push_back(replica("perm-a", dmlite::Replica::kVolatile));
+    replicas.push_back(replica("perm-b", dmlite::Replica::kPermanent));
+    replicas.push_back(replica("perm-c", dmlite::Replica::kVolatile));
+
+    for (int i = 0; i < 20; ++i)
+      CPPUNIT_ASSERT_EQUAL(1u, selector.select(&context, replicas));
+  }
+
+  void testLocal()
+  {
+    dmlite::ReplicaSelector selector;
+    std::vector<dmlite::Replica> replicas;
+
+    selector.setCriteria("local,load");
+    replicas.push_back(replica("10.2.2.3"));
+    replicas.push_back(replica("10.1.2.200"));
+    replicas.push_back(replica("[::ffff:10.1.3.1]"));
+
+    for (int i = 0; i < 20; ++i)
+      CPPUNIT_ASSERT_EQUAL(1u, selector.select(&context, replicas));
+
+    // Wider subnet, the last one is local too and less loaded
+    selector.setSubnetPrefixes("16/64");
+    CPPUNIT_ASSERT_EQUAL(2u, selector.select(&context, replicas));
+
+    // Without a client address, nothing is local
+    CPPUNIT_ASSERT(selector.select(NULL, replicas) < replicas.size());
+  }
+
+  void testLoadSpreads()
+  {
+    dmlite::ReplicaSelector selector;
+    std::vector<dmlite::Replica> replicas;
+    std::map<unsigned, unsigned> count;
+
+    selector.setCriteria("load");
+    replicas.push_back(replica("load-a"));
+    replicas.push_back(replica("load-b"));
+    replicas.push_back(replica("load-c"));
+    replicas.push_back(replica("load-d"));
+
+    for (int i = 0; i < 400; ++i)
+      ++count[selector.select(&context, replicas)];
+
+    // The least loaded always wins, so the reads are spread evenly
+    for (unsigned i = 0; i < replicas.size(); ++i)
+      CPPUNIT_ASSERT_EQUAL(100u, count[i]);
+    CPPUNIT_ASSERT_EQUAL(100ul, dmlite::ReplicaSelector::recentRedirections("load-a"));
+  }
+
+  void testNoReplicas()
+  {
+    dmlite::ReplicaSelector selector;
+    std::vector<dmlite::Replica> replicas;
+
+    CPPUNIT_ASSERT_THROW(selector.select(&context, replicas), dmlite::DmException);
+  }
+
+  CPPUNIT_TEST_SUITE(TestReplicaSelector);
+  CPPUNIT_TEST(testCriteria);
+  CPPUNIT_TEST(testPermanent);
+  CPPUNIT_TEST(testLocal);
+  CPPUNIT_TEST(testLoadSpreads);
+  CPPUNIT_TEST(testNoReplicas);
+  CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TestReplicaSelector);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  return runner.run()?0:1;
+}
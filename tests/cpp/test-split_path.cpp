@@ -44,13 +44,45 @@ int Validate(const std::string& path, int n, ...)
 
 
 
+int ValidateIterator(const std::string& path)
+{
+  std::vector<std::string> components = dmlite::Url::splitPath(path);
+  dmlite::PathIterator     i(path);
+  unsigned                 n = 0;
+
+  std::cout << "- Checking iterator over " << path;
+
+  while (i.next()) {
+    if (n >= components.size() || !i.equals(components[n].c_str()) ||
+        std::string(i.data(), i.size()) != components[n] ||
+        path.compare(i.offset(), i.size(), components[n]) != 0) {
+      std::cout << std::endl << "\tMismatch at position " << n << std::endl;
+      return 1;
+    }
+    ++n;
+  }
+
+  if (n != components.size()) {
+    std::cout << std::endl << "\tGot " << n << " components while expecting "
+              << components.size() << std::endl;
+    return 1;
+  }
+
+  std::cout << "\t[OK]" << std::endl;
+  return 0;
+}
+
+
+
 int ValidateNormalization(const std::string& original, const std::string &expected)
 {
   std::string got = dmlite::Url::normalizePath(original);
+  std::string inPlace(original);
+  dmlite::Url::normalizePathInPlace(inPlace);
   
   std::cout << "- Checking normalization of " << original;
   
-  if (got == expected) {
+  if (got == expected && inPlace == expected) {
     std::cout << "\t[OK]" << std::endl;
     return 0;
   }
@@ -83,6 +115,27 @@ int main(int argc, char **argv)
   r += ValidateNormalization("/with/slash/", "/with/slash/");
   r += ValidateNormalization("/multiple///slashes//", "/multiple/slashes/");
   r += ValidateNormalization("relative//path", "relative/path");
+  r += ValidateNormalization("relative/", "relative");
+  r += ValidateNormalization("", "");
+
+  // Check the iterator gives the same as splitPath
+  r += ValidateIterator("");
+  r += ValidateIterator("/");
+  r += ValidateIterator("no-root");
+  r += ValidateIterator("/two/levels");
+  r += ValidateIterator("////several////slashes//////right//");
+  r += ValidateIterator("relative/./../path/");
+
+  // And what is left after a component
+  dmlite::PathIterator it("/a/bb//ccc/");
+  it.next(); it.next(); it.next();
+  if (it.equals("bb") && !it.equals("b") && !it.equals("bbb") &&
+      std::string(it.rest(), it.restSize()) == "//ccc/")
+    std::cout << "- PathIterator::rest\t[OK]" << std::endl;
+  else {
+    std::cout << "- PathIterator::rest: got " << std::string(it.rest(), it.restSize()) << std::endl;
+    ++r;
+  }
   
   // Check join
   std::string original = "/sample/path/file";
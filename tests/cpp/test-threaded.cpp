@@ -1,6 +1,11 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cppunit/TestAssert.h>
 #include <dmlite/cpp/utils/security.h>
+#include <dmlite/cpp/utils/stackinstancepool.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
 #include "test-base.h"
 
 
@@ -39,6 +44,47 @@ void* appendMapfiles(void*)
 }
 
 
+static const size_t kMapfileDNs = 100000;
+static const size_t kLookups    = 100000;
+
+
+
+void* lookupMapfile(void* udata)
+{
+    const char* mapfile = static_cast<const char*>(udata);
+    size_t      found   = 0;
+
+    for (size_t i = 0; i < kLookups; ++i) {
+        std::ostringstream dn;
+        dn << "/DC=ch/DC=cern/OU=Users/CN=user" << (i * 7919) % kMapfileDNs;
+        try {
+            if (dmlite::voFromDn(mapfile, dn.str()) == "dteam")
+                ++found;
+        }
+        catch (...) {
+            // Counted as not found
+        }
+    }
+
+    return (void*)found;
+}
+
+
+
+// Written aside and renamed, so readers never see it half done
+static void writeMapfile(const char* path, size_t ndns)
+{
+    std::string tmp = std::string(path) + ".tmp";
+    {
+        std::ofstream mapfile(tmp.c_str());
+        for (size_t i = 0; i < ndns; ++i)
+            mapfile << "\"/DC=ch/DC=cern/OU=Users/CN=user" << i << "\" dteam" << std::endl;
+    }
+    rename(tmp.c_str(), path);
+}
+
+
+
 class TestThreaded: public TestBase
 {
 public:
@@ -99,9 +145,74 @@ public:
   }
 
 
+  // Benchmark voFromDn with a big mapfile, looked up concurrently
+  // while it is being rewritten
+  void testVoFromDnThroughput(void)
+  {
+      static const size_t NREADERS = 20;
+      static const char   mapfile[] = "/tmp/mapfile-bench";
+      pthread_t readers[NREADERS];
+      struct timeval start, end;
+
+      writeMapfile(mapfile, kMapfileDNs);
+      dmlite::setMapFileCheckInterval(0);
+
+      gettimeofday(&start, NULL);
+      for (size_t i = 0; i < NREADERS; ++i)
+          pthread_create(&readers[i], NULL, lookupMapfile, (void*)mapfile);
+
+      // Changes must not block the readers
+      usleep(100000);
+      writeMapfile(mapfile, kMapfileDNs);
+
+      size_t found = 0;
+      for (size_t i = 0; i < NREADERS; ++i) {
+          void* n;
+          pthread_join(readers[i], &n);
+          found += (size_t)n;
+      }
+      gettimeofday(&end, NULL);
+
+      double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+      std::cout << std::endl << NREADERS * kLookups << " lookups in " << elapsed << " s ("
+                << (NREADERS * kLookups) / elapsed << " lookups/s)" << std::endl;
+
+      dmlite::setMapFileCheckInterval(dmlite::kDefaultMapFileCheckInterval);
+      unlink(mapfile);
+
+      CPPUNIT_ASSERT_EQUAL(NREADERS * kLookups, found);
+  }
+
+
+  // A released stack comes back without the state of the previous user
+  void testStackInstancePoolReset(void)
+  {
+    dmlite::StackInstancePool pool(this->pluginManager, 1);
+
+    dmlite::StackInstance* si = pool.acquire();
+    si->setSecurityCredentials(this->cred1);
+    mode_t umask = si->getCatalog()->umask(0077);
+    si->getCatalog()->changeDir(BASE_DIR);
+    si->set("user.key", std::string("value"));
+    pool.release(si);
+
+    dmlite::StackInstance* again = pool.acquire();
+    CPPUNIT_ASSERT_EQUAL(si, again);
+    CPPUNIT_ASSERT(!again->contains("user.key"));
+    again->setSecurityCredentials(this->cred2);
+    CPPUNIT_ASSERT_EQUAL(std::string("/"), again->getCatalog()->getWorkingDir());
+    CPPUNIT_ASSERT_EQUAL(umask, again->getCatalog()->umask(umask));
+    CPPUNIT_ASSERT_EQUAL(this->cred2.clientName,
+                         again->getSecurityContext()->credentials.clientName);
+    pool.release(again);
+  }
+
+
   CPPUNIT_TEST_SUITE(TestThreaded);
   CPPUNIT_TEST(testBetweenThreads);
   CPPUNIT_TEST(testMessWithVoFromDn);
+  CPPUNIT_TEST(testVoFromDnThroughput);
+  CPPUNIT_TEST(testStackInstancePoolReset);
   CPPUNIT_TEST_SUITE_END();
 };
 